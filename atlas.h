@@ -0,0 +1,463 @@
+#ifndef _ATLAS_H_
+#define _ATLAS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//
+// Texture atlas. build() packs sprite images of any size into one RGBA8
+// image with MaxRects (best short side fit) or a skyline (bottom left),
+// the atlas starts at the smallest power of two that could hold them and
+// doubles a side until they fit. Each sprite gets padding texels around
+// it, filled with its edge texels so bilinear filtering does not bleed
+// in from the neighbours. rects[] is the sprite to rect table in input
+// order; uvinfo() turns a rect into ObjectFormat.uvinfo (offset .xy,
+// size .zw, in atlas uv). write() / read() are the offline file.
+//
+struct atlas_rect_t {
+	uint32_t x;
+	uint32_t y;
+	uint32_t w;
+	uint32_t h;
+};
+
+struct atlas_image_t {
+	std::string name;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> rgba;  //width * 4 bytes per row
+};
+
+enum atlas_method_t {
+	AtlasMaxRects,
+	AtlasSkyline,
+};
+
+enum {
+	AtlasMagic = 0x31415454,  //"TTA1"
+	AtlasPadding = 1,         //texels around a sprite, enough for bilinear without mips
+	AtlasMaxSize = 8192,
+};
+
+struct atlas_maxrects_t {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<atlas_rect_t> free;
+
+	void init(uint32_t w, uint32_t h)
+	{
+		width = w;
+		height = h;
+		free.assign(1, { 0, 0, w, h });
+	}
+
+	static bool contains(const atlas_rect_t &a, const atlas_rect_t &b)
+	{
+		return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+	}
+
+	//the free rect with the smallest leftover on its shorter side.
+	bool insert(uint32_t w, uint32_t h, atlas_rect_t &out)
+	{
+		uint32_t best_short = ~0u;
+		uint32_t best_long = ~0u;
+		for (auto & f : free) {
+			if (f.w < w || f.h < h)
+				continue;
+			uint32_t short_side = std::min(f.w - w, f.h - h);
+			uint32_t long_side = std::max(f.w - w, f.h - h);
+			if (short_side < best_short || (short_side == best_short && long_side < best_long)) {
+				out = { f.x, f.y, w, h };
+				best_short = short_side;
+				best_long = long_side;
+			}
+		}
+		if (best_short == ~0u)
+			return false;
+		place(out);
+		return true;
+	}
+
+	//free rects overlapping used give up to 4 maximal pieces, then the contained ones go.
+	void place(const atlas_rect_t &used)
+	{
+		std::vector<atlas_rect_t> next;
+		for (auto & f : free) {
+			if (used.x >= f.x + f.w || used.x + used.w <= f.x ||
+				used.y >= f.y + f.h || used.y + used.h <= f.y) {
+				next.push_back(f);
+				continue;
+			}
+			if (used.x > f.x)
+				next.push_back({ f.x, f.y, used.x - f.x, f.h });
+			if (used.x + used.w < f.x + f.w)
+				next.push_back({ used.x + used.w, f.y, f.x + f.w - used.x - used.w, f.h });
+			if (used.y > f.y)
+				next.push_back({ f.x, f.y, f.w, used.y - f.y });
+			if (used.y + used.h < f.y + f.h)
+				next.push_back({ f.x, used.y + used.h, f.w, f.y + f.h - used.y - used.h });
+		}
+		free.swap(next);
+		prune();
+	}
+
+	void prune()
+	{
+		for (size_t i = 0; i < free.size(); i++)
+			for (size_t j = i + 1; j < free.size(); j++) {
+				if (contains(free[j], free[i])) {
+					free.erase(free.begin() + i);
+					i--;
+					break;
+				}
+				if (contains(free[i], free[j])) {
+					free.erase(free.begin() + j);
+					j--;
+				}
+			}
+	}
+};
+
+struct atlas_skyline_t {
+	struct node_t {
+		uint32_t x;
+		uint32_t y;
+		uint32_t w;
+	};
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<node_t> nodes;  //by x, covering [0, width)
+
+	void init(uint32_t w, uint32_t h)
+	{
+		width = w;
+		height = h;
+		nodes.assign(1, { 0, 0, w });
+	}
+
+	//top of the skyline under [nodes[i].x, + w), false when it does not fit.
+	bool fit(size_t i, uint32_t w, uint32_t h, uint32_t &y) const
+	{
+		uint32_t x = nodes[i].x;
+		if (x + w > width)
+			return false;
+		y = 0;
+		for (uint32_t left = w; left; i++) {
+			y = std::max(y, nodes[i].y);
+			left -= std::min(left, nodes[i].w);
+		}
+		return y + h <= height;
+	}
+
+	//lowest top, then the narrowest node.
+	bool insert(uint32_t w, uint32_t h, atlas_rect_t &out)
+	{
+		size_t best = nodes.size();
+		uint32_t best_top = ~0u;
+		uint32_t best_w = ~0u;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			uint32_t y;
+			if (!fit(i, w, h, y))
+				continue;
+			if (y + h < best_top || (y + h == best_top && nodes[i].w < best_w)) {
+				best = i;
+				best_top = y + h;
+				best_w = nodes[i].w;
+				out = { nodes[i].x, y, w, h };
+			}
+		}
+		if (best == nodes.size())
+			return false;
+		nodes.insert(nodes.begin() + best, { out.x, out.y + h, w });
+		for (size_t i = best + 1; i < nodes.size(); ) {
+			auto & n = nodes[i];
+			uint32_t end = out.x + w;
+			if (n.x >= end)
+				break;
+			uint32_t cut = std::min(n.w, end - n.x);
+			n.x += cut;
+			n.w -= cut;
+			if (n.w == 0)
+				nodes.erase(nodes.begin() + i);
+			else
+				break;
+		}
+		for (size_t i = 0; i + 1 < nodes.size(); ) {
+			if (nodes[i].y == nodes[i + 1].y) {
+				nodes[i].w += nodes[i + 1].w;
+				nodes.erase(nodes.begin() + i + 1);
+			} else {
+				i++;
+			}
+		}
+		return true;
+	}
+};
+
+struct atlas_t {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t padding = 0;
+	std::vector<uint8_t> pixels;  //RGBA8, width * 4 bytes per row
+	std::vector<std::string> names;
+	std::vector<atlas_rect_t> rects;  //sprite i, padding excluded
+
+	//offset .xy and size .zw of sprite i in uv.
+	void uvinfo(uint32_t i, float *out) const
+	{
+		auto & r = rects[i];
+		out[0] = float(r.x) / width;
+		out[1] = float(r.y) / height;
+		out[2] = float(r.w) / width;
+		out[3] = float(r.h) / height;
+	}
+
+	//index of the sprite called name, ~0u when none.
+	uint32_t find(const std::string &name) const
+	{
+		for (uint32_t i = 0; i < names.size(); i++)
+			if (names[i] == name)
+				return i;
+		return ~0u;
+	}
+
+	//sprite texels over atlas texels.
+	double occupancy() const
+	{
+		double used = 0.0;
+		for (auto & r : rects)
+			used += double(r.w) * r.h;
+		return width && height ? used / (double(width) * height) : 0.0;
+	}
+
+	//positions of the padded images in a w x h atlas, false when they do not fit.
+	static bool pack(const std::vector<atlas_image_t> &images, const std::vector<uint32_t> &order,
+		uint32_t pad, uint32_t w, uint32_t h, uint8_t method, std::vector<atlas_rect_t> &out)
+	{
+		atlas_maxrects_t maxrects;
+		atlas_skyline_t skyline;
+		if (method == AtlasSkyline)
+			skyline.init(w, h);
+		else
+			maxrects.init(w, h);
+		out.resize(images.size());
+		for (auto i : order) {
+			uint32_t pw = images[i].width + pad * 2;
+			uint32_t ph = images[i].height + pad * 2;
+			bool ok = method == AtlasSkyline ? skyline.insert(pw, ph, out[i]) : maxrects.insert(pw, ph, out[i]);
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+
+	bool build(const std::vector<atlas_image_t> &images, uint32_t pad, uint32_t max_size,
+		uint8_t method = AtlasMaxRects)
+	{
+		std::vector<uint32_t> order(images.size());
+		double area = 0.0;
+		uint32_t w = 1, h = 1;
+		for (uint32_t i = 0; i < images.size(); i++) {
+			auto & img = images[i];
+			order[i] = i;
+			area += double(img.width + pad * 2) * (img.height + pad * 2);
+			while (w < img.width + pad * 2)
+				w *= 2;
+			while (h < img.height + pad * 2)
+				h *= 2;
+		}
+		std::stable_sort(order.begin(), order.end(), [&images](uint32_t a, uint32_t b) {
+			auto & ia = images[a];
+			auto & ib = images[b];
+			uint32_t ma = std::max(ia.width, ia.height);
+			uint32_t mb = std::max(ib.width, ib.height);
+			return ma != mb ? ma > mb : ia.width * ia.height > ib.width * ib.height;
+		});
+		while (double(w) * h < area) {
+			if (w <= h)
+				w *= 2;
+			else
+				h *= 2;
+		}
+		std::vector<atlas_rect_t> placed;
+		while (!pack(images, order, pad, w, h, method, placed)) {
+			if (w <= h)
+				w *= 2;
+			else
+				h *= 2;
+			if (w > max_size || h > max_size)
+				return false;
+		}
+		if (w > max_size || h > max_size)
+			return false;
+		width = w;
+		height = h;
+		padding = pad;
+		pixels.assign(size_t(w) * h * 4, 0);
+		names.resize(images.size());
+		rects.resize(images.size());
+		for (uint32_t i = 0; i < images.size(); i++) {
+			names[i] = images[i].name;
+			rects[i] = { placed[i].x + pad, placed[i].y + pad, images[i].width, images[i].height };
+			blit(images[i], rects[i]);
+		}
+		return true;
+	}
+
+	//the image at r, its edge texels repeated over the padding.
+	void blit(const atlas_image_t &img, const atlas_rect_t &r)
+	{
+		if (img.width == 0 || img.height == 0)
+			return;
+		int p = int(padding);
+		for (int y = -p; y < int(img.height) + p; y++) {
+			int sy = std::min(std::max(y, 0), int(img.height) - 1);
+			uint8_t *dst = &pixels[(size_t(r.y + y) * width + r.x) * 4];
+			const uint8_t *src = &img.rgba[size_t(sy) * img.width * 4];
+			memcpy(dst, src, size_t(img.width) * 4);
+			for (int x = 1; x <= p; x++) {
+				memcpy(dst - x * 4, src, 4);
+				memcpy(dst + (img.width - 1 + x) * 4, src + (img.width - 1) * 4, 4);
+			}
+		}
+	}
+
+	//header, table (rect, name length, name), then the pixels.
+	bool write(FILE *fp) const
+	{
+		uint32_t h[5] = { AtlasMagic, width, height, padding, uint32_t(rects.size()) };
+		bool ok = fwrite(h, sizeof(h), 1, fp) == 1;
+		for (size_t i = 0; ok && i < rects.size(); i++) {
+			uint32_t n = uint32_t(names[i].size());
+			ok = fwrite(&rects[i], sizeof(atlas_rect_t), 1, fp) == 1 && fwrite(&n, sizeof(n), 1, fp) == 1 &&
+				fwrite(names[i].data(), 1, n, fp) == n;
+		}
+		return ok && fwrite(pixels.data(), 1, pixels.size(), fp) == pixels.size();
+	}
+
+	bool read(FILE *fp)
+	{
+		uint32_t h[5];
+		if (fread(h, sizeof(h), 1, fp) != 1 || h[0] != AtlasMagic || h[1] > 16384 || h[2] > 16384)
+			return false;
+		width = h[1];
+		height = h[2];
+		padding = h[3];
+		rects.resize(h[4]);
+		names.resize(h[4]);
+		for (uint32_t i = 0; i < h[4]; i++) {
+			uint32_t n;
+			if (fread(&rects[i], sizeof(atlas_rect_t), 1, fp) != 1 || fread(&n, sizeof(n), 1, fp) != 1 ||
+				n > 4096)
+				return false;
+			names[i].resize(n);
+			if (fread(&names[i][0], 1, n, fp) != n)
+				return false;
+			auto & r = rects[i];
+			if (r.x + r.w > width || r.y + r.h > height)
+				return false;
+		}
+		pixels.resize(size_t(width) * height * 4);
+		return fread(pixels.data(), 1, pixels.size(), fp) == pixels.size();
+	}
+
+	bool save(const char *path) const
+	{
+		FILE *fp = fopen(path, "wb");
+		if (!fp)
+			return false;
+		bool ok = write(fp);
+		return fclose(fp) == 0 && ok;
+	}
+
+	bool load(const char *path)
+	{
+		FILE *fp = fopen(path, "rb");
+		if (!fp)
+			return false;
+		bool ok = read(fp);
+		fclose(fp);
+		return ok;
+	}
+};
+
+//
+// Binary PNM sprites for the offline builder : P5 (gray), P6 (RGB) and
+// P7 (PAM, DEPTH 1 to 4, 8 bits). Missing channels are opaque.
+//
+static inline bool
+atlas_read_pnm(const char *path, atlas_image_t &out)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+	char magic[3] = {};
+	uint32_t depth = 0, maxval = 0;
+	bool ok = fread(magic, 1, 2, fp) == 2 && magic[0] == 'P';
+	auto token = [fp](char *buf, size_t n) {
+		int c;
+		size_t len = 0;
+		while ((c = fgetc(fp)) != EOF) {
+			if (c == '#') {
+				while ((c = fgetc(fp)) != EOF && c != '\n')
+					;
+			} else if (c > ' ') {
+				break;
+			}
+		}
+		while (c != EOF && c > ' ' && len + 1 < n) {
+			buf[len++] = char(c);
+			c = fgetc(fp);
+		}
+		buf[len] = 0;
+		return len > 0;
+	};
+	char tok[64];
+	if (ok && (magic[1] == '5' || magic[1] == '6')) {
+		depth = magic[1] == '5' ? 1 : 3;
+		ok = token(tok, sizeof(tok)) && (out.width = atoi(tok)) &&
+			token(tok, sizeof(tok)) && (out.height = atoi(tok)) &&
+			token(tok, sizeof(tok)) && (maxval = atoi(tok));
+	} else if (ok && magic[1] == '7') {
+		while ((ok = token(tok, sizeof(tok))) && strcmp(tok, "ENDHDR")) {
+			uint32_t *v = !strcmp(tok, "WIDTH") ? &out.width : !strcmp(tok, "HEIGHT") ? &out.height :
+				!strcmp(tok, "DEPTH") ? &depth : !strcmp(tok, "MAXVAL") ? &maxval : nullptr;
+			char value[64];
+			if (!token(value, sizeof(value)))
+				ok = false;
+			else if (v)
+				*v = atoi(value);
+			if (!ok)
+				break;
+		}
+	} else {
+		ok = false;
+	}
+	ok = ok && out.width && out.height && out.width <= 16384 && out.height <= 16384 &&
+		maxval == 255 && depth >= 1 && depth <= 4;
+	std::vector<uint8_t> src;
+	if (ok) {
+		src.resize(size_t(out.width) * out.height * depth);
+		ok = fread(src.data(), 1, src.size(), fp) == src.size();
+	}
+	fclose(fp);
+	if (!ok)
+		return false;
+	out.rgba.resize(size_t(out.width) * out.height * 4);
+	for (size_t i = 0; i < size_t(out.width) * out.height; i++) {
+		const uint8_t *s = &src[i * depth];
+		uint8_t *d = &out.rgba[i * 4];
+		d[0] = s[0];
+		d[1] = depth >= 3 ? s[1] : s[0];
+		d[2] = depth >= 3 ? s[2] : s[0];
+		d[3] = depth == 4 ? s[3] : depth == 2 ? s[1] : 255;
+	}
+	out.name = path;
+	return true;
+}
+
+#endif //_ATLAS_H_
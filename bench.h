@@ -0,0 +1,107 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+//
+// Results of the benchmark mode (-benchmark) : per frame timings of every
+// stage, reported as mean and percentiles in JSON so CI can track them.
+//
+struct bench_series_t {
+	std::vector<double> values;
+
+	void add(double v)
+	{
+		values.push_back(v);
+	}
+
+	double mean() const
+	{
+		double sum = 0.0;
+		for (auto v : values)
+			sum += v;
+		return values.empty() ? 0.0 : sum / values.size();
+	}
+
+	//nearest rank.
+	double percentile(double p) const
+	{
+		if (values.empty())
+			return 0.0;
+		std::vector<double> v = values;
+		size_t rank = size_t(p / 100.0 * v.size() + 0.5);
+		rank = std::min(std::max(rank, size_t(1)), v.size()) - 1;
+		std::nth_element(v.begin(), v.begin() + rank, v.end());
+		return v[rank];
+	}
+
+	//seconds as ms.
+	void json(FILE *fp, const char *name) const
+	{
+		fprintf(fp, "\"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+			name, mean() * 1e3, percentile(50) * 1e3, percentile(95) * 1e3, percentile(99) * 1e3,
+			values.empty() ? 0.0 : *std::max_element(values.begin(), values.end()) * 1e3);
+	}
+};
+
+struct bench_scene_result_t {
+	const char *name = "";
+	uint32_t objects = 0;     //per layer
+	double animate = 0.0;     //moving fraction
+	uint32_t churn = 0;       //respawns per layer and frame
+	bench_series_t update;    //churn, capacity, CPU update of the store
+	bench_series_t upload;    //flush of the dirty ranges
+	bench_series_t expand;    //update.hlsl on the CPU, empty on the GPU
+	bench_series_t raster;    //software layer and present passes, optional
+	bench_series_t frame;
+	double upload_bytes = 0.0;
+	double copies = 0.0;
+	double sprites = 0.0;     //live objects, all layers
+
+	void json(FILE *fp) const
+	{
+		size_t n = std::max<size_t>(frame.values.size(), 1);
+		fprintf(fp, "    {\n");
+		fprintf(fp, "      \"name\": \"%s\", \"objects\": %u, \"animate\": %.3f, \"churn\": %u,\n",
+			name, objects, animate, churn);
+		fprintf(fp, "      \"frames\": %zu, \"fps\": %.2f, \"sprites_per_frame\": %.1f,\n",
+			frame.values.size(), frame.mean() > 0.0 ? 1.0 / frame.mean() : 0.0, sprites / n);
+		fprintf(fp, "      \"upload_bytes_per_frame\": %.1f, \"copies_per_frame\": %.2f,\n",
+			upload_bytes / n, copies / n);
+		const bench_series_t *series[] = { &update, &upload, &expand, &raster, &frame };
+		const char *names[] = { "update_ms", "upload_ms", "expand_ms", "raster_ms", "frame_ms" };
+		bool first = true;
+		for (int i = 0; i < 5; i++) {
+			if (series[i]->values.empty())
+				continue;
+			fprintf(fp, "%s      ", first ? "" : ",\n");
+			series[i]->json(fp, names[i]);
+			first = false;
+		}
+		fprintf(fp, "\n    }");
+	}
+};
+
+//
+// Whole report : the setup, then one entry per scene.
+//
+static inline void
+bench_report_json(FILE *fp, const char *backend, const char *simd, int threads, int layers,
+	uint32_t width, uint32_t height, const std::vector<bench_scene_result_t> &scenes)
+{
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"backend\": \"%s\", \"simd\": \"%s\", \"threads\": %d, \"layers\": %d,\n",
+		backend, simd, threads, layers);
+	fprintf(fp, "  \"width\": %u, \"height\": %u,\n", width, height);
+	fprintf(fp, "  \"scenes\": [\n");
+	for (size_t i = 0; i < scenes.size(); i++) {
+		scenes[i].json(fp);
+		fprintf(fp, "%s\n", i + 1 < scenes.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+#endif //_BENCH_H_
@@ -0,0 +1,232 @@
+#ifndef _BIN_H_
+#define _BIN_H_
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "fp.h"
+#include "sprite.h"
+#include "store.h"
+#include "job.h"
+
+//no fma, bin_cull has to match bin_cull_ref (see sprite.h).
+FP_NO_FMA_BEGIN
+
+//
+// Viewport culling and binning of the objects of a layer (before
+// update.hlsl and the draw, cull.hlsl is the compute version).
+// An object is kept when the bounds of its rotated quad, |sx c| + |sy s|,
+// |sx s| + |sy c| around pos grown by margin, overlap NDC [-1, 1].
+// Kept objects stay in object order, which is the draw order, and go into
+// the list of every tile of the grid they overlap. Tile row 0 is the top
+// of the image (NDC y = 1). grid_x == 0 only culls.
+//
+struct bin_view_t {
+	float margin;
+	uint32_t grid_x;
+	uint32_t grid_y;
+};
+
+//kept objects of a range and their tiles, x0, y0, x1, y1 inclusive.
+struct bin_chunk_t {
+	std::vector<uint32_t> objects;
+	std::vector<uint16_t> rects;
+	std::vector<uint32_t> counts;
+	uint32_t base = 0;
+};
+
+static inline uint16_t
+bin_tile(float t, uint32_t grid)
+{
+	t = t < 0.0f ? 0.0f : t;
+	t = t > float(grid - 1) ? float(grid - 1) : t;
+	return uint16_t(t);
+}
+
+static inline void
+bin_cull_ref(const object_store_t &st, uint32_t begin, uint32_t end,
+	const bin_view_t &view, bin_chunk_t &out)
+{
+	float gx = view.grid_x * 0.5f;
+	float gy = view.grid_y * 0.5f;
+
+	for (uint32_t i = begin; i < end; i++) {
+		if (st.flags[i] == 0)
+			continue;
+		float s, c;
+		sprite_sincos(st.rotate[i], s, c);
+		float ex = fabsf(st.scale_x[i] * c) + fabsf(st.scale_y[i] * s) + view.margin;
+		float ey = fabsf(st.scale_x[i] * s) + fabsf(st.scale_y[i] * c) + view.margin;
+		float x0 = st.pos_x[i] - ex;
+		float x1 = st.pos_x[i] + ex;
+		float y0 = st.pos_y[i] - ey;
+		float y1 = st.pos_y[i] + ey;
+		if (!(x1 >= -1.0f && 1.0f >= x0 && y1 >= -1.0f && 1.0f >= y0))
+			continue;
+		out.objects.push_back(i);
+		if (!view.grid_x)
+			continue;
+		out.rects.push_back(bin_tile(floorf((x0 + 1.0f) * gx), view.grid_x));
+		out.rects.push_back(bin_tile(floorf((1.0f - y1) * gy), view.grid_y));
+		out.rects.push_back(bin_tile(floorf((x1 + 1.0f) * gx), view.grid_x));
+		out.rects.push_back(bin_tile(floorf((1.0f - y0) * gy), view.grid_y));
+	}
+}
+
+//8 objects per step, same operations as bin_cull_ref.
+static inline void
+bin_cull(const object_store_t &st, uint32_t begin, uint32_t end,
+	const bin_view_t &view, bin_chunk_t &out)
+{
+	const f32x8 zero = f8_set1(0.0f);
+	const f32x8 one = f8_set1(1.0f);
+	const f32x8 neg_one = f8_set1(-1.0f);
+	const f32x8 margin = f8_set1(view.margin);
+	const f32x8 gx = f8_set1(view.grid_x * 0.5f);
+	const f32x8 gy = f8_set1(view.grid_y * 0.5f);
+	auto abs = [zero](f32x8 a) { return f8_max(a, f8_sub(zero, a)); };
+	uint32_t i = begin;
+
+	for ( ; i + 8 <= end; i += 8) {
+		uint32_t live = 0;
+		for (int l = 0; l < 8; l++)
+			live |= uint32_t(st.flags[i + l] != 0) << l;
+		if (!live)
+			continue;
+		f32x8 s, c;
+		f8_sincos(f8_load(st.rotate + i), s, c);
+		f32x8 sx = f8_load(st.scale_x + i);
+		f32x8 sy = f8_load(st.scale_y + i);
+		f32x8 px = f8_load(st.pos_x + i);
+		f32x8 py = f8_load(st.pos_y + i);
+		f32x8 ex = f8_add(f8_add(abs(f8_mul(sx, c)), abs(f8_mul(sy, s))), margin);
+		f32x8 ey = f8_add(f8_add(abs(f8_mul(sx, s)), abs(f8_mul(sy, c))), margin);
+		f32x8 x0 = f8_sub(px, ex);
+		f32x8 x1 = f8_add(px, ex);
+		f32x8 y0 = f8_sub(py, ey);
+		f32x8 y1 = f8_add(py, ey);
+		f32x8 in = f8_and(f8_and(f8_ge(x1, neg_one), f8_ge(one, x0)),
+			f8_and(f8_ge(y1, neg_one), f8_ge(one, y0)));
+		uint32_t keep = live & f8_bits(in);
+		if (!keep)
+			continue;
+
+		float r[4][8];
+		if (view.grid_x) {
+			f8_store(r[0], f8_floor(f8_mul(f8_add(x0, one), gx)));
+			f8_store(r[1], f8_floor(f8_mul(f8_sub(one, y1), gy)));
+			f8_store(r[2], f8_floor(f8_mul(f8_add(x1, one), gx)));
+			f8_store(r[3], f8_floor(f8_mul(f8_sub(one, y0), gy)));
+		}
+		for (int l = 0; l < 8; l++) {
+			if (!(keep & (1u << l)))
+				continue;
+			out.objects.push_back(i + l);
+			if (!view.grid_x)
+				continue;
+			out.rects.push_back(bin_tile(r[0][l], view.grid_x));
+			out.rects.push_back(bin_tile(r[1][l], view.grid_y));
+			out.rects.push_back(bin_tile(r[2][l], view.grid_x));
+			out.rects.push_back(bin_tile(r[3][l], view.grid_y));
+		}
+	}
+	bin_cull_ref(st, i, end, view, out);
+}
+
+//
+// Kept objects and tile lists of a layer. build() culls chunks of
+// objects in parallel, then sorts them into the tiles by counting
+// (tile major, chunk minor), so every list is in object order.
+//
+struct sprite_bins_t {
+	bin_view_t view = {};
+	std::vector<uint32_t> visible;
+	std::vector<uint32_t> offsets;  //tile t : objects[offsets[t], offsets[t + 1])
+	std::vector<uint32_t> objects;
+	std::vector<bin_chunk_t> chunks;
+
+	void init(const bin_view_t &v)
+	{
+		view = v;
+		offsets.assign(tiles() + 1, 0);
+	}
+
+	uint32_t tiles() const
+	{
+		return view.grid_x * view.grid_y;
+	}
+
+	//jobs == nullptr runs on the calling thread, simd = false for the reference.
+	void build(job_system_t *jobs, const object_store_t &st, uint32_t end,
+		uint32_t chunk, bool simd = true)
+	{
+		uint32_t num = (end + chunk - 1) / chunk;
+		uint32_t tile_num = tiles();
+		auto run = [jobs](uint32_t n, const std::function<void(int, int)> &fn) {
+			if (jobs)
+				jobs->parallel_for(n, 1, fn);
+			else
+				fn(0, n);
+		};
+
+		chunks.resize(num);
+		run(num, [&](int job_begin, int job_end) {
+			for (int k = job_begin; k < job_end; k++) {
+				auto & ck = chunks[k];
+				uint32_t begin = k * chunk;
+				uint32_t last = std::min(begin + chunk, end);
+				ck.objects.clear();
+				ck.rects.clear();
+				if (simd)
+					bin_cull(st, begin, last, view, ck);
+				else
+					bin_cull_ref(st, begin, last, view, ck);
+				ck.counts.assign(tile_num, 0);
+				for (size_t j = 0; j < ck.objects.size() && tile_num; j++) {
+					const uint16_t *r = &ck.rects[j * 4];
+					for (uint32_t ty = r[1]; ty <= r[3]; ty++)
+						for (uint32_t tx = r[0]; tx <= r[2]; tx++)
+							ck.counts[ty * view.grid_x + tx]++;
+				}
+			}
+		});
+
+		//bases of the chunks in visible, then in every tile list.
+		uint32_t total = 0;
+		for (auto & ck : chunks) {
+			ck.base = total;
+			total += uint32_t(ck.objects.size());
+		}
+		visible.resize(total);
+		uint32_t sum = 0;
+		for (uint32_t t = 0; t < tile_num; t++) {
+			offsets[t] = sum;
+			for (auto & ck : chunks) {
+				uint32_t n = ck.counts[t];
+				ck.counts[t] = sum;
+				sum += n;
+			}
+		}
+		offsets[tile_num] = sum;
+		objects.resize(sum);
+
+		run(num, [&](int job_begin, int job_end) {
+			for (int k = job_begin; k < job_end; k++) {
+				auto & ck = chunks[k];
+				std::copy(ck.objects.begin(), ck.objects.end(), visible.begin() + ck.base);
+				for (size_t j = 0; j < ck.objects.size() && tile_num; j++) {
+					const uint16_t *r = &ck.rects[j * 4];
+					for (uint32_t ty = r[1]; ty <= r[3]; ty++)
+						for (uint32_t tx = r[0]; tx <= r[2]; tx++)
+							objects[ck.counts[ty * view.grid_x + tx]++] = ck.objects[j];
+				}
+			}
+		});
+	}
+};
+
+FP_NO_FMA_END
+
+#endif //_BIN_H_
@@ -0,0 +1,364 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//
+// Content addressed cache of shader bytecode and pipeline blobs (-shader-cache).
+// The key of a shader is a hash of its source and every file it includes,
+// entry point, profile, flags, defines, the compiler version and
+// CacheVersion, so any change gives a new key and old entries are simply
+// never asked for again. Entries are written to a temporary file and
+// renamed over the final name, a reader sees a whole entry or none. Loads
+// map the file; the header and checksum are checked, a bad entry is a miss
+// and gets rewritten. The compiler is a function, a fake one runs the
+// cache on any platform. Any thread may ask for shaders at the same time.
+//
+enum {
+	CacheVersion = 1,  //bump on changes of root signatures or pipeline state
+	CacheMagic = 0x31435354,  //"TSC1"
+};
+
+enum cache_kind_t : uint32_t {
+	CacheShader,
+	CachePipeline,
+};
+
+struct cache_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t kind;
+	uint32_t reserved;
+	uint64_t key;
+	uint64_t size;
+	uint64_t checksum;
+};
+
+static inline uint64_t
+cache_hash(uint64_t h, const void *p, size_t n)
+{
+	auto s = (const uint8_t *)p;
+	for (size_t i = 0; i < n; i++)
+		h = (h ^ s[i]) * 1099511628211ull;
+	return (h);
+}
+
+static inline uint64_t
+cache_hash(uint64_t h, const std::string &s)
+{
+	//the length too, so ("ab", "c") and ("a", "bc") differ.
+	uint64_t n = s.size();
+	h = cache_hash(h, &n, sizeof(n));
+	return cache_hash(h, s.data(), s.size());
+}
+
+static const uint64_t CacheHashSeed = 14695981039346656037ull;
+
+//read only view of a whole file.
+struct cache_map_t {
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+	cache_map_t() = default;
+	cache_map_t(const cache_map_t &) = delete;
+	cache_map_t &operator=(const cache_map_t &) = delete;
+
+	~cache_map_t()
+	{
+		close();
+	}
+
+	bool open(const std::string &path)
+	{
+		close();
+#ifdef _WIN32
+		LARGE_INTEGER n;
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &n) || n.QuadPart == 0) {
+			close();
+			return false;
+		}
+		size = size_t(n.QuadPart);
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		data = mapping ? (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+		struct stat st;
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			size = size_t(st.st_size);
+			void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			data = p == MAP_FAILED ? nullptr : (const uint8_t *)p;
+		}
+		::close(fd);
+#endif
+		if (!data)
+			close();
+		return data != nullptr;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data)
+			munmap((void *)data, size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+};
+
+//bytes of an entry, either mapped from the cache or owned.
+struct cache_blob_t {
+	cache_map_t map;
+	std::vector<uint8_t> owned;
+
+	const uint8_t *data() const
+	{
+		return map.data ? map.data + sizeof(cache_header_t) : owned.data();
+	}
+
+	size_t size() const
+	{
+		return map.data ? map.size - sizeof(cache_header_t) : owned.size();
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+};
+
+struct shader_desc_t {
+	std::string path;
+	std::string entry;
+	std::string profile;
+	uint32_t flags = 0;
+	std::vector<std::pair<std::string, std::string>> defines;
+};
+
+struct shader_cache_t {
+	//compiles desc into code, returns false with the messages in error.
+	typedef std::function<bool(const shader_desc_t &, std::vector<uint8_t> &, std::string &)> compile_t;
+
+	std::string dir;            //empty : compile every time
+	std::string compiler_version;
+	compile_t compile;
+	std::mutex mtx;
+	std::map<std::string, uint64_t> sources;  //hash of a file and its includes, per run
+	std::atomic<uint64_t> hits {0};
+	std::atomic<uint64_t> misses {0};
+	std::atomic<uint64_t> rejected {0};      //bad header, checksum or version
+	std::atomic<uint64_t> writes {0};
+	std::atomic<uint64_t> write_errors {0};
+
+	void init(const std::string &path, const std::string &version, compile_t fn)
+	{
+		dir = path;
+		compiler_version = version;
+		compile = fn;
+		sources.clear();
+		hits = misses = rejected = writes = write_errors = 0;
+		if (!dir.empty()) {
+#ifdef _WIN32
+			CreateDirectoryA(dir.c_str(), nullptr);
+#else
+			mkdir(dir.c_str(), 0755);
+#endif
+		}
+	}
+
+	static bool read_file(const std::string &path, std::string &out)
+	{
+		FILE *fp = fopen(path.c_str(), "rb");
+		if (!fp)
+			return false;
+		char buf[4096];
+		size_t n;
+		out.clear();
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+			out.append(buf, n);
+		fclose(fp);
+		return true;
+	}
+
+	//the file and the quoted includes it pulls in, relative to the including file.
+	uint64_t source_hash(const std::string &path, int depth = 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			auto it = sources.find(path);
+			if (it != sources.end())
+				return it->second;
+		}
+		std::string text;
+		uint64_t ret = cache_hash(CacheHashSeed, path);
+		if (!read_file(path, text) || depth > 16)
+			return cache_hash(ret, "missing", 7);
+		ret = cache_hash(ret, text);
+		size_t slash = path.find_last_of("/\\");
+		std::string base = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+		for (size_t pos = 0; pos < text.size(); ) {
+			size_t eol = text.find('\n', pos);
+			if (eol == std::string::npos)
+				eol = text.size();
+			size_t p = text.find_first_not_of(" \t", pos);
+			if (p < eol && !text.compare(p, 8, "#include")) {
+				size_t q0 = text.find('"', p);
+				size_t q1 = q0 < eol ? text.find('"', q0 + 1) : std::string::npos;
+				if (q1 < eol) {
+					uint64_t h = source_hash(base + text.substr(q0 + 1, q1 - q0 - 1), depth + 1);
+					ret = cache_hash(ret, &h, sizeof(h));
+				}
+			}
+			pos = eol + 1;
+		}
+		std::lock_guard<std::mutex> lock(mtx);
+		sources[path] = ret;
+		return (ret);
+	}
+
+	uint64_t shader_key(const shader_desc_t &d)
+	{
+		uint64_t h = source_hash(d.path);
+		uint32_t v = CacheVersion;
+		h = cache_hash(h, &v, sizeof(v));
+		h = cache_hash(h, compiler_version);
+		h = cache_hash(h, d.entry);
+		h = cache_hash(h, d.profile);
+		h = cache_hash(h, &d.flags, sizeof(d.flags));
+		for (auto & m : d.defines) {
+			h = cache_hash(h, m.first);
+			h = cache_hash(h, m.second);
+		}
+		return (h);
+	}
+
+	std::string entry_path(uint64_t key, uint32_t kind) const
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "/%016llx.%s", (unsigned long long)key,
+			kind == CacheShader ? "dxbc" : "pso");
+		return dir + name;
+	}
+
+	//mapped entry of key, false when missing or bad.
+	bool load(uint64_t key, uint32_t kind, cache_blob_t &out)
+	{
+		out.owned.clear();
+		if (dir.empty() || !out.map.open(entry_path(key, kind)))
+			return false;
+		cache_header_t h;
+		bool ok = out.map.size >= sizeof(h);
+		if (ok) {
+			memcpy(&h, out.map.data, sizeof(h));
+			ok = h.magic == CacheMagic && h.version == CacheVersion && h.kind == kind &&
+				h.key == key && h.size == out.map.size - sizeof(h) &&
+				h.checksum == cache_hash(CacheHashSeed, out.data(), out.size());
+		}
+		if (!ok) {
+			out.map.close();
+			rejected++;
+		}
+		return ok;
+	}
+
+	//write to a temporary file, then rename it over the entry.
+	bool store(uint64_t key, uint32_t kind, const void *data, size_t size)
+	{
+		if (dir.empty())
+			return false;
+		static std::atomic<uint32_t> serial {0};
+		std::string path = entry_path(key, kind);
+		char suffix[64];
+#ifdef _WIN32
+		snprintf(suffix, sizeof(suffix), ".%lu.%u.tmp", GetCurrentProcessId(), serial.fetch_add(1));
+#else
+		snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", int(getpid()), serial.fetch_add(1));
+#endif
+		std::string tmp = path + suffix;
+		cache_header_t h = { CacheMagic, CacheVersion, kind, 0, key, size,
+			cache_hash(CacheHashSeed, data, size) };
+		FILE *fp = fopen(tmp.c_str(), "wb");
+		bool ok = fp && fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(data, 1, size, fp) == size;
+		if (fp)
+			ok = fclose(fp) == 0 && ok;
+#ifdef _WIN32
+		ok = ok && MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+		ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+		if (!ok) {
+			remove(tmp.c_str());
+			write_errors++;
+			return false;
+		}
+		writes++;
+		return true;
+	}
+
+	//bytecode of desc from the cache, or compiled and stored. key, error may be null.
+	bool shader(const shader_desc_t &d, cache_blob_t &out, uint64_t *key = nullptr,
+		std::string *error = nullptr)
+	{
+		uint64_t k = shader_key(d);
+		if (key)
+			*key = k;
+		if (load(k, CacheShader, out)) {
+			hits++;
+			return true;
+		}
+		misses++;
+		std::string messages;
+		if (!compile(d, out.owned, messages)) {
+			if (error)
+				*error = messages;
+			out.owned.clear();
+			return false;
+		}
+		store(k, CacheShader, out.owned.data(), out.owned.size());
+		return true;
+	}
+
+	//key of a pipeline : its shaders and whatever else of its state the caller hashes.
+	static uint64_t pipeline_key(const uint64_t *shader_keys, int num, const void *state, size_t state_size)
+	{
+		uint64_t h = cache_hash(CacheHashSeed, shader_keys, sizeof(uint64_t) * num);
+		return cache_hash(h, state, state_size);
+	}
+};
+
+#endif //_CACHE_H_
@@ -0,0 +1,237 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Asynchronous frame capture (-capture). A ring of readback slots :
+// begin() picks the next slot for the copy of a frame, end() records the
+// fence value that completes the copy, collect() hands the slots whose
+// fence completed to the writer thread, which converts and writes them,
+// then frees the slot. The render thread never waits, a frame that finds
+// its slot still busy is dropped and counted.
+// Slots are used in ring order and written in that order, so the output
+// keeps the frame order.
+//
+enum capture_format_t {
+	CaptureRaw,  //RGBA, tightly packed rows
+	CaptureY4m,  //YUV4MPEG2, 4:2:0 full range BT.601
+};
+
+//one frame of src (RGBA8 rows of row_pitch bytes) into buffer, in format.
+static inline void
+capture_convert(uint8_t format, const uint8_t *src, uint32_t width, uint32_t height,
+	uint32_t row_pitch, std::vector<uint8_t> &buffer)
+{
+	if (format == CaptureRaw) {
+		buffer.resize(size_t(width) * height * 4);
+		for (uint32_t y = 0; y < height; y++)
+			memcpy(&buffer[size_t(y) * width * 4], src + size_t(y) * row_pitch, width * 4);
+		return;
+	}
+	static const char tag[] = "FRAME\n";
+	uint32_t cw = (width + 1) / 2;
+	uint32_t ch = (height + 1) / 2;
+	size_t luma = size_t(width) * height;
+	buffer.resize(6 + luma + size_t(cw) * ch * 2);
+	memcpy(buffer.data(), tag, 6);
+	uint8_t *py = &buffer[6];
+	uint8_t *pu = py + luma;
+	uint8_t *pv = pu + size_t(cw) * ch;
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t *s = src + size_t(y) * row_pitch;
+		for (uint32_t x = 0; x < width; x++, s += 4)
+			py[y * width + x] = uint8_t((77 * s[0] + 150 * s[1] + 29 * s[2] + 128) >> 8);
+	}
+	//chroma of the mean of each 2x2 block, edges repeat.
+	for (uint32_t y = 0; y < ch; y++) {
+		const uint8_t *r0 = src + size_t(y * 2) * row_pitch;
+		const uint8_t *r1 = src + size_t(std::min(y * 2 + 1, height - 1)) * row_pitch;
+		for (uint32_t x = 0; x < cw; x++) {
+			uint32_t x0 = x * 8;
+			uint32_t x1 = std::min(x * 2 + 1, width - 1) * 4;
+			int c[3];
+			for (int k = 0; k < 3; k++)
+				c[k] = (r0[x0 + k] + r0[x1 + k] + r1[x0 + k] + r1[x1 + k] + 2) >> 2;
+			int u = (-43 * c[0] - 85 * c[1] + 128 * c[2] + 32896) >> 8;
+			int v = (128 * c[0] - 107 * c[1] - 21 * c[2] + 32896) >> 8;
+			pu[y * cw + x] = uint8_t(std::min(u, 255));
+			pv[y * cw + x] = uint8_t(std::min(v, 255));
+		}
+	}
+}
+
+struct capture_t {
+	enum : uint8_t {
+		SlotFree,
+		SlotCopying,  //the GPU copy is queued
+		SlotWriting,  //owned by the writer thread
+	};
+	//writes bytes, returns false on error.
+	typedef std::function<bool(const void *, size_t)> sink_t;
+
+	sink_t sink;
+	uint8_t format = CaptureRaw;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t row_pitch = 0;
+	uint32_t fps = 60;
+	std::vector<const uint8_t *> data;  //RGBA8 rows of row_pitch bytes
+	std::vector<uint64_t> fences;
+	std::unique_ptr<std::atomic<uint8_t>[]> states;
+	std::deque<int> copying;
+	std::deque<int> queue;
+	std::vector<uint8_t> buffer;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::thread writer;
+	uint32_t next = 0;
+	bool quit = false;
+	bool failed = false;
+	uint64_t captured = 0;
+	uint64_t dropped = 0;
+	std::atomic<uint64_t> written {0};
+	uint64_t bytes = 0;
+	double write_sec = 0.0;
+
+	//D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+	static uint32_t pitch(uint32_t w)
+	{
+		return (w * 4 + 255) & ~255u;
+	}
+
+	static sink_t file_sink(FILE *fp)
+	{
+		return [fp](const void *p, size_t n) { return fwrite(p, 1, n, fp) == n; };
+	}
+
+	void init(sink_t s, uint8_t fmt, uint32_t w, uint32_t h, uint32_t pitch_bytes, uint32_t rate,
+		const std::vector<const uint8_t *> &slots)
+	{
+		sink = s;
+		format = fmt;
+		width = w;
+		height = h;
+		row_pitch = pitch_bytes;
+		fps = rate;
+		data = slots;
+		fences.assign(slots.size(), 0);
+		states.reset(new std::atomic<uint8_t>[slots.size()]);
+		for (size_t i = 0; i < slots.size(); i++)
+			states[i] = SlotFree;
+		if (format == CaptureY4m) {
+			char header[128];
+			int n = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n",
+				width, height, fps);
+			failed = !sink(header, n);
+		}
+		writer = std::thread([this]() { writer_main(); });
+	}
+
+	//flush with collect(~0ull) first, once the GPU is idle.
+	void term()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		cv.notify_all();
+		if (writer.joinable())
+			writer.join();
+	}
+
+	~capture_t()
+	{
+		term();
+	}
+
+	int slots() const
+	{
+		return int(data.size());
+	}
+
+	//slot for this frame, -1 when the frame is dropped. Offline (wait) waits for the writer.
+	int begin(bool wait = false)
+	{
+		int slot = int(next % data.size());
+		if (wait && states[slot].load(std::memory_order_acquire) == SlotWriting) {
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [this, slot]() { return states[slot].load() != SlotWriting; });
+		}
+		if (states[slot].load(std::memory_order_acquire) != SlotFree) {
+			dropped++;
+			return -1;
+		}
+		next++;
+		return slot;
+	}
+
+	//the copy into slot completes with fence.
+	void end(int slot, uint64_t fence)
+	{
+		fences[slot] = fence;
+		states[slot].store(SlotCopying, std::memory_order_relaxed);
+		copying.push_back(slot);
+		captured++;
+	}
+
+	void collect(uint64_t completed)
+	{
+		bool any = false;
+		while (!copying.empty() && fences[copying.front()] <= completed) {
+			int slot = copying.front();
+			copying.pop_front();
+			states[slot].store(SlotWriting, std::memory_order_relaxed);
+			std::lock_guard<std::mutex> lock(mtx);
+			queue.push_back(slot);
+			any = true;
+		}
+		if (any)
+			cv.notify_all();
+	}
+
+	//frames handed to the writer and not written yet.
+	size_t pending()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return queue.size() + copying.size();
+	}
+
+	void writer_main()
+	{
+		using namespace std::chrono;
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true) {
+			cv.wait(lock, [this]() { return quit || !queue.empty(); });
+			if (queue.empty())
+				break;
+			int slot = queue.front();
+			lock.unlock();
+			auto t = steady_clock::now();
+			capture_convert(format, data[slot], width, height, row_pitch, buffer);
+			if (!failed)
+				failed = !sink(buffer.data(), buffer.size());
+			bytes += buffer.size();
+			write_sec += duration<double>(steady_clock::now() - t).count();
+			lock.lock();
+			queue.pop_front();
+			states[slot].store(SlotFree, std::memory_order_release);
+			written++;
+			cv.notify_all();
+		}
+	}
+};
+
+#endif //_CAPTURE_H_
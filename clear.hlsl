@@ -21,17 +21,10 @@
  *
  */
 
-struct ObjectFormat {
-	float4 pos;
-	float4 scale;
-	float4 rotate;
-	float4 color;
-	float4 uvinfo;
-	uint metadata[4];
-};
+#include "format.h"
 
-Texture2D<float4> layer_tex[] : register(t0);
-Texture2D<float4> user_tex[] : register(t1);
+Texture2D<float4> layer_tex[256] : register(t0);
+Texture2D<float4> user_tex[256] : register(t256);  //[0] : atlas of the layer (atlas.h), then -tex (tex.h)
 SamplerState samplers[]   : register(s0);
 
 struct VSInput {
@@ -0,0 +1,621 @@
+#ifndef _CMD_H_
+#define _CMD_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <vector>
+
+//
+// Backend agnostic command IR. Commands refer to objects (resources,
+// pipelines, root signatures, descriptor tables, render targets) by id,
+// a backend resolves the ids through its own table. A cmd_list_t is plain
+// data, so every layer can be recorded on its own thread and the lists
+// merged in layer order afterwards.
+// Passes declare the state they need with use() and done(), the state
+// tracker (state.h) turns those into barriers before a backend runs the list.
+//
+enum cmd_type_t : uint8_t {
+	CmdCopy,
+	CmdCopyTexture,
+	CmdUploadTexture,
+	CmdBarrier,
+	CmdSetRootSig,
+	CmdSetPipeline,
+	CmdSetTable,
+	CmdSetConstants,
+	CmdSetSrv,
+	CmdSetUav,
+	CmdSetVertex,
+	CmdSetTarget,
+	CmdClear,
+	CmdViewport,
+	CmdDispatch,
+	CmdDraw,
+	CmdDrawIndirect,
+	CmdTimestamp,
+	CmdResolveQueries,
+	CmdUse,
+	CmdDone,
+	CmdTypeMax,
+};
+
+enum cmd_state_t : uint8_t {
+	CmdStateCommon,
+	CmdStateCopyDest,
+	CmdStateShaderResource,
+	CmdStateRenderTarget,
+	CmdStateUnorderedAccess,
+	CmdStatePixelResource,
+	CmdStateVertexBuffer,
+	CmdStateIndirect,
+	CmdStateGenericRead,
+	CmdStateCopySource,
+	CmdStateMax,
+};
+
+//barrier flags (cmd_t::slot).
+enum {
+	CmdBarrierUav = 1,
+	CmdBarrierBegin = 2,
+	CmdBarrierEnd = 4,
+};
+
+static const uint32_t CmdAllSubresources = 0xFFFFFFFF;
+static const uint32_t CmdNoId = 0xFFFFFFFF;
+
+enum cmd_bind_t : uint8_t {
+	CmdBindCompute,
+	CmdBindGraphics,
+};
+
+struct cmd_t {
+	uint8_t type;
+	uint8_t bind;
+	uint8_t slot;
+	uint8_t num;
+	uint32_t id[2];
+	union {
+		uint32_t u[4];
+		float f[4];
+	} arg;
+};
+
+static inline const char *
+cmd_type_name(int type)
+{
+	static const char *names[CmdTypeMax] = {
+		"copy", "copy_texture", "upload_texture", "barrier", "set_root_sig", "set_pipeline", "set_table",
+		"set_constants", "set_srv", "set_uav", "set_vertex", "set_target", "clear",
+		"viewport", "dispatch", "draw", "draw_indirect", "timestamp", "resolve_queries",
+		"use", "done",
+	};
+	return type < CmdTypeMax ? names[type] : "?";
+}
+
+struct cmd_list_t {
+	std::vector<cmd_t> cmds;
+
+	void reset()
+	{
+		cmds.clear();
+	}
+
+	cmd_t &push(uint8_t type)
+	{
+		cmds.emplace_back();
+		auto & c = cmds.back();
+		memset(&c, 0, sizeof(c));
+		c.type = type;
+		return c;
+	}
+
+	void append(const cmd_list_t &cl)
+	{
+		cmds.insert(cmds.end(), cl.cmds.begin(), cl.cmds.end());
+	}
+
+	void copy(uint32_t dst, uint32_t dst_offset, uint32_t src, uint32_t src_offset, uint32_t bytes)
+	{
+		auto & c = push(CmdCopy);
+		c.id[0] = dst;
+		c.id[1] = src;
+		c.arg.u[0] = dst_offset;
+		c.arg.u[1] = src_offset;
+		c.arg.u[2] = bytes;
+	}
+
+	//w x h texels of texture subresource 0 into buffer, rows of row_pitch bytes.
+	void copy_texture(uint32_t buffer, uint32_t texture, uint32_t w, uint32_t h, uint32_t row_pitch)
+	{
+		auto & c = push(CmdCopyTexture);
+		c.id[0] = buffer;
+		c.id[1] = texture;
+		c.arg.u[0] = w;
+		c.arg.u[1] = h;
+		c.arg.u[2] = row_pitch;
+	}
+
+	//mip of texture from buffer at offset : rows of row_bytes, row_pitch bytes apart (tex.h).
+	void upload_texture(uint32_t texture, uint32_t mip, uint32_t buffer, uint32_t offset,
+		uint32_t row_bytes, uint32_t rows, uint32_t row_pitch)
+	{
+		auto & c = push(CmdUploadTexture);
+		c.id[0] = texture;
+		c.id[1] = buffer;
+		c.slot = uint8_t(mip);
+		c.arg.u[0] = offset;
+		c.arg.u[1] = row_bytes;
+		c.arg.u[2] = rows;
+		c.arg.u[3] = row_pitch;
+	}
+
+	void barrier(uint32_t res, uint8_t before, uint8_t after,
+		uint32_t sub = CmdAllSubresources, uint8_t flags = 0)
+	{
+		auto & c = push(CmdBarrier);
+		c.slot = flags;
+		c.id[0] = res;
+		c.id[1] = sub;
+		c.arg.u[0] = before;
+		c.arg.u[1] = after;
+	}
+
+	void uav_barrier(uint32_t res)
+	{
+		auto & c = push(CmdBarrier);
+		c.slot = CmdBarrierUav;
+		c.id[0] = res;
+		c.id[1] = CmdAllSubresources;
+		c.arg.u[0] = c.arg.u[1] = CmdStateUnorderedAccess;
+	}
+
+	//GPU time into query index of a timestamp query heap.
+	void timestamp(uint32_t heap, uint32_t index)
+	{
+		auto & c = push(CmdTimestamp);
+		c.id[0] = heap;
+		c.arg.u[0] = index;
+	}
+
+	//queries [begin, begin + num) of heap as uint64_t into buffer at offset.
+	void resolve_queries(uint32_t heap, uint32_t begin, uint32_t num, uint32_t buffer, uint32_t offset)
+	{
+		auto & c = push(CmdResolveQueries);
+		c.id[0] = heap;
+		c.id[1] = buffer;
+		c.arg.u[0] = begin;
+		c.arg.u[1] = num;
+		c.arg.u[2] = offset;
+	}
+
+	//the following commands need res (or one subresource of it) in state.
+	void use(uint32_t res, uint8_t state, uint32_t sub = CmdAllSubresources)
+	{
+		auto & c = push(CmdUse);
+		c.id[0] = res;
+		c.id[1] = sub;
+		c.arg.u[0] = state;
+	}
+
+	//the list is done with res in its current state until its next use.
+	void done(uint32_t res)
+	{
+		push(CmdDone).id[0] = res;
+	}
+
+	void set_root_sig(uint8_t bind, uint32_t sig)
+	{
+		auto & c = push(CmdSetRootSig);
+		c.bind = bind;
+		c.id[0] = sig;
+	}
+
+	void set_pipeline(uint32_t pso)
+	{
+		push(CmdSetPipeline).id[0] = pso;
+	}
+
+	void set_table(uint8_t bind, uint8_t slot, uint32_t table)
+	{
+		auto & c = push(CmdSetTable);
+		c.bind = bind;
+		c.slot = slot;
+		c.id[0] = table;
+	}
+
+	//up to 4 root constants.
+	void set_constants(uint8_t bind, uint8_t slot, const uint32_t *values, uint8_t num)
+	{
+		auto & c = push(CmdSetConstants);
+		c.bind = bind;
+		c.slot = slot;
+		c.num = num < 4 ? num : 4;
+		for (int i = 0; i < c.num; i++)
+			c.arg.u[i] = values[i];
+	}
+
+	void set_srv(uint8_t bind, uint8_t slot, uint32_t res)
+	{
+		auto & c = push(CmdSetSrv);
+		c.bind = bind;
+		c.slot = slot;
+		c.id[0] = res;
+	}
+
+	void set_uav(uint8_t bind, uint8_t slot, uint32_t res)
+	{
+		auto & c = push(CmdSetUav);
+		c.bind = bind;
+		c.slot = slot;
+		c.id[0] = res;
+	}
+
+	void set_vertex(uint32_t res, uint32_t bytes, uint32_t stride)
+	{
+		auto & c = push(CmdSetVertex);
+		c.id[0] = res;
+		c.arg.u[0] = bytes;
+		c.arg.u[1] = stride;
+	}
+
+	void set_target(uint32_t rtv)
+	{
+		push(CmdSetTarget).id[0] = rtv;
+	}
+
+	void clear(uint32_t rtv, const float color[4])
+	{
+		auto & c = push(CmdClear);
+		c.id[0] = rtv;
+		for (int i = 0; i < 4; i++)
+			c.arg.f[i] = color[i];
+	}
+
+	//viewport and scissor.
+	void viewport(uint32_t w, uint32_t h)
+	{
+		auto & c = push(CmdViewport);
+		c.arg.u[0] = w;
+		c.arg.u[1] = h;
+	}
+
+	void dispatch(uint32_t x, uint32_t y, uint32_t z)
+	{
+		auto & c = push(CmdDispatch);
+		c.arg.u[0] = x;
+		c.arg.u[1] = y;
+		c.arg.u[2] = z;
+	}
+
+	void draw(uint32_t vertex_count, uint32_t instance_count)
+	{
+		auto & c = push(CmdDraw);
+		c.arg.u[0] = vertex_count;
+		c.arg.u[1] = instance_count;
+	}
+
+	//one D3D12_DRAW_ARGUMENTS at offset of args.
+	void draw_indirect(uint32_t args, uint32_t offset)
+	{
+		auto & c = push(CmdDrawIndirect);
+		c.id[0] = args;
+		c.arg.u[0] = offset;
+	}
+};
+
+//ids -> backend objects, the D3D12 backend keeps pointers and descriptor addresses.
+struct cmd_table_t {
+	std::vector<uintptr_t> objects;
+
+	void reset()
+	{
+		objects.clear();
+	}
+
+	uint32_t add(uintptr_t obj)
+	{
+		objects.push_back(obj);
+		return uint32_t(objects.size() - 1);
+	}
+
+	template <typename T>
+	uint32_t add(T *obj)
+	{
+		return add(uintptr_t(obj));
+	}
+
+	template <typename T>
+	T get(uint32_t id) const
+	{
+		return (T)objects[id];
+	}
+};
+
+//
+// Null backend : runs a resolved list on the CPU. Copies go to the buffers
+// given by set_buffer(), texture uploads to the tight mips of the
+// set_texture() ones, everything else only checks the list : ids in
+// range, barriers that start from the current state of every subresource
+// they touch, no use of a resource in the middle of a split barrier,
+// resources in a state their command can use, dispatches and draws with
+// a pipeline and root signature bound, draws with a target. Buffers
+// promote from common on their first use and decay to common at the end
+// of a list, as D3D12 buffers do.
+// Timestamps read a mock GPU clock in ns that every command advances,
+// copies and draws by their size, queries live in set_queries() heaps.
+//
+struct cmd_null_t {
+	enum : uint8_t {
+		Splitting = 0x80,
+	};
+	std::vector<std::vector<uint8_t>> buffers;
+	std::vector<std::vector<std::vector<uint8_t>>> textures;  //per subresource
+	std::vector<std::vector<uint8_t>> states;
+	std::vector<uint8_t> is_buffer;
+	std::vector<std::vector<uint64_t>> queries;
+	uint64_t clock = 0;
+	uint64_t counts[CmdTypeMax] = {};
+	uint64_t copy_bytes = 0;
+	uint64_t barriers = 0;
+	uint64_t batches = 0;
+	uint64_t errors = 0;
+	char first_error[128] = {};
+
+	void init(uint32_t num_objects)
+	{
+		buffers.assign(num_objects, std::vector<uint8_t>());
+		textures.assign(num_objects, std::vector<std::vector<uint8_t>>());
+		states.assign(num_objects, std::vector<uint8_t>(1, CmdStateCommon));
+		is_buffer.assign(num_objects, 0);
+		queries.assign(num_objects, std::vector<uint64_t>());
+		memset(counts, 0, sizeof(counts));
+		copy_bytes = barriers = batches = errors = 0;
+		first_error[0] = 0;
+	}
+
+	void set_buffer(uint32_t id, size_t bytes)
+	{
+		buffers[id].assign(bytes, 0);
+		is_buffer[id] = 1;
+	}
+
+	void set_texture(uint32_t id, uint32_t num_subs, uint8_t state)
+	{
+		textures[id].assign(num_subs, std::vector<uint8_t>());
+		states[id].assign(num_subs, state);
+	}
+
+	void set_queries(uint32_t id, uint32_t num)
+	{
+		queries[id].assign(num, 0);
+	}
+
+	void set_state(uint32_t id, uint8_t state, uint32_t num_subs = 1)
+	{
+		states[id].assign(num_subs, state);
+	}
+
+	void fail(size_t index, const cmd_t &c, const char *what)
+	{
+		if (!errors++)
+			snprintf(first_error, sizeof(first_error), "cmd %zu (%s) : %s",
+				index, cmd_type_name(c.type), what);
+	}
+
+	//the whole of id (or sub) must be in one of the n states, buffers promote from common.
+	void use(size_t index, const cmd_t &c, uint32_t id, const uint8_t *ok, int n,
+		uint32_t sub = CmdAllSubresources)
+	{
+		if (id >= states.size() || (sub != CmdAllSubresources && sub >= states[id].size())) {
+			fail(index, c, "bad id");
+			return;
+		}
+		for (uint32_t s = 0; s < states[id].size(); s++) {
+			auto & st = states[id][s];
+			if (sub != CmdAllSubresources && s != sub)
+				continue;
+			bool found = false;
+			for (int i = 0; i < n; i++)
+				found |= st == ok[i];
+			if (found)
+				continue;
+			if (is_buffer[id] && st == CmdStateCommon)
+				st = ok[0];
+			else
+				fail(index, c, st & Splitting ? "resource used during a split barrier" :
+					"resource is not in the state it is used in");
+		}
+	}
+
+	void barrier(size_t index, const cmd_t &c)
+	{
+		uint32_t id = c.id[0];
+		if (id >= states.size()) {
+			fail(index, c, "bad id");
+			return;
+		}
+		barriers++;
+		if (c.slot & CmdBarrierUav) {
+			for (auto st : states[id])
+				if (st != CmdStateUnorderedAccess)
+					fail(index, c, "uav barrier on a resource that is not in uav state");
+			return;
+		}
+		auto & subs = states[id];
+		uint32_t begin = 0, end = uint32_t(subs.size());
+		if (c.id[1] != CmdAllSubresources) {
+			if (c.id[1] >= subs.size()) {
+				fail(index, c, "bad subresource");
+				return;
+			}
+			begin = c.id[1];
+			end = begin + 1;
+		}
+		uint8_t before = uint8_t(c.arg.u[0]);
+		uint8_t after = uint8_t(c.arg.u[1]);
+		for (uint32_t s = begin; s < end; s++) {
+			if (c.slot & CmdBarrierEnd) {
+				if (subs[s] != (Splitting | after))
+					fail(index, c, "end of a split barrier that did not begin");
+				subs[s] = after;
+				continue;
+			}
+			//a buffer in common may have been promoted by an access through a table.
+			if (subs[s] != before && !(is_buffer[id] && subs[s] == CmdStateCommon))
+				fail(index, c, "before state does not match");
+			subs[s] = (c.slot & CmdBarrierBegin) ? (Splitting | after) : after;
+		}
+	}
+
+	void execute(const cmd_list_t &cl)
+	{
+		static const uint8_t copy_dst[] = { CmdStateCopyDest };
+		static const uint8_t copy_src[] = { CmdStateGenericRead };
+		static const uint8_t texture_src[] = { CmdStateCopySource };
+		static const uint8_t srv[] = { CmdStateShaderResource, CmdStatePixelResource, CmdStateGenericRead };
+		static const uint8_t vertex[] = { CmdStateVertexBuffer, CmdStateGenericRead };
+		static const uint8_t indirect[] = { CmdStateIndirect, CmdStateGenericRead };
+		static const uint8_t uav[] = { CmdStateUnorderedAccess };
+		uint32_t num = uint32_t(states.size());
+		bool sig[2] = {};
+		bool pso = false;
+		bool target = false;
+
+		for (size_t i = 0; i < cl.cmds.size(); i++) {
+			auto & c = cl.cmds[i];
+			if (c.type >= CmdTypeMax) {
+				fail(i, c, "bad type");
+				continue;
+			}
+			counts[c.type]++;
+			clock++;
+			switch (c.type) {
+			case CmdCopy:
+				if (c.id[0] >= num || c.id[1] >= num) {
+					fail(i, c, "bad id");
+					break;
+				}
+				use(i, c, c.id[0], copy_dst, 1);
+				use(i, c, c.id[1], copy_src, 1);
+				if (buffers[c.id[0]].size() < size_t(c.arg.u[0]) + c.arg.u[2] ||
+					buffers[c.id[1]].size() < size_t(c.arg.u[1]) + c.arg.u[2]) {
+					fail(i, c, "out of bounds");
+					break;
+				}
+				memcpy(&buffers[c.id[0]][c.arg.u[0]], &buffers[c.id[1]][c.arg.u[1]], c.arg.u[2]);
+				copy_bytes += c.arg.u[2];
+				clock += c.arg.u[2] / 16;
+				break;
+			case CmdCopyTexture:
+				if (c.id[0] >= num || c.id[1] >= num) {
+					fail(i, c, "bad id");
+					break;
+				}
+				use(i, c, c.id[0], copy_dst, 1);
+				use(i, c, c.id[1], texture_src, 1);
+				if (c.arg.u[2] < c.arg.u[0] * 4 || !c.arg.u[1] ||
+					buffers[c.id[0]].size() < size_t(c.arg.u[2]) * (c.arg.u[1] - 1) + c.arg.u[0] * 4)
+					fail(i, c, "out of bounds");
+				else
+					copy_bytes += size_t(c.arg.u[0]) * c.arg.u[1] * 4;
+				clock += size_t(c.arg.u[0]) * c.arg.u[1] / 4;
+				break;
+			case CmdUploadTexture: {
+				if (c.id[0] >= num || c.id[1] >= num || c.slot >= textures[c.id[0]].size()) {
+					fail(i, c, "bad id");
+					break;
+				}
+				use(i, c, c.id[0], copy_dst, 1, c.slot);
+				use(i, c, c.id[1], copy_src, 1);
+				uint32_t row_bytes = c.arg.u[1], rows = c.arg.u[2], pitch = c.arg.u[3];
+				auto & src = buffers[c.id[1]];
+				if (pitch < row_bytes || !rows || src.size() < size_t(c.arg.u[0]) + size_t(pitch) * (rows - 1) + row_bytes) {
+					fail(i, c, "out of bounds");
+					break;
+				}
+				auto & dst = textures[c.id[0]][c.slot];
+				dst.resize(size_t(row_bytes) * rows);
+				for (uint32_t y = 0; y < rows; y++)
+					memcpy(&dst[size_t(y) * row_bytes], &src[c.arg.u[0] + size_t(y) * pitch], row_bytes);
+				copy_bytes += dst.size();
+				clock += dst.size() / 16;
+				break;
+			}
+			case CmdBarrier:
+				if (i == 0 || cl.cmds[i - 1].type != CmdBarrier)
+					batches++;
+				barrier(i, c);
+				break;
+			case CmdSetRootSig:
+				sig[c.bind & 1] = true;
+				break;
+			case CmdSetPipeline:
+				pso = true;
+				break;
+			case CmdSetSrv:
+				use(i, c, c.id[0], srv, 3);
+				break;
+			case CmdSetUav:
+				use(i, c, c.id[0], uav, 1);
+				break;
+			case CmdSetVertex:
+				use(i, c, c.id[0], vertex, 2);
+				break;
+			case CmdSetTarget:
+				target = true;
+				break;
+			case CmdDispatch:
+				if (!sig[CmdBindCompute] || !pso)
+					fail(i, c, "nothing bound");
+				clock += uint64_t(c.arg.u[0]) * c.arg.u[1] * c.arg.u[2] * 64;
+				break;
+			case CmdDrawIndirect:
+				use(i, c, c.id[0], indirect, 2);
+				//fall through
+			case CmdDraw:
+				if (!sig[CmdBindGraphics] || !pso || !target)
+					fail(i, c, "nothing bound");
+				if (c.type == CmdDraw)
+					clock += uint64_t(c.arg.u[0]) * c.arg.u[1];
+				break;
+			case CmdTimestamp:
+				if (c.id[0] >= num || c.arg.u[0] >= queries[c.id[0]].size())
+					fail(i, c, "bad query");
+				else
+					queries[c.id[0]][c.arg.u[0]] = clock;
+				break;
+			case CmdResolveQueries: {
+				if (c.id[0] >= num || c.id[1] >= num ||
+					size_t(c.arg.u[0]) + c.arg.u[1] > queries[c.id[0]].size()) {
+					fail(i, c, "bad query");
+					break;
+				}
+				use(i, c, c.id[1], copy_dst, 1);
+				size_t bytes = size_t(c.arg.u[1]) * sizeof(uint64_t);
+				if (buffers[c.id[1]].size() < c.arg.u[2] + bytes) {
+					fail(i, c, "out of bounds");
+					break;
+				}
+				memcpy(&buffers[c.id[1]][c.arg.u[2]], &queries[c.id[0]][c.arg.u[0]], bytes);
+				break;
+			}
+			case CmdUse:
+			case CmdDone:
+				fail(i, c, "not resolved by the state tracker");
+				break;
+			default:
+				if ((c.type == CmdSetTable || c.type == CmdClear) && c.id[0] >= num)
+					fail(i, c, "bad id");
+				break;
+			}
+		}
+		for (uint32_t id = 0; id < num; id++)
+			if (is_buffer[id])
+				for (auto & st : states[id])
+					if (!(st & Splitting) && st != CmdStateGenericRead)
+						st = CmdStateCommon;
+	}
+};
+
+#endif //_CMD_H_
@@ -0,0 +1,315 @@
+#ifndef _COMPOSE_H_
+#define _COMPOSE_H_
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "format.h"
+#include "sprite.h"
+#include "store.h"
+
+//
+// Tile classified composition of the layer images (present.hlsl).
+// Every layer keeps a coverage mask of its tiles, built from the bounds
+// of its live objects. The present pass gets one layer bit mask per
+// output tile and only samples the layers set in it. Texels outside the
+// objects are cleared to 0, so leaving them out does not change the sum.
+//
+enum {
+	ComposeLayerTile = 32,  //layer texels
+	ComposeOutTile = 64,    //output pixels
+	ComposeObjectPad = 2,   //texels around an object, packed halfs and edge rules
+	ComposeMaskHeader = 2,  //out tile size, tiles per row
+};
+
+//tiles of one layer image that may hold something else than 0.
+struct tile_cover_t {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t tile = 0;
+	uint32_t tiles_x = 0;
+	uint32_t tiles_y = 0;
+	uint32_t count = 0;
+	std::vector<uint8_t> tiles;
+
+	void init(uint32_t w, uint32_t h, uint32_t t)
+	{
+		width = w;
+		height = h;
+		tile = t;
+		tiles_x = (w + t - 1) / t;
+		tiles_y = (h + t - 1) / t;
+		tiles.assign(tiles_x * tiles_y, 0);
+		count = 0;
+	}
+
+	void clear()
+	{
+		memset(tiles.data(), 0, tiles.size());
+		count = 0;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	bool covered(uint32_t x, uint32_t y) const
+	{
+		return tiles[(y / tile) * tiles_x + x / tile] != 0;
+	}
+
+	//texels [x0, x1] x [y0, y1], clipped to the image like the rasterizer does.
+	void mark(int x0, int y0, int x1, int y1)
+	{
+		x0 = x0 < 0 ? 0 : x0;
+		y0 = y0 < 0 ? 0 : y0;
+		x1 = x1 >= int(width) ? int(width) - 1 : x1;
+		y1 = y1 >= int(height) ? int(height) - 1 : y1;
+		if (x0 > x1 || y0 > y1)
+			return;
+		for (int ty = y0 / tile; ty <= y1 / int(tile); ty++) {
+			for (int tx = x0 / tile; tx <= x1 / int(tile); tx++) {
+				auto & t = tiles[ty * tiles_x + tx];
+				count += t == 0;
+				t = 1;
+			}
+		}
+	}
+};
+
+//
+// Cover the bounds of the live objects [0, end) of a layer. NDC maps to
+// the image with y down, the rotated extent is |sx c| + |sy s|, |sx s| + |sy c|.
+//
+static inline void
+compose_classify_layer(const object_store_t &store, uint32_t end, tile_cover_t &cover)
+{
+	float hw = cover.width * 0.5f;
+	float hh = cover.height * 0.5f;
+
+	cover.clear();
+	for (uint32_t i = 0; i < end; i++) {
+		if (store.flags[i] == 0)
+			continue;
+		float s, c;
+		sprite_sincos(store.rotate[i], s, c);
+		float sx = store.scale_x[i];
+		float sy = store.scale_y[i];
+		float ex = fabsf(sx * c) + fabsf(sy * s);
+		float ey = fabsf(sx * s) + fabsf(sy * c);
+		float x0 = (store.pos_x[i] - ex + 1.0f) * hw;
+		float x1 = (store.pos_x[i] + ex + 1.0f) * hw;
+		float y0 = (1.0f - store.pos_y[i] - ey) * hh;
+		float y1 = (1.0f - store.pos_y[i] + ey) * hh;
+		if (!(x1 >= 0.0f && x0 < cover.width && y1 >= 0.0f && y0 < cover.height))
+			continue;
+		cover.mark(int(floorf(x0)) - ComposeObjectPad, int(floorf(y0)) - ComposeObjectPad,
+			int(floorf(x1)) + ComposeObjectPad, int(floorf(y1)) + ComposeObjectPad);
+	}
+}
+
+//
+// Layer bits of every output tile : the layer tiles under the bilinear
+// footprint of the tile, with wrap addressing (samplers[1]).
+// The footprint gets one more texel on each side for the rounding of the
+// interpolated uv.
+//
+struct tile_mask_t {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t tile = 0;
+	uint32_t tiles_x = 0;
+	uint32_t tiles_y = 0;
+	uint32_t active = 0;
+	uint32_t samples = 0;   //layer samples per frame, all layers : width * height * layers
+	std::vector<uint32_t> bits;
+
+	void init(uint32_t w, uint32_t h, uint32_t t)
+	{
+		width = w;
+		height = h;
+		tile = t;
+		tiles_x = (w + t - 1) / t;
+		tiles_y = (h + t - 1) / t;
+		bits.assign(tiles_x * tiles_y, 0);
+		active = 0;
+		samples = 0;
+	}
+
+	uint32_t get(uint32_t x, uint32_t y) const
+	{
+		return bits[(y / tile) * tiles_x + x / tile];
+	}
+
+	//layer tiles [first, last] of texels [t0, t1] of an axis of n texels.
+	static void footprint(int t0, int t1, uint32_t n, uint32_t tile, std::vector<uint32_t> &out)
+	{
+		out.clear();
+		if (t1 - t0 + 1 >= int(n)) {
+			for (uint32_t i = 0; i < (n + tile - 1) / tile; i++)
+				out.push_back(i);
+			return;
+		}
+		for (int t = t0; t <= t1; t++) {
+			uint32_t i = uint32_t(((t % int(n)) + int(n)) % int(n)) / tile;
+			if (out.empty() || out.back() != i)
+				out.push_back(i);
+		}
+	}
+
+	void build(const tile_cover_t *covers, int layer_max)
+	{
+		std::vector<uint32_t> cols, rows;
+		uint32_t lw = covers[0].width;
+		uint32_t lh = covers[0].height;
+		float sx = float(lw) / float(width);
+		float sy = float(lh) / float(height);
+
+		active = 0;
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			active |= uint32_t(!covers[lidx].empty()) << lidx;
+		samples = 0;
+		for (uint32_t ty = 0; ty < tiles_y; ty++) {
+			uint32_t py0 = ty * tile;
+			uint32_t py1 = std::min(py0 + tile, height) - 1;
+			//v = 1 - (y + 0.5) / height, texel = v * lh - 0.5
+			int y0 = int(floorf(lh - (py1 + 0.5f) * sy - 0.5f)) - 1;
+			int y1 = int(floorf(lh - (py0 + 0.5f) * sy - 0.5f)) + 2;
+			footprint(y0, y1, lh, covers[0].tile, rows);
+			for (uint32_t tx = 0; tx < tiles_x; tx++) {
+				uint32_t px0 = tx * tile;
+				uint32_t px1 = std::min(px0 + tile, width) - 1;
+				int x0 = int(floorf((px0 + 0.5f) * sx - 0.5f)) - 1;
+				int x1 = int(floorf((px1 + 0.5f) * sx - 0.5f)) + 2;
+				footprint(x0, x1, lw, covers[0].tile, cols);
+
+				uint32_t mask = 0;
+				for (int lidx = 0; lidx < layer_max; lidx++) {
+					auto & cover = covers[lidx];
+					if (!(active & (1u << lidx)))
+						continue;
+					for (size_t r = 0; r < rows.size() && !(mask & (1u << lidx)); r++)
+						for (auto c : cols)
+							if (cover.tiles[rows[r] * cover.tiles_x + c]) {
+								mask |= 1u << lidx;
+								break;
+							}
+				}
+				bits[ty * tiles_x + tx] = mask;
+				for (uint32_t m = mask; m; m &= m - 1)
+					samples += (px1 - px0 + 1) * (py1 - py0 + 1);
+			}
+		}
+	}
+
+	//layout of the tile_mask buffer of present.hlsl.
+	void write(uint32_t *dst) const
+	{
+		dst[0] = tile;
+		dst[1] = tiles_x;
+		memcpy(dst + ComposeMaskHeader, bits.data(), bits.size() * sizeof(uint32_t));
+	}
+
+	size_t buffer_size() const
+	{
+		return (ComposeMaskHeader + bits.size()) * sizeof(uint32_t);
+	}
+};
+
+//
+// CPU reference of the layer and present passes, float RGBA images.
+//
+
+//triangles of vtx (sprite_expand_ref) with the pixel center rule, last one wins.
+static inline void
+compose_raster_ref(const VertexFormat *vtx, size_t vertex_num, float *image, uint32_t w, uint32_t h)
+{
+	for (size_t v = 0; v + 3 <= vertex_num; v += 3) {
+		float x[3], y[3];
+		for (int k = 0; k < 3; k++) {
+			x[k] = (vtx[v + k].pos[0] + 1.0f) * 0.5f * w;
+			y[k] = (1.0f - vtx[v + k].pos[1]) * 0.5f * h;
+		}
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (area == 0.0f)
+			continue;
+		float sign = area < 0.0f ? -1.0f : 1.0f;
+		int bx0 = std::max(int(floorf(std::min({ x[0], x[1], x[2] }))), 0);
+		int by0 = std::max(int(floorf(std::min({ y[0], y[1], y[2] }))), 0);
+		int bx1 = std::min(int(ceilf(std::max({ x[0], x[1], x[2] }))), int(w) - 1);
+		int by1 = std::min(int(ceilf(std::max({ y[0], y[1], y[2] }))), int(h) - 1);
+		for (int py = by0; py <= by1; py++) {
+			for (int px = bx0; px <= bx1; px++) {
+				float cx = px + 0.5f;
+				float cy = py + 0.5f;
+				bool in = true;
+				for (int k = 0; k < 3 && in; k++) {
+					int n = (k + 1) % 3;
+					float e = (x[n] - x[k]) * (cy - y[k]) - (y[n] - y[k]) * (cx - x[k]);
+					in = e * sign >= 0.0f;
+				}
+				if (in)
+					memcpy(&image[(py * w + px) * 4], vtx[v].color, sizeof(float) * 4);
+			}
+		}
+	}
+}
+
+//bilinear, wrap, like samplers[1].
+static inline void
+compose_sample(const float *image, uint32_t w, uint32_t h, float u, float v, float out[4])
+{
+	float tx = u * w - 0.5f;
+	float ty = v * h - 0.5f;
+	float fx0 = floorf(tx);
+	float fy0 = floorf(ty);
+	float fx = tx - fx0;
+	float fy = ty - fy0;
+	int x0 = ((int(fx0) % int(w)) + int(w)) % int(w);
+	int y0 = ((int(fy0) % int(h)) + int(h)) % int(h);
+	int x1 = (x0 + 1) % int(w);
+	int y1 = (y0 + 1) % int(h);
+	const float *t00 = &image[(y0 * w + x0) * 4];
+	const float *t10 = &image[(y0 * w + x1) * 4];
+	const float *t01 = &image[(y1 * w + x0) * 4];
+	const float *t11 = &image[(y1 * w + x1) * 4];
+	for (int k = 0; k < 4; k++) {
+		float a = t00[k] * (1.0f - fx) + t10[k] * fx;
+		float b = t01[k] * (1.0f - fx) + t11[k] * fx;
+		out[k] = a * (1.0f - fy) + b * fy;
+	}
+}
+
+//
+// Output rows [y0, y1) : the sum of the layers of mask in layer order.
+// mask == nullptr samples every layer (present.hlsl before the tile mask).
+//
+static inline void
+compose_rows(const float *const *layers, int layer_max, uint32_t lw, uint32_t lh,
+	const tile_mask_t *mask, float *out, uint32_t w, uint32_t h, uint32_t y0, uint32_t y1)
+{
+	uint32_t all = layer_max >= 32 ? ~0u : (1u << layer_max) - 1;
+	for (uint32_t y = y0; y < y1; y++) {
+		float v = 1.0f - (y + 0.5f) / h;
+		for (uint32_t x = 0; x < w; x++) {
+			float u = (x + 0.5f) / w;
+			uint32_t bits = mask ? mask->get(x, y) : all;
+			float sum[4] = {};
+			for (int lidx = 0; lidx < layer_max; lidx++) {
+				if (!(bits & (1u << lidx)))
+					continue;
+				float s[4];
+				compose_sample(layers[lidx], lw, lh, u, v, s);
+				for (int k = 0; k < 4; k++)
+					sum[k] += s[k];
+			}
+			memcpy(&out[(y * w + x) * 4], sum, sizeof(sum));
+		}
+	}
+}
+
+#endif //_COMPOSE_H_
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "format.h"
+
+#ifdef PACKED
+StructuredBuffer<PackedObjectFormat> obj : register(t0, space1);
+#define load_object(i) unpack_object(obj[i])
+#else
+StructuredBuffer<ObjectFormat> obj : register(t0, space1);
+#define load_object(i) obj[i]
+#endif
+
+RWStructuredBuffer<uint> visible : register(u0, space1);
+RWByteAddressBuffer args : register(u1, space1);
+
+cbuffer CullRange : register(b0)
+{
+	uint object_count;
+	float margin;
+};
+
+groupshared uint keep_sum[256];
+
+//bin_cull_ref (bin.h) without the tiles.
+uint keep_object(uint i)
+{
+	ObjectFormat o = load_object(i);
+	if (o.metadata[0] == 0)
+		return 0;
+	float s, c;
+	sincos(o.rotate.x, s, c);
+	float2 e = float2(
+		abs(o.scale.x * c) + abs(o.scale.y * s),
+		abs(o.scale.x * s) + abs(o.scale.y * c)) + margin;
+	return all(o.pos.xy + e >= -1.0) && all(1.0 >= o.pos.xy - e) ? 1 : 0;
+}
+
+//
+// One group per layer walks the objects in order, so the kept list is in
+// draw order like the CPU one. Writes the DrawInstanced(6, kept) arguments
+// of draw_sprites.hlsl.
+//
+[numthreads(256, 1, 1)]
+void CSMain(uint gi : SV_GroupIndex)
+{
+	uint base = 0;
+	for (uint begin = 0; begin < object_count; begin += 256) {
+		uint i = begin + gi;
+		uint keep = 0;
+		if (i < object_count)
+			keep = keep_object(i);
+
+		//inclusive prefix sum of keep over the group.
+		keep_sum[gi] = keep;
+		GroupMemoryBarrierWithGroupSync();
+		for (uint d = 1; d < 256; d <<= 1) {
+			uint v = gi >= d ? keep_sum[gi - d] : 0;
+			GroupMemoryBarrierWithGroupSync();
+			keep_sum[gi] += v;
+			GroupMemoryBarrierWithGroupSync();
+		}
+		if (keep)
+			visible[base + keep_sum[gi] - 1] = i;
+		base += keep_sum[255];
+		GroupMemoryBarrierWithGroupSync();
+	}
+	if (gi == 0)
+		args.Store4(0, uint4(6, base, 0, 0));
+}
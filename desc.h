@@ -0,0 +1,184 @@
+#ifndef _DESC_H_
+#define _DESC_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "ring.h"
+
+//
+// Descriptor heaps. desc_pool_t hands out persistent ranges from CPU only
+// heaps, a free list per page, a new page when none fits. desc_ring_t is
+// the shader visible heap : each frame takes linear ranges, copies its
+// tables into them and the ranges come back once the fence of the frame
+// completed, a ring that is full grows (ring.h). Heaps come from a create
+// function, a fake one runs the allocators on any platform. The increment
+// is asked once per allocator and carried by the ranges. Not thread safe.
+//
+struct desc_heap_t {
+	void *heap = nullptr;  //ID3D12DescriptorHeap
+	uint64_t cpu = 0;      //handle of the first descriptor
+	uint64_t gpu = 0;      //0 when not shader visible
+	uint32_t size = 0;
+};
+
+//heap of num descriptors, false on failure.
+typedef std::function<bool(uint32_t, desc_heap_t &)> desc_create_t;
+typedef std::function<void(desc_heap_t &)> desc_release_t;
+
+struct desc_range_t {
+	uint64_t cpu = 0;
+	uint64_t gpu = 0;
+	uint32_t page = 0;
+	uint32_t offset = 0;
+	uint32_t num = 0;
+	uint32_t increment = 0;
+
+	uint64_t cpu_at(uint32_t i) const
+	{
+		return cpu + uint64_t(i) * increment;
+	}
+
+	uint64_t gpu_at(uint32_t i) const
+	{
+		return gpu + uint64_t(i) * increment;
+	}
+};
+
+struct desc_pool_t {
+	struct free_t {
+		uint32_t offset;
+		uint32_t num;
+	};
+	struct page_t {
+		desc_heap_t heap;
+		std::vector<free_t> free;  //sorted by offset, neighbours merged
+	};
+
+	desc_create_t create;
+	desc_release_t release;
+	uint32_t increment = 0;
+	uint32_t page_size = 0;
+	std::vector<page_t> pages;
+	uint32_t live = 0;
+	uint32_t peak = 0;
+
+	void init(uint32_t inc, uint32_t page_num, desc_create_t c, desc_release_t r)
+	{
+		term();
+		increment = inc;
+		page_size = page_num;
+		create = c;
+		release = r;
+		live = peak = 0;
+	}
+
+	void term()
+	{
+		for (auto & p : pages)
+			if (release)
+				release(p.heap);
+		pages.clear();
+	}
+
+	~desc_pool_t()
+	{
+		term();
+	}
+
+	//num contiguous descriptors, first fit; larger than a page gets a page of its own.
+	bool alloc(uint32_t num, desc_range_t &out)
+	{
+		if (num == 0)
+			return false;
+		for (uint32_t i = 0; i < pages.size(); i++)
+			if (take(i, num, out))
+				return true;
+		page_t page;
+		if (!create(std::max(num, page_size), page.heap))
+			return false;
+		page.free.push_back({ 0, page.heap.size });
+		pages.push_back(page);
+		return take(uint32_t(pages.size() - 1), num, out);
+	}
+
+	bool take(uint32_t index, uint32_t num, desc_range_t &out)
+	{
+		auto & page = pages[index];
+		for (size_t i = 0; i < page.free.size(); i++) {
+			auto & f = page.free[i];
+			if (f.num < num)
+				continue;
+			out.page = index;
+			out.offset = f.offset;
+			out.num = num;
+			out.increment = increment;
+			out.cpu = page.heap.cpu + uint64_t(f.offset) * increment;
+			out.gpu = page.heap.gpu ? page.heap.gpu + uint64_t(f.offset) * increment : 0;
+			f.offset += num;
+			f.num -= num;
+			if (f.num == 0)
+				page.free.erase(page.free.begin() + i);
+			live += num;
+			peak = std::max(peak, live);
+			return true;
+		}
+		return false;
+	}
+
+	void free(desc_range_t &r)
+	{
+		if (r.num == 0)
+			return;
+		auto & list = pages[r.page].free;
+		auto it = std::lower_bound(list.begin(), list.end(), r.offset,
+			[](const free_t &f, uint32_t offset) { return f.offset < offset; });
+		it = list.insert(it, { r.offset, r.num });
+		if (it + 1 != list.end() && it->offset + it->num == (it + 1)->offset) {
+			it->num += (it + 1)->num;
+			list.erase(it + 1);
+		}
+		if (it != list.begin() && (it - 1)->offset + (it - 1)->num == it->offset) {
+			(it - 1)->num += it->num;
+			list.erase(it);
+		}
+		live -= r.num;
+		r = desc_range_t();
+	}
+};
+
+struct desc_ring_t : fence_ring_t<desc_heap_t, uint32_t> {
+	uint32_t increment = 0;
+
+	bool init(uint32_t inc, uint32_t num, desc_create_t c, desc_release_t r)
+	{
+		increment = inc;
+		return start(num, c, r);
+	}
+
+	uint32_t used() const
+	{
+		return uint32_t(head - tail);
+	}
+
+	//num contiguous descriptors, never across the end of the heap.
+	bool alloc(uint32_t num, desc_range_t &out)
+	{
+		uint64_t pos;
+		if (!place(head, num, pos))
+			return false;
+		uint32_t offset = uint32_t(pos % buffer.size);
+		out.page = 0;
+		out.offset = offset;
+		out.num = num;
+		out.increment = increment;
+		out.cpu = buffer.cpu + uint64_t(offset) * increment;
+		out.gpu = buffer.gpu + uint64_t(offset) * increment;
+		head = pos + num;
+		return true;
+	}
+};
+
+#endif //_DESC_H_
@@ -0,0 +1,202 @@
+#ifndef _DIRTY_H_
+#define _DIRTY_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+struct dirty_range_t {
+	uint32_t begin;
+	uint32_t end;
+};
+
+//
+// Dirty objects of a layer, one bit per page of (1 << page_shift) objects.
+// get_ranges() returns the dirty objects as sorted, coalesced ranges.
+// A layer keeps one tracker per frame in flight, since every frame has
+// its own copy of the buffers.
+//
+struct dirty_tracker_t {
+	uint32_t count = 0;
+	uint32_t page_shift = 0;
+	uint32_t dirty_pages = 0;
+	std::vector<uint64_t> bits;
+
+	void init(uint32_t num, uint32_t shift)
+	{
+		count = num;
+		page_shift = shift;
+		bits.assign((page_num() + 63) / 64, 0);
+		dirty_pages = 0;
+	}
+
+	//new objects are clean, dirty bits of the kept ones stay.
+	void resize(uint32_t num)
+	{
+		uint32_t pages = (num + (1u << page_shift) - 1) >> page_shift;
+		count = num;
+		bits.resize((pages + 63) / 64, 0);
+		if (pages % 64)
+			bits.back() &= (1ull << (pages % 64)) - 1;
+		dirty_pages = 0;
+		for (auto w : bits)
+			dirty_pages += popcount64(w);
+	}
+
+	uint32_t page_num() const
+	{
+		return (count + (1u << page_shift) - 1) >> page_shift;
+	}
+
+	bool empty() const
+	{
+		return dirty_pages == 0;
+	}
+
+	void clear()
+	{
+		if (dirty_pages)
+			bits.assign(bits.size(), 0);
+		dirty_pages = 0;
+	}
+
+	void mark(uint32_t begin, uint32_t end)
+	{
+		if (end > count)
+			end = count;
+		if (begin >= end)
+			return;
+		uint32_t p = begin >> page_shift;
+		uint32_t last = (end - 1) >> page_shift;
+		while (p <= last) {
+			uint32_t w = p / 64;
+			uint32_t b = p % 64;
+			uint32_t n = last - p + 1 < 64 - b ? last - p + 1 : 64 - b;
+			uint64_t m = (n == 64 ? ~0ull : ((1ull << n) - 1)) << b;
+			dirty_pages += popcount64(m & ~bits[w]);
+			bits[w] |= m;
+			p += n;
+		}
+	}
+
+	void mark_all()
+	{
+		mark(0, count);
+	}
+
+	//ranges closer than merge_gap pages are merged into one.
+	void get_ranges(std::vector<dirty_range_t> &ranges, uint32_t merge_gap = 0) const
+	{
+		ranges.clear();
+		if (empty())
+			return;
+		uint32_t pages = page_num();
+		uint32_t p = 0;
+		while (p < pages) {
+			p = find(p, true);
+			if (p >= pages)
+				break;
+			uint32_t e = find(p, false);
+			uint32_t begin = p << page_shift;
+			uint32_t end = e << page_shift;
+			if (end > count)
+				end = count;
+			if (!ranges.empty() && begin - ranges.back().end <= (merge_gap << page_shift))
+				ranges.back().end = end;
+			else
+				ranges.push_back({ begin, end });
+			p = e;
+		}
+	}
+
+	//first page >= p whose bit is value.
+	uint32_t find(uint32_t p, bool value) const
+	{
+		uint32_t pages = page_num();
+		while (p < pages) {
+			uint64_t w = bits[p / 64];
+			if (!value)
+				w = ~w;
+			w &= ~0ull << (p % 64);
+			if (w)
+				return std::min(pages, (p & ~63u) + ctz64(w));
+			p = (p & ~63u) + 64;
+		}
+		return pages;
+	}
+
+	static uint32_t popcount64(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		uint32_t n = 0;
+		for ( ; v; v &= v - 1)
+			n++;
+		return n;
+#else
+		return __builtin_popcountll(v);
+#endif
+	}
+
+	static uint32_t ctz64(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward64(&i, v);
+		return i;
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+};
+
+//drop the parts of ranges at or above end.
+static inline void
+dirty_clip(std::vector<dirty_range_t> &ranges, uint32_t end)
+{
+	while (!ranges.empty() && ranges.back().begin >= end)
+		ranges.pop_back();
+	if (!ranges.empty() && ranges.back().end > end)
+		ranges.back().end = end;
+}
+
+//bytes and copies uploaded from the dirty ranges.
+struct upload_stats_t {
+	uint64_t bytes = 0;
+	uint64_t copies = 0;
+	uint64_t skipped = 0;
+	uint64_t frames = 0;
+
+	void add(const std::vector<dirty_range_t> &ranges, size_t object_size)
+	{
+		if (ranges.empty())
+			skipped++;
+		for (auto & r : ranges)
+			bytes += uint64_t(r.end - r.begin) * object_size;
+		copies += ranges.size();
+	}
+
+	void frame()
+	{
+		frames++;
+	}
+
+	double bytes_per_frame() const
+	{
+		return frames ? double(bytes) / frames : 0.0;
+	}
+
+	double copies_per_frame() const
+	{
+		return frames ? double(copies) / frames : 0.0;
+	}
+
+	double skipped_per_frame() const
+	{
+		return frames ? double(skipped) / frames : 0.0;
+	}
+};
+
+#endif //_DIRTY_H_
@@ -21,18 +21,10 @@
  *
  */
 
-struct ObjectFormat {
-	float4 pos;
-	float4 scale;
-	float4 rotate;
-	float4 color;
-	
-	float4 uvinfo;
-	uint metadata[4];
-};
+#include "format.h"
 
-Texture2D<float4> layer_tex[] : register(t0);
-Texture2D<float4> user_tex[] : register(t1);
+Texture2D<float4> layer_tex[256] : register(t0);
+Texture2D<float4> user_tex[256] : register(t256);  //[0] : atlas of the layer (atlas.h), then -tex (tex.h)
 ConstantBuffer<ObjectFormat> objects[] : register(b0);
 SamplerState samplers[]   : register(s0);
 
@@ -47,6 +39,7 @@ struct PSInput {
 	float4 pos : SV_POSITION;
 	float2 uv : TEXCOORD0;
 	float4 color : TEXCOORD1;
+	nointerpolation uint matid : TEXCOORD2;
 };
 
 PSInput VSMain(VSInput vsin)
@@ -55,10 +48,17 @@ PSInput VSMain(VSInput vsin)
 	result.pos = float4(vsin.pos.xyz, 1.0);
 	result.uv = vsin.uv.xy;
 	result.color = vsin.color;
+	result.matid = vsin.id.x;
 	return result;
 }
 
 void PSMain(PSInput input, out float4 mrt0 : SV_TARGET)
 {
+#if defined(USER_TEX)
+	mrt0 = input.color * user_tex[NonUniformResourceIndex(input.matid)].Sample(samplers[1], input.uv);
+#elif defined(ATLAS)
+	mrt0 = input.color * user_tex[0].Sample(samplers[1], input.uv);
+#else
 	mrt0 = input.color;
+#endif
 }
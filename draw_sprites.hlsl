@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "format.h"
+
+#ifdef PACKED
+StructuredBuffer<PackedObjectFormat> obj : register(t0, space1);
+#define load_object(i) unpack_object(obj[i])
+#else
+StructuredBuffer<ObjectFormat> obj : register(t0, space1);
+#define load_object(i) obj[i]
+#endif
+
+#ifdef CULL
+//kept objects of the layer (bin.h or cull.hlsl), one instance each.
+StructuredBuffer<uint> visible : register(t2, space1);
+#define object_index(i) visible[i]
+#else
+#define object_index(i) (i)
+#endif
+
+Texture2D<float4> user_tex[256] : register(t256);  //[0] : atlas of the layer (atlas.h), then -tex (tex.h)
+SamplerState samplers[2] : register(s0);
+
+struct PSInput {
+	float4 pos : SV_POSITION;
+	float2 uv : TEXCOORD0;
+	float4 color : TEXCOORD1;
+	nointerpolation uint matid : TEXCOORD2;
+};
+
+float2 rotate(float2 p, float a) {
+	float c = cos(a);
+	float s = sin(a);
+	return float2(
+		p.x * c - p.y * s,
+		p.x * s + p.y * c);
+}
+
+//
+// Same math as update.hlsl, but done per vertex from the object buffer.
+// DrawInstanced(6, ObjectMax) : SV_InstanceID is the object index
+// (the index into visible with CULL).
+//
+PSInput VSMain(uint vid : SV_VertexID, uint iid : SV_InstanceID)
+{
+	PSInput result = (PSInput)0;
+	ObjectFormat o = load_object(object_index(iid));
+	if (o.metadata[0] == 0) {
+		result.pos = float4(0, 0, 0, 0);
+		return result;
+	}
+
+	static const uint index[6] = { 0, 1, 2, 1, 3, 2 };
+	uint i = index[vid % 6];
+	float2 corner = float2(i >> 1, i & 1);
+
+	float2 basepos = (corner * 2.0 - 1.0) * o.scale.xy;
+	basepos = rotate(basepos, o.rotate.x);
+	basepos += o.pos.xy;
+
+	result.pos = float4(basepos, 0, 1);
+	result.uv = o.uvinfo.xy + corner * o.uvinfo.zw;
+	result.color = o.color;
+	result.matid = o.metadata[1];
+	return result;
+}
+
+void PSMain(PSInput input, out float4 mrt0 : SV_TARGET)
+{
+#if defined(USER_TEX)
+	mrt0 = input.color * user_tex[NonUniformResourceIndex(input.matid)].Sample(samplers[1], input.uv);
+#elif defined(ATLAS)
+	mrt0 = input.color * user_tex[0].Sample(samplers[1], input.uv);
+#else
+	mrt0 = input.color;
+#endif
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2020 gyabo <gyaboyan@gmail.com>
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Buffer layouts shared by main.cpp and the hlsl files.
+// Included from C++ and from HLSL (D3D_COMPILE_STANDARD_FILE_INCLUDE).
+//
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#ifdef __cplusplus
+#include <stdint.h>
+#define FORMAT_FLOAT4(name) float name[4]
+#define FORMAT_UINT(name) uint32_t name
+#define FORMAT_UINT_ARRAY(name, n) uint32_t name[n]
+#else
+#define FORMAT_FLOAT4(name) float4 name
+#define FORMAT_UINT(name) uint name
+#define FORMAT_UINT_ARRAY(name, n) uint name[n]
+#endif
+
+struct VertexFormat {
+	FORMAT_FLOAT4(pos);
+	FORMAT_FLOAT4(uv);
+	FORMAT_FLOAT4(color);
+	FORMAT_UINT(matid);
+	FORMAT_UINT_ARRAY(reserved, 3);
+};
+
+struct ObjectFormat {
+	FORMAT_FLOAT4(pos);
+	FORMAT_FLOAT4(scale);
+	FORMAT_FLOAT4(rotate);
+	FORMAT_FLOAT4(color);
+	FORMAT_FLOAT4(uvinfo);  //rect in the texture : offset .xy, size .zw
+	FORMAT_UINT_ARRAY(metadata, 4);
+};
+
+//
+// Packed layouts (-packed).
+// half2 is x in the low 16 bits, unorm4 is r in the low byte
+// (same as DXGI_FORMAT_R16G16_FLOAT / R8G8B8A8_UNORM).
+//
+struct PackedVertexFormat {
+	FORMAT_UINT(pos);          //half2 pos.xy
+	FORMAT_UINT(uv);           //half2 uv.xy
+	FORMAT_UINT(color);        //unorm4
+	FORMAT_UINT(matid);        //low 16 bits
+};
+
+struct PackedObjectFormat {
+	FORMAT_UINT(pos);          //half2 pos.xy
+	FORMAT_UINT(scale);        //half2 scale.xy
+	FORMAT_UINT(rotate_matid); //half rotate.x, high 16 bits : metadata[1]
+	FORMAT_UINT(color);        //unorm4
+	FORMAT_UINT_ARRAY(uvinfo, 2); //half4 uvinfo
+	FORMAT_UINT(flags);        //metadata[0]
+	FORMAT_UINT(reserved);
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(VertexFormat) == 64, "VertexFormat");
+static_assert(sizeof(ObjectFormat) == 96, "ObjectFormat");
+static_assert(sizeof(PackedVertexFormat) == 16, "PackedVertexFormat");
+static_assert(sizeof(PackedObjectFormat) == 32, "PackedObjectFormat");
+#else
+float4 unpack_unorm4(uint c)
+{
+	return float4((c >> uint4(0, 8, 16, 24)) & 0xFF) / 255.0;
+}
+
+uint pack_unorm4(float4 c)
+{
+	uint4 u = uint4(floor(saturate(c) * 255.0 + 0.5));
+	return u.x | (u.y << 8) | (u.z << 16) | (u.w << 24);
+}
+
+float2 unpack_half2(uint h)
+{
+	return float2(f16tof32(h), f16tof32(h >> 16));
+}
+
+uint pack_half2(float2 v)
+{
+	return f32tof16(v.x) | (f32tof16(v.y) << 16);
+}
+
+ObjectFormat unpack_object(PackedObjectFormat p)
+{
+	ObjectFormat o = (ObjectFormat)0;
+	o.pos = float4(unpack_half2(p.pos), 0, 0);
+	o.scale = float4(unpack_half2(p.scale), 0, 0);
+	o.rotate = float4(f16tof32(p.rotate_matid), 0, 0, 0);
+	o.color = unpack_unorm4(p.color);
+	o.uvinfo = float4(unpack_half2(p.uvinfo[0]), unpack_half2(p.uvinfo[1]));
+	o.metadata[0] = p.flags;
+	o.metadata[1] = p.rotate_matid >> 16;
+	return o;
+}
+
+PackedVertexFormat pack_vertex(float2 pos, float2 uv, float4 color, uint matid)
+{
+	PackedVertexFormat v;
+	v.pos = pack_half2(pos);
+	v.uv = pack_half2(uv);
+	v.color = pack_unorm4(color);
+	v.matid = matid & 0xFFFF;
+	return v;
+}
+#endif
+
+#endif //_FORMAT_H_
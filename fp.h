@@ -0,0 +1,32 @@
+#ifndef _FP_H_
+#define _FP_H_
+
+//
+// FP_NO_FMA_BEGIN / FP_NO_FMA_END keep the compiler from fusing mul/add
+// into fma between them, for code whose scalar reference and vector
+// kernel have to round the same. The state before BEGIN comes back at END.
+//
+#if defined(__clang__)
+#define FP_NO_FMA_BEGIN \
+	_Pragma("float_control(push)") \
+	_Pragma("clang fp contract(off)")
+#define FP_NO_FMA_END \
+	_Pragma("float_control(pop)")
+#elif defined(__GNUC__)
+#define FP_NO_FMA_BEGIN \
+	_Pragma("GCC push_options") \
+	_Pragma("GCC optimize(\"fp-contract=off\")")
+#define FP_NO_FMA_END \
+	_Pragma("GCC pop_options")
+#elif defined(_MSC_VER)
+#define FP_NO_FMA_BEGIN \
+	__pragma(float_control(push)) \
+	__pragma(fp_contract(off))
+#define FP_NO_FMA_END \
+	__pragma(float_control(pop))
+#else
+#define FP_NO_FMA_BEGIN
+#define FP_NO_FMA_END
+#endif
+
+#endif //_FP_H_
@@ -0,0 +1,196 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Monotonic timeline of a GPU queue. signal() is called right after the
+// work of a frame is submitted and returns the value that marks that work
+// complete. wait_present() blocks while the present queue is over the
+// latency target (the waitable swap chain), the default never blocks.
+//
+struct gpu_timeline_t {
+	virtual ~gpu_timeline_t() {}
+	virtual uint64_t signal() = 0;
+	virtual uint64_t completed() = 0;
+	virtual void wait(uint64_t value) = 0;
+	virtual void wait_present() {}
+};
+
+//
+// N frames in flight over a timeline. begin(slot) returns once the GPU is
+// done with the previous use of slot, so its allocator and buffers can be
+// reset; end(slot) signals after the submit of this frame.
+//
+struct frame_scheduler_t {
+	gpu_timeline_t *timeline = nullptr;
+	std::vector<uint64_t> values;
+	uint64_t frame = 0;
+	uint64_t stalls = 0;
+	double stall_sec = 0.0;
+
+	void init(gpu_timeline_t *t, int frames)
+	{
+		timeline = t;
+		values.assign(frames < 1 ? 1 : frames, 0);
+		frame = 0;
+		stalls = 0;
+		stall_sec = 0.0;
+	}
+
+	int frames() const
+	{
+		return (int)values.size();
+	}
+
+	//slot of the next frame when the caller does not pick one (back buffer index).
+	int next_slot() const
+	{
+		return int(frame % values.size());
+	}
+
+	void begin(int slot)
+	{
+		using namespace std::chrono;
+		auto t = steady_clock::now();
+		bool stall = false;
+		timeline->wait_present();
+		if (timeline->completed() < values[slot]) {
+			timeline->wait(values[slot]);
+			stall = true;
+		}
+		if (stall)
+			stalls++;
+		stall_sec += duration<double>(steady_clock::now() - t).count();
+	}
+
+	uint64_t end(int slot)
+	{
+		values[slot] = timeline->signal();
+		frame++;
+		return values[slot];
+	}
+
+	//wait for everything submitted (resize, shutdown).
+	void flush()
+	{
+		for (auto v : values)
+			timeline->wait(v);
+	}
+};
+
+//
+// Timeline with a simulated GPU thread. work(usec) adds GPU time to the
+// next signal(), the GPU runs the submissions in order and completes their
+// values. present_latency models the waitable swap chain : wait_present()
+// blocks while that many frames are still queued. Completion times are
+// kept per value for latency measurement.
+//
+struct mock_timeline_t : gpu_timeline_t {
+	struct submit_t {
+		uint64_t value;
+		double usec;
+	};
+	typedef std::chrono::steady_clock clock_t;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<submit_t> submits;
+	std::thread gpu;
+	std::vector<clock_t::time_point> done_time;
+	uint64_t last = 0;
+	std::atomic<uint64_t> done {0};
+	double pending_usec = 0.0;
+	int present_latency = 0;
+	bool quit = false;
+
+	void init(int latency)
+	{
+		present_latency = latency;
+		done_time.assign(1, clock_t::now());
+		gpu = std::thread([this]() { gpu_main(); });
+	}
+
+	void term()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		cv.notify_all();
+		if (gpu.joinable())
+			gpu.join();
+	}
+
+	~mock_timeline_t()
+	{
+		term();
+	}
+
+	void work(double usec)
+	{
+		pending_usec += usec;
+	}
+
+	uint64_t signal() override
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		submits.push_back({ ++last, pending_usec });
+		pending_usec = 0.0;
+		cv.notify_all();
+		return last;
+	}
+
+	uint64_t completed() override
+	{
+		return done.load();
+	}
+
+	void wait(uint64_t value) override
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [this, value]() { return done.load() >= value; });
+	}
+
+	void wait_present() override
+	{
+		if (present_latency <= 0)
+			return;
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [this]() { return last - done.load() < uint64_t(present_latency); });
+	}
+
+	//completion time of value, only valid once completed() >= value.
+	clock_t::time_point done_at(uint64_t value)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return done_time[value];
+	}
+
+	void gpu_main()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true) {
+			cv.wait(lock, [this]() { return quit || !submits.empty(); });
+			if (submits.empty())
+				break;
+			auto s = submits.front();
+			submits.pop_front();
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::microseconds(int64_t(s.usec)));
+			lock.lock();
+			done_time.push_back(clock_t::now());
+			done = s.value;
+			cv.notify_all();
+		}
+	}
+};
+
+#endif //_FRAME_H_
@@ -0,0 +1,186 @@
+#ifndef _JOB_H_
+#define _JOB_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+//
+// Work stealing job system.
+// Every worker owns a deque, it pushes and pops at the back and the other
+// workers steal from the front. The thread that calls init() is worker 0
+// and runs jobs while it waits on a counter, so a 1 thread system runs
+// everything inline.
+//
+struct job_t {
+	std::function<void()> fn;
+	std::atomic<int> *counter = nullptr;
+};
+
+struct job_system_t {
+	struct queue_t {
+		std::mutex mtx;
+		std::deque<job_t> jobs;
+	};
+
+	std::vector<std::unique_ptr<queue_t>> queues;
+	std::vector<std::thread> threads;
+	std::mutex sleep_mtx;
+	std::condition_variable sleep_cv;
+	std::atomic<int> pending {0};
+	std::atomic<bool> quit {false};
+	std::atomic<uint64_t> steal_count {0};
+
+	struct worker_t {
+		const job_system_t *owner = nullptr;
+		int index = 0;
+	};
+
+	static worker_t &worker()
+	{
+		static thread_local worker_t w;
+		return w;
+	}
+
+	//queue of the calling thread, 0 for threads this system did not start.
+	int worker_index() const
+	{
+		auto & w = worker();
+		return w.owner == this ? w.index : 0;
+	}
+
+	~job_system_t()
+	{
+		term();
+	}
+
+	void init(int num_threads)
+	{
+		if (num_threads < 1)
+			num_threads = 1;
+		quit = false;
+		for (int i = 0; i < num_threads; i++)
+			queues.emplace_back(new queue_t);
+		for (int i = 1; i < num_threads; i++)
+			threads.emplace_back([this, i]() { worker_main(i); });
+	}
+
+	//joins the workers, a second call does nothing.
+	void term()
+	{
+		if (queues.empty())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(sleep_mtx);
+			quit = true;
+		}
+		sleep_cv.notify_all();
+		for (auto & t : threads)
+			t.join();
+		threads.clear();
+		queues.clear();
+	}
+
+	int num_threads() const
+	{
+		return (int)queues.size();
+	}
+
+	void submit(std::atomic<int> &counter, std::function<void()> fn)
+	{
+		auto & q = *queues[worker_index()];
+
+		counter++;
+		{
+			std::lock_guard<std::mutex> lock(q.mtx);
+			q.jobs.push_back({ std::move(fn), &counter });
+		}
+		{
+			//under sleep_mtx, or a worker can miss it between its check and its wait.
+			std::lock_guard<std::mutex> lock(sleep_mtx);
+			pending++;
+		}
+		if (!threads.empty())
+			sleep_cv.notify_one();
+	}
+
+	//run jobs until counter reaches zero.
+	void wait(std::atomic<int> &counter)
+	{
+		while (counter.load() > 0) {
+			if (!run_one(worker_index()))
+				std::this_thread::yield();
+		}
+	}
+
+	//split [0, count) into chunk sized jobs and join.
+	void parallel_for(int count, int chunk,
+		const std::function<void(int, int)> &fn)
+	{
+		std::atomic<int> counter {0};
+
+		for (int begin = 0; begin < count; begin += chunk) {
+			int end = begin + chunk < count ? begin + chunk : count;
+			submit(counter, [&fn, begin, end]() { fn(begin, end); });
+		}
+		wait(counter);
+	}
+
+	bool pop(int index, job_t &job)
+	{
+		auto & q = *queues[index];
+		std::lock_guard<std::mutex> lock(q.mtx);
+		if (q.jobs.empty())
+			return false;
+		job = std::move(q.jobs.back());
+		q.jobs.pop_back();
+		return true;
+	}
+
+	bool steal(int index, job_t &job)
+	{
+		int n = num_threads();
+		for (int i = 1; i < n; i++) {
+			auto & q = *queues[(index + i) % n];
+			std::unique_lock<std::mutex> lock(q.mtx, std::try_to_lock);
+			if (!lock.owns_lock() || q.jobs.empty())
+				continue;
+			job = std::move(q.jobs.front());
+			q.jobs.pop_front();
+			steal_count++;
+			return true;
+		}
+		return false;
+	}
+
+	bool run_one(int index)
+	{
+		job_t job;
+		if (!pop(index, job) && !steal(index, job))
+			return false;
+		pending--;
+		job.fn();
+		job.counter->fetch_sub(1);
+		return true;
+	}
+
+	void worker_main(int index)
+	{
+		worker().owner = this;
+		worker().index = index;
+		while (!quit) {
+			if (run_one(index))
+				continue;
+			std::unique_lock<std::mutex> lock(sleep_mtx);
+			sleep_cv.wait(lock, [this]() { return quit || pending > 0; });
+		}
+	}
+};
+
+#endif //_JOB_H_
@@ -2,11 +2,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <chrono>
+#include <memory>
+#include <map>
 
+#ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
 
 #include <dwmapi.h>
 #include <D3Dcompiler.h>
@@ -20,9 +27,38 @@
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3d12.lib")
 #pragma comment(lib, "D3DCompiler.lib")
+#else
+#include <unistd.h>
+#include <dirent.h>
+#endif //_WIN32
 
-#define err(...) printf("[ERR] : " __FUNCTION__ " : " __VA_ARGS__)
-#define dbg(...) printf("[DBG] : " __FUNCTION__ " : " __VA_ARGS__)
+#include "sprite.h"
+#include "job.h"
+#include "rng.h"
+#include "store.h"
+#include "dirty.h"
+#include "slots.h"
+#include "frame.h"
+#include "cmd.h"
+#include "state.h"
+#include "compose.h"
+#include "bin.h"
+#include "soft.h"
+#include "capture.h"
+#include "bench.h"
+#include "prof.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "desc.h"
+#include "mem.h"
+#include "upload.h"
+#include "atlas.h"
+#include "tex.h"
+
+#define err(fmt, ...) printf("[ERR] : %s : " fmt, __FUNCTION__, ##__VA_ARGS__)
+#define dbg(fmt, ...) printf("[DBG] : %s : " fmt, __FUNCTION__, ##__VA_ARGS__)
+
+#ifdef _WIN32
 
 static LRESULT WINAPI
 win_msg_proc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -170,20 +206,216 @@ create_device()
 	return (ret);
 }
 
+//
+// Resources placed in heaps of mem.h. Heaps of resource heap tier 1 take
+// either buffers, render targets or other textures, so there are heaps per
+// heap type and kind. defrag() plans moves out of the emptiest heaps, move() applies one
+// to an idle resource. -committed gives every resource its own allocation.
+//
+enum {
+	MemUpload,
+	MemReadback,
+	MemBuffer,        //default heap, UAV buffers
+	MemRenderTarget,
+	MemTexture,       //sampled only, the atlases of atlas.h
+	MemKindNum,
+	MemHeapSize = 64 << 20,
+};
+
+struct d3d_mem_t {
+	struct placed_t {
+		int kind;
+		uint32_t id;
+	};
+	ID3D12Device *dev = nullptr;
+	bool committed = false;
+	mem_heaps_t heaps[MemKindNum];
+	std::map<ID3D12Resource *, placed_t> placed;
+	std::vector<mem_move_t> moves[MemKindNum];
+
+	static D3D12_HEAP_PROPERTIES props(D3D12_HEAP_TYPE type)
+	{
+		D3D12_HEAP_PROPERTIES ret = {};
+		ret.Type = type;
+		ret.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+		ret.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+		ret.CreationNodeMask = 1;
+		ret.VisibleNodeMask = 1;
+		return (ret);
+	}
+
+	static D3D12_HEAP_TYPE heap_type(int kind)
+	{
+		if (kind == MemUpload)
+			return D3D12_HEAP_TYPE_UPLOAD;
+		if (kind == MemReadback)
+			return D3D12_HEAP_TYPE_READBACK;
+		return D3D12_HEAP_TYPE_DEFAULT;
+	}
+
+	static D3D12_RESOURCE_STATES initial_state(int kind)
+	{
+		if (kind == MemUpload)
+			return D3D12_RESOURCE_STATE_GENERIC_READ;
+		if (kind == MemReadback)
+			return D3D12_RESOURCE_STATE_COPY_DEST;
+		return D3D12_RESOURCE_STATE_COMMON;
+	}
+
+	void init(ID3D12Device *d, bool use_committed)
+	{
+		dev = d;
+		committed = use_committed;
+		for (int k = 0; k < MemKindNum; k++) {
+			heaps[k].init(MemHeapSize, [this, k](uint64_t n, void *&heap) {
+				ID3D12Heap *p = nullptr;
+				D3D12_HEAP_DESC desc = {};
+				desc.SizeInBytes = n;
+				desc.Properties = props(heap_type(k));
+				desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+				desc.Flags = k == MemRenderTarget ? D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES :
+					k == MemTexture ? D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES :
+					D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+				if (FAILED(dev->CreateHeap(&desc, IID_PPV_ARGS(&p))))
+					return false;
+				heap = p;
+				dbg("heap=%p kind=%d size=%llu\n", p, k, (unsigned long long)n);
+				return true;
+			}, [](void *heap) {
+				((ID3D12Heap *)heap)->Release();
+			});
+		}
+	}
+
+	ID3D12Resource *place(int kind, const mem_alloc_t &a, const D3D12_RESOURCE_DESC &desc)
+	{
+		ID3D12Resource *ret = nullptr;
+		auto hr = dev->CreatePlacedResource((ID3D12Heap *)heaps[kind].heaps[a.heap]->heap, a.offset,
+			&desc, initial_state(kind), nullptr, IID_PPV_ARGS(&ret));
+		if (FAILED(hr)) {
+			err("CreatePlacedResource kind=%d offset=%llu hr=%08X\n", kind, (unsigned long long)a.offset, hr);
+			return nullptr;
+		}
+		return (ret);
+	}
+
+	ID3D12Resource *create(D3D12_HEAP_TYPE htype, const D3D12_RESOURCE_DESC &desc)
+	{
+		ID3D12Resource *ret = nullptr;
+		int kind = MemBuffer;
+		if (htype == D3D12_HEAP_TYPE_UPLOAD)
+			kind = MemUpload;
+		else if (htype == D3D12_HEAP_TYPE_READBACK)
+			kind = MemReadback;
+		else if (desc.Flags & D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET)
+			kind = MemRenderTarget;
+		else if (desc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER)
+			kind = MemTexture;
+		if (committed) {
+			auto hprop = props(htype);
+			if (FAILED(dev->CreateCommittedResource(&hprop, D3D12_HEAP_FLAG_NONE, &desc,
+				initial_state(kind), nullptr, IID_PPV_ARGS(&ret))))
+				return nullptr;
+			return (ret);
+		}
+		auto info = dev->GetResourceAllocationInfo(0, 1, &desc);
+		uint32_t id = heaps[kind].alloc(info.SizeInBytes, info.Alignment);
+		if (id == mem_heaps_t::Invalid)
+			return nullptr;
+		ret = place(kind, heaps[kind].get(id), desc);
+		if (!ret) {
+			heaps[kind].free(id);
+			return nullptr;
+		}
+		placed[ret] = { kind, id };
+		return (ret);
+	}
+
+	void release(ID3D12Resource *res)
+	{
+		auto it = placed.find(res);
+		res->Release();
+		if (it != placed.end()) {
+			heaps[it->second.kind].free(it->second.id);
+			placed.erase(it);
+		}
+	}
+
+	//moves of up to max_bytes per kind, only of resources movable says yes to.
+	size_t defrag(std::function<bool(ID3D12Resource *)> movable, uint64_t max_bytes)
+	{
+		size_t ret = 0;
+		for (int k = 0; k < MemKindNum; k++) {
+			std::vector<ID3D12Resource *> owners(heaps[k].allocs.size(), nullptr);
+			for (auto & p : placed)
+				if (p.second.kind == k)
+					owners[p.second.id] = p.first;
+			ret += heaps[k].defrag([&](uint32_t id) {
+				return owners[id] && movable(owners[id]);
+			}, max_bytes, moves[k]);
+		}
+		return (ret);
+	}
+
+	//res at its planned place in its initial state, res itself without a move.
+	//Upload and readback contents are copied, default heap contents are lost.
+	ID3D12Resource *move(ID3D12Resource *res)
+	{
+		auto it = placed.find(res);
+		if (it == placed.end())
+			return (res);
+		auto p = it->second;
+		auto & list = moves[p.kind];
+		auto m = std::find_if(list.begin(), list.end(), [&p](const mem_move_t &m) { return m.id == p.id; });
+		if (m == list.end())
+			return (res);
+		auto desc = res->GetDesc();
+		auto ret = place(p.kind, m->to, desc);
+		if (!ret)
+			return (res);
+		if (p.kind == MemUpload || p.kind == MemReadback) {
+			void *src = nullptr, *dst = nullptr;
+			res->Map(0, nullptr, &src);
+			ret->Map(0, nullptr, &dst);
+			if (src && dst)
+				memcpy(dst, src, size_t(desc.Width));
+			ret->Unmap(0, nullptr);
+			res->Unmap(0, nullptr);
+		}
+		res->Release();
+		placed.erase(it);
+		heaps[p.kind].finish(*m);
+		placed[ret] = p;
+		list.erase(m);
+		return (ret);
+	}
+
+	//drops the moves move() was not called for.
+	void cancel()
+	{
+		for (int k = 0; k < MemKindNum; k++) {
+			for (auto & m : moves[k])
+				heaps[k].cancel(m);
+			moves[k].clear();
+		}
+	}
+
+	void report()
+	{
+		const char *names[MemKindNum] = { "upload", "readback", "buffer", "render target", "texture" };
+		for (int k = 0; k < MemKindNum; k++)
+			if (!heaps[k].heaps.empty())
+				heaps[k].report(stdout, names[k]);
+	}
+};
+
 ID3D12Resource *
-create_res(ID3D12Device *dev, int w, int h, DXGI_FORMAT fmt,
+create_res(d3d_mem_t *mem, int w, int h, DXGI_FORMAT fmt,
 	D3D12_RESOURCE_FLAGS flags, D3D12_HEAP_TYPE htype,
-	D3D12_RESOURCE_DIMENSION dim, D3D12_TEXTURE_LAYOUT layout)
+	D3D12_RESOURCE_DIMENSION dim, D3D12_TEXTURE_LAYOUT layout, UINT mips = 1)
 {
 	ID3D12Resource *ret = nullptr;
 	D3D12_RESOURCE_DESC desc = {};
-	D3D12_HEAP_PROPERTIES hprop  = {};
-
-	hprop.Type = htype;
-	hprop.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-	hprop.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-	hprop.CreationNodeMask = 1;
-	hprop.VisibleNodeMask = 1;
 
 	desc.Dimension = dim;
 	desc.Width = w;
@@ -195,19 +427,13 @@ create_res(ID3D12Device *dev, int w, int h, DXGI_FORMAT fmt,
 	desc.DepthOrArraySize = 1;
 	desc.SampleDesc.Count = 1;
 	desc.SampleDesc.Quality = 0;
-	desc.MipLevels = 1;
-	auto state = D3D12_RESOURCE_STATE_COMMON;
-	if (htype == D3D12_HEAP_TYPE_UPLOAD)
-		state = D3D12_RESOURCE_STATE_GENERIC_READ;
-
-	auto hr = dev->CreateCommittedResource(&hprop, D3D12_HEAP_FLAG_NONE,
-			&desc, state, nullptr,
-			IID_PPV_ARGS(&ret));
-	if (hr) {
-		err("w=%d, h=%d, flags=%08X, hr=%08X\n",
-			w, h, flags, hr);
+	desc.MipLevels = mips;
+
+	ret = mem->create(htype, desc);
+	if (!ret) {
+		err("w=%d, h=%d, flags=%08X\n", w, h, flags);
 		err("GetDeviceRemovedReason=%08X\n",
-			dev->GetDeviceRemovedReason());
+			mem->dev->GetDeviceRemovedReason());
 		return nullptr;
 	}
 
@@ -216,9 +442,9 @@ create_res(ID3D12Device *dev, int w, int h, DXGI_FORMAT fmt,
 
 
 ID3D12Resource *
-create_res_render_target(ID3D12Device *dev, UINT w, UINT h, DXGI_FORMAT fmt)
+create_res_render_target(d3d_mem_t *mem, UINT w, UINT h, DXGI_FORMAT fmt)
 {
-	return create_res(dev, w, h, fmt,
+	return create_res(mem, w, h, fmt,
 			D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET,
 			D3D12_HEAP_TYPE_DEFAULT,
 			D3D12_RESOURCE_DIMENSION_TEXTURE2D,
@@ -226,9 +452,26 @@ create_res_render_target(ID3D12Device *dev, UINT w, UINT h, DXGI_FORMAT fmt)
 }
 
 ID3D12Resource *
-create_res_buffer(ID3D12Device *dev, UINT bytes)
+create_res_texture(d3d_mem_t *mem, UINT w, UINT h, DXGI_FORMAT fmt, UINT mips = 1)
+{
+	return create_res(mem, w, h, fmt,
+			D3D12_RESOURCE_FLAG_NONE,
+			D3D12_HEAP_TYPE_DEFAULT,
+			D3D12_RESOURCE_DIMENSION_TEXTURE2D,
+			D3D12_TEXTURE_LAYOUT_UNKNOWN, mips);
+}
+
+DXGI_FORMAT
+tex_dxgi_format(uint32_t format)
+{
+	return format == TexBC1 ? DXGI_FORMAT_BC1_UNORM : format == TexBC3 ?
+		DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+}
+
+ID3D12Resource *
+create_res_buffer(d3d_mem_t *mem, UINT bytes)
 {
-	return create_res(dev, bytes, 1, DXGI_FORMAT_UNKNOWN,
+	return create_res(mem, bytes, 1, DXGI_FORMAT_UNKNOWN,
 			D3D12_RESOURCE_FLAG_NONE,
 			D3D12_HEAP_TYPE_UPLOAD,
 			D3D12_RESOURCE_DIMENSION_BUFFER,
@@ -236,9 +479,19 @@ create_res_buffer(ID3D12Device *dev, UINT bytes)
 }
 
 ID3D12Resource *
-create_res_uav_buffer(ID3D12Device *dev, UINT bytes)
+create_res_readback(d3d_mem_t *mem, UINT bytes)
+{
+	return create_res(mem, bytes, 1, DXGI_FORMAT_UNKNOWN,
+			D3D12_RESOURCE_FLAG_NONE,
+			D3D12_HEAP_TYPE_READBACK,
+			D3D12_RESOURCE_DIMENSION_BUFFER,
+			D3D12_TEXTURE_LAYOUT_ROW_MAJOR);
+}
+
+ID3D12Resource *
+create_res_uav_buffer(d3d_mem_t *mem, UINT bytes)
 {
-	return create_res(dev, bytes, 1, DXGI_FORMAT_UNKNOWN,
+	return create_res(mem, bytes, 1, DXGI_FORMAT_UNKNOWN,
 			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
 			D3D12_HEAP_TYPE_DEFAULT,
 			D3D12_RESOURCE_DIMENSION_BUFFER,
@@ -272,6 +525,67 @@ upload_data(ID3D12Resource *res, void *data, size_t size)
 	}
 }
 
+//
+// RGBA8 rows of w * 4 bytes into texture res (COMMON), through a staging
+// buffer and a list of its own, waited for. Startup only. Leaves res in
+// PIXEL_SHADER_RESOURCE.
+//
+bool
+upload_texture(ID3D12Device *dev, ID3D12CommandQueue *queue, d3d_mem_t *mem,
+	ID3D12Resource *res, const uint8_t *pixels, UINT w, UINT h)
+{
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT fp = {};
+	UINT64 total = 0;
+	auto desc = res->GetDesc();
+	dev->GetCopyableFootprints(&desc, 0, 1, 0, &fp, nullptr, nullptr, &total);
+	auto staging = create_res_buffer(mem, UINT(total));
+	if (!staging)
+		return false;
+	auto dst = (uint8_t *)get_data_address(staging);
+	for (UINT y = 0; y < h; y++)
+		memcpy(dst + fp.Offset + size_t(y) * fp.Footprint.RowPitch, pixels + size_t(y) * w * 4, w * 4);
+	staging->Unmap(0, nullptr);
+
+	ID3D12CommandAllocator *alloc = nullptr;
+	ID3D12GraphicsCommandList *list = nullptr;
+	ID3D12Fence *fence = nullptr;
+	dev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&alloc));
+	dev->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, alloc, nullptr, IID_PPV_ARGS(&list));
+	dev->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
+	D3D12_TEXTURE_COPY_LOCATION to = {};
+	D3D12_TEXTURE_COPY_LOCATION from = {};
+	to.pResource = res;
+	to.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+	to.SubresourceIndex = 0;
+	from.pResource = staging;
+	from.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+	from.PlacedFootprint = fp;
+	D3D12_RESOURCE_BARRIER b = {};
+	b.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	b.Transition.pResource = res;
+	b.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	b.Transition.StateBefore = D3D12_RESOURCE_STATE_COMMON;
+	b.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
+	list->ResourceBarrier(1, &b);
+	list->CopyTextureRegion(&to, 0, 0, 0, &from, nullptr);
+	b.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+	b.Transition.StateAfter = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+	list->ResourceBarrier(1, &b);
+	list->Close();
+	ID3D12CommandList *lists[] = { list };
+	queue->ExecuteCommandLists(1, lists);
+	queue->Signal(fence, 1);
+	auto hevent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	fence->SetEventOnCompletion(1, hevent);
+	WaitForSingleObject(hevent, INFINITE);
+	CloseHandle(hevent);
+	fence->Release();
+	list->Release();
+	alloc->Release();
+	mem->release(staging);
+	return true;
+}
+
 int
 create_rtv(ID3D12Device *dev, ID3D12Resource *res,
 	D3D12_CPU_DESCRIPTOR_HANDLE hcpu_rtv)
@@ -287,7 +601,7 @@ create_rtv(ID3D12Device *dev, ID3D12Resource *res,
 
 int
 create_srv(ID3D12Device *dev, ID3D12Resource *res,
-	D3D12_CPU_DESCRIPTOR_HANDLE hcpu_srv)
+	D3D12_CPU_DESCRIPTOR_HANDLE hcpu_srv, UINT most_detailed = 0, UINT mips = 1)
 {
 	D3D12_SHADER_RESOURCE_VIEW_DESC desc_srv = {};
 	D3D12_RESOURCE_DESC desc_res = res->GetDesc();
@@ -296,7 +610,8 @@ create_srv(ID3D12Device *dev, ID3D12Resource *res,
 	desc_srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
 	desc_srv.Shader4ComponentMapping =
 		D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	desc_srv.Texture2D.MipLevels = 1;
+	desc_srv.Texture2D.MostDetailedMip = most_detailed;
+	desc_srv.Texture2D.MipLevels = mips;
 	dev->CreateShaderResourceView(res, &desc_srv, hcpu_srv);
 	return (0);
 }
@@ -391,6 +706,44 @@ create_root_param(D3D12_DESCRIPTOR_RANGE *ranges, UINT num)
 	return (ret);
 }
 
+D3D12_ROOT_PARAMETER
+create_root_param_constants(UINT reg, UINT num)
+{
+	D3D12_ROOT_PARAMETER ret = {};
+
+	ret.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+	ret.Constants.ShaderRegister = reg;
+	ret.Constants.RegisterSpace = 0;
+	ret.Constants.Num32BitValues = num;
+	ret.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	return (ret);
+}
+
+D3D12_ROOT_PARAMETER
+create_root_param_srv(UINT reg, UINT space,
+	D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_VERTEX)
+{
+	D3D12_ROOT_PARAMETER ret = {};
+
+	ret.ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+	ret.Descriptor.ShaderRegister = reg;
+	ret.Descriptor.RegisterSpace = space;
+	ret.ShaderVisibility = visibility;
+	return (ret);
+}
+
+D3D12_ROOT_PARAMETER
+create_root_param_uav(UINT reg, UINT space)
+{
+	D3D12_ROOT_PARAMETER ret = {};
+
+	ret.ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV;
+	ret.Descriptor.ShaderRegister = reg;
+	ret.Descriptor.RegisterSpace = space;
+	ret.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	return (ret);
+}
+
 ID3D12RootSignature *
 create_root_gsig(ID3D12Device *dev, const UINT num = 256)
 {
@@ -413,6 +766,15 @@ create_root_gsig(ID3D12Device *dev, const UINT num = 256)
 	for (int i = 0 ; i < dranges.size(); i++)
 		rparams.push_back(create_root_param(&dranges[i], 1));
 
+	//object buffer for vertex pulling, t0 space1
+	rparams.push_back(create_root_param_srv(0, 1));
+
+	//layer mask per output tile of the present pass, t1 space1
+	rparams.push_back(create_root_param_srv(1, 1, D3D12_SHADER_VISIBILITY_PIXEL));
+
+	//kept objects of a layer for draw_sprites, t2 space1
+	rparams.push_back(create_root_param_srv(2, 1));
+
 	desc.pParameters = rparams.data();
 	desc.NumParameters = rparams.size();
 	desc.Flags =
@@ -459,6 +821,16 @@ create_root_csig(ID3D12Device *dev, const UINT num = 256)
 	for (int i = 0 ; i < dranges.size(); i++)
 		rparams.push_back(create_root_param(&dranges[i], 1));
 
+	//object range to update, b0
+	rparams.push_back(create_root_param_constants(0, 2));
+
+	//kept objects (update) or objects (cull), t0 space1
+	rparams.push_back(create_root_param_srv(0, 1, D3D12_SHADER_VISIBILITY_ALL));
+
+	//kept objects and draw arguments written by cull, u0 and u1 space1
+	rparams.push_back(create_root_param_uav(0, 1));
+	rparams.push_back(create_root_param_uav(1, 1));
+
 	desc.pParameters = rparams.data();
 	desc.NumParameters = rparams.size();
 
@@ -485,47 +857,107 @@ create_root_csig(ID3D12Device *dev, const UINT num = 256)
 	return (ret);
 }
 
-static D3D12_SHADER_BYTECODE
-gen_shader_from_file(std::string fstr, std::string entry,
-	std::string profile, std::vector<uint8_t> &shader_code)
+//the compiler of shader_cache_t (cache.h).
+static bool
+d3d_compile(const shader_desc_t &d, std::vector<uint8_t> &code, std::string &error)
 {
 	ID3DBlob *blob = nullptr;
 	ID3DBlob *blob_err = nullptr;
-	ID3DBlob *blob_sig = nullptr;
-
+	std::vector<D3D_SHADER_MACRO> defines;
 	std::vector<WCHAR> wfname;
-	UINT flags = D3DCOMPILE_ENABLE_UNBOUNDED_DESCRIPTOR_TABLES;
-	for (int i = 0; i < fstr.length(); i++)
-		wfname.push_back(fstr[i]);
+
+	for (auto & m : d.defines)
+		defines.push_back({ m.first.c_str(), m.second.c_str() });
+	defines.push_back({ nullptr, nullptr });
+	for (size_t i = 0; i < d.path.length(); i++)
+		wfname.push_back(d.path[i]);
 	wfname.push_back(0);
 
-	D3DCompileFromFile(&wfname[0], NULL, D3D_COMPILE_STANDARD_FILE_INCLUDE,
-		entry.c_str(), profile.c_str(), flags, 0, &blob, &blob_err);
+	D3DCompileFromFile(&wfname[0], defines.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE,
+		d.entry.c_str(), d.profile.c_str(), d.flags, 0, &blob, &blob_err);
 	if (blob_err) {
-		err("%s\n", (char *)blob_err->GetBufferPointer());
+		error = (char *)blob_err->GetBufferPointer();
 		blob_err->Release();
 	}
 	if (!blob && !blob_err)
-		err("File Not found : %s\n", fstr.c_str());
+		error = "File Not found : " + d.path;
 	if (!blob)
+		return false;
+	code.resize(blob->GetBufferSize());
+	memcpy(code.data(), blob->GetBufferPointer(), blob->GetBufferSize());
+	blob->Release();
+	return true;
+}
+
+static D3D12_SHADER_BYTECODE
+gen_shader_from_file(shader_cache_t *cache, std::string fstr, std::string entry,
+	std::string profile, cache_blob_t &shader_code, uint64_t *key,
+	const D3D_SHADER_MACRO *defines = nullptr)
+{
+	shader_desc_t desc;
+
+	desc.path = fstr;
+	desc.entry = entry;
+	desc.profile = profile;
+	desc.flags = D3DCOMPILE_ENABLE_UNBOUNDED_DESCRIPTOR_TABLES;
+	for (auto m = defines; m && m->Name; m++)
+		desc.defines.push_back({ m->Name, m->Definition ? m->Definition : "" });
+	std::string error;
+	if (!cache->shader(desc, shader_code, key, &error)) {
+		err("%s\n", error.c_str());
 		return {nullptr, 0};
-	shader_code.resize(blob->GetBufferSize());
-	memcpy(shader_code.data(),
-		blob->GetBufferPointer(),
-		blob->GetBufferSize());
-	if (blob)
-		blob->Release();
+	}
 	return { shader_code.data(), shader_code.size() };
 }
 
+//
+// Pipeline from desc with the cached blob of key. A blob of another driver
+// or adapter is refused by create, then the pipeline is built from scratch
+// and its new blob replaces the entry.
+//
+template <typename D, typename F>
+ID3D12PipelineState *
+create_pstate_cached(shader_cache_t *cache, uint64_t key, D &desc, F create)
+{
+	ID3D12PipelineState *pstate = nullptr;
+	cache_blob_t blob;
+
+	if (cache->load(key, CachePipeline, blob)) {
+		desc.CachedPSO = { blob.data(), blob.size() };
+		create(&desc, &pstate);
+		if (pstate) {
+			cache->hits++;
+			return (pstate);
+		}
+		cache->rejected++;
+	}
+	cache->misses++;
+	desc.CachedPSO = {};
+	create(&desc, &pstate);
+	ID3DBlob *cached = nullptr;
+	if (pstate && SUCCEEDED(pstate->GetCachedBlob(&cached))) {
+		cache->store(key, CachePipeline, cached->GetBufferPointer(), cached->GetBufferSize());
+		cached->Release();
+	}
+	return (pstate);
+}
+
+enum {
+	InputLayoutNone,
+	InputLayoutVertex,
+	InputLayoutPackedVertex,
+};
+
 ID3D12PipelineState *
-create_gpstate_from_file(ID3D12Device *dev, ID3D12RootSignature *root_sig,
-	DXGI_FORMAT fmt_color, DXGI_FORMAT fmt_depth, std::string filename)
+create_gpstate_from_file(ID3D12Device *dev, shader_cache_t *cache, ID3D12RootSignature *root_sig,
+	DXGI_FORMAT fmt_color, DXGI_FORMAT fmt_depth, std::string filename,
+	int input_layout = InputLayoutVertex,
+	const D3D_SHADER_MACRO *defines = nullptr)
 {
 	ID3D12PipelineState *pstate = nullptr;
-	std::vector<uint8_t> vs;
-	std::vector<uint8_t> gs;
-	std::vector<uint8_t> ps;
+	cache_blob_t vs;
+	cache_blob_t ps;
+	uint64_t keys[2] = {};
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC desc = {};
 	D3D12_INPUT_ELEMENT_DESC layout[] = {
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
@@ -533,9 +965,20 @@ create_gpstate_from_file(ID3D12Device *dev, ID3D12RootSignature *root_sig,
 		{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 		{ "MATID", 0, DXGI_FORMAT_R32G32B32A32_UINT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 	};
+	D3D12_INPUT_ELEMENT_DESC layout_packed[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "MATID", 0, DXGI_FORMAT_R16G16_UINT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 
-	desc.InputLayout.pInputElementDescs = layout;
-	desc.InputLayout.NumElements = _countof(layout);
+	if (input_layout == InputLayoutVertex) {
+		desc.InputLayout.pInputElementDescs = layout;
+		desc.InputLayout.NumElements = _countof(layout);
+	} else if (input_layout == InputLayoutPackedVertex) {
+		desc.InputLayout.pInputElementDescs = layout_packed;
+		desc.InputLayout.NumElements = _countof(layout_packed);
+	}
 	desc.DepthStencilState.DepthEnable = FALSE;
 	desc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS;
 	desc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
@@ -558,8 +1001,8 @@ create_gpstate_from_file(ID3D12Device *dev, ID3D12RootSignature *root_sig,
 
 	desc.pRootSignature = root_sig;
 	desc.NumRenderTargets = _countof(rtref);
-	desc.VS = gen_shader_from_file(fname, "VSMain", "vs_5_1", vs);
-	desc.PS = gen_shader_from_file(fname, "PSMain", "ps_5_1", ps);
+	desc.VS = gen_shader_from_file(cache, fname, "VSMain", "vs_5_1", vs, &keys[0], defines);
+	desc.PS = gen_shader_from_file(cache, fname, "PSMain", "ps_5_1", ps, &keys[1], defines);
 	desc.SampleDesc.Count = 1;
 	desc.SampleMask = UINT_MAX;
 	desc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
@@ -573,12 +1016,17 @@ create_gpstate_from_file(ID3D12Device *dev, ID3D12RootSignature *root_sig,
 	desc.DSVFormat = fmt_depth;
 
 	if (!vs.empty() && !ps.empty()) {
-		auto status = dev->CreateGraphicsPipelineState(
-			&desc, IID_PPV_ARGS(&pstate));
+		HRESULT status = S_OK;
+		uint32_t state[3] = { uint32_t(fmt_color), uint32_t(fmt_depth), uint32_t(input_layout) };
+		uint64_t key = shader_cache_t::pipeline_key(keys, 2, state, sizeof(state));
+		pstate = create_pstate_cached(cache, key, desc,
+			[&](D3D12_GRAPHICS_PIPELINE_STATE_DESC *d, ID3D12PipelineState **p) {
+				status = dev->CreateGraphicsPipelineState(d, IID_PPV_ARGS(p));
+			});
+		//runs on a pipeline_builder_t thread : the failed build is reported, not fatal.
 		if (!pstate) {
-			printf("CreateGraphicsPipelineState:%s:0x%08X\n",
+			err("CreateGraphicsPipelineState:%s:0x%08X\n",
 				filename.c_str(), status);
-			exit(1);
 			return nullptr;
 		}
 	}
@@ -588,28 +1036,52 @@ create_gpstate_from_file(ID3D12Device *dev, ID3D12RootSignature *root_sig,
 
 ID3D12PipelineState *
 create_cpstate_from_file(
-	ID3D12Device *dev, ID3D12RootSignature *root_sig, std::string filename)
+	ID3D12Device *dev, shader_cache_t *cache, ID3D12RootSignature *root_sig, std::string filename,
+	const D3D_SHADER_MACRO *defines = nullptr)
 {
 	ID3D12PipelineState *pstate = nullptr;
 	D3D12_COMPUTE_PIPELINE_STATE_DESC desc = {};
-	std::vector<uint8_t> cs;
+	cache_blob_t cs;
+	uint64_t key = 0;
+	HRESULT status = S_OK;
 	auto fname = filename + ".hlsl";
 
 	desc.pRootSignature = root_sig;
-	desc.CS = gen_shader_from_file(fname, "CSMain", "cs_5_1", cs);
+	desc.CS = gen_shader_from_file(cache, fname, "CSMain", "cs_5_1", cs, &key, defines);
 	if (cs.empty())
 		return nullptr;
 
-	auto status = dev->CreateComputePipelineState(
-		&desc, IID_PPV_ARGS(&pstate));
+	pstate = create_pstate_cached(cache, shader_cache_t::pipeline_key(&key, 1, "cs", 2), desc,
+		[&](D3D12_COMPUTE_PIPELINE_STATE_DESC *d, ID3D12PipelineState **p) {
+			status = dev->CreateComputePipelineState(d, IID_PPV_ARGS(p));
+		});
 	if (!pstate) {
-		printf("CreateComputePipelineState:%s:0x%08X\n",
+		err("CreateComputePipelineState:%s:0x%08X\n",
 			filename.c_str(), status);
 		return nullptr;
 	}
 	return (pstate);
 }
 
+ID3D12CommandSignature *
+create_cmd_sig_draw(ID3D12Device *dev)
+{
+	ID3D12CommandSignature *ret = nullptr;
+	D3D12_INDIRECT_ARGUMENT_DESC arg = {};
+	D3D12_COMMAND_SIGNATURE_DESC desc = {};
+
+	arg.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW;
+	desc.ByteStride = sizeof(D3D12_DRAW_ARGUMENTS);
+	desc.NumArgumentDescs = 1;
+	desc.pArgumentDescs = &arg;
+	auto hr = dev->CreateCommandSignature(&desc, nullptr, IID_PPV_ARGS(&ret));
+	if (hr) {
+		err("Failed hr=%08X\n", hr);
+		return nullptr;
+	}
+	return (ret);
+}
+
 D3D12_RESOURCE_BARRIER
 get_barrier(ID3D12Resource *res, D3D12_RESOURCE_STATES before,
 	D3D12_RESOURCE_STATES after)
@@ -625,324 +1097,5615 @@ get_barrier(ID3D12Resource *res, D3D12_RESOURCE_STATES before,
 	return ret;
 }
 
-struct VertexFormat {
-	float pos[4];
-	float uv[4];
-	float color[4];
-	uint32_t matid;
-	uint32_t reserved[3];
-};
-
-struct ObjectFormat {
-	float pos[4];
-	float scale[4];
-	float rotate[4];
-	float color[4];
-	float uvinfo[4];
-	uint32_t metadata[4];
-};
-
-struct Handles {
-	D3D12_CPU_DESCRIPTOR_HANDLE cpu;
-	D3D12_GPU_DESCRIPTOR_HANDLE gpu;
-};
-
 struct frame_info_t {
 	ID3D12CommandAllocator *cmd_alloc = nullptr;
 	ID3D12GraphicsCommandList *cmd_list = nullptr;
-	ID3D12Fence *fence = nullptr;
-	std::vector<Handles> vhandles_rtv;
-	std::vector<Handles> vhandles_srv;
+	desc_range_t rtv;  //the layers, then the back buffer
+	desc_range_t srv;  //the layer images
 
 	ID3D12Resource *image = nullptr;
 	ID3D12Resource *res_vertex_buffer_rect = nullptr;
+	ID3D12Resource *res_draw_args = nullptr;
+	D3D12_DRAW_ARGUMENTS *draw_args = nullptr;
+	ID3D12Resource *res_tile_mask = nullptr;
+	uint32_t *tile_mask = nullptr;
 
 	struct layer_t {
-		std::vector<Handles> vhandles_uav;
-		std::vector<Handles> vhandles_cbv;
+		desc_range_t uav;  //object update, expanded vertices
 		ID3D12Resource *image = nullptr;
-		ID3D12Resource *res_object_data = nullptr;
 		ID3D12Resource *res_object_vertex = nullptr;
 
 		ID3D12Resource *res_object_update_buffer_uav = nullptr;
-		ID3D12Resource *res_object_buffer = nullptr;
-		ObjectFormat *object_buffer = nullptr;
+		ID3D12Resource *res_visible = nullptr;
+		ID3D12Resource *res_cull_args = nullptr;
+		uint32_t *visible = nullptr;
+		uint32_t visible_count = 0;
+		upload_alloc_t upload;  //dirty ranges of this frame in ring_upload
+		dirty_tracker_t dirty;
+		std::vector<dirty_range_t> ranges;
+		uint32_t capacity = 0;
+		bool clear = false;
+		bool idle = false;
 	};
 	std::vector<layer_t> layers;
 
-	uint64_t fence_value = 0;
 	void init(ID3D12Device *dev, IDXGISwapChain3 *swapchain, int index)
 	{
 		swapchain->GetBuffer(index, IID_PPV_ARGS(&image));
-		dev->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
 		dev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&cmd_alloc));
 		dev->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, cmd_alloc, nullptr, IID_PPV_ARGS(&cmd_list));
 		dbg("cmd_alloc=%p\n", cmd_alloc);
 		dbg("cmd_list=%p\n", cmd_list);
-		dbg("fence=%p\n", fence);
 		dbg("image=%p\n", image);
 	}
 };
 
-Handles get_descriptor_handles(ID3D12Device *device,
-	ID3D12DescriptorHeap *heap, UINT index)
-{
-	Handles ret = {};
-	auto desc = heap->GetDesc();
-	auto size = device->GetDescriptorHandleIncrementSize(desc.Type);
-	ret.cpu = heap->GetCPUDescriptorHandleForHeapStart();
-	ret.gpu = heap->GetGPUDescriptorHandleForHeapStart();
-	ret.cpu.ptr += size * index;
-	ret.gpu.ptr += size * index;
-	return ret;
-}
+//
+// gpu_timeline_t of a D3D12 queue : one fence and one event for all frames,
+// wait_present() waits on the frame latency object of the swap chain.
+//
+struct d3d_timeline_t : gpu_timeline_t {
+	ID3D12CommandQueue *queue = nullptr;
+	ID3D12Fence *fence = nullptr;
+	HANDLE hevent = nullptr;
+	HANDLE hlatency = nullptr;
+	uint64_t last = 0;
 
-int main()
-{
+	void init(ID3D12Device *dev, ID3D12CommandQueue *q, IDXGISwapChain3 *swapchain, int latency)
+	{
+		queue = q;
+		dev->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
+		hevent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		swapchain->SetMaximumFrameLatency(latency);
+		hlatency = swapchain->GetFrameLatencyWaitableObject();
+		dbg("fence=%p\n", fence);
+		dbg("hlatency=%p\n", hlatency);
+	}
 
-	enum {
-		ScreenWidth = 1024,
-		ScreenHeight = 1024,
-		Width = 512,
-		Height = 512,
+	void term()
+	{
+		if (hlatency)
+			CloseHandle(hlatency);
+		if (hevent)
+			CloseHandle(hevent);
+		if (fence)
+			fence->Release();
+		hlatency = hevent = nullptr;
+		fence = nullptr;
+	}
 
-		FrameCount = 2,
-		LayerMax = 8,
-		ObjectMax = 4096,
-		MaxDescNum = 32,
-		MaxDescSrvNum = 256,
-		MaxDescSampler = 32,
-		ComputeUpdateGroupSize = 256,
-	};
+	uint64_t signal() override
+	{
+		queue->Signal(fence, ++last);
+		return last;
+	}
 
-	auto hwnd = win_create("test", ScreenWidth, ScreenHeight);
-	auto dev = create_device();
+	uint64_t completed() override
+	{
+		return fence->GetCompletedValue();
+	}
 
-	auto queue = create_queue(dev);
-	auto swapchain = create_swap_chain(queue, hwnd, ScreenWidth, ScreenHeight, FrameCount);
-	auto root_gsig = create_root_gsig(dev);
-	auto root_csig = create_root_csig(dev);
-	auto heap_rtv = create_heap(dev, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, D3D12_DESCRIPTOR_HEAP_FLAG_NONE, 256);
-	auto heap_dsv = create_heap(dev, D3D12_DESCRIPTOR_HEAP_TYPE_DSV, D3D12_DESCRIPTOR_HEAP_FLAG_NONE, 256);
-	auto heap_srv = create_heap(dev, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE, 256);
-	auto heap_sampler = create_heap(dev, D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER, D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE, 256);
-
-	UINT index_heap_rtv = 0;
-	UINT index_heap_dsv = 0;
-	UINT index_heap_srv = 0;
-	UINT index_heap_cbv = 0;
-	UINT index_heap_sampler = 0;
-	auto pstate_update = create_cpstate_from_file(dev, root_csig, "update");
-	auto pstate_clear = create_gpstate_from_file(dev, root_gsig, DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R32_FLOAT, "clear");
-	auto pstate_draw_rects = create_gpstate_from_file(dev, root_gsig, DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R32_FLOAT, "draw_rects");
-	auto pstate_present = create_gpstate_from_file(dev, root_gsig, DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R32_FLOAT, "present");
+	void wait(uint64_t value) override
+	{
+		if (fence->GetCompletedValue() >= value)
+			return;
+		fence->SetEventOnCompletion(value, hevent);
+		WaitForSingleObject(hevent, INFINITE);
+	}
 
-	VertexFormat vertex_rect[6] = {
-		{ {-1, -1, 0, 1}, {0, 0} },
-		{ {-1,  1, 0, 1}, {0, 1} },
-		{ { 1, -1, 0, 1}, {1, 0} },
+	void wait_present() override
+	{
+		if (hlatency)
+			WaitForSingleObjectEx(hlatency, 1000, TRUE);
+	}
+};
 
-		{ { 1,  1, 0, 1}, {1, 1} },
-		{ {-1,  1, 0, 1}, {0, 1} },
-		{ { 1, -1, 0, 1}, {1, 0} },
-	};
-	float clear_color[LayerMax][4] = {
-		{1, 0, 0, 1},
-		{0, 0, 1, 1},
-		{0, 1, 1, 1},
-		{1, 0, 1, 1},
-		{1, 1, 0, 1},
-		{0, 1, 1, 1},
-		{0, 0, 1, 1},
-		{1, 0, 0, 1},
+static D3D12_RESOURCE_STATES
+d3d_state(uint32_t state)
+{
+	static const D3D12_RESOURCE_STATES states[CmdStateMax] = {
+		D3D12_RESOURCE_STATE_COMMON,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+		D3D12_RESOURCE_STATE_RENDER_TARGET,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER,
+		D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT,
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		D3D12_RESOURCE_STATE_COPY_SOURCE,
 	};
-	frame_info_t framedata[FrameCount];
-
-	std::vector<Handles> vhandles_sampler;
-	auto hsampler_point = get_descriptor_handles(dev, heap_sampler, index_heap_sampler++);
-	auto hsampler_linear = get_descriptor_handles(dev, heap_sampler, index_heap_sampler++);
-	vhandles_sampler.push_back(hsampler_point);
-	vhandles_sampler.push_back(hsampler_linear);
-	create_sampler(dev, D3D12_FILTER_MIN_MAG_MIP_POINT, hsampler_point.cpu);
-	create_sampler(dev, D3D12_FILTER_MIN_MAG_MIP_LINEAR, hsampler_linear.cpu);
+	return states[state];
+}
 
-	for (int i = 0 ; i < FrameCount; i++) {
-		auto & ref = framedata[i];
-		ref.init(dev, swapchain, i);
-		ref.res_vertex_buffer_rect = create_res_buffer(dev, sizeof(vertex_rect));
-		upload_data(ref.res_vertex_buffer_rect, vertex_rect, sizeof(vertex_rect));
+//
+// Translate an IR list (cmd.h) into a D3D12 command list. Table ids hold
+// ID3D12 pointers, GPU descriptor addresses for tables and CPU descriptor
+// addresses for render targets. The list comes resolved by the state
+// tracker (state.h), its consecutive barriers go out as one batch.
+//
+void
+d3d_translate(ID3D12GraphicsCommandList *cmd_list, const cmd_list_t &cl,
+	const cmd_table_t &table, ID3D12CommandSignature *cmd_sig_draw)
+{
+	std::vector<D3D12_RESOURCE_BARRIER> barriers;
+	auto flush_barriers = [&]() {
+		if (!barriers.empty())
+			cmd_list->ResourceBarrier(barriers.size(), barriers.data());
+		barriers.clear();
+	};
+	auto res = [&table](uint32_t id) { return table.get<ID3D12Resource *>(id); };
 
-		auto desc_backbuffer = ref.image->GetDesc();
-		auto object_buffer_size = sizeof(ObjectFormat) * ObjectMax;
-		auto object_buffer_vertex_size = object_buffer_size * 6;
-		object_buffer_size = (object_buffer_size + 255) & ~255;
-		object_buffer_vertex_size = (object_buffer_vertex_size + 255) & ~255;
-		for (int i = 0 ; i < LayerMax; i++) {
-			frame_info_t::layer_t layer;
-			auto hrtv = get_descriptor_handles(dev, heap_rtv, index_heap_rtv++);
-			auto hsrv = get_descriptor_handles(dev, heap_srv, index_heap_srv++);
-			ref.vhandles_rtv.push_back(hrtv);
-			ref.vhandles_srv.push_back(hsrv);
-			layer.image = create_res_render_target(dev, Width, Height, desc_backbuffer.Format);
-			create_rtv(dev, layer.image, hrtv.cpu);
-			create_srv(dev, layer.image, hsrv.cpu);
-			ref.layers.push_back(layer);
+	cmd_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	for (auto & c : cl.cmds) {
+		if (c.type != CmdBarrier)
+			flush_barriers();
+		bool compute = c.bind == CmdBindCompute;
+		switch (c.type) {
+		case CmdCopy:
+			cmd_list->CopyBufferRegion(res(c.id[0]), c.arg.u[0], res(c.id[1]), c.arg.u[1], c.arg.u[2]);
+			break;
+		case CmdCopyTexture: {
+			D3D12_TEXTURE_COPY_LOCATION dst = {};
+			D3D12_TEXTURE_COPY_LOCATION src = {};
+			dst.pResource = res(c.id[0]);
+			dst.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+			dst.PlacedFootprint.Footprint.Format = res(c.id[1])->GetDesc().Format;
+			dst.PlacedFootprint.Footprint.Width = c.arg.u[0];
+			dst.PlacedFootprint.Footprint.Height = c.arg.u[1];
+			dst.PlacedFootprint.Footprint.Depth = 1;
+			dst.PlacedFootprint.Footprint.RowPitch = c.arg.u[2];
+			src.pResource = res(c.id[1]);
+			src.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			src.SubresourceIndex = 0;
+			cmd_list->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+			break;
 		}
-
-		for (int i = 0 ; i < LayerMax; i++) {
-			auto & layer = ref.layers[i];
-			auto huav_src = get_descriptor_handles(dev, heap_srv, index_heap_srv++);
-			auto huav_dst = get_descriptor_handles(dev, heap_srv, index_heap_srv++);
-			layer.vhandles_uav.push_back(huav_src);
-			layer.vhandles_uav.push_back(huav_dst);
-			layer.res_object_update_buffer_uav = create_res_uav_buffer(dev, object_buffer_size);
-			layer.res_object_buffer = create_res_buffer(dev, object_buffer_size);
-			layer.res_object_vertex = create_res_uav_buffer(dev, object_buffer_vertex_size);
-			layer.object_buffer = (ObjectFormat *)get_data_address(layer.res_object_buffer);
-
-			create_uav(dev, layer.res_object_update_buffer_uav, ObjectMax, sizeof(ObjectFormat), huav_src.cpu);
-			create_uav(dev, layer.res_object_vertex, ObjectMax, sizeof(VertexFormat) * 6, huav_dst.cpu);
-
-			printf("res_object_buffer=%p, object_buffer=%p\n", layer.res_object_buffer, layer.object_buffer);
+		case CmdUploadTexture: {
+			//the rows of the mip in the placed footprint tex.h stores.
+			auto tex = res(c.id[0]);
+			auto desc = tex->GetDesc();
+			UINT dim = desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM ? 1 : 4;
+			D3D12_TEXTURE_COPY_LOCATION dst = {};
+			D3D12_TEXTURE_COPY_LOCATION src = {};
+			dst.pResource = tex;
+			dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			dst.SubresourceIndex = c.slot;
+			src.pResource = res(c.id[1]);
+			src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+			src.PlacedFootprint.Offset = c.arg.u[0];
+			src.PlacedFootprint.Footprint.Format = desc.Format;
+			src.PlacedFootprint.Footprint.Width = (std::max(UINT(desc.Width >> c.slot), 1u) + dim - 1) / dim * dim;
+			src.PlacedFootprint.Footprint.Height = c.arg.u[2] * dim;
+			src.PlacedFootprint.Footprint.Depth = 1;
+			src.PlacedFootprint.Footprint.RowPitch = c.arg.u[3];
+			cmd_list->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+			break;
 		}
-
-		auto hbackbuffer = get_descriptor_handles(dev, heap_rtv, index_heap_rtv++);
-		create_rtv(dev, ref.image, hbackbuffer.cpu);
-		ref.vhandles_rtv.push_back(hbackbuffer);
-
-		auto cmd_list = ref.cmd_list;
-		auto hsrv = ref.vhandles_srv.data();
-		auto hsampler = vhandles_sampler.data();
-
-		std::vector<ID3D12DescriptorHeap *> heaplists = {
-			heap_srv,
-			heap_sampler,
-		};
-		D3D12_VERTEX_BUFFER_VIEW view = {
-			ref.res_vertex_buffer_rect->GetGPUVirtualAddress(), sizeof(vertex_rect), sizeof(VertexFormat)
-		};
-		std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> rtv_backbuffer_handles = { hbackbuffer.cpu };
-
-		printf("Create Command\n");
-		cmd_list->Close();
-		ref.cmd_alloc->Reset();
-		cmd_list->Reset(ref.cmd_alloc, 0);
-		cmd_list->SetDescriptorHeaps(heaplists.size(), heaplists.data());
-
-		printf("Begin Layer Command\n");
-		for (int i = 0 ; i < LayerMax; i++) {
-			auto & layer = ref.layers[i];
-			auto & h = ref.vhandles_rtv[i];
-			auto huav_src = layer.vhandles_uav.data();
-			auto huav_dst = huav_src + 1;
-			std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> rtv_handles = { h.cpu };
-			cmd_list->SetComputeRootSignature(root_csig);
-			cmd_list->SetComputeRootDescriptorTable(0, huav_src->gpu);
-			cmd_list->SetComputeRootDescriptorTable(1, huav_dst->gpu);
-			{
-				auto desc = layer.res_object_buffer->GetDesc();
-				cmd_list->CopyBufferRegion(
-					layer.res_object_update_buffer_uav, 0,
-					layer.res_object_buffer, 0,
-					desc.Width);
-			}
-			cmd_list->SetPipelineState(pstate_update);
-			cmd_list->Dispatch(ObjectMax / ComputeUpdateGroupSize, 1, 1);
-
-			auto barrier = get_barrier(layer.image, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_RENDER_TARGET);
-			cmd_list->ResourceBarrier(1, &barrier);
-			D3D12_VERTEX_BUFFER_VIEW view_sprite = {
-				layer.res_object_vertex->GetGPUVirtualAddress(), sizeof(VertexFormat) * ObjectMax * 6, sizeof(VertexFormat)
+		case CmdBarrier: {
+			D3D12_RESOURCE_BARRIER b = {};
+			if (c.slot & CmdBarrierUav) {
+				b.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+				b.UAV.pResource = res(c.id[0]);
+			} else {
+				b = get_barrier(res(c.id[0]), d3d_state(c.arg.u[0]), d3d_state(c.arg.u[1]));
+				b.Transition.Subresource = c.id[1];
+				if (c.slot & CmdBarrierBegin)
+					b.Flags = D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY;
+				if (c.slot & CmdBarrierEnd)
+					b.Flags = D3D12_RESOURCE_BARRIER_FLAG_END_ONLY;
+			}
+			barriers.push_back(b);
+			break;
+		}
+		case CmdSetRootSig:
+			if (compute)
+				cmd_list->SetComputeRootSignature(table.get<ID3D12RootSignature *>(c.id[0]));
+			else
+				cmd_list->SetGraphicsRootSignature(table.get<ID3D12RootSignature *>(c.id[0]));
+			break;
+		case CmdSetPipeline:
+			cmd_list->SetPipelineState(table.get<ID3D12PipelineState *>(c.id[0]));
+			break;
+		case CmdSetTable: {
+			D3D12_GPU_DESCRIPTOR_HANDLE h = { table.get<UINT64>(c.id[0]) };
+			if (compute)
+				cmd_list->SetComputeRootDescriptorTable(c.slot, h);
+			else
+				cmd_list->SetGraphicsRootDescriptorTable(c.slot, h);
+			break;
+		}
+		case CmdSetConstants:
+			if (compute)
+				cmd_list->SetComputeRoot32BitConstants(c.slot, c.num, c.arg.u, 0);
+			else
+				cmd_list->SetGraphicsRoot32BitConstants(c.slot, c.num, c.arg.u, 0);
+			break;
+		case CmdSetSrv:
+			if (compute)
+				cmd_list->SetComputeRootShaderResourceView(c.slot, res(c.id[0])->GetGPUVirtualAddress());
+			else
+				cmd_list->SetGraphicsRootShaderResourceView(c.slot, res(c.id[0])->GetGPUVirtualAddress());
+			break;
+		case CmdSetUav:
+			if (compute)
+				cmd_list->SetComputeRootUnorderedAccessView(c.slot, res(c.id[0])->GetGPUVirtualAddress());
+			else
+				cmd_list->SetGraphicsRootUnorderedAccessView(c.slot, res(c.id[0])->GetGPUVirtualAddress());
+			break;
+		case CmdSetVertex: {
+			D3D12_VERTEX_BUFFER_VIEW view = {
+				res(c.id[0])->GetGPUVirtualAddress(), c.arg.u[0], c.arg.u[1]
 			};
-			cmd_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-			cmd_list->OMSetRenderTargets(rtv_handles.size(), rtv_handles.data(), FALSE, nullptr);
-			D3D12_VIEWPORT viewport = {0, 0, Width, Height, 0.0f, 1.0f };
-			D3D12_RECT rect = { 0, 0, Width, Height };
-			cmd_list->RSSetViewports(1, &viewport);
-			cmd_list->RSSetScissorRects(1, &rect);
-			cmd_list->SetGraphicsRootSignature(root_gsig);
-			cmd_list->SetGraphicsRootDescriptorTable(0, hsrv->gpu);
-			cmd_list->SetGraphicsRootDescriptorTable(3, hsampler->gpu);
-			cmd_list->SetPipelineState(pstate_clear);
 			cmd_list->IASetVertexBuffers(0, 1, &view);
-			cmd_list->DrawInstanced(6, 1, 0, 0);
-
-			cmd_list->SetPipelineState(pstate_draw_rects);
-			cmd_list->IASetVertexBuffers(0, 1, &view_sprite);
-			cmd_list->DrawInstanced(ObjectMax * 6, 1, 0, 0);
+			break;
 		}
+		case CmdSetTarget: {
+			D3D12_CPU_DESCRIPTOR_HANDLE h = { table.get<SIZE_T>(c.id[0]) };
+			cmd_list->OMSetRenderTargets(1, &h, FALSE, nullptr);
+			break;
+		}
+		case CmdClear: {
+			D3D12_CPU_DESCRIPTOR_HANDLE h = { table.get<SIZE_T>(c.id[0]) };
+			cmd_list->ClearRenderTargetView(h, c.arg.f, 0, NULL);
+			break;
+		}
+		case CmdViewport: {
+			D3D12_VIEWPORT viewport = { 0, 0, float(c.arg.u[0]), float(c.arg.u[1]), 0.0f, 1.0f };
+			D3D12_RECT rect = { 0, 0, LONG(c.arg.u[0]), LONG(c.arg.u[1]) };
+			cmd_list->RSSetViewports(1, &viewport);
+			cmd_list->RSSetScissorRects(1, &rect);
+			break;
+		}
+		case CmdDispatch:
+			cmd_list->Dispatch(c.arg.u[0], c.arg.u[1], c.arg.u[2]);
+			break;
+		case CmdDraw:
+			cmd_list->DrawInstanced(c.arg.u[0], c.arg.u[1], 0, 0);
+			break;
+		case CmdDrawIndirect:
+			cmd_list->ExecuteIndirect(cmd_sig_draw, 1, res(c.id[0]), c.arg.u[0], nullptr, 0);
+			break;
+		case CmdTimestamp:
+			cmd_list->EndQuery(table.get<ID3D12QueryHeap *>(c.id[0]), D3D12_QUERY_TYPE_TIMESTAMP, c.arg.u[0]);
+			break;
+		case CmdResolveQueries:
+			cmd_list->ResolveQueryData(table.get<ID3D12QueryHeap *>(c.id[0]), D3D12_QUERY_TYPE_TIMESTAMP,
+				c.arg.u[0], c.arg.u[1], res(c.id[1]), c.arg.u[2]);
+			break;
+		}
+	}
+	flush_barriers();
+}
+
+//heaps of the desc.h allocators.
+desc_create_t
+d3d_desc_heaps(ID3D12Device *dev, D3D12_DESCRIPTOR_HEAP_TYPE type, bool visible)
+{
+	return [dev, type, visible](uint32_t num, desc_heap_t &h) {
+		auto heap = create_heap(dev, type,
+			visible ? D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE : D3D12_DESCRIPTOR_HEAP_FLAG_NONE, num);
+		if (!heap)
+			return false;
+		h.heap = heap;
+		h.cpu = heap->GetCPUDescriptorHandleForHeapStart().ptr;
+		h.gpu = visible ? heap->GetGPUDescriptorHandleForHeapStart().ptr : 0;
+		h.size = num;
+		dbg("descriptor heap=%p type=%d num=%u\n", heap, type, num);
+		return true;
+	};
+}
+
+void
+d3d_desc_release(desc_heap_t &h)
+{
+	((ID3D12DescriptorHeap *)h.heap)->Release();
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE
+cpu_handle(const desc_range_t &r, uint32_t i = 0)
+{
+	D3D12_CPU_DESCRIPTOR_HANDLE ret = { SIZE_T(r.cpu_at(i)) };
+	return (ret);
+}
+#endif //_WIN32
+
+//
+// Random fields of an object, Philox counter = (object, field / 4, layer, 0).
+//
+enum {
+	UpdateFieldPosX,
+	UpdateFieldPosY,
+	UpdateFieldScaleX,
+	UpdateFieldScaleY,
+	UpdateFieldRotate,
+	UpdateFieldColorR,
+	UpdateFieldColorG,
+	UpdateFieldColorB,
+	UpdateFieldColorA,
+	UpdateFieldMax,
+	UpdateFieldBlocks = (UpdateFieldMax + 3) / 4,
+};
+
+static const uint32_t update_seed[2] = { 0, 0 };
+
+//
+// Compute the animated fields of objects [begin, end) of a layer
+// and hand them to set(i, field values). world > 1 spreads the objects
+// over world x world screens that scroll under the view.
+//
+template <typename F>
+void
+update_fields(int begin, int end, int lidx, double a_time, F set, double world = 1.0)
+{
+	double view_x = (world - 1.0) * sin(a_time * 0.011);
+	double view_y = (world - 1.0) * sin(a_time * 0.007);
+	for (int base = begin; base < end; base += 8) {
+		uint32_t r[UpdateFieldBlocks][4][8];
+		for (int b = 0; b < UpdateFieldBlocks; b++)
+			rng_philox_x8(base, b, lidx, 0, update_seed, r[b]);
+		int n = std::min(8, end - base);
+		for (int j = 0; j < n; j++) {
+			int i = base + j;
+			auto frand = [&r, j](int field) {
+				return rng_snorm(r[field / 4][field % 4][j]);
+			};
+			float v[UpdateFieldMax];
+			v[UpdateFieldPosX] = cos(frand(UpdateFieldPosX) * (lidx + i + 1.0 + a_time * 0.03)) * world - view_x;
+			v[UpdateFieldPosY] = sin(frand(UpdateFieldPosY) * (lidx + i + 1.0 + a_time * 0.04)) * world - view_y;
+			v[UpdateFieldScaleX] = 0.01f  + frand(UpdateFieldScaleX) * 0.01;
+			v[UpdateFieldScaleY] = 0.01f  + frand(UpdateFieldScaleY) * 0.01;
+
+			v[UpdateFieldRotate] = frand(UpdateFieldRotate);
+
+			v[UpdateFieldColorR] = frand(UpdateFieldColorR) * 0.5 + 0.5;
+			v[UpdateFieldColorG] = frand(UpdateFieldColorG) * 0.5 + 0.5;
+			v[UpdateFieldColorB] = frand(UpdateFieldColorB) * 0.5 + 0.5;
+			v[UpdateFieldColorA] = frand(UpdateFieldColorA) * 0.5 + 0.5;
+			set(i, v);
+		}
+	}
+}
+
+//update obj[begin, end) of a layer. obj is the head of the layer.
+void
+update_objects(ObjectFormat *obj, int begin, int end, int lidx, double a_time)
+{
+	update_fields(begin, end, lidx, a_time, [obj](int i, const float *v) {
+		obj[i].pos[0] = v[UpdateFieldPosX];
+		obj[i].pos[1] = v[UpdateFieldPosY];
+		obj[i].scale[0] = v[UpdateFieldScaleX];
+		obj[i].scale[1] = v[UpdateFieldScaleY];
+
+		obj[i].rotate[0] = v[UpdateFieldRotate];
+
+		obj[i].color[0] = v[UpdateFieldColorR];
+		obj[i].color[1] = v[UpdateFieldColorG];
+		obj[i].color[2] = v[UpdateFieldColorB];
+		obj[i].color[3] = v[UpdateFieldColorA];
+
+		obj[i].uvinfo[0] = 0;
+		obj[i].uvinfo[1] = 0;
+		obj[i].uvinfo[2] = 1;
+		obj[i].uvinfo[3] = 1;
+
+		obj[i].metadata[0] = 1;
+		obj[i].metadata[1] = i;
+	});
+}
+
+void
+update_objects(ObjectFormat *obj, int count, int lidx, double a_time)
+{
+	update_objects(obj, 0, count, lidx, a_time);
+}
+
+//flags (alive or not) belong to the slot allocator and are not touched here.
+void
+update_store(object_store_t &store, int begin, int end, int lidx, double a_time, double world = 1.0)
+{
+	update_fields(begin, end, lidx, a_time, [&store](int i, const float *v) {
+		store.pos_x[i] = v[UpdateFieldPosX];
+		store.pos_y[i] = v[UpdateFieldPosY];
+		store.scale_x[i] = v[UpdateFieldScaleX];
+		store.scale_y[i] = v[UpdateFieldScaleY];
+		store.rotate[i] = v[UpdateFieldRotate];
+		store.color[0][i] = v[UpdateFieldColorR];
+		store.color[1][i] = v[UpdateFieldColorG];
+		store.color[2][i] = v[UpdateFieldColorB];
+		store.color[3][i] = v[UpdateFieldColorA];
+		store.uvinfo[0][i] = 0;
+		store.uvinfo[1][i] = 0;
+		store.uvinfo[2][i] = 1;
+		store.uvinfo[3][i] = 1;
+		store.matid[i] = i;
+	}, world);
+}
+
+//uvinfo of objects [begin, end) : slot i shows sprite i % count of atlas.
+void
+atlas_assign(object_store_t &store, int begin, int end, const atlas_t &atlas)
+{
+	uint32_t n = uint32_t(atlas.rects.size());
+	for (int i = begin; i < end; i++) {
+		float uv[4];
+		atlas.uvinfo(i % n, uv);
+		for (int k = 0; k < 4; k++)
+			store.uvinfo[k][i] = uv[k];
+	}
+}
+
+//
+// matid of objects [begin, end) : the user_tex[] slot they sample, 0 is the
+// atlas. Slot i samples texture i % count of -tex, or the atlas in turn
+// with them when there is one; the textures are sampled whole.
+//
+void
+tex_assign(object_store_t &store, int begin, int end, uint32_t count, bool atlas)
+{
+	for (int i = begin; i < end; i++) {
+		uint32_t slot = atlas ? i % (count + 1) : 1 + i % count;
+		store.matid[i] = slot;
+		if (slot == 0)
+			continue;
+		store.uvinfo[0][i] = 0.0f;
+		store.uvinfo[1][i] = 0.0f;
+		store.uvinfo[2][i] = 1.0f;
+		store.uvinfo[3][i] = 1.0f;
+	}
+}
+
+//
+// On-screen demand of the -tex textures from the live objects of a layer :
+// area (pixels) and largest side (pixels) per texture, objects off the
+// [-1, 1] screen count for nothing. Accumulates into area and size.
+//
+void
+tex_demand(const object_store_t &store, uint32_t end, uint32_t width, uint32_t height,
+	uint32_t count, float *area, float *size)
+{
+	for (uint32_t i = 0; i < end; i++) {
+		uint32_t t = store.matid[i] - 1;
+		float sx = fabsf(store.scale_x[i]), sy = fabsf(store.scale_y[i]);
+		if (!store.flags[i] || t >= count || fabsf(store.pos_x[i]) > 1.0f + sx || fabsf(store.pos_y[i]) > 1.0f + sy)
+			continue;
+		//scale is half the side, the screen is 2 wide.
+		float w = sx * width, h = sy * height;
+		area[t] += w * h;
+		size[t] = std::max(size[t], std::max(w, h));
+	}
+}
+
+//split ranges of every layer into jobs of at most chunk objects.
+struct layer_chunk_t {
+	int lidx;
+	uint32_t begin;
+	uint32_t end;
+	uint32_t at;  //begin in the ranges of the layer packed back to back
+};
+
+void
+split_layer_chunks(std::vector<layer_chunk_t> &chunks,
+	const std::vector<dirty_range_t> *ranges, int layer_max, uint32_t chunk)
+{
+	chunks.clear();
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		uint32_t at = 0;
+		for (auto & r : ranges[lidx])
+			for (uint32_t begin = r.begin; begin < r.end; begin += chunk) {
+				uint32_t end = std::min(begin + chunk, r.end);
+				chunks.push_back({ lidx, begin, end, at });
+				at += end - begin;
+			}
+	}
+}
+
+//
+// Animate objects [0, counts[lidx]) of every layer in the stores,
+// as layer x chunk jobs, and join.
+//
+void
+update_layers(job_system_t &jobs, object_store_t *stores, const uint32_t *counts,
+	int layer_max, int chunk, double a_time, double world = 1.0)
+{
+	PROF_SCOPE("update");
+	std::vector<std::vector<dirty_range_t>> ranges(layer_max);
+	std::vector<layer_chunk_t> chunks;
+	for (int lidx = 0; lidx < layer_max; lidx++)
+		if (counts[lidx])
+			ranges[lidx].push_back({ 0, counts[lidx] });
+	split_layer_chunks(chunks, ranges.data(), layer_max, chunk);
+	jobs.parallel_for(chunks.size(), 1, [&](int job_begin, int job_end) {
+		PROF_SCOPE("update job");
+		for (int j = job_begin; j < job_end; j++) {
+			auto & c = chunks[j];
+			update_store(stores[c.lidx], c.begin, c.end, c.lidx, a_time, world);
+		}
+	});
+}
+
+//
+// Flush the ranges of every layer's store to obj[lidx] and join.
+// packed != nullptr also packs each flushed chunk to packed[lidx].
+// compact : obj[lidx] and packed[lidx] hold the ranges back to back
+// (upload.h) instead of at their slots.
+//
+void
+flush_layers(job_system_t &jobs, const object_store_t *stores,
+	const std::vector<dirty_range_t> *ranges, ObjectFormat **obj,
+	PackedObjectFormat **packed, int layer_max, int chunk, bool compact = false)
+{
+	PROF_SCOPE("flush");
+	std::vector<layer_chunk_t> chunks;
+	split_layer_chunks(chunks, ranges, layer_max, chunk);
+	jobs.parallel_for(chunks.size(), 1, [&](int job_begin, int job_end) {
+		PROF_SCOPE("flush job");
+		for (int j = job_begin; j < job_end; j++) {
+			auto & c = chunks[j];
+			uint32_t at = compact ? c.at : c.begin;
+			stores[c.lidx].flush_to(obj[c.lidx] + at, c.begin, c.end);
+			if (packed)
+				sprite_pack_objects(obj[c.lidx] + at, packed[c.lidx] + at, c.end - c.begin);
+		}
+	});
+}
+
+//
+// Spawn and despawn objects of a layer : free `churn` random live objects,
+// then free or alloc until target objects are alive. Spawned objects are
+// animated once. Every touched slot is passed to mark(slot).
+//
+template <typename F>
+void
+churn_layer(slot_allocator_t &slots, std::vector<slot_handle_t> &handles,
+	object_store_t &store, int lidx, uint32_t frame, uint32_t churn,
+	uint32_t target, double a_time, F mark, double world = 1.0)
+{
+	static const uint32_t key[2] = { 0xc4c4, 0 };
+	uint32_t r[4][8];
+	uint32_t n = 0;
+	auto next = [&]() {
+		if (n % 32 == 0)
+			rng_philox_x8(n / 32, frame, lidx, 0, key, r);
+		uint32_t v = r[(n % 32) / 8][n % 8];
+		n++;
+		return v;
+	};
+	auto despawn = [&]() {
+		uint32_t k = next() % handles.size();
+		uint32_t slot = slots.free(handles[k]);
+		handles[k] = handles.back();
+		handles.pop_back();
+		store.flags[slot] = 0;
+		mark(slot);
+	};
+
+	for (uint32_t i = 0; i < churn && !handles.empty(); i++)
+		despawn();
+	while (handles.size() > target)
+		despawn();
+	while (handles.size() < target) {
+		slot_handle_t h;
+		uint32_t slot;
+		if (!slots.alloc(h, slot))
+			break;
+		handles.push_back(h);
+		store.flags[slot] = 1;
+		update_store(store, slot, slot + 1, lidx, a_time, world);
+		mark(slot);
+	}
+}
+
+//move the live objects of a layer down into the holes, returns the moves.
+template <typename F>
+size_t
+compact_layer(slot_allocator_t &slots, object_store_t &store, F mark)
+{
+	std::vector<slot_move_t> moves;
+	uint32_t old_end = slots.end();
+
+	slots.compact(moves);
+	for (auto & m : moves) {
+		store.copy(m.from, m.to);
+		mark(m.to);
+	}
+	store.set_flags(slots.end(), old_end, 0);
+	return moves.size();
+}
+
+enum {
+	LayerCapacityMin = 256,
+};
+
+//smallest LayerCapacityMin * 2^n that holds need objects.
+uint32_t
+fit_capacity(uint32_t need)
+{
+	uint32_t ret = LayerCapacityMin;
+	while (ret < need)
+		ret *= 2;
+	return ret;
+}
+
+//
+// Grow the layer geometrically when need objects do not fit. Shrink it when
+// a quarter of the capacity would do, or when half would do and memory is
+// short (pressure). Shrinking compacts first. Returns true on a new capacity.
+//
+template <typename F>
+bool
+fit_layer_capacity(slot_allocator_t &slots, object_store_t &store, uint32_t need,
+	bool pressure, F mark)
+{
+	uint32_t cap = slots.capacity;
+	uint32_t fit = fit_capacity(std::max(need, slots.live));
+
+	if (fit > cap)
+		cap = std::max(fit, cap * 2);
+	else if (fit * 4 <= cap || (pressure && fit * 2 <= cap))
+		cap = fit;
+	if (cap == slots.capacity)
+		return false;
+	if (cap < slots.end())
+		compact_layer(slots, store, mark);
+	if (!store.resize(cap))
+		return false;
+	slots.resize(cap);
+	return true;
+}
+
+//
+// Object ids (cmd.h) of a frame, the table of the backend resolves them.
+// Root signature slots follow create_root_gsig / create_root_csig.
+//
+struct layer_cmd_ids_t {
+	uint32_t image;
+	uint32_t rtv;
+	uint32_t update_buffer;
+	uint32_t upload;           //upload.h ring, the dirty ranges back to back from upload_offset
+	uint32_t upload_offset;
+	uint32_t vertex_buffer;
+	uint32_t uav_src;
+	uint32_t uav_dst;
+	uint32_t visible;
+	uint32_t cull_args;
+	uint32_t capacity;
+	uint32_t count;          //live range [0, count), cull.hlsl walks it
+	uint32_t visible_count;  //kept objects of bin.h
+	uint32_t user_tex;       //user_tex[] table : the atlas (atlas.h), then -tex (tex.h); CmdNoId without them
+	bool idle;  //no objects and the image is already clear, no pass
+};
+
+struct frame_cmd_ids_t {
+	uint32_t root_gsig;
+	uint32_t root_csig;
+	uint32_t pso_update;
+	uint32_t pso_clear;
+	uint32_t pso_draw_rects;
+	uint32_t pso_draw_sprites;
+	uint32_t pso_present;
+	uint32_t pso_cull;
+	uint32_t srv_table;
+	uint32_t sampler_table;
+	uint32_t rect_vertex;
+	uint32_t draw_args;
+	uint32_t backbuffer;
+	uint32_t backbuffer_rtv;
+	uint32_t tile_mask;
+	uint32_t capture;        //readback buffer of the frame (capture.h), CmdNoId when not captured
+	uint32_t capture_pitch;
+	uint32_t timestamps;     //timestamp query heap (prof.h), CmdNoId when not profiled
+	uint32_t timestamp_base; //first query of the frame
+	uint32_t timestamp_readback;
+	bool sprites;            //update and draw pipelines are ready (pipeline.h)
+	std::vector<layer_cmd_ids_t> layers;
+};
+
+//timestamp pairs of a frame : these for every layer, then the present pass.
+enum {
+	ProfPairCopy,
+	ProfPairUpdate,
+	ProfPairDraw,
+	ProfLayerPairs,
+};
+
+std::vector<std::string>
+prof_pair_names(int layer_max)
+{
+	static const char *passes[ProfLayerPairs] = { "copy", "update", "draw" };
+	std::vector<std::string> ret;
+	for (int lidx = 0; lidx < layer_max; lidx++)
+		for (auto pass : passes)
+			ret.push_back("layer" + std::to_string(lidx) + " " + pass);
+	ret.push_back("present");
+	return (ret);
+}
+
+//query of pair (pass, end) of layer lidx, the present pass is lidx = layer_max.
+static inline void
+record_timestamp(cmd_list_t &cl, const frame_cmd_ids_t &ids, int lidx, int pass, int end)
+{
+	if (ids.timestamps != CmdNoId)
+		cl.timestamp(ids.timestamps, ids.timestamp_base + (lidx * ProfLayerPairs + pass) * 2 + end);
+}
+
+enum {
+	CullNone,
+	CullCpu,  //bin.h on the job system, the kept list is uploaded
+	CullGpu,  //cull.hlsl, pull path only
+};
+
+struct layer_cmd_params_t {
+	bool draw_pull;
+	uint8_t cull;
+	float cull_margin;
+	uint32_t object_size;
+	uint32_t vertex_size;
+	uint32_t rect_vertex_bytes;
+	uint32_t rect_vertex_stride;
+	uint32_t width;
+	uint32_t height;
+	uint32_t group_size;
+};
+
+//
+// Pass of layer lidx : upload the dirty ranges, update (or pull) and draw
+// into the layer image. Only reads its arguments, so layers can be
+// recorded on any thread. Pipelines still building leave the layer
+// cleared (no sprites) or skip it (no clear).
+//
+void
+record_layer_cmds(cmd_list_t &cl, const frame_cmd_ids_t &ids, int lidx,
+	const std::vector<dirty_range_t> &ranges, const layer_cmd_params_t &p)
+{
+	auto & layer = ids.layers[lidx];
+
+	if (layer.idle || ids.pso_clear == CmdNoId) {
+		for (int pass = 0; pass < ProfLayerPairs; pass++) {
+			record_timestamp(cl, ids, lidx, pass, 0);
+			record_timestamp(cl, ids, lidx, pass, 1);
+		}
+		return;
+	}
+	record_timestamp(cl, ids, lidx, ProfPairCopy, 0);
+	if (!ranges.empty())
+		cl.use(layer.update_buffer, CmdStateCopyDest);
+	uint32_t src = layer.upload_offset;
+	for (auto & r : ranges) {
+		uint32_t bytes = (r.end - r.begin) * p.object_size;
+		cl.copy(layer.update_buffer, r.begin * p.object_size, layer.upload, src, bytes);
+		src += bytes;
+	}
+	record_timestamp(cl, ids, lidx, ProfPairCopy, 1);
+	record_timestamp(cl, ids, lidx, ProfPairUpdate, 0);
+	if (!ids.sprites) {
+		//nothing to update yet.
+	} else if (p.draw_pull) {
+		cl.use(layer.update_buffer, CmdStateShaderResource);
+		if (p.cull == CullGpu) {
+			uint32_t args[2] = { layer.count };
+			memcpy(&args[1], &p.cull_margin, sizeof(float));
+			cl.use(layer.visible, CmdStateUnorderedAccess);
+			cl.use(layer.cull_args, CmdStateUnorderedAccess);
+			cl.set_root_sig(CmdBindCompute, ids.root_csig);
+			cl.set_srv(CmdBindCompute, 3, layer.update_buffer);
+			cl.set_uav(CmdBindCompute, 4, layer.visible);
+			cl.set_uav(CmdBindCompute, 5, layer.cull_args);
+			cl.set_pipeline(ids.pso_cull);
+			cl.set_constants(CmdBindCompute, 2, args, 2);
+			cl.dispatch(1, 1, 1);
+			cl.use(layer.visible, CmdStateShaderResource);
+			cl.use(layer.cull_args, CmdStateIndirect);
+		}
+	} else if (p.cull == CullCpu) {
+		//the vertices follow the kept list, so all of them are expanded again.
+		if (layer.visible_count) {
+			uint32_t range[2] = { 0, layer.visible_count };
+			cl.use(layer.update_buffer, CmdStateUnorderedAccess);
+			cl.use(layer.vertex_buffer, CmdStateUnorderedAccess);
+			cl.set_root_sig(CmdBindCompute, ids.root_csig);
+			cl.set_table(CmdBindCompute, 0, layer.uav_src);
+			cl.set_table(CmdBindCompute, 1, layer.uav_dst);
+			cl.set_srv(CmdBindCompute, 3, layer.visible);
+			cl.set_pipeline(ids.pso_update);
+			cl.set_constants(CmdBindCompute, 2, range, 2);
+			cl.dispatch((layer.visible_count + p.group_size - 1) / p.group_size, 1, 1);
+		}
+	} else if (!ranges.empty()) {
+		cl.use(layer.update_buffer, CmdStateUnorderedAccess);
+		cl.use(layer.vertex_buffer, CmdStateUnorderedAccess);
+		cl.set_root_sig(CmdBindCompute, ids.root_csig);
+		cl.set_table(CmdBindCompute, 0, layer.uav_src);
+		cl.set_table(CmdBindCompute, 1, layer.uav_dst);
+		cl.set_pipeline(ids.pso_update);
+		for (auto & r : ranges) {
+			uint32_t range[2] = { r.begin, r.end };
+			cl.set_constants(CmdBindCompute, 2, range, 2);
+			cl.dispatch((r.end - r.begin + p.group_size - 1) / p.group_size, 1, 1);
+		}
+	}
+	record_timestamp(cl, ids, lidx, ProfPairUpdate, 1);
+
+	record_timestamp(cl, ids, lidx, ProfPairDraw, 0);
+	cl.use(layer.image, CmdStateRenderTarget);
+	cl.set_target(layer.rtv);
+	cl.viewport(p.width, p.height);
+	cl.set_root_sig(CmdBindGraphics, ids.root_gsig);
+	cl.set_table(CmdBindGraphics, 0, ids.srv_table);
+	cl.set_table(CmdBindGraphics, 3, ids.sampler_table);
+	if (layer.user_tex != CmdNoId)
+		cl.set_table(CmdBindGraphics, 1, layer.user_tex);
+	cl.set_pipeline(ids.pso_clear);
+	cl.set_vertex(ids.rect_vertex, p.rect_vertex_bytes, p.rect_vertex_stride);
+	cl.draw(6, 1);
+
+	uint32_t args_offset = lidx * sizeof(uint32_t) * 4;
+	if (!ids.sprites) {
+		//only the clear.
+	} else if (p.draw_pull) {
+		cl.set_pipeline(ids.pso_draw_sprites);
+		cl.set_srv(CmdBindGraphics, 4, layer.update_buffer);
+		if (p.cull != CullNone)
+			cl.set_srv(CmdBindGraphics, 6, layer.visible);
+		if (p.cull == CullGpu)
+			cl.draw_indirect(layer.cull_args, 0);
+		else
+			cl.draw_indirect(ids.draw_args, args_offset);
+	} else {
+		cl.use(layer.vertex_buffer, CmdStateVertexBuffer);
+		cl.set_vertex(layer.vertex_buffer, p.vertex_size * layer.capacity * 6, p.vertex_size);
+		cl.set_pipeline(ids.pso_draw_rects);
+		cl.draw_indirect(ids.draw_args, args_offset);
+	}
+	record_timestamp(cl, ids, lidx, ProfPairDraw, 1);
+	cl.done(layer.image);
+}
+
+//
+// Composition of the layer images into the back buffer, the tile mask
+// (compose.h) picks the layers of every output tile.
+//
+void
+record_present_cmds(cmd_list_t &cl, const frame_cmd_ids_t &ids, const layer_cmd_params_t &p,
+	const float clear_color[4], uint32_t width, uint32_t height)
+{
+	int present = int(ids.layers.size());
+	//the layer images are only written once the clear pipeline is ready.
+	bool compose = ids.pso_present != CmdNoId && ids.pso_clear != CmdNoId;
+	record_timestamp(cl, ids, present, 0, 0);
+	if (compose)
+		for (auto & layer : ids.layers)
+			cl.use(layer.image, CmdStatePixelResource);
+	cl.use(ids.backbuffer, CmdStateRenderTarget);
+	cl.set_target(ids.backbuffer_rtv);
+	cl.clear(ids.backbuffer_rtv, clear_color);
+	if (compose) {
+		cl.viewport(width, height);
+		cl.set_root_sig(CmdBindGraphics, ids.root_gsig);
+		cl.set_table(CmdBindGraphics, 0, ids.srv_table);
+		cl.set_table(CmdBindGraphics, 3, ids.sampler_table);
+		cl.set_srv(CmdBindGraphics, 5, ids.tile_mask);
+		cl.set_pipeline(ids.pso_present);
+		cl.set_vertex(ids.rect_vertex, p.rect_vertex_bytes, p.rect_vertex_stride);
+		cl.draw(6, 1);
+	}
+	record_timestamp(cl, ids, present, 0, 1);
+	if (ids.timestamps != CmdNoId) {
+		uint32_t num = (present * ProfLayerPairs + 1) * 2;
+		cl.use(ids.timestamp_readback, CmdStateCopyDest);
+		cl.resolve_queries(ids.timestamps, ids.timestamp_base, num, ids.timestamp_readback,
+			ids.timestamp_base * sizeof(uint64_t));
+	}
+	if (ids.capture != CmdNoId) {
+		cl.use(ids.backbuffer, CmdStateCopySource);
+		cl.use(ids.capture, CmdStateCopyDest);
+		cl.copy_texture(ids.capture, ids.backbuffer, width, height, ids.capture_pitch);
+	}
+	cl.use(ids.backbuffer, CmdStateCommon);
+}
+
+//
+// Mips streamed in by tex_stream_t (tex.h) into their textures, before
+// anything of the frame samples them. textures[] are the backend objects
+// of the -tex textures; every texture written ends in pixel shader state.
+//
+void
+record_stream_cmds(cmd_list_t &cl, cmd_table_t &table, const tex_file_t &file,
+	const std::vector<tex_stream_job_t> &jobs, const std::vector<uintptr_t> &textures)
+{
+	std::vector<uint32_t> ids(textures.size(), CmdNoId);
+	void *buffer = nullptr;
+	uint32_t buffer_id = CmdNoId;
+	for (auto & j : jobs) {
+		auto & m = file.entries[j.tex].mip[j.mip];
+		if (ids[j.tex] == CmdNoId)
+			ids[j.tex] = table.add(textures[j.tex]);
+		if (j.src.resource != buffer) {
+			buffer = j.src.resource;
+			buffer_id = table.add(buffer);
+		}
+		cl.use(ids[j.tex], CmdStateCopyDest, j.mip);
+		cl.upload_texture(ids[j.tex], j.mip, buffer_id, uint32_t(j.src.offset), m.row_bytes, m.rows, m.pitch);
+	}
+	for (auto id : ids)
+		if (id != CmdNoId)
+			cl.use(id, CmdStatePixelResource);
+}
+
+//
+// Record every layer into its own list on the job system, then merge them
+// in layer order and append the present pass.
+//
+void
+record_frame_cmds(job_system_t &jobs, std::vector<cmd_list_t> &layer_lists, cmd_list_t &out,
+	const frame_cmd_ids_t &ids, const std::vector<dirty_range_t> *ranges,
+	const layer_cmd_params_t &p, const float clear_color[4], uint32_t screen_w, uint32_t screen_h)
+{
+	PROF_SCOPE("record");
+	int layer_max = (int)ids.layers.size();
+	layer_lists.resize(layer_max);
+	jobs.parallel_for(layer_max, 1, [&](int begin, int end) {
+		PROF_SCOPE("record layers");
+		for (int lidx = begin; lidx < end; lidx++) {
+			layer_lists[lidx].reset();
+			record_layer_cmds(layer_lists[lidx], ids, lidx, ranges[lidx], p);
+		}
+	});
+	out.reset();
+	for (auto & cl : layer_lists)
+		out.append(cl);
+	record_present_cmds(out, ids, p, clear_color, screen_w, screen_h);
+}
+
+double
+get_time_sec()
+{
+	using namespace std::chrono;
+	auto now = steady_clock::now().time_since_epoch();
+	return duration_cast<duration<double>>(now).count();
+}
+
+int
+bench_expand(int layer_max, int object_max, int loop_count)
+{
+	std::vector<ObjectFormat> objects(layer_max * object_max);
+	std::vector<VertexFormat> vtx_ref(objects.size() * 6);
+	std::vector<VertexFormat> vtx(objects.size() * 6);
+
+	for (int lidx = 0; lidx < layer_max; lidx++)
+		update_objects(&objects[lidx * object_max], object_max, lidx, 1.0);
+
+	sprite_expand_ref(objects.data(), vtx_ref.data(), objects.size());
+	sprite_expand(objects.data(), vtx.data(), objects.size());
+	if (memcmp(vtx_ref.data(), vtx.data(), vtx.size() * sizeof(VertexFormat))) {
+		err("sprite_expand(%s) does not match the scalar reference\n",
+			sprite_simd_name());
+		return 1;
+	}
+
+	double t_ref = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		sprite_expand_ref(objects.data(), vtx_ref.data(), objects.size());
+	t_ref = get_time_sec() - t_ref;
+
+	double t_simd = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		sprite_expand(objects.data(), vtx.data(), objects.size());
+	t_simd = get_time_sec() - t_simd;
+
+	double n = double(objects.size()) * loop_count;
+	printf("expand objects=%zu loop=%d\n", objects.size(), loop_count);
+	printf("  scalar : %8.2f Mobjects/sec\n", n / t_ref * 1e-6);
+	printf("  %-6s : %8.2f Mobjects/sec\n", sprite_simd_name(), n / t_simd * 1e-6);
+	return 0;
+}
+
+int
+bench_pack(int layer_max, int object_max, int loop_count)
+{
+	std::vector<ObjectFormat> objects(layer_max * object_max);
+	std::vector<ObjectFormat> unpacked(objects.size());
+	std::vector<PackedObjectFormat> packed_ref(objects.size());
+	std::vector<PackedObjectFormat> packed(objects.size());
+	std::vector<VertexFormat> vtx(objects.size() * 6);
+	std::vector<PackedVertexFormat> packed_vtx_ref(vtx.size());
+	std::vector<PackedVertexFormat> packed_vtx(vtx.size());
+	std::vector<PackedVertexFormat> packed_vtx_expand(vtx.size());
+
+	for (int lidx = 0; lidx < layer_max; lidx++)
+		update_objects(&objects[lidx * object_max], object_max, lidx, 1.0);
+	sprite_expand(objects.data(), vtx.data(), objects.size());
+
+	sprite_pack_objects_ref(objects.data(), packed_ref.data(), objects.size());
+	sprite_pack_objects(objects.data(), packed.data(), objects.size());
+	sprite_pack_vertices_ref(vtx.data(), packed_vtx_ref.data(), vtx.size());
+	sprite_pack_vertices(vtx.data(), packed_vtx.data(), vtx.size());
+	if (memcmp(packed_ref.data(), packed.data(), packed.size() * sizeof(PackedObjectFormat)) ||
+		memcmp(packed_vtx_ref.data(), packed_vtx.data(), packed_vtx.size() * sizeof(PackedVertexFormat))) {
+		err("sprite_pack(%s) does not match the scalar reference\n",
+			sprite_simd_name());
+		return 1;
+	}
+	sprite_unpack_objects(packed.data(), unpacked.data(), packed.size());
+
+	float max_err = 0.0f;
+	for (size_t i = 0; i < objects.size(); i++) {
+		auto & a = objects[i];
+		auto & b = unpacked[i];
+		max_err = std::max(max_err, fabsf(a.pos[0] - b.pos[0]));
+		max_err = std::max(max_err, fabsf(a.pos[1] - b.pos[1]));
+		max_err = std::max(max_err, fabsf(std::min(std::max(a.color[0], 0.0f), 1.0f) - b.color[0]));
+	}
+
+	double t_pack = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		sprite_pack_objects(objects.data(), packed.data(), objects.size());
+	t_pack = get_time_sec() - t_pack;
+
+	double t_unpack = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		sprite_unpack_objects(packed.data(), unpacked.data(), packed.size());
+	t_unpack = get_time_sec() - t_unpack;
+
+	double t_expand = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		sprite_expand_packed(packed.data(), packed_vtx_expand.data(), packed.size());
+	t_expand = get_time_sec() - t_expand;
+
+	double n = double(objects.size()) * loop_count;
+	printf("pack objects=%zu loop=%d simd=%s\n", objects.size(), loop_count, sprite_simd_name());
+	printf("  object : %zu -> %zu bytes\n", sizeof(ObjectFormat), sizeof(PackedObjectFormat));
+	printf("  vertex : %zu -> %zu bytes\n", sizeof(VertexFormat), sizeof(PackedVertexFormat));
+	printf("  pack   : %8.2f Mobjects/sec\n", n / t_pack * 1e-6);
+	printf("  unpack : %8.2f Mobjects/sec\n", n / t_unpack * 1e-6);
+	printf("  expand : %8.2f Mobjects/sec (packed in, packed out)\n", n / t_expand * 1e-6);
+	printf("  max roundtrip error : %f\n", max_err);
+	return 0;
+}
+
+int
+check_pull(int layer_max, int object_max)
+{
+	std::vector<ObjectFormat> objects(layer_max * object_max);
+	std::vector<VertexFormat> vtx(objects.size() * 6);
+	size_t mismatch = 0;
+
+	for (int lidx = 0; lidx < layer_max; lidx++)
+		update_objects(&objects[lidx * object_max], object_max, lidx, 1.0);
+	for (size_t i = 0; i < objects.size(); i += object_max)
+		objects[i].metadata[0] = 0;
+	sprite_expand(objects.data(), vtx.data(), objects.size());
+
+	for (uint32_t iid = 0; iid < objects.size(); iid++) {
+		for (uint32_t vid = 0; vid < 6; vid++) {
+			VertexFormat v;
+			if (!sprite_pull_vertex(objects.data(), iid, vid, v))
+				continue;
+			if (memcmp(&v, &vtx[iid * 6 + vid], sizeof(v)))
+				mismatch++;
+		}
+	}
+	printf("pull objects=%zu mismatch=%zu\n", objects.size(), mismatch);
+	printf("  vertex buffer per layer : %zu bytes -> 0 bytes\n",
+		sizeof(VertexFormat) * 6 * object_max);
+	return mismatch ? 1 : 0;
+}
+
+int
+bench_rng(int layer_max, int object_max, int loop_count)
+{
+	//Random123 known answers for philox4x32-10.
+	static const uint32_t kat[3][10] = {
+		{ 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+			0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+		{ 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+			0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+		{ 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0,
+			0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 },
+	};
+	for (auto & k : kat) {
+		uint32_t r[4];
+		rng_philox(&k[0], &k[4], r);
+		if (memcmp(r, &k[6], sizeof(r))) {
+			err("philox4x32-10 known answer mismatch\n");
+			return 1;
+		}
+	}
+
+	const uint32_t key[2] = { 0x12345678, 0x9abcdef0 };
+	for (uint32_t first = 0; first < 4096; first += 5) {
+		uint32_t a[4][8], b[4][8];
+		rng_philox_x8_ref(first, first * 3, 7, 0xffffffff - first, key, a);
+		rng_philox_x8(first, first * 3, 7, 0xffffffff - first, key, b);
+		if (memcmp(a, b, sizeof(a))) {
+			err("rng_philox_x8(%s) does not match the scalar one\n", rng_simd_name());
+			return 1;
+		}
+	}
+
+	//any chunking of update_objects gives the same objects.
+	std::vector<ObjectFormat> whole(object_max);
+	std::vector<ObjectFormat> chunked(object_max);
+	const int chunks[] = { 1, 3, 8, 13, 512 };
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		update_objects(whole.data(), object_max, lidx, 1.0);
+		for (int chunk : chunks) {
+			for (int begin = 0; begin < object_max; begin += chunk)
+				update_objects(chunked.data(), begin, std::min(begin + chunk, object_max), lidx, 1.0);
+			if (memcmp(whole.data(), chunked.data(), whole.size() * sizeof(ObjectFormat))) {
+				err("update_objects chunk=%d does not match\n", chunk);
+				return 1;
+			}
+		}
+	}
+
+	size_t n = size_t(layer_max) * object_max * UpdateFieldMax;
+	uint32_t sum = 0;
+	double t_rand = get_time_sec();
+	for (int l = 0; l < loop_count; l++) {
+		srand(l);
+		for (size_t i = 0; i < n; i++)
+			sum += rand();
+	}
+	t_rand = get_time_sec() - t_rand;
+
+	double t_philox = get_time_sec();
+	for (int l = 0; l < loop_count; l++) {
+		for (size_t i = 0; i < n; i += 32) {
+			uint32_t r[4][8];
+			rng_philox_x8(uint32_t(i / 32), l, 0, 0, key, r);
+			sum += r[0][0] ^ r[1][1] ^ r[2][2] ^ r[3][3];
+		}
+	}
+	t_philox = get_time_sec() - t_philox;
+
+	double m = double(n) * loop_count;
+	printf("rng values=%zu loop=%d (sum=%08x)\n", n, loop_count, sum);
+	printf("  rand()       : %8.2f Mvalues/sec\n", m / t_rand * 1e-6);
+	printf("  philox %-6s: %8.2f Mvalues/sec\n", rng_simd_name(), m / t_philox * 1e-6);
+	return 0;
+}
+
+int
+bench_store(int layer_max, int object_max, int loop_count)
+{
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	std::vector<ObjectFormat> aos(layer_max * object_max);
+	std::vector<ObjectFormat> flushed(aos.size());
+	std::vector<uint8_t> unaligned((aos.size() + 1) * sizeof(ObjectFormat));
+
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		stores[lidx].init(object_max);
+		stores[lidx].set_flags(0, object_max, 1);
+		update_objects(&aos[lidx * object_max], object_max, lidx, 1.0);
+		update_store(stores[lidx], 0, object_max, lidx, 1.0);
+	}
+
+	//every byte of ObjectFormat comes from the store, ref and simd.
+	auto obj_unaligned = (ObjectFormat *)(unaligned.data() + 4);
+	for (int pass = 0; pass < 3; pass++) {
+		auto dst = pass == 2 ? obj_unaligned : flushed.data();
+		memset(dst, 0xCD, aos.size() * sizeof(ObjectFormat));
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			auto o = dst + lidx * object_max;
+			if (pass == 0)
+				stores[lidx].flush_ref(o, 0, object_max);
+			else
+				stores[lidx].flush(o, 0, object_max);
+		}
+		if (memcmp(aos.data(), dst, aos.size() * sizeof(ObjectFormat))) {
+			err("object_store_t flush pass=%d does not match ObjectFormat\n", pass);
+			return 1;
+		}
+	}
+
+	double t_aos = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			update_objects(&aos[lidx * object_max], object_max, lidx, i);
+	t_aos = get_time_sec() - t_aos;
+
+	double t_store = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			update_store(stores[lidx], 0, object_max, lidx, i);
+	t_store = get_time_sec() - t_store;
+
+	double t_flush_ref = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			stores[lidx].flush_ref(&flushed[lidx * object_max], 0, object_max);
+	t_flush_ref = get_time_sec() - t_flush_ref;
+
+	double t_flush = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			stores[lidx].flush(&flushed[lidx * object_max], 0, object_max);
+	t_flush = get_time_sec() - t_flush;
+
+	double n = double(aos.size()) * loop_count;
+	double bytes = n * sizeof(ObjectFormat);
+	printf("store objects=%zu loop=%d simd=%s\n", aos.size(), loop_count, sprite_simd_name());
+	printf("  update aos   : %8.2f Mobjects/sec\n", n / t_aos * 1e-6);
+	printf("  update store : %8.2f Mobjects/sec\n", n / t_store * 1e-6);
+	printf("  flush scalar : %8.2f Mobjects/sec %6.2f GB/sec\n", n / t_flush_ref * 1e-6, bytes / t_flush_ref * 1e-9);
+	printf("  flush stream : %8.2f Mobjects/sec %6.2f GB/sec\n", n / t_flush * 1e-6, bytes / t_flush * 1e-9);
+	return 0;
+}
+
+//
+// Mostly static scene : every frame `changes` random objects of the even
+// layers move, the odd layers never change after the first frame.
+// Replays the per frame copies on a fake GPU copy of every frame in flight
+// and checks it against the store.
+//
+int
+bench_dirty(int layer_max, int object_max, int frame_count, int changes, int loop_count)
+{
+	const uint32_t key[2] = { 0xd1e7, 0 };
+	//page shift, merge gap in pages
+	const uint32_t configs[][2] = { { 0, 0 }, { 0, 16 }, { 4, 0 }, { 6, 0 } };
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+
+	printf("dirty layers=%d objects=%d frames in flight=%d changes=%d/frame (even layers)\n",
+		layer_max, object_max, frame_count, changes);
+	printf("  full copy         : %10.0f bytes/frame\n", double(sizeof(ObjectFormat)) * layer_max * object_max);
+	for (auto & config : configs) {
+		uint32_t shift = config[0];
+		uint32_t gap = config[1];
+		std::vector<dirty_tracker_t> trackers(frame_count * layer_max);
+		std::vector<ObjectFormat> upload(frame_count * layer_max * object_max);
+		std::vector<ObjectFormat> gpu(upload.size());
+		std::vector<ObjectFormat> expect(object_max);
+		std::vector<dirty_range_t> ranges;
+		upload_stats_t stats;
+
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			stores[lidx].init(object_max);
+			stores[lidx].set_flags(0, object_max, 1);
+			update_store(stores[lidx], 0, object_max, lidx, 0.0);
+		}
+		for (auto & t : trackers) {
+			t.init(object_max, shift);
+			t.mark_all();
+		}
+
+		for (int frame = 0; frame < loop_count; frame++) {
+			int slot = frame % frame_count;
+			for (int lidx = 0; frame && lidx < layer_max; lidx += 2) {
+				for (int c = 0; c < changes; c += 8) {
+					uint32_t r[4][8];
+					rng_philox_x8(c, frame, lidx, 0, key, r);
+					for (int l = 0; l < 8 && c + l < changes; l++) {
+						uint32_t i = r[0][l] % object_max;
+						update_store(stores[lidx], i, i + 1, lidx, frame);
+						for (int f = 0; f < frame_count; f++)
+							trackers[f * layer_max + lidx].mark(i, i + 1);
+					}
+				}
+			}
+			for (int lidx = 0; lidx < layer_max; lidx++) {
+				auto & t = trackers[slot * layer_max + lidx];
+				size_t base = size_t(slot * layer_max + lidx) * object_max;
+				t.get_ranges(ranges, gap);
+				stats.add(ranges, sizeof(ObjectFormat));
+				for (auto & r : ranges) {
+					stores[lidx].flush(&upload[base], r.begin, r.end);
+					memcpy(&gpu[base + r.begin], &upload[base + r.begin],
+						(r.end - r.begin) * sizeof(ObjectFormat));
+				}
+				t.clear();
+			}
+			stats.frame();
+			for (int lidx = 0; lidx < layer_max; lidx++) {
+				size_t base = size_t(slot * layer_max + lidx) * object_max;
+				stores[lidx].flush_ref(expect.data(), 0, object_max);
+				if (memcmp(expect.data(), &gpu[base], object_max * sizeof(ObjectFormat))) {
+					err("page_shift=%u frame=%d layer=%d gpu copy is stale\n", shift, frame, lidx);
+					return 1;
+				}
+			}
+		}
+		printf("  page=%-3u gap=%-3u : %10.0f bytes/frame, %6.1f copies/frame, %4.1f layers skipped/frame\n",
+			1u << shift, gap, stats.bytes_per_frame(), stats.copies_per_frame(),
+			stats.skipped_per_frame());
+	}
+	return 0;
+}
+
+int
+check_slots(uint32_t capacity)
+{
+	slot_allocator_t slots;
+	object_store_t store;
+	std::vector<slot_handle_t> handles;
+	std::vector<uint32_t> tags;
+	std::vector<slot_move_t> moves;
+	slot_handle_t h;
+	uint32_t slot;
+
+	slots.init(capacity);
+	store.init(capacity);
+	for (uint32_t i = 0; i < capacity; i++) {
+		if (!slots.alloc(h, slot) || slot != i) {
+			err("alloc %u failed\n", i);
+			return 1;
+		}
+		handles.push_back(h);
+	}
+	if (slots.alloc(h, slot) || slots.end() != capacity) {
+		err("alloc over capacity\n");
+		return 1;
+	}
+
+	//stale handles never reach a reused slot.
+	auto stale = handles[7];
+	slots.free(stale);
+	if (slots.valid(stale) || slots.free(stale) != slot_allocator_t::Invalid ||
+		slots.get(stale) != slot_allocator_t::Invalid) {
+		err("stale handle is still valid\n");
+		return 1;
+	}
+	if (!slots.alloc(h, slot) || slot != 7 || slots.valid(stale) ||
+		(h.index == stale.index && h.generation == stale.generation)) {
+		err("freed slot is not reused with a new generation\n");
+		return 1;
+	}
+	slots.free(h);
+	for (auto & e : handles)
+		slots.free(e);
+	if (slots.live || slots.end()) {
+		err("live=%u end=%u after freeing everything\n", slots.live, slots.end());
+		return 1;
+	}
+
+	//random churn against tags kept in the store.
+	const uint32_t key[2] = { 0x5107, 0 };
+	handles.clear();
+	for (uint32_t step = 0; step < 4096; step++) {
+		uint32_t r[4][8];
+		rng_philox_x8(0, step, 0, 0, key, r);
+		uint32_t ops = r[0][0] % 64;
+		bool grow = (step / 256) % 2 == 0;
+		for (uint32_t k = 0; k < ops; k++) {
+			uint32_t v = r[1 + k % 3][k % 8] + k * 0x9E3779B9;
+			bool do_alloc = handles.empty() || (grow ? v % 3 != 0 : v % 3 == 0);
+			if (do_alloc && slots.alloc(h, slot)) {
+				store.matid[slot] = h.index * 65536 + h.generation;
+				store.flags[slot] = 1;
+				handles.push_back(h);
+			} else if (!handles.empty()) {
+				uint32_t i = v % handles.size();
+				slot = slots.free(handles[i]);
+				store.flags[slot] = 0;
+				handles[i] = handles.back();
+				handles.pop_back();
+			}
+		}
+		if (slots.need_compact()) {
+			uint32_t live = slots.live;
+			compact_layer(slots, store, [](uint32_t) {});
+			for (uint32_t i = 0; i < live; i++) {
+				if (store.flags[i] != 1) {
+					err("step=%u slot %u is a hole after compaction\n", step, i);
+					return 1;
+				}
+			}
+			if (slots.end() != live) {
+				err("step=%u end=%u live=%u after compaction\n", step, slots.end(), live);
+				return 1;
+			}
+		}
+		if (slots.live != handles.size()) {
+			err("step=%u live=%u handles=%zu\n", step, slots.live, handles.size());
+			return 1;
+		}
+		for (auto & e : handles) {
+			slot = slots.get(e);
+			if (slot >= slots.end() || store.matid[slot] != e.index * 65536 + e.generation) {
+				err("step=%u handle %u/%u lost its object\n", step, e.index, e.generation);
+				return 1;
+			}
+		}
+	}
+	printf("slots capacity=%u ok\n", capacity);
+	return 0;
+}
+
+//
+// Churn benchmark : the population of a layer swings between 1/4 and all
+// of the capacity while `churn` objects respawn every frame.
+// Reports alloc/free cost and how close end() (the dispatch / draw size)
+// stays to the live count with and without compaction.
+//
+int
+bench_slots(int object_max, int churn, int frame_count)
+{
+	if (check_slots(object_max))
+		return 1;
+
+	printf("churn objects=%d churn=%d/frame frames=%d\n", object_max, churn, frame_count);
+	for (int compact = 0; compact < 2; compact++) {
+		slot_allocator_t slots;
+		object_store_t store;
+		std::vector<slot_handle_t> handles;
+		std::vector<VertexFormat> vtx(object_max * 6);
+		double sum_live = 0, sum_end = 0;
+		double t_churn = 0, t_compact = 0, t_expand = 0, t_expand_full = 0;
+		size_t moves = 0;
+		uint64_t marks = 0;
+
+		slots.init(object_max);
+		store.init(object_max);
+		for (int frame = 0; frame < frame_count; frame++) {
+			double a_time = frame / 16.0;
+			uint32_t target = uint32_t(object_max * (0.625 + 0.375 * cos(a_time * 0.5)));
+			double t = get_time_sec();
+			churn_layer(slots, handles, store, 0, frame, churn, target, a_time,
+				[&marks](uint32_t) { marks++; });
+			t_churn += get_time_sec() - t;
+
+			t = get_time_sec();
+			if (compact && slots.need_compact())
+				moves += compact_layer(slots, store, [&marks](uint32_t) { marks++; });
+			t_compact += get_time_sec() - t;
+			sum_live += slots.live;
+			sum_end += slots.end();
+
+			//the CPU expansion only covers [0, end()).
+			if (frame % 16 == 0) {
+				std::vector<ObjectFormat> obj(object_max);
+				store.flush_ref(obj.data(), 0, object_max);
+				t = get_time_sec();
+				sprite_expand(obj.data(), vtx.data(), slots.end());
+				t_expand += get_time_sec() - t;
+				t = get_time_sec();
+				sprite_expand(obj.data(), vtx.data(), object_max);
+				t_expand_full += get_time_sec() - t;
+			}
+		}
+		printf("  compaction %-3s : churn %6.2f us/frame, compact %6.2f us/frame (%zu moves), dirty %6.1f slots/frame\n",
+			compact ? "on" : "off", t_churn / frame_count * 1e6, t_compact / frame_count * 1e6,
+			moves, double(marks) / frame_count);
+		printf("                   live %7.1f, end %7.1f (dispatch/draw), capacity %d, expand %.2fx faster than capacity\n",
+			sum_live / frame_count, sum_end / frame_count, object_max, t_expand_full / t_expand);
+	}
+	return 0;
+}
+
+//
+// Per layer capacity over time : a sparse layer (tens of objects) and a
+// dense layer (up to dense_max) swing in size. Every frame in flight
+// reallocates its copy of a layer only when its turn comes, as it would
+// once its fence completes. The copies are checked against the store,
+// and budget_bytes forces shrinking.
+//
+int
+bench_grow(int frame_count, uint32_t dense_max, int frames, size_t budget_bytes)
+{
+	enum { Layers = 2 };
+	struct gpu_layer_t {
+		uint32_t capacity = 0;
+		std::vector<ObjectFormat> buffer;
+		dirty_tracker_t dirty;
+	};
+	object_store_t stores[Layers];
+	slot_allocator_t slots[Layers];
+	std::vector<slot_handle_t> handles[Layers];
+	std::vector<gpu_layer_t> gpu(frame_count * Layers);
+	std::vector<dirty_range_t> ranges;
+	std::vector<ObjectFormat> expect;
+	size_t reallocs = 0, peak_bytes = 0, sum_bytes = 0;
+	uint32_t peak_capacity[Layers] = {};
+
+	for (int lidx = 0; lidx < Layers; lidx++) {
+		stores[lidx].init(LayerCapacityMin);
+		slots[lidx].init(LayerCapacityMin);
+	}
+	for (auto & g : gpu)
+		g.dirty.init(0, 0);
+
+	for (int frame = 0; frame < frames; frame++) {
+		int slot = frame % frame_count;
+		double a_time = frame / 16.0;
+		double wave = 0.5 + 0.5 * sin(a_time * 0.2);
+		uint32_t target[Layers] = {
+			uint32_t(10 + 20 * wave),
+			uint32_t(dense_max * wave * wave),
+		};
+		size_t bytes = 0;
+		for (int lidx = 0; lidx < Layers; lidx++)
+			bytes += size_t(slots[lidx].capacity) * sizeof(ObjectFormat) * (frame_count + 1);
+		bool pressure = bytes > budget_bytes;
+
+		for (int lidx = 0; lidx < Layers; lidx++) {
+			auto mark = [&gpu, frame_count, lidx](uint32_t s) {
+				for (int f = 0; f < frame_count; f++)
+					gpu[f * Layers + lidx].dirty.mark(s, s + 1);
+			};
+			if (fit_layer_capacity(slots[lidx], stores[lidx], target[lidx], pressure, mark)) {
+				for (int f = 0; f < frame_count; f++)
+					gpu[f * Layers + lidx].dirty.resize(slots[lidx].capacity);
+			}
+			churn_layer(slots[lidx], handles[lidx], stores[lidx], lidx, frame, 4,
+				target[lidx], a_time, mark);
+			if (slots[lidx].need_compact())
+				compact_layer(slots[lidx], stores[lidx], mark);
+			peak_capacity[lidx] = std::max(peak_capacity[lidx], slots[lidx].capacity);
+		}
+
+		//this frame's copies are idle : reallocate, then upload the dirty ranges.
+		bytes = 0;
+		for (int lidx = 0; lidx < Layers; lidx++) {
+			auto & g = gpu[slot * Layers + lidx];
+			uint32_t cap = slots[lidx].capacity;
+			if (g.capacity != cap) {
+				g.capacity = cap;
+				g.buffer.assign(cap, ObjectFormat());
+				g.buffer.shrink_to_fit();
+				g.dirty.init(cap, 0);
+				g.dirty.mark_all();
+				reallocs++;
+			}
+			g.dirty.get_ranges(ranges);
+			g.dirty.clear();
+			dirty_clip(ranges, slots[lidx].end());
+			for (auto & r : ranges)
+				stores[lidx].flush(g.buffer.data(), r.begin, r.end);
+
+			uint32_t end = slots[lidx].end();
+			expect.resize(end);
+			stores[lidx].flush_ref(expect.data(), 0, end);
+			if (memcmp(expect.data(), g.buffer.data(), end * sizeof(ObjectFormat))) {
+				err("frame=%d layer=%d copy does not match the store\n", frame, lidx);
+				return 1;
+			}
+		}
+		for (auto & g : gpu)
+			bytes += g.buffer.capacity() * sizeof(ObjectFormat);
+		for (int lidx = 0; lidx < Layers; lidx++)
+			bytes += stores[lidx].capacity * sizeof(ObjectFormat);
+		peak_bytes = std::max(peak_bytes, bytes);
+		sum_bytes += bytes;
+	}
+
+	size_t fixed = size_t(Layers) * fit_capacity(dense_max) * sizeof(ObjectFormat) * (frame_count + 1);
+	if (budget_bytes == ~size_t(0))
+		printf("grow frames=%d frames in flight=%d dense max=%u budget=none\n", frames, frame_count, dense_max);
+	else
+		printf("grow frames=%d frames in flight=%d dense max=%u budget=%zu MB\n",
+			frames, frame_count, dense_max, budget_bytes >> 20);
+	printf("  peak capacity : sparse %u, dense %u\n", peak_capacity[0], peak_capacity[1]);
+	printf("  reallocations : %zu\n", reallocs);
+	printf("  memory        : avg %.0f, peak %zu bytes, fixed capacity %zu bytes\n",
+		double(sum_bytes) / frames, peak_bytes, fixed);
+	return 0;
+}
+
+//
+// Frame pacing on the mock timeline : cpu_usec of recording and gpu_usec of
+// GPU work per frame, for a few (frames in flight, present latency) pairs.
+// "serial" is the old loop, signal and wait before the submit. Checks that a
+// slot is only reused once its GPU work is done and that no more than
+// frames - 1 frames are in flight at begin().
+//
+int
+bench_frames(double cpu_usec, double gpu_usec, int frames)
+{
+	struct config_t {
+		const char *name;
+		int frames;
+		int latency;
+	};
+	static const config_t configs[] = {
+		{ "serial", 1, 0 },
+		{ "frames=2", 2, 0 },
+		{ "frames=2 latency=1", 2, 1 },
+		{ "frames=3", 3, 0 },
+		{ "frames=3 latency=2", 3, 2 },
+	};
+	using namespace std::chrono;
+	printf("frames count=%d cpu=%.0f us gpu=%.0f us\n", frames, cpu_usec, gpu_usec);
+	for (auto & c : configs) {
+		mock_timeline_t timeline;
+		frame_scheduler_t sched;
+		std::vector<steady_clock::time_point> begin_time(frames);
+		std::vector<uint64_t> values(frames);
+		timeline.init(c.latency);
+		sched.init(&timeline, c.frames);
+
+		double t = get_time_sec();
+		for (int i = 0; i < frames; i++) {
+			int slot = sched.next_slot();
+			sched.begin(slot);
+			if (timeline.completed() < sched.values[slot]) {
+				err("%s : slot %d reused before its fence\n", c.name, slot);
+				return 1;
+			}
+			if (timeline.last - timeline.completed() > uint64_t(c.frames - 1)) {
+				err("%s : %llu frames in flight\n", c.name,
+					(unsigned long long)(timeline.last - timeline.completed()));
+				return 1;
+			}
+			begin_time[i] = steady_clock::now();
+			std::this_thread::sleep_for(microseconds(int64_t(cpu_usec)));
+			timeline.work(gpu_usec);
+			values[i] = sched.end(slot);
+			if (c.frames == 1) {
+				auto w = steady_clock::now();
+				timeline.wait(values[i]);
+				sched.stall_sec += duration<double>(steady_clock::now() - w).count();
+			}
+		}
+		sched.flush();
+		t = get_time_sec() - t;
+
+		std::vector<double> latency(frames);
+		for (int i = 0; i < frames; i++)
+			latency[i] = duration<double>(timeline.done_at(values[i]) - begin_time[i]).count() * 1e3;
+		std::sort(latency.begin(), latency.end());
+		double avg = 0.0;
+		for (auto l : latency)
+			avg += l;
+		avg /= frames;
+		printf("  %-20s: %7.1f fps, latency avg %6.2f ms p99 %6.2f ms, cpu wait %5.2f ms/frame\n",
+			c.name, frames / t, avg, latency[frames * 99 / 100], sched.stall_sec / frames * 1e3);
+		timeline.term();
+	}
+	return 0;
+}
+
+//
+// State tracker cases (state.h), every resolved list also has to pass
+// the null backend.
+//
+int
+check_state()
+{
+	enum { Tex, Buf, Img, Mip, Rt, Num };
+	int fails = 0;
+	std::vector<uintptr_t> keys = { 100, 101, 102, 103, 104 };
+	auto expect = [&fails](const char *name, bool ok) {
+		printf("  %-34s: %s\n", name, ok ? "ok" : "NG");
+		fails += !ok;
+	};
+	auto count = [](const cmd_list_t &cl, uint8_t flags) {
+		int n = 0;
+		for (auto & c : cl.cmds)
+			n += c.type == CmdBarrier && c.slot == flags;
+		return n;
+	};
+	auto run = [&](state_tracker_t &t, cmd_null_t &null, const cmd_list_t &in, cmd_list_t &out) {
+		t.resolve(in, out, keys);
+		null.execute(out);
+		t.end_list();
+		if (null.errors)
+			printf("  null backend : %s\n", null.first_error);
+		return null.errors == 0;
+	};
+	auto setup = [&](state_tracker_t &t, cmd_null_t &null) {
+		null.init(Num);
+		null.set_buffer(Buf, 256);
+		null.set_buffer(Rt, 256);
+		null.set_state(Rt, CmdStateGenericRead);
+		null.set_state(Mip, CmdStateCommon, 4);
+		t.set(keys[Buf], CmdStateCommon, 1, true);
+		t.set(keys[Rt], CmdStateGenericRead, 1, true);
+		t.set(keys[Mip], CmdStateCommon, 4);
+	};
+	static const float black[4] = {};
+
+	printf("state\n");
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t in, out;
+		setup(t, null);
+		in.use(Tex, CmdStateRenderTarget);
+		in.use(Tex, CmdStateRenderTarget);
+		in.set_target(Tex);
+		in.clear(Tex, black);
+		in.use(Tex, CmdStateRenderTarget);
+		in.clear(Tex, black);
+		bool ok = run(t, null, in, out);
+		expect("redundant uses are skipped", ok && count(out, 0) == 1 && t.skipped == 2);
+	}
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t in, out;
+		setup(t, null);
+		in.use(Buf, CmdStateCopyDest);
+		in.copy(Buf, 0, Rt, 0, 16);
+		in.use(Buf, CmdStateShaderResource);
+		in.set_srv(CmdBindGraphics, 0, Buf);
+		bool ok = run(t, null, in, out);
+		expect("buffer promotes from common", ok && count(out, 0) == 1 && t.promotions == 1);
+		expect("buffer decays after the list", t.state(keys[Buf]) == CmdStateCommon);
+	}
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t in, out;
+		setup(t, null);
+		in.set_root_sig(CmdBindCompute, Num);
+		in.set_pipeline(Num);
+		for (int i = 0; i < 3; i++) {
+			in.use(Img, CmdStateUnorderedAccess);
+			in.dispatch(1, 1, 1);
+		}
+		bool ok = run(t, null, in, out);
+		expect("uav barrier between uav uses", ok && count(out, 0) == 1 && count(out, CmdBarrierUav) == 2);
+	}
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t in, out;
+		setup(t, null);
+		in.use(Tex, CmdStateRenderTarget);
+		in.clear(Tex, black);
+		in.done(Tex);
+		in.use(Img, CmdStateRenderTarget);
+		in.clear(Img, black);
+		in.use(Tex, CmdStatePixelResource);
+		in.clear(Img, black);
+		bool ok = run(t, null, in, out);
+		int begin = -1, end = -1;
+		for (int i = 0; i < (int)out.cmds.size(); i++) {
+			if (out.cmds[i].slot == CmdBarrierBegin)
+				begin = i;
+			if (out.cmds[i].slot == CmdBarrierEnd)
+				end = i;
+		}
+		expect("split barrier around other work", ok && t.splits == 1 && begin >= 0 && end > begin + 1 &&
+			t.state(keys[Tex]) == CmdStatePixelResource);
+	}
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t in, out;
+		setup(t, null);
+		in.use(Tex, CmdStateRenderTarget);
+		in.clear(Tex, black);
+		in.done(Tex);
+		in.use(Tex, CmdStatePixelResource);
+		in.clear(Img, black);
+		bool ok = run(t, null, in, out);
+		expect("no split without work in between", ok && t.splits == 0 && count(out, 0) == 2);
+	}
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t in, out;
+		setup(t, null);
+		in.use(Mip, CmdStateRenderTarget, 1);
+		in.clear(Img, black);
+		in.use(Mip, CmdStatePixelResource);
+		in.clear(Img, black);
+		in.use(Mip, CmdStateCommon);
+		in.clear(Img, black);
+		bool ok = run(t, null, in, out);
+		//sub 1, then subs 0, 1, 2, 3 one by one, then the whole resource at once.
+		int subs = 0, all = 0;
+		for (auto & c : out.cmds) {
+			if (c.type != CmdBarrier)
+				continue;
+			if (c.id[1] == CmdAllSubresources)
+				all++;
+			else
+				subs++;
+		}
+		expect("subresources", ok && subs == 5 && all == 1);
+	}
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t in, out;
+		setup(t, null);
+		for (int i = 0; i < Num; i++)
+			if (i != Rt)
+				in.use(i, CmdStateCopyDest);
+		in.use(Img, CmdStateRenderTarget);
+		in.set_target(Img);
+		bool ok = run(t, null, in, out);
+		expect("barriers before a command are one batch", ok && t.batches == 1 && null.batches == 1);
+	}
+	{
+		state_tracker_t t;
+		cmd_null_t null;
+		cmd_list_t bad;
+		setup(t, null);
+		bad.barrier(Tex, CmdStateRenderTarget, CmdStateCommon);
+		bad.use(Tex, CmdStateCommon);
+		null.execute(bad);
+		expect("null backend rejects bad lists", null.errors == 2);
+	}
+	printf("state %s\n", fails ? "NG" : "ok");
+	return fails ? 1 : 0;
+}
+
+//
+// Tile classified composition (compose.h) against the plain present pass.
+// The layers are rasterized on the CPU from their stores : dense, sparse,
+// empty, dead objects only and objects on the edges for the wrap of the
+// sampler. Every texel that is not 0 has to be in a covered tile and the
+// composed images have to be identical.
+//
+int
+check_compose(int layer_max, int object_max, uint32_t layer_w, uint32_t layer_h)
+{
+	static const int counts[] = { -1, 16, 0, 256, 0, 4, 1, 0 };
+	static const uint32_t sizes[][2] = { { 1024, 1024 }, { 3840, 2160 } };
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	std::vector<tile_cover_t> covers(layer_max);
+	std::vector<std::vector<float>> images(layer_max);
+	std::vector<const float *> image_ptrs(layer_max);
+	std::vector<uint32_t> ends(layer_max);
+
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		int n = counts[lidx % 8] < 0 ? object_max : counts[lidx % 8];
+		auto & store = stores[lidx];
+		store.init(std::max(n, 1));
+		update_store(store, 0, n, lidx, 1.0);
+		store.set_flags(0, n, 1);
+		if (lidx % 8 == 4) {
+			//live range with dead objects only.
+			update_store(store, 0, 1, lidx, 1.0);
+			n = 1;
+		}
+		if (lidx % 8 == 5) {
+			for (int i = 0; i < n; i++) {
+				store.pos_x[i] = i & 1 ? 0.995f : -0.995f;
+				store.pos_y[i] = i & 2 ? 0.995f : -0.995f;
+			}
+		}
+		ends[lidx] = n;
+
+		std::vector<ObjectFormat> obj(n);
+		std::vector<VertexFormat> vtx(n * 6);
+		store.flush_ref(obj.data(), 0, n);
+		sprite_expand_ref(obj.data(), vtx.data(), n);
+		images[lidx].assign(layer_w * layer_h * 4, 0.0f);
+		compose_raster_ref(vtx.data(), vtx.size(), images[lidx].data(), layer_w, layer_h);
+		image_ptrs[lidx] = images[lidx].data();
+		covers[lidx].init(layer_w, layer_h, ComposeLayerTile);
+	}
+
+	double t_classify = get_time_sec();
+	for (int lidx = 0; lidx < layer_max; lidx++)
+		compose_classify_layer(stores[lidx], ends[lidx], covers[lidx]);
+	t_classify = get_time_sec() - t_classify;
+
+	int fails = 0;
+	printf("compose layers=%d layer=%ux%u tile=%d out tile=%d\n",
+		layer_max, layer_w, layer_h, ComposeLayerTile, ComposeOutTile);
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		auto & cover = covers[lidx];
+		uint32_t texels = 0, missed = 0;
+		for (uint32_t y = 0; y < layer_h; y++) {
+			for (uint32_t x = 0; x < layer_w; x++) {
+				const float *t = &images[lidx][(y * layer_w + x) * 4];
+				if (t[0] == 0.0f && t[1] == 0.0f && t[2] == 0.0f && t[3] == 0.0f)
+					continue;
+				texels++;
+				missed += !cover.covered(x, y);
+			}
+		}
+		printf("  layer %d : end=%-5u %6u texels, %3u / %zu tiles%s\n", lidx, ends[lidx],
+			texels, cover.count, cover.tiles.size(), missed ? " NG" : "");
+		fails += missed != 0;
+	}
+	printf("  classify : %.3f ms\n", t_classify * 1e3);
+
+	for (auto & size : sizes) {
+		uint32_t w = size[0];
+		uint32_t h = size[1];
+		tile_mask_t mask;
+		std::vector<float> ref(w * h * 4);
+		std::vector<float> tiled(w * h * 4);
+		mask.init(w, h, ComposeOutTile);
+
+		double t_mask = get_time_sec();
+		mask.build(covers.data(), layer_max);
+		t_mask = get_time_sec() - t_mask;
+		double t_ref = get_time_sec();
+		compose_rows(image_ptrs.data(), layer_max, layer_w, layer_h, nullptr, ref.data(), w, h, 0, h);
+		t_ref = get_time_sec() - t_ref;
+		double t_tiled = get_time_sec();
+		compose_rows(image_ptrs.data(), layer_max, layer_w, layer_h, &mask, tiled.data(), w, h, 0, h);
+		t_tiled = get_time_sec() - t_tiled;
+
+		bool same = memcmp(ref.data(), tiled.data(), ref.size() * sizeof(float)) == 0;
+		uint32_t empty_tiles = 0;
+		for (auto b : mask.bits)
+			empty_tiles += b == 0;
+		printf("  out %ux%u : active layers=0x%02x, %u / %zu tiles empty, %.1f%% of the samples, mask %.3f ms\n",
+			w, h, mask.active, empty_tiles, mask.bits.size(),
+			mask.samples * 100.0 / (double(w) * h * layer_max), t_mask * 1e3);
+		printf("    all layers : %8.2f ms\n", t_ref * 1e3);
+		printf("    tiled      : %8.2f ms x%.2f, %s\n", t_tiled * 1e3, t_ref / t_tiled,
+			same ? "identical" : "NG");
+		fails += !same;
+	}
+	printf("compose %s\n", fails ? "NG" : "ok");
+	return fails ? 1 : 0;
+}
+
+//
+// Viewport culling and binning (bin.h) of layers spread over world x world
+// screens. The SIMD kernel and the parallel build have to match the scalar
+// reference. Rasterized on the CPU, the kept objects give the same image
+// as all of them, and every drawn pixel is in the list of its tile.
+//
+int
+bench_cull(int layer_max, int object_max, int thread_max, int loop_count, double world)
+{
+	enum { Width = 512, Height = 512, Grid = 16, Chunk = 1024 };
+	bin_view_t view = { 2.0f / Width, Grid, Grid };
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	std::vector<sprite_bins_t> ref(layer_max);
+	size_t kept = 0;
+
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		auto & store = stores[lidx];
+		store.init(object_max);
+		update_store(store, 0, object_max, lidx, 1.0, world);
+		for (int i = 0; i < object_max; i++)
+			store.flags[i] = i % 7 != 3;
+		ref[lidx].init(view);
+		ref[lidx].build(nullptr, store, object_max, Chunk, false);
+		kept += ref[lidx].visible.size();
+	}
+	auto same = [](const sprite_bins_t &a, const sprite_bins_t &b) {
+		return a.visible == b.visible && a.offsets == b.offsets && a.objects == b.objects;
+	};
+
+	//layer 0 on the CPU : all objects, kept objects, object id per pixel.
+	{
+		auto & bins = ref[0];
+		std::vector<ObjectFormat> obj(object_max);
+		std::vector<VertexFormat> vtx(object_max * 6);
+		std::vector<VertexFormat> vtx_kept;
+		std::vector<float> all(Width * Height * 4, 0.0f);
+		std::vector<float> part(Width * Height * 4, 0.0f);
+		std::vector<float> ids(Width * Height * 4, -1.0f);
+		stores[0].flush_ref(obj.data(), 0, object_max);
+		sprite_expand_ref(obj.data(), vtx.data(), object_max);
+		for (auto i : bins.visible)
+			vtx_kept.insert(vtx_kept.end(), &vtx[i * 6], &vtx[i * 6 + 6]);
+		compose_raster_ref(vtx.data(), vtx.size(), all.data(), Width, Height);
+		compose_raster_ref(vtx_kept.data(), vtx_kept.size(), part.data(), Width, Height);
+		for (size_t k = 0; k < bins.visible.size(); k++)
+			for (int v = 0; v < 6; v++)
+				vtx_kept[k * 6 + v].color[0] = float(bins.visible[k]);
+		compose_raster_ref(vtx_kept.data(), vtx_kept.size(), ids.data(), Width, Height);
+		if (all != part) {
+			err("culled objects are visible\n");
+			return 1;
+		}
+		for (uint32_t y = 0; y < Height; y++) {
+			for (uint32_t x = 0; x < Width; x++) {
+				float id = ids[(y * Width + x) * 4];
+				if (id < 0.0f)
+					continue;
+				uint32_t t = (y * Grid / Height) * Grid + x * Grid / Width;
+				auto b = bins.objects.begin() + bins.offsets[t];
+				auto e = bins.objects.begin() + bins.offsets[t + 1];
+				if (!std::binary_search(b, e, uint32_t(id))) {
+					err("object %u at (%u, %u) is not in the list of tile %u\n", uint32_t(id), x, y, t);
+					return 1;
+				}
+			}
+		}
+	}
+
+	double n = double(layer_max) * object_max * loop_count;
+	printf("cull layers=%d objects=%d world=%.1f grid=%dx%d simd=%s\n",
+		layer_max, object_max, world, Grid, Grid, sprite_simd_name());
+	printf("  kept %.1f%%, %.1f tiles/object\n", kept * 100.0 / (double(layer_max) * object_max),
+		double(ref[0].objects.size()) / std::max<size_t>(ref[0].visible.size(), 1));
+	for (int simd = 0; simd < 2; simd++) {
+		for (int grid = 0; grid < 2; grid++) {
+			bin_view_t v = view;
+			if (!grid)
+				v.grid_x = v.grid_y = 0;
+			std::vector<sprite_bins_t> bins(layer_max);
+			for (auto & b : bins)
+				b.init(v);
+			double t = get_time_sec();
+			for (int i = 0; i < loop_count; i++)
+				for (int lidx = 0; lidx < layer_max; lidx++)
+					bins[lidx].build(nullptr, stores[lidx], object_max, Chunk, simd != 0);
+			t = get_time_sec() - t;
+			for (int lidx = 0; lidx < layer_max && grid; lidx++) {
+				if (!same(bins[lidx], ref[lidx])) {
+					err("bin_cull(%s) does not match the scalar reference\n", sprite_simd_name());
+					return 1;
+				}
+			}
+			printf("  %-6s %-9s : %8.2f Mobjects/sec\n", simd ? sprite_simd_name() : "scalar",
+				grid ? "cull+bin" : "cull", n / t * 1e-6);
+		}
+	}
+
+	std::vector<int> thread_nums;
+	for (int threads = 1; threads < thread_max; threads *= 2)
+		thread_nums.push_back(threads);
+	thread_nums.push_back(std::max(1, thread_max));
+	for (int threads : thread_nums) {
+		job_system_t jobs;
+		std::vector<sprite_bins_t> bins(layer_max);
+		for (auto & b : bins)
+			b.init(view);
+		jobs.init(threads);
+		double t = get_time_sec();
+		for (int i = 0; i < loop_count; i++)
+			for (int lidx = 0; lidx < layer_max; lidx++)
+				bins[lidx].build(&jobs, stores[lidx], object_max, Chunk);
+		t = get_time_sec() - t;
+		jobs.term();
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			if (!same(bins[lidx], ref[lidx])) {
+				err("threads=%d bins do not match the serial ones\n", threads);
+				return 1;
+			}
+		}
+		printf("  threads=%-2d      : %8.2f Mobjects/sec\n", threads, n / t * 1e-6);
+	}
+	return 0;
+}
+
+//
+// Software backend (soft.h) against the CPU reference : layers rasterized
+// by compose_raster_ref and stored as unorm, then every layer sampled
+// (compose_rows without a mask). Serial and threaded frames have to be
+// identical to it. Then sprites/sec of the layer pass and pixels/sec of
+// the present pass on 1, 2, 4 .. N threads.
+//
+int
+bench_soft(int layer_max, int object_max, uint32_t layer_w, uint32_t layer_h,
+	uint32_t w, uint32_t h, int thread_max, int loop_count)
+{
+	static const int counts[] = { -1, 16, 0, 256, 0, 4, 1, -1 };
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	std::vector<uint32_t> ends(layer_max);
+	std::vector<std::vector<float>> texels(layer_max);
+	std::vector<const float *> texel_ptrs(layer_max);
+
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		int n = counts[lidx % 8] < 0 ? object_max : counts[lidx % 8];
+		auto & store = stores[lidx];
+		store.init(std::max(n, 1));
+		update_store(store, 0, n, lidx, 1.0, lidx % 8 == 7 ? 2.0 : 1.0);
+		store.set_flags(0, n, 1);
+		for (int i = 0; i < n; i += 5)
+			store.flags[i] = 0;
+		if (lidx % 8 == 5) {
+			for (int i = 0; i < n; i++) {
+				store.pos_x[i] = i & 1 ? 0.995f : -0.995f;
+				store.pos_y[i] = i & 2 ? 0.995f : -0.995f;
+			}
+		}
+		ends[lidx] = n;
+
+		std::vector<ObjectFormat> obj(n);
+		std::vector<VertexFormat> vtx(n * 6);
+		std::vector<float> image(layer_w * layer_h * 4, 0.0f);
+		store.flush_ref(obj.data(), 0, n);
+		sprite_expand_ref(obj.data(), vtx.data(), n);
+		compose_raster_ref(vtx.data(), vtx.size(), image.data(), layer_w, layer_h);
+		texels[lidx].resize(image.size());
+		for (size_t i = 0; i < image.size(); i += 4)
+			soft_unpack(soft_pack(&image[i]), &texels[lidx][i]);
+		texel_ptrs[lidx] = texels[lidx].data();
+	}
+	std::vector<float> out(w * h * 4);
+	soft_image_t ref;
+	ref.init(w, h);
+	compose_rows(texel_ptrs.data(), layer_max, layer_w, layer_h, nullptr, out.data(), w, h, 0, h);
+	for (size_t i = 0; i < ref.pixels.size(); i++)
+		ref.pixels[i] = soft_pack(&out[i * 4]);
+
+	auto render = [&](job_system_t *jobs, soft_renderer_t &soft) {
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			soft.draw(jobs, lidx, stores[lidx], ends[lidx], 1024);
+		soft.present(jobs);
+	};
+	auto same = [&](soft_renderer_t &soft) {
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			auto & img = soft.layers[lidx].image;
+			for (size_t i = 0; i < img.pixels.size(); i++) {
+				float c[4];
+				soft_unpack(img.pixels[i], c);
+				if (memcmp(c, &texels[lidx][i * 4], sizeof(c))) {
+					err("layer %d pixel (%zu, %zu) does not match the reference\n",
+						lidx, i % layer_w, i / layer_w);
+					return false;
+				}
+			}
+		}
+		if (soft.frame.pixels != ref.pixels) {
+			err("composed frame does not match the reference\n");
+			return false;
+		}
+		return true;
+	};
+
+	printf("soft layers=%d layer=%ux%u tiles=%ux%u out=%ux%u simd=%s\n",
+		layer_max, layer_w, layer_h, SoftTile, SoftTile, w, h, sprite_simd_name());
+	{
+		soft_renderer_t soft;
+		soft.init(layer_max, layer_w, layer_h, w, h);
+		render(nullptr, soft);
+		if (!same(soft))
+			return 1;
+		printf("  serial frame matches the reference, hash=%016llx\n",
+			(unsigned long long)ref.hash());
+	}
+
+	std::vector<int> thread_nums;
+	for (int threads = 1; threads < thread_max; threads *= 2)
+		thread_nums.push_back(threads);
+	thread_nums.push_back(std::max(1, thread_max));
+	for (int threads : thread_nums) {
+		job_system_t jobs;
+		soft_renderer_t soft;
+		jobs.init(threads);
+		soft.init(layer_max, layer_w, layer_h, w, h);
+		double t_draw = 0.0, t_present = 0.0;
+		for (int i = 0; i < loop_count; i++) {
+			double t = get_time_sec();
+			for (int lidx = 0; lidx < layer_max; lidx++)
+				soft.draw(&jobs, lidx, stores[lidx], ends[lidx], 1024);
+			t_draw += get_time_sec() - t;
+			t = get_time_sec();
+			soft.present(&jobs);
+			t_present += get_time_sec() - t;
+		}
+		jobs.term();
+		if (!same(soft))
+			return 1;
+		printf("  threads=%-2d: layers %8.2f Msprites/sec %8.2f Mpixels/sec, present %8.2f Mpixels/sec\n",
+			threads, soft.sprites / t_draw * 1e-6,
+			double(layer_w) * layer_h * layer_max * loop_count / t_draw * 1e-6,
+			double(w) * h * loop_count / t_present * 1e-6);
+	}
+	return 0;
+}
+
+//
+// Headless frames on the software backend : the scene of the D3D12 loop
+// without churn, frame hashes on stdout and dump%04d.ppm when dump is set.
+// cap != nullptr streams the frames through its ring, already complete.
+//
+int
+run_soft(int layer_max, uint32_t objects, uint32_t layer_w, uint32_t layer_h,
+	uint32_t w, uint32_t h, int frames, int thread_num, double world, const char *dump,
+	capture_t *cap)
+{
+	enum { Chunk = 512 };
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	std::vector<uint32_t> counts(layer_max, objects);
+	job_system_t jobs;
+	soft_renderer_t soft;
+
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		stores[lidx].init(std::max(objects, 1u));
+		stores[lidx].set_flags(0, objects, 1);
+	}
+	jobs.init(thread_num);
+	soft.init(layer_max, layer_w, layer_h, w, h);
+	double a_time = 0.0;
+	double t = get_time_sec();
+	for (int frame = 0; frame < frames; frame++) {
+		prof_t::get().frame();
+		a_time += 1.0 / 16.0f;
+		update_layers(jobs, stores.get(), counts.data(), layer_max, Chunk, a_time, world);
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			soft.draw(&jobs, lidx, stores[lidx], objects, Chunk);
+		soft.present(&jobs);
+		if (cap) {
+			int slot = cap->begin(true);
+			if (slot >= 0) {
+				memcpy((void *)cap->data[slot], soft.frame.pixels.data(), soft.frame.pixels.size() * 4);
+				cap->end(slot, 0);
+			}
+			cap->collect(0);
+		}
+		printf("frame %4d : %016llx\n", frame, (unsigned long long)soft.frame.hash());
+		if (dump) {
+			char path[1024];
+			snprintf(path, sizeof(path), "%s%04d.ppm", dump, frame);
+			if (!soft.frame.write_ppm(path)) {
+				err("can not write %s\n", path);
+				jobs.term();
+				return 1;
+			}
+		}
+	}
+	t = get_time_sec() - t;
+	jobs.term();
+	printf("soft frames=%d threads=%d : %.2f fps, %.2f Msprites/sec\n",
+		frames, thread_num, frames / t, soft.sprites / t * 1e-6);
+	if (cap) {
+		cap->collect(~0ull);
+		cap->term();
+		printf("capture %llu frames, %llu dropped, %.2f ms/frame%s\n",
+			(unsigned long long)cap->written.load(), (unsigned long long)cap->dropped,
+			cap->write_sec / std::max<uint64_t>(cap->written, 1) * 1e3, cap->failed ? ", write failed" : "");
+	}
+	return 0;
+}
+
+//
+// Scenes of -benchmark : objects per layer relative to -objects, the
+// animated fraction and the respawns per frame relative to the objects.
+// Churning scenes also swing the population, like -churn.
+//
+struct bench_scene_t {
+	const char *name;
+	double objects;
+	double animate;
+	double churn;
+};
+
+static const bench_scene_t bench_scenes[] = {
+	{ "sparse",  1.0 / 16, 1.0, 0.0 },
+	{ "dense",   4.0,      1.0, 0.0 },
+	{ "static",  1.0,      0.0, 0.0 },
+	{ "dynamic", 1.0,      1.0, 1.0 / 8 },
+};
+
+//
+// Headless frames of a scene, the CPU side of the D3D12 loop : capacity,
+// churn and the store update, the upload of the dirty ranges into the copy
+// of the frame in flight, update.hlsl on those ranges and, with raster,
+// the software layer and present passes.
+//
+bench_scene_result_t
+run_bench_scene(job_system_t &jobs, const bench_scene_t &scene, int layer_max, uint32_t objects,
+	uint32_t w, uint32_t h, int frames, int frame_count, bool raster, double world)
+{
+	enum { Chunk = 512, MergeGap = 16 };
+	struct gpu_layer_t {
+		uint32_t capacity = 0;
+		std::vector<ObjectFormat> obj;
+		std::vector<VertexFormat> vtx;
+		dirty_tracker_t dirty;
+	};
+	bench_scene_result_t ret;
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	std::vector<slot_allocator_t> slots(layer_max);
+	std::vector<std::vector<slot_handle_t>> handles(layer_max);
+	std::vector<gpu_layer_t> gpu(frame_count * layer_max);
+	std::vector<std::vector<dirty_range_t>> ranges(layer_max);
+	std::vector<ObjectFormat *> obj_ptrs(layer_max);
+	std::vector<uint32_t> counts(layer_max);
+	std::vector<layer_chunk_t> chunks;
+	upload_stats_t stats;
+	soft_renderer_t soft;
+	uint32_t scene_objects = std::max(uint32_t(objects * scene.objects), 1u);
+	uint32_t churn = uint32_t(scene_objects * scene.churn);
+
+	ret.name = scene.name;
+	ret.objects = scene_objects;
+	ret.animate = scene.animate;
+	ret.churn = churn;
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		stores[lidx].init(LayerCapacityMin);
+		slots[lidx].init(LayerCapacityMin);
+	}
+	for (auto & g : gpu)
+		g.dirty.init(0, 0);
+	if (raster)
+		soft.init(layer_max, w / 2, h / 2, w, h);
+
+	for (int frame = 0; frame < frames; frame++) {
+		int slot = frame % frame_count;
+		double a_time = (frame + 1) / 16.0;
+		uint32_t target = churn ? uint32_t(scene_objects * (0.625 + 0.375 * cos(a_time * 0.5))) : scene_objects;
+		prof_t::get().frame();
+		double t0 = get_time_sec();
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			auto mark = [&gpu, frame_count, layer_max, lidx](uint32_t s) {
+				for (int f = 0; f < frame_count; f++)
+					gpu[f * layer_max + lidx].dirty.mark(s, s + 1);
+			};
+			if (fit_layer_capacity(slots[lidx], stores[lidx], target, false, mark)) {
+				for (int f = 0; f < frame_count; f++)
+					gpu[f * layer_max + lidx].dirty.resize(slots[lidx].capacity);
+			}
+			churn_layer(slots[lidx], handles[lidx], stores[lidx], lidx, frame, churn, target, a_time, mark, world);
+			if (slots[lidx].need_compact())
+				compact_layer(slots[lidx], stores[lidx], mark);
+			counts[lidx] = uint32_t(slots[lidx].end() * scene.animate);
+		}
+		update_layers(jobs, stores.get(), counts.data(), layer_max, Chunk, a_time, world);
+		for (int f = 0; f < frame_count; f++)
+			for (int lidx = 0; lidx < layer_max; lidx++)
+				gpu[f * layer_max + lidx].dirty.mark(0, counts[lidx]);
+		double t1 = get_time_sec();
+
+		//this frame's copies are idle : reallocate, then upload the dirty ranges.
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			auto & g = gpu[slot * layer_max + lidx];
+			uint32_t cap = slots[lidx].capacity;
+			if (g.capacity != cap) {
+				g.capacity = cap;
+				g.obj.resize(cap);
+				g.vtx.resize(size_t(cap) * 6);
+				g.dirty.init(cap, 0);
+				g.dirty.mark_all();
+			}
+			g.dirty.get_ranges(ranges[lidx], MergeGap);
+			g.dirty.clear();
+			dirty_clip(ranges[lidx], slots[lidx].end());
+			obj_ptrs[lidx] = g.obj.data();
+			stats.add(ranges[lidx], sizeof(ObjectFormat));
+		}
+		flush_layers(jobs, stores.get(), ranges.data(), obj_ptrs.data(), nullptr, layer_max, Chunk);
+		double t2 = get_time_sec();
+
+		split_layer_chunks(chunks, ranges.data(), layer_max, Chunk);
+		jobs.parallel_for(chunks.size(), 1, [&](int job_begin, int job_end) {
+			PROF_SCOPE("expand job");
+			for (int j = job_begin; j < job_end; j++) {
+				auto & c = chunks[j];
+				auto & g = gpu[slot * layer_max + c.lidx];
+				sprite_expand(&g.obj[c.begin], &g.vtx[size_t(c.begin) * 6], c.end - c.begin);
+			}
+		});
+		double t3 = get_time_sec();
+
+		if (raster) {
+			for (int lidx = 0; lidx < layer_max; lidx++)
+				soft.draw(&jobs, lidx, stores[lidx], slots[lidx].end(), Chunk);
+			soft.present(&jobs);
+		}
+		double t4 = get_time_sec();
+		ret.update.add(t1 - t0);
+		ret.upload.add(t2 - t1);
+		ret.expand.add(t3 - t2);
+		if (raster)
+			ret.raster.add(t4 - t3);
+		ret.frame.add(t4 - t0);
+		stats.frame();
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			ret.sprites += slots[lidx].live;
+	}
+	ret.upload_bytes = double(stats.bytes);
+	ret.copies = double(stats.copies);
+	return (ret);
+}
+
+//JSON report to path, stdout when null.
+int
+bench_write_json(const char *path, const char *backend, int threads, int layer_max,
+	uint32_t w, uint32_t h, const std::vector<bench_scene_result_t> &scenes)
+{
+	FILE *fp = path ? fopen(path, "w") : stdout;
+	if (!fp) {
+		err("can not open %s\n", path);
+		return 1;
+	}
+	bench_report_json(fp, backend, sprite_simd_name(), threads, layer_max, w, h, scenes);
+	if (path)
+		fclose(fp);
+	return 0;
+}
+
+//
+// -benchmark : a fixed number of frames of one scene or of all of them,
+// no window and no vsync, so it runs on CI. Timings go out as JSON.
+//
+int
+run_benchmark(const char *name, int layer_max, uint32_t objects, uint32_t w, uint32_t h,
+	int frames, int frame_count, int thread_num, bool raster, double world, const char *json)
+{
+	std::vector<bench_scene_result_t> results;
+	job_system_t jobs;
+
+	jobs.init(thread_num);
+	for (auto & scene : bench_scenes) {
+		if (strcmp(name, "all") && strcmp(name, scene.name))
+			continue;
+		results.push_back(run_bench_scene(jobs, scene, layer_max, objects, w, h,
+			frames, frame_count, raster, world));
+		auto & r = results.back();
+		if (json)
+			printf("%-8s : frame p50 %.3f ms, p99 %.3f ms, %.0f upload bytes/frame\n",
+				r.name, r.frame.percentile(50) * 1e3, r.frame.percentile(99) * 1e3,
+				r.upload_bytes / frames);
+	}
+	jobs.term();
+	if (results.empty()) {
+		err("unknown scene %s, try all, sparse, dense, static or dynamic\n", name);
+		return 1;
+	}
+	return bench_write_json(json, raster ? "soft" : "cpu", thread_num, layer_max, w, h, results);
+}
+
+//
+// Output of -capture, "-" is stdout : the text output moves to stderr so
+// the pipe only gets frames.
+//
+FILE *
+capture_open(const char *path)
+{
+	if (strcmp(path, "-"))
+		return fopen(path, "wb");
+	fflush(stdout);
+#ifdef _WIN32
+	int fd = _dup(1);
+	_dup2(2, 1);
+	_setmode(fd, _O_BINARY);
+	return _fdopen(fd, "wb");
+#else
+	int fd = dup(1);
+	dup2(2, 1);
+	return fdopen(fd, "wb");
+#endif
+}
+
+//
+// Capture ring and writer (capture.h) with a mock producer : frames are
+// painted into the readback slots and complete on a mock GPU timeline.
+// Paced at fps no frame may be dropped, unpaced the render thread must
+// drop frames rather than wait. The written stream has to match the
+// frames converted in order.
+//
+int
+bench_capture(uint32_t w, uint32_t h, int frame_max, int fps, int slot_num)
+{
+	using namespace std::chrono;
+	uint32_t pitch = capture_t::pitch(w);
+	auto paint = [w, h, pitch](uint8_t *dst, int frame) {
+		for (uint32_t y = 0; y < h; y++) {
+			uint32_t *row = (uint32_t *)(dst + size_t(y) * pitch);
+			for (uint32_t x = 0; x < w; x++)
+				row[x] = ((x + frame) & 0xFF) | (((y + frame * 3) & 0xFF) << 8) | (((x ^ y) & 0xFF) << 16) | 0xFF000000u;
+		}
+	};
+	auto fnv = [](uint64_t h, const void *p, size_t n) {
+		auto b = (const uint8_t *)p;
+		for (size_t i = 0; i < n; i++)
+			h = (h ^ b[i]) * 0x100000001b3ULL;
+		return h;
+	};
+
+	printf("capture %ux%u frames=%d fps=%d slots=%d\n", w, h, frame_max, fps, slot_num);
+	for (int paced = 1; paced >= 0; paced--) {
+		for (int format = CaptureRaw; format <= CaptureY4m; format++) {
+			mock_timeline_t timeline;
+			frame_scheduler_t sched;
+			capture_t cap;
+			std::vector<std::vector<uint8_t>> mem(slot_num, std::vector<uint8_t>(size_t(pitch) * h));
+			std::vector<const uint8_t *> ptrs;
+			std::vector<int> frames;
+			uint64_t hash = 0xcbf29ce484222325ULL;
+			for (auto & m : mem)
+				ptrs.push_back(m.data());
+			timeline.init(0);
+			sched.init(&timeline, 2);
+			cap.init([&hash, &fnv](const void *p, size_t n) { hash = fnv(hash, p, n); return true; },
+				format, w, h, pitch, fps, ptrs);
+
+			double t_render = 0.0;
+			double t_max = 0.0;
+			auto start = steady_clock::now();
+			for (int i = 0; i < frame_max; i++) {
+				if (paced)
+					std::this_thread::sleep_until(start + microseconds(int64_t(i * 1e6 / fps)));
+				int fslot = sched.next_slot();
+				sched.begin(fslot);
+				auto t = steady_clock::now();
+				int slot = cap.begin();
+				double dt = duration<double>(steady_clock::now() - t).count();
+				//the GPU copy of the frame.
+				if (slot >= 0) {
+					paint(mem[slot].data(), i);
+					frames.push_back(i);
+				}
+				timeline.work(2000);
+				uint64_t value = sched.end(fslot);
+				t = steady_clock::now();
+				if (slot >= 0)
+					cap.end(slot, value);
+				cap.collect(timeline.completed());
+				dt += duration<double>(steady_clock::now() - t).count();
+				t_render += dt;
+				t_max = std::max(t_max, dt);
+			}
+			sched.flush();
+			cap.collect(~0ull);
+			cap.term();
+			double t = duration<double>(steady_clock::now() - start).count();
+			timeline.term();
+
+			uint64_t expect = 0xcbf29ce484222325ULL;
+			std::vector<uint8_t> src(size_t(pitch) * h);
+			std::vector<uint8_t> out;
+			if (format == CaptureY4m) {
+				char header[128];
+				int n = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", w, h, fps);
+				expect = fnv(expect, header, n);
+			}
+			for (int i : frames) {
+				paint(src.data(), i);
+				capture_convert(format, src.data(), w, h, pitch, out);
+				expect = fnv(expect, out.data(), out.size());
+			}
+			printf("  %-7s %-4s : %6.1f fps, %llu written %llu dropped, writer %5.2f ms/frame, render thread %5.1f us/frame (max %5.1f us)\n",
+				paced ? "paced" : "unpaced", format == CaptureY4m ? "y4m" : "raw",
+				frame_max / t, (unsigned long long)cap.written.load(), (unsigned long long)cap.dropped,
+				cap.write_sec / std::max<uint64_t>(cap.written, 1) * 1e3,
+				t_render / frame_max * 1e6, t_max * 1e6);
+			if (cap.written != frames.size() || cap.captured + cap.dropped != uint64_t(frame_max)) {
+				err("frames are missing\n");
+				return 1;
+			}
+			if (hash != expect) {
+				err("written stream does not match the frames\n");
+				return 1;
+			}
+			if (paced && cap.dropped) {
+				err("dropped frames at %d fps\n", fps);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static std::vector<std::string>
+list_dir(const std::string &dir)
+{
+	std::vector<std::string> ret;
+#ifdef _WIN32
+	WIN32_FIND_DATAA fd;
+	HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+	if (h == INVALID_HANDLE_VALUE)
+		return (ret);
+	do {
+		if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			ret.push_back(fd.cFileName);
+	} while (FindNextFileA(h, &fd));
+	FindClose(h);
+#else
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return (ret);
+	while (auto e = readdir(d))
+		if (e->d_name[0] != '.')
+			ret.push_back(e->d_name);
+	closedir(d);
+#endif
+	return (ret);
+}
+
+//
+// Shader cache (cache.h) with a fake compiler in a temporary directory :
+// cold and warm starts, edits of an included file, defines, flags and the
+// compiler version as new keys, corrupt and truncated entries, compile
+// errors, pipeline blobs and no temporary file left behind.
+//
+int
+check_cache()
+{
+#ifdef _WIN32
+	char tmp[MAX_PATH];
+	GetTempPathA(MAX_PATH, tmp);
+	std::string dir = std::string(tmp) + "tanbo_cache_check";
+	std::string src = dir + "_src";
+	CreateDirectoryA(src.c_str(), nullptr);
+#else
+	char tmp_src[] = "/tmp/tanbo_cache_srcXXXXXX";
+	if (!mkdtemp(tmp_src)) {
+		err("can not create a temporary directory\n");
+		return 1;
+	}
+	std::string src = tmp_src;
+	std::string dir = src + "/cache";
+#endif
+	auto write = [](const std::string &path, const std::string &text) {
+		FILE *fp = fopen(path.c_str(), "wb");
+		if (fp) {
+			fwrite(text.data(), 1, text.size(), fp);
+			fclose(fp);
+		}
+	};
+	//bytecode : hash of the source with its includes and the desc, plus a few ms of work.
+	int compiles = 0;
+	auto fake = [&compiles](const shader_desc_t &d, std::vector<uint8_t> &code, std::string &error) {
+		shader_cache_t plain;
+		if (d.entry == "Broken") {
+			error = d.path + "(1,1): error X3000: syntax error";
+			return false;
+		}
+		compiles++;
+		uint64_t h = plain.source_hash(d.path);
+		h = cache_hash(h, d.entry);
+		h = cache_hash(h, d.profile);
+		for (auto & m : d.defines)
+			h = cache_hash(h, m.first + "=" + m.second);
+		double t = get_time_sec();
+		while (get_time_sec() - t < 0.002)
+			h = cache_hash(h, &t, sizeof(t));
+		code.assign(64 + d.entry.size(), 0);
+		memcpy(code.data(), "FAKE", 4);
+		memcpy(&code[8], &h, sizeof(h));
+		memcpy(&code[64], d.entry.data(), d.entry.size());
+		return true;
+	};
+	write(src + "/format.h", "struct ObjectFormat { float4 pos; };\n");
+	write(src + "/draw.hlsl", "#include \"format.h\"\nfloat4 VSMain() : SV_Position { return 0; }\n");
+	write(src + "/update.hlsl", "  #include \"format.h\"\n[numthreads(256, 1, 1)] void CSMain() {}\n");
+	write(src + "/clear.hlsl", "float4 VSMain() : SV_Position { return 0; }\n");
+
+	std::vector<shader_desc_t> descs(4);
+	descs[0] = { src + "/draw.hlsl", "VSMain", "vs_5_1", 1, {} };
+	descs[1] = { src + "/draw.hlsl", "PSMain", "ps_5_1", 1, {} };
+	descs[2] = { src + "/update.hlsl", "CSMain", "cs_5_1", 1, { { "PACKED", "1" } } };
+	descs[3] = { src + "/clear.hlsl", "VSMain", "vs_5_1", 1, {} };
+	std::vector<std::vector<uint8_t>> cold;
+	int fails = 0;
+	//a new cache per start, as a new process. expect hits and compiles.
+	auto start = [&](const char *name, const char *version, int hits, int expect_compiles) {
+		shader_cache_t cache;
+		compiles = 0;
+		cache.init(dir, version, fake);
+		double t = get_time_sec();
+		std::vector<std::vector<uint8_t>> codes;
+		for (auto & d : descs) {
+			cache_blob_t blob;
+			if (!cache.shader(d, blob))
+				fails++;
+			codes.emplace_back(blob.data(), blob.data() + blob.size());
+		}
+		t = get_time_sec() - t;
+		printf("cache %-16s : %.2f ms, %llu hits, %llu misses, %llu rejected, %d compiles\n", name, t * 1e3,
+			(unsigned long long)cache.hits, (unsigned long long)cache.misses,
+			(unsigned long long)cache.rejected, compiles);
+		if (int(cache.hits) != hits || compiles != expect_compiles) {
+			err("%s : expected %d hits and %d compiles\n", name, hits, expect_compiles);
+			fails++;
+		}
+		if (cold.empty())
+			cold = codes;
+		return codes;
+	};
+
+	start("cold", "fake 1", 0, 4);
+	if (start("warm", "fake 1", 4, 0) != cold) {
+		err("warm bytecode does not match the cold one\n");
+		fails++;
+	}
+	write(src + "/format.h", "struct ObjectFormat { float4 pos; float4 color; };\n");
+	auto edited = start("include edited", "fake 1", 1, 3);
+	if (edited[3] != cold[3] || edited[0] == cold[0] || edited[2] == cold[2]) {
+		err("an include edit has to change exactly the shaders that include it\n");
+		fails++;
+	}
+	descs[2].defines[0].second = "0";
+	descs[1].flags = 2;
+	start("define and flags", "fake 1", 2, 2);
+	start("compiler version", "fake 2", 0, 4);
+	start("warm again", "fake 2", 4, 0);
+
+	//damage two entries : a flipped byte and a cut file.
+	shader_cache_t cache;
+	cache.init(dir, "fake 2", fake);
+	std::string corrupt = cache.entry_path(cache.shader_key(descs[0]), CacheShader);
+	std::string cut = cache.entry_path(cache.shader_key(descs[3]), CacheShader);
+	{
+		std::string text;
+		shader_cache_t::read_file(corrupt, text);
+		text.back() ^= 1;
+		write(corrupt, text);
+		shader_cache_t::read_file(cut, text);
+		text.resize(text.size() / 2);
+		write(cut, text);
+	}
+	start("corrupt entries", "fake 2", 2, 2);
+	start("repaired", "fake 2", 4, 0);
+
+	//compile errors are not cached, pipeline blobs are kept apart from shaders.
+	shader_desc_t broken = { src + "/draw.hlsl", "Broken", "ps_5_1", 0, {} };
+	cache_blob_t blob;
+	std::string error;
+	if (cache.shader(broken, blob, nullptr, &error) || error.find("X3000") == std::string::npos ||
+		cache.load(cache.shader_key(broken), CacheShader, blob)) {
+		err("a failed compile has to report its error and store nothing\n");
+		fails++;
+	}
+	uint64_t keys[2] = { cache.shader_key(descs[0]), cache.shader_key(descs[1]) };
+	uint64_t pso_key = shader_cache_t::pipeline_key(keys, 2, "rgba8", 5);
+	static const char pso[] = "driver blob";
+	cache.store(pso_key, CachePipeline, pso, sizeof(pso));
+	if (!cache.load(pso_key, CachePipeline, blob) || blob.size() != sizeof(pso) ||
+		memcmp(blob.data(), pso, sizeof(pso)) || cache.load(pso_key, CacheShader, blob) ||
+		cache.load(keys[0], CachePipeline, blob)) {
+		err("pipeline blob round trip failed\n");
+		fails++;
+	}
+	blob.map.close();
+
+	//no cache directory : compile every time.
+	shader_cache_t none;
+	none.init("", "fake 2", fake);
+	compiles = 0;
+	none.shader(descs[0], blob);
+	none.shader(descs[0], blob);
+	if (compiles != 2 || none.hits) {
+		err("without a directory every shader has to compile\n");
+		fails++;
+	}
+
+	auto names = list_dir(dir);
+	for (auto & n : names) {
+		if (n.find(".tmp") != std::string::npos) {
+			err("temporary file %s left\n", n.c_str());
+			fails++;
+		}
+		remove((dir + "/" + n).c_str());
+	}
+	printf("cache entries : %zu\n", names.size());
+	for (auto n : { "format.h", "draw.hlsl", "update.hlsl", "clear.hlsl" })
+		remove((src + "/" + n).c_str());
+#ifdef _WIN32
+	RemoveDirectoryA(dir.c_str());
+	RemoveDirectoryA(src.c_str());
+#else
+	rmdir(dir.c_str());
+	rmdir(src.c_str());
+#endif
+	if (fails)
+		return 1;
+	printf("cache ok\n");
+	return 0;
+}
+
+//
+// Heap sub-allocator (mem.h) on fake heaps of host memory : random
+// allocations and frees with alignments of 256 bytes to 64 KB, each filled
+// with its own pattern, checked for overlaps, alignment and the block list
+// of every heap. Then defragmentation moves the data of the emptiest heaps
+// with memcpy until they are released, and the allocation rate against
+// malloc.
+//
+int
+check_mem(int ops)
+{
+	const uint64_t heap_size = 4 << 20;
+	mem_heaps_t mem;
+	int fails = 0;
+	uint64_t rng_n = 0;
+	const uint32_t key[2] = { 0x6d656d, 0 };
+	auto rnd = [&rng_n, &key]() {
+		uint32_t ctr[4] = { uint32_t(rng_n), uint32_t(rng_n >> 32), 0, 0 }, r[4];
+		rng_n++;
+		rng_philox(ctr, key, r);
+		return r[0];
+	};
+	mem.init(heap_size, [](uint64_t n, void *&heap) {
+		heap = new std::vector<uint8_t>(n);
+		return true;
+	}, [](void *heap) {
+		delete (std::vector<uint8_t> *)heap;
+	});
+	auto data = [&mem](uint32_t id) {
+		return ((std::vector<uint8_t> *)mem.heap(id))->data() + mem.get(id).offset;
+	};
+	auto fill = [&](uint32_t id, uint8_t tag) {
+		memset(data(id), tag, size_t(mem.get(id).size));
+	};
+	auto verify = [&](const std::vector<uint32_t> &ids, const std::vector<uint8_t> &tags) {
+		for (size_t i = 0; i < ids.size(); i++) {
+			auto p = data(ids[i]);
+			for (uint64_t b = 0; b < mem.get(ids[i]).size; b += 97)
+				if (p[b] != tags[i]) {
+					err("allocation %u overwritten\n", ids[i]);
+					return false;
+				}
+		}
+		//blocks of a heap : address order, no gaps, no free neighbours.
+		for (auto h : mem.heaps) {
+			if (!h)
+				continue;
+			auto & t = h->tlsf;
+			uint64_t end = 0, used = 0;
+			bool prev_free = false;
+			for (uint32_t b = 0; b != mem_tlsf_t::Invalid; b = t.blocks[b].next_phys) {
+				auto & blk = t.blocks[b];
+				if (blk.offset != end || (prev_free && blk.free)) {
+					err("heap blocks broken at %llu\n", (unsigned long long)blk.offset);
+					return false;
+				}
+				end += blk.size;
+				used += blk.free ? 0 : blk.size;
+				prev_free = blk.free;
+			}
+			if (end != t.size || used != t.used) {
+				err("heap of %llu bytes covers %llu, %llu used of %llu\n", (unsigned long long)t.size,
+					(unsigned long long)end, (unsigned long long)used, (unsigned long long)t.used);
+				return false;
+			}
+		}
+		return true;
+	};
+
+	std::vector<uint32_t> ids;
+	std::vector<uint8_t> tags;
+	for (int i = 0; i < ops && !fails; i++) {
+		uint32_t r = rnd();
+		//a working set of about 1024.
+		if (ids.size() > 1024 || (ids.size() > 64 && (r & 3) == 0)) {
+			uint32_t k = rnd() % ids.size();
+			mem.free(ids[k]);
+			ids[k] = ids.back();
+			tags[k] = tags.back();
+			ids.pop_back();
+			tags.pop_back();
+			continue;
+		}
+		//mostly small buffers, now and then one past the heap size.
+		uint64_t bytes = (r >> 8) % 512 == 0 ? heap_size + (rnd() & 0xFFFFF) : 1 + rnd() % (1 << (8 + (r >> 2) % 11));
+		uint64_t align = uint64_t(256) << (rnd() % 9);
+		uint32_t id = mem.alloc(bytes, align);
+		if (id == mem_heaps_t::Invalid || mem.get(id).offset % align || mem.get(id).size < bytes) {
+			err("alloc of %llu at %llu failed\n", (unsigned long long)bytes, (unsigned long long)align);
+			fails++;
+			break;
+		}
+		ids.push_back(id);
+		tags.push_back(uint8_t(i));
+		fill(id, uint8_t(i));
+		if (i % 4096 == 0 && !verify(ids, tags))
+			fails++;
+	}
+	if (!fails && !verify(ids, tags))
+		fails++;
+	mem.report(stdout, "churn ");
+
+	//free most of it at random, then move the emptiest heaps out.
+	for (size_t k = 0; k < ids.size(); ) {
+		if (rnd() % 4) {
+			mem.free(ids[k]);
+			ids[k] = ids.back();
+			tags[k] = tags.back();
+			ids.pop_back();
+			tags.pop_back();
+		} else {
+			k++;
+		}
+	}
+	mem.report(stdout, "sparse");
+	std::vector<mem_move_t> moves;
+	uint64_t reserved = mem.reserved();
+	int passes = 0;
+	while (!fails && mem.defrag([](uint32_t) { return true; }, 8 << 20, moves)) {
+		for (auto & m : moves) {
+			auto from = (std::vector<uint8_t> *)mem.heaps[m.from.heap]->heap;
+			auto to = (std::vector<uint8_t> *)mem.heaps[m.to.heap]->heap;
+			memcpy(to->data() + m.to.offset, from->data() + m.from.offset, size_t(m.from.size));
+			if (m.to.offset % m.from.align) {
+				err("moved allocation lost its alignment\n");
+				fails++;
+			}
+		}
+		for (auto & m : moves)
+			mem.finish(m);
+		passes++;
+		if (!verify(ids, tags))
+			fails++;
+	}
+	mem.report(stdout, "defrag");
+	printf("defrag : %d passes, %.1f MB moved, %.1f -> %.1f MB of heaps\n", passes, mem.moved / 1048576.0,
+		reserved / 1048576.0, mem.reserved() / 1048576.0);
+	for (auto id : ids)
+		mem.free(id);
+	if (mem.used() != 0 || mem.reserved() != heap_size) {
+		err("%llu bytes used, %llu reserved after freeing everything\n",
+			(unsigned long long)mem.used(), (unsigned long long)mem.reserved());
+		fails++;
+	}
+
+	//rate : a working set of 4096 buffers of 256 bytes .. 16 KB.
+	const int n = 4096, loop = 1 << 20;
+	std::vector<uint32_t> work(n, mem_heaps_t::Invalid);
+	std::vector<void *> work_malloc(n, nullptr);
+	std::vector<uint32_t> sizes(loop);
+	for (auto & s : sizes)
+		s = 256 + rnd() % (16 << 10);
+	double t = get_time_sec();
+	for (int i = 0; i < loop; i++) {
+		auto & w = work[(i * 2654435761u) % n];
+		if (w != mem_heaps_t::Invalid)
+			mem.free(w);
+		w = mem.alloc(sizes[i], 256);
+	}
+	double t_mem = get_time_sec() - t;
+	t = get_time_sec();
+	for (int i = 0; i < loop; i++) {
+		auto & w = work_malloc[(i * 2654435761u) % n];
+		::free(w);
+		w = malloc(sizes[i]);
+	}
+	double t_malloc = get_time_sec() - t;
+	for (auto w : work_malloc)
+		::free(w);
+	mem.report(stdout, "rate  ");
+	printf("rate : %.1f ns per free + alloc, malloc %.1f ns\n", t_mem * 1e9 / loop, t_malloc * 1e9 / loop);
+	if (fails)
+		return 1;
+	printf("mem ok\n");
+	return 0;
+}
+
+//
+// Fake storage and mock GPU of the ring checks (check_desc, check_upload,
+// check_tex). add() makes a numbered storage of bytes, keys start at 1.
+// release() fails on storage released twice, or while reader(key) gives
+// the fence of a frame in flight that still reads it. Frames run on a mock
+// timeline with 3 frames in flight, done is the fence completed when the
+// frame began.
+//
+struct ring_fixture_t {
+	struct storage_t {
+		std::vector<uint8_t> bytes;
+		bool alive;
+	};
+
+	const char *what;
+	std::vector<storage_t> storage;
+	std::function<uint64_t(uintptr_t)> reader;
+	mock_timeline_t timeline;
+	frame_scheduler_t sched;
+	uint64_t done = 0;
+	int fails = 0;
+
+	ring_fixture_t(const char *name) : what(name)
+	{
+		timeline.init(0);
+		sched.init(&timeline, 3);
+	}
+
+	uintptr_t add(uint64_t bytes)
+	{
+		storage.push_back({ std::vector<uint8_t>(bytes), true });
+		return storage.size();
+	}
+
+	void release(uintptr_t key)
+	{
+		auto & s = storage[key - 1];
+		uint64_t fence = reader ? reader(key) : 0;
+		if (fence) {
+			err("%s released while the frame of fence %llu reads it\n", what, (unsigned long long)fence);
+			fails++;
+		}
+		if (!s.alive) {
+			err("%s released twice\n", what);
+			fails++;
+		}
+		s.alive = false;
+		s.bytes.clear();
+		s.bytes.shrink_to_fit();
+	}
+
+	size_t alive(size_t first = 0) const
+	{
+		size_t ret = 0;
+		for (size_t i = first; i < storage.size(); i++)
+			ret += storage[i].alive;
+		return (ret);
+	}
+
+	//upload buffers on the storage.
+	upload_create_t upload_create()
+	{
+		return [this](uint64_t size, upload_buffer_t &b) {
+			uintptr_t key = add(size);
+			b.resource = (void *)key;
+			b.cpu = storage[key - 1].bytes.data();
+			b.gpu = uint64_t(key) << 40;
+			b.size = size;
+			return true;
+		};
+	}
+
+	upload_release_t upload_release()
+	{
+		return [this](upload_buffer_t &b) {
+			release(uintptr_t(b.resource));
+		};
+	}
+
+	//slot of the next frame, once its previous frame completed.
+	int begin()
+	{
+		int slot = sched.next_slot();
+		sched.begin(slot);
+		done = timeline.completed();
+		return slot;
+	}
+
+	//fence of the frame, after usec of GPU work.
+	uint64_t end(int slot, double usec)
+	{
+		timeline.work(usec);
+		return sched.end(slot);
+	}
+
+	void flush()
+	{
+		sched.flush();
+		done = timeline.completed();
+	}
+};
+
+//
+// Descriptor allocators (desc.h) against fake heaps : a pool paging past
+// its first heap, free ranges merging back, ranges larger than a page,
+// then a ring of tables over frames in flight on a mock GPU whose demand
+// jumps past the heap, checked for tables overwritten or heaps released
+// while a frame in flight still reads them.
+//
+int
+check_desc(int frame_max)
+{
+	const uint32_t inc = 32;
+	//a heap is a storage of uint64_t cells.
+	ring_fixture_t fx("heap");
+	int &fails = fx.fails;
+	std::vector<std::pair<uint64_t, desc_range_t>> in_flight;  //fence, table
+	auto create = [&fx](bool visible) -> desc_create_t {
+		return [&fx, visible](uint32_t num, desc_heap_t &h) {
+			uintptr_t key = fx.add(uint64_t(num) * sizeof(uint64_t));
+			h.heap = (void *)key;
+			h.cpu = uint64_t(key) << 32;
+			h.gpu = visible ? h.cpu | (1ull << 63) : 0;
+			h.size = num;
+			return true;
+		};
+	};
+	auto cell = [&fx, inc](uint64_t cpu) -> uint64_t & {
+		return ((uint64_t *)fx.storage[(cpu >> 32) - 1].bytes.data())[(cpu & 0xFFFFFFFF) / inc];
+	};
+	desc_release_t release = [&fx](desc_heap_t &h) {
+		fx.release(uintptr_t(h.heap));
+	};
+	fx.reader = [&](uintptr_t key) -> uint64_t {
+		for (auto & f : in_flight)
+			if (f.first > fx.done && (f.second.cpu >> 32) == key)
+				return f.first;
+		return 0;
+	};
+
+	desc_pool_t pool;
+	std::vector<desc_range_t> ranges(200);
+	pool.init(inc, 64, create(false), release);
+	for (uint32_t i = 0; i < ranges.size(); i++) {
+		pool.alloc(1, ranges[i]);
+		cell(ranges[i].cpu) = i + 1;
+	}
+	for (uint32_t i = 0; i < ranges.size(); i++)
+		if (cell(ranges[i].cpu) != i + 1) {
+			err("descriptor %u shared\n", i);
+			fails++;
+		}
+	if (pool.pages.size() != 4 || pool.live != 200) {
+		err("200 descriptors in %zu pages, %u live\n", pool.pages.size(), pool.live);
+		fails++;
+	}
+	//every other one of the first page, then the rest : one free range again.
+	for (uint32_t i = 0; i < 64; i += 2)
+		pool.free(ranges[i]);
+	desc_range_t r;
+	pool.alloc(2, r);
+	if (r.page == 0) {
+		err("2 descriptors in holes of 1\n");
+		fails++;
+	}
+	pool.free(r);
+	for (uint32_t i = 1; i < 64; i += 2)
+		pool.free(ranges[i]);
+	if (pool.pages[0].free.size() != 1 || pool.pages[0].free[0].num != 64) {
+		err("free ranges of the first page did not merge\n");
+		fails++;
+	}
+	pool.alloc(64, r);
+	if (r.page != 0 || r.offset != 0 || r.cpu_at(63) != pool.pages[0].heap.cpu + 63 * inc) {
+		err("the whole first page was not reused\n");
+		fails++;
+	}
+	desc_range_t big;
+	pool.alloc(100, big);
+	if (pool.pages.size() != 5 || pool.pages[big.page].heap.size != 100) {
+		err("100 descriptors did not get a page of their own\n");
+		fails++;
+	}
+	printf("pool : %zu pages, %u live, %u peak, %zu heaps created\n",
+		pool.pages.size(), pool.live, pool.peak, fx.storage.size());
+
+	double t = get_time_sec();
+	const int loop = 1 << 20;
+	std::vector<desc_range_t> churn(256);
+	for (int i = 0; i < loop; i++) {
+		auto & c = churn[(i * 97) & 255];
+		pool.free(c);
+		pool.alloc(1 + (i & 3), c);
+	}
+	printf("pool : %.1f ns per free + alloc\n", (get_time_sec() - t) * 1e9 / loop);
+	pool.term();
+
+	//tables of 24 .. 280 descriptors, a few frames of 900 : the ring has to grow.
+	desc_ring_t ring;
+	size_t heap_base = fx.storage.size();
+	ring.init(inc, 256, create(true), release);
+	size_t descriptors = 0;
+	for (int f = 0; f < frame_max; f++) {
+		int slot = fx.begin();
+		uint64_t done = fx.done;
+		ring.retire(done);
+		in_flight.erase(std::remove_if(in_flight.begin(), in_flight.end(),
+			[&done](const std::pair<uint64_t, desc_range_t> &p) { return p.first <= done; }), in_flight.end());
+		std::vector<desc_range_t> tables;
+		uint32_t need = (f % 50 == 49) ? 900 : 24 + (f * 37) % 257;
+		while (need) {
+			uint32_t n = std::min(need, 8u + (f * 13 + need) % 120);
+			desc_range_t table;
+			if (!ring.alloc(n, table)) {
+				err("ring alloc of %u failed\n", n);
+				return 1;
+			}
+			if (table.gpu >> 63 == 0 || (table.cpu & 0xFFFFFFFF) / inc + n > fx.storage[(table.cpu >> 32) - 1].bytes.size() / sizeof(uint64_t)) {
+				err("table out of its heap\n");
+				fails++;
+			}
+			for (uint32_t i = 0; i < n; i++)
+				cell(table.cpu_at(i)) = uint64_t(f + 1) << 16 | i;
+			tables.push_back(table);
+			need -= n;
+			descriptors += n;
+		}
+		for (auto & p : in_flight) {
+			auto & table = p.second;
+			bool ok = fx.storage[(table.cpu >> 32) - 1].alive;
+			for (uint32_t i = 0; ok && i < table.num; i++)
+				ok = (cell(table.cpu_at(i)) & 0xFFFF) == i && (cell(table.cpu_at(i)) >> 16) != uint64_t(f + 1);
+			if (!ok) {
+				err("frame %d overwrote a table of fence %llu\n", f, (unsigned long long)p.first);
+				fails++;
+				break;
+			}
+		}
+		uint64_t value = fx.end(slot, 200.0);
+		ring.close(value);
+		for (auto & table : tables)
+			in_flight.push_back({ value, table });
+	}
+	fx.flush();
+	ring.retire(fx.done);
+	size_t alive = fx.alive(heap_base);
+	if (!ring.old.empty() || alive != 1 || ring.grows == 0) {
+		err("ring : %zu old heaps, %zu alive, %u grows\n", ring.old.size(), alive, ring.grows);
+		fails++;
+	}
+	printf("ring : %d frames, %.1f descriptors/frame, %u grows, heap of %u\n",
+		frame_max, double(descriptors) / frame_max, ring.grows, ring.buffer.size);
+	ring.term();
+	if (fails)
+		return 1;
+	printf("desc ok\n");
+	return 0;
+}
+
+//
+// Upload ring (upload.h) on fake buffers and a mock GPU : frames of
+// allocations with mixed alignments, now and then one far past the
+// buffer, each filled with a tag of its frame and checked while its frame
+// is in flight, so nothing is overwritten or released before its fence.
+// Then the dirty ranges of a few layers go through flush_layers() into the
+// ring, plain and packed, are copied at their offsets into per frame
+// copies and compared against the stores.
+//
+int
+check_upload(int frame_max)
+{
+	struct live_t {
+		uint64_t fence;
+		upload_alloc_t a;
+		uint8_t tag;
+	};
+	ring_fixture_t fx("buffer");
+	int &fails = fx.fails;
+	std::vector<live_t> in_flight;
+	upload_create_t create = fx.upload_create();
+	upload_release_t release = fx.upload_release();
+	fx.reader = [&](uintptr_t key) -> uint64_t {
+		for (auto & l : in_flight)
+			if (l.fence > fx.done && uintptr_t(l.a.resource) == key)
+				return l.fence;
+		return 0;
+	};
+	auto intact = [&fx](const live_t &l) {
+		auto & fake = fx.storage[uintptr_t(l.a.resource) - 1];
+		if (!fake.alive)
+			return false;
+		for (uint64_t i = 0; i < l.a.size; i++)
+			if (l.a.cpu[i] != l.tag)
+				return false;
+		return true;
+	};
+
+	//frames of 4 .. 64 KB, every 64th one 3 MB : the ring of 256 KB has to grow.
+	upload_ring_t ring;
+	ring.init(256 << 10, create, release);
+	uint64_t bytes = 0;
+	for (int f = 0; f < frame_max; f++) {
+		int slot = fx.begin();
+		uint64_t done = fx.done;
+		ring.retire(done);
+		in_flight.erase(std::remove_if(in_flight.begin(), in_flight.end(),
+			[&done](const live_t &l) { return l.fence <= done; }), in_flight.end());
+		for (auto & l : in_flight)
+			if (!intact(l)) {
+				err("frame %d overwrote an allocation of fence %llu\n", f, (unsigned long long)l.fence);
+				fails++;
+				break;
+			}
+		std::vector<live_t> frame;
+		uint64_t need = (f % 64 == 63) ? 3 << 20 : 4096 + (uint64_t(f) * 7919) % (60 << 10);
+		for (uint32_t k = 0; need; k++) {
+			uint64_t n = std::min<uint64_t>(need, 1 + (f * 131 + k * 977) % 8192);
+			uint64_t align = (k & 1) ? 256 : 16;
+			live_t l = { 0, upload_alloc_t(), uint8_t(f * 31 + k) };
+			if (!ring.alloc(n, align, l.a)) {
+				err("ring alloc of %llu failed\n", (unsigned long long)n);
+				return 1;
+			}
+			auto & b = ring.buffer;
+			if (l.a.offset % align || l.a.offset + n > b.size || l.a.resource != b.resource ||
+				l.a.cpu != b.cpu + l.a.offset || l.a.gpu != b.gpu + l.a.offset) {
+				err("allocation of %llu at %llu out of its buffer or unaligned\n",
+					(unsigned long long)n, (unsigned long long)l.a.offset);
+				fails++;
+			}
+			memset(l.a.cpu, l.tag, n);
+			frame.push_back(l);
+			need -= n;
+			bytes += n;
+		}
+		for (auto & l : in_flight)
+			if (!intact(l)) {
+				err("frame %d overwrote an allocation of fence %llu\n", f, (unsigned long long)l.fence);
+				fails++;
+				break;
+			}
+		uint64_t value = fx.end(slot, 200.0);
+		ring.close(value);
+		for (auto & l : frame) {
+			l.fence = value;
+			in_flight.push_back(l);
+		}
+	}
+	fx.flush();
+	ring.retire(fx.done);
+	size_t alive = fx.alive();
+	if (!ring.old.empty() || alive != 1 || ring.grows == 0 || ring.used() != 0) {
+		err("ring : %zu old buffers, %zu alive, %u grows, %llu used\n",
+			ring.old.size(), alive, ring.grows, (unsigned long long)ring.used());
+		fails++;
+	}
+	printf("ring : %d frames, %.1f KB/frame, peak %.1f KB/frame, %.1f KB used, %u grows, buffer of %.1f KB\n",
+		frame_max, bytes / 1024.0 / frame_max, ring.peak_frame / 1024.0, ring.peak_used / 1024.0,
+		ring.grows, ring.buffer.size / 1024.0);
+	ring.term();
+
+	//dirty ranges of every layer through flush_layers() into the ring, chunks split inside ranges.
+	const int layer_max = 4;
+	const int frame_count = 3;
+	const uint32_t object_max = 4096;
+	const uint32_t key[2] = { 0x0b1d, 0 };
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	job_system_t jobs;
+	jobs.init(2);
+	for (int pack = 0; pack < 2; pack++) {
+		size_t size = pack ? sizeof(PackedObjectFormat) : sizeof(ObjectFormat);
+		std::vector<dirty_tracker_t> trackers(frame_count * layer_max);
+		std::vector<uint8_t> gpu(frame_count * layer_max * object_max * size);
+		std::vector<ObjectFormat> expect(object_max);
+		std::vector<PackedObjectFormat> expect_packed(object_max);
+		std::vector<ObjectFormat> staging[layer_max];
+		std::vector<dirty_range_t> ranges[layer_max];
+		upload_alloc_t allocs[layer_max];
+		ObjectFormat *obj_ptrs[layer_max];
+		PackedObjectFormat *packed_ptrs[layer_max];
+		uint64_t frame_bytes = 0;
+		in_flight.clear();
+		ring.init(64 << 10, create, release);
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			stores[lidx].init(object_max);
+			stores[lidx].set_flags(0, object_max, 1);
+			update_store(stores[lidx], 0, object_max, lidx, 0.0);
+		}
+		for (auto & t : trackers) {
+			t.init(object_max, 0);
+			t.mark_all();
+		}
+		for (int f = 0; f < 64; f++) {
+			int slot = fx.begin();
+			ring.retire(fx.done);
+			for (int lidx = 0; f && lidx < layer_max; lidx++) {
+				uint32_t r[4][8];
+				for (int c = 0; c < 16; c += 8) {
+					rng_philox_x8(c, f, lidx, 0, key, r);
+					for (int l = 0; l < 8; l++) {
+						uint32_t i = r[0][l] % object_max;
+						uint32_t n = 1 + r[1][l] % 16;
+						update_store(stores[lidx], i, std::min(i + n, object_max), lidx, f);
+						for (int s = 0; s < frame_count; s++)
+							trackers[s * layer_max + lidx].mark(i, std::min(i + n, object_max));
+					}
+				}
+			}
+			for (int lidx = 0; lidx < layer_max; lidx++) {
+				auto & t = trackers[slot * layer_max + lidx];
+				t.get_ranges(ranges[lidx], 16);
+				t.clear();
+				uint32_t num = 0;
+				for (auto & r : ranges[lidx])
+					num += r.end - r.begin;
+				if (!ring.alloc(num * size, 16, allocs[lidx])) {
+					err("ring alloc of %u objects failed\n", num);
+					return 1;
+				}
+				frame_bytes += num * size;
+				if (staging[lidx].size() < num)
+					staging[lidx].resize(num);
+				obj_ptrs[lidx] = pack ? staging[lidx].data() : (ObjectFormat *)allocs[lidx].cpu;
+				packed_ptrs[lidx] = (PackedObjectFormat *)allocs[lidx].cpu;
+			}
+			flush_layers(jobs, stores.get(), ranges, obj_ptrs, pack ? packed_ptrs : nullptr, layer_max, 64, true);
+			//the copies of record_layer_cmds, executed right away.
+			for (int lidx = 0; lidx < layer_max; lidx++) {
+				uint8_t *dst = &gpu[size_t(slot * layer_max + lidx) * object_max * size];
+				uint64_t src = allocs[lidx].offset;
+				auto & fake = fx.storage[uintptr_t(allocs[lidx].resource) - 1];
+				for (auto & r : ranges[lidx]) {
+					memcpy(dst + r.begin * size, &fake.bytes[src], (r.end - r.begin) * size);
+					src += (r.end - r.begin) * size;
+				}
+				stores[lidx].flush_ref(expect.data(), 0, object_max);
+				sprite_pack_objects_ref(expect.data(), expect_packed.data(), object_max);
+				if (memcmp(dst, pack ? (void *)expect_packed.data() : (void *)expect.data(), object_max * size)) {
+					err("%s frame=%d layer=%d copy is stale\n", pack ? "packed" : "plain", f, lidx);
+					return 1;
+				}
+			}
+			ring.close(fx.end(slot, 200.0));
+		}
+		fx.flush();
+		ring.retire(fx.done);
+		printf("%s : %.1f KB/frame through the ring of %.1f KB, %u grows, objects %.1f KB/frame\n",
+			pack ? "packed" : "plain ", frame_bytes / 1024.0 / 64, ring.buffer.size / 1024.0, ring.grows,
+			double(layer_max) * object_max * size / 1024.0);
+		ring.term();
+	}
+	jobs.term();
+	if (fails)
+		return 1;
+	printf("upload ok\n");
+	return 0;
+}
+
+//
+// -atlas-build OUT IN... : packs the PNM sprites IN into the atlas file OUT.
+//
+int
+atlas_build(const char *out, int num, char **paths)
+{
+	std::vector<atlas_image_t> images(num);
+	for (int i = 0; i < num; i++) {
+		if (!atlas_read_pnm(paths[i], images[i])) {
+			err("can not read %s\n", paths[i]);
+			return 1;
+		}
+	}
+	atlas_t atlas;
+	double t = get_time_sec();
+	if (!atlas.build(images, AtlasPadding, AtlasMaxSize)) {
+		err("%d sprites do not fit in %ux%u\n", num, AtlasMaxSize, AtlasMaxSize);
+		return 1;
+	}
+	t = get_time_sec() - t;
+	if (!atlas.save(out)) {
+		err("can not write %s\n", out);
+		return 1;
+	}
+	printf("atlas %s : %d sprites in %ux%u, %.1f%% used, %.2f ms\n",
+		out, num, atlas.width, atlas.height, atlas.occupancy() * 100.0, t * 1e3);
+	return 0;
+}
+
+//
+// Atlas builder (atlas.h) on generated sprites of mixed sizes, thin ones
+// included : both packers, checked for overlaps, texels, the edge texels
+// repeated over the padding and uvinfo hitting the rect of each sprite
+// through sprite_expand_ref(). Then the file and PNM round trips.
+//
+int
+check_atlas(int num)
+{
+	const uint32_t key[2] = { 0xa71a, 0 };
+	auto texel = [](uint32_t i, uint32_t x, uint32_t y) {
+		return uint32_t(i & 0xFF) | ((x & 0xFF) << 8) | ((y & 0xFF) << 16) | ((i >> 8) << 24);
+	};
+	std::vector<atlas_image_t> images(num);
+	for (int i = 0; i < num; i++) {
+		uint32_t r[4][8];
+		rng_philox_x8(i, 0, 0, 0, key, r);
+		auto & img = images[i];
+		img.name = "sprite" + std::to_string(i);
+		img.width = 4 + r[0][0] % 96;
+		img.height = 4 + r[0][1] % 96;
+		if (i % 16 == 0)
+			img.height = 2 + r[0][2] % 4;  //thin
+		if (i % 16 == 1)
+			img.width = 2 + r[0][2] % 4;
+		img.rgba.resize(size_t(img.width) * img.height * 4);
+		for (uint32_t y = 0; y < img.height; y++)
+			for (uint32_t x = 0; x < img.width; x++) {
+				uint32_t v = texel(i, x, y);
+				memcpy(&img.rgba[(size_t(y) * img.width + x) * 4], &v, 4);
+			}
+	}
+
+	int fails = 0;
+	static const char *names[] = { "maxrects", "skyline" };
+	atlas_t atlas;
+	for (uint8_t method = AtlasMaxRects; method <= AtlasSkyline; method++) {
+		double t = get_time_sec();
+		if (!atlas.build(images, AtlasPadding, AtlasMaxSize, method)) {
+			err("%s : %d sprites do not fit\n", names[method], num);
+			return 1;
+		}
+		t = get_time_sec() - t;
+		uint32_t pad = atlas.padding;
+		auto at = [&atlas](int x, int y) {
+			uint32_t v;
+			memcpy(&v, &atlas.pixels[(size_t(y) * atlas.width + x) * 4], 4);
+			return v;
+		};
+		for (int i = 0; i < num && !fails; i++) {
+			auto & a = atlas.rects[i];
+			if (a.w != images[i].width || a.h != images[i].height || a.x < pad || a.y < pad ||
+				a.x + a.w + pad > atlas.width || a.y + a.h + pad > atlas.height) {
+				err("%s : sprite %d out of the atlas\n", names[method], i);
+				fails++;
+			}
+			for (int j = i + 1; j < num; j++) {
+				auto & b = atlas.rects[j];
+				if (a.x < b.x + b.w + pad * 2 && b.x < a.x + a.w + pad * 2 &&
+					a.y < b.y + b.h + pad * 2 && b.y < a.y + a.h + pad * 2) {
+					err("%s : sprites %d and %d overlap\n", names[method], i, j);
+					fails++;
+					break;
+				}
+			}
+			for (int y = -int(pad); y < int(a.h + pad); y++)
+				for (int x = -int(pad); x < int(a.w + pad); x++) {
+					uint32_t sx = std::min(std::max(x, 0), int(a.w) - 1);
+					uint32_t sy = std::min(std::max(y, 0), int(a.h) - 1);
+					if (at(a.x + x, a.y + y) != texel(i, sx, sy) && !fails) {
+						err("%s : sprite %d texel (%d, %d) is wrong\n", names[method], i, x, y);
+						fails++;
+					}
+				}
+			ObjectFormat o = {};
+			VertexFormat v[6];
+			o.scale[0] = o.scale[1] = 1.0f;
+			o.metadata[0] = 1;
+			atlas.uvinfo(i, o.uvinfo);
+			sprite_expand_ref(&o, v, 1);
+			float u0 = 1.0f, v0 = 1.0f, u1 = 0.0f, v1 = 0.0f;
+			for (auto & vtx : v) {
+				u0 = std::min(u0, vtx.uv[0]);
+				v0 = std::min(v0, vtx.uv[1]);
+				u1 = std::max(u1, vtx.uv[0]);
+				v1 = std::max(v1, vtx.uv[1]);
+			}
+			const float eps = 1e-6f;
+			if (fabsf(u0 * atlas.width - a.x) > eps * atlas.width || fabsf(v0 * atlas.height - a.y) > eps * atlas.height ||
+				fabsf(u1 * atlas.width - (a.x + a.w)) > eps * atlas.width ||
+				fabsf(v1 * atlas.height - (a.y + a.h)) > eps * atlas.height) {
+				err("%s : uv of sprite %d miss its rect\n", names[method], i);
+				fails++;
+			}
+		}
+		if (atlas.width & (atlas.width - 1) || atlas.height & (atlas.height - 1)) {
+			err("%s : %ux%u is not a power of two\n", names[method], atlas.width, atlas.height);
+			fails++;
+		}
+		printf("%-8s : %d sprites in %ux%u, %.1f%% used, %.2f ms\n", names[method], num,
+			atlas.width, atlas.height, atlas.occupancy() * 100.0, t * 1e3);
+	}
+
+	//the grid of the old uvinfo is a rect too.
+	float grid[4];
+	sprite_uv_grid(3, 1, 4, 2, grid);
+	if (grid[0] != 0.75f || grid[1] != 0.5f || grid[2] != 0.25f || grid[3] != 0.5f) {
+		err("grid cell (3, 1) of 4x2 is (%f, %f, %f, %f)\n", grid[0], grid[1], grid[2], grid[3]);
+		fails++;
+	}
+
+	FILE *fp = tmpfile();
+	atlas_t copy;
+	bool ok = fp && atlas.write(fp);
+	if (ok) {
+		rewind(fp);
+		ok = copy.read(fp);
+	}
+	if (fp)
+		fclose(fp);
+	if (!ok || copy.width != atlas.width || copy.height != atlas.height || copy.pixels != atlas.pixels ||
+		copy.names != atlas.names || copy.find("sprite7") != 7 ||
+		memcmp(copy.rects.data(), atlas.rects.data(), atlas.rects.size() * sizeof(atlas_rect_t))) {
+		err("atlas file round trip failed\n");
+		fails++;
+	}
+
+#ifdef _WIN32
+	char tmp[MAX_PATH];
+	GetTempPathA(MAX_PATH, tmp);
+	std::string path = std::string(tmp) + "tanbo_atlas_check.pam";
+#else
+	std::string path = "/tmp/tanbo_atlas_check.pam";
+#endif
+	auto & img = images[5];
+	fp = fopen(path.c_str(), "wb");
+	ok = fp != nullptr;
+	if (fp) {
+		fprintf(fp, "P7\n# sprite\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+			img.width, img.height);
+		ok = fwrite(img.rgba.data(), 1, img.rgba.size(), fp) == img.rgba.size();
+		ok = fclose(fp) == 0 && ok;
+	}
+	atlas_image_t pam;
+	ok = ok && atlas_read_pnm(path.c_str(), pam);
+	remove(path.c_str());
+	if (!ok || pam.width != img.width || pam.height != img.height || pam.rgba != img.rgba) {
+		err("PAM round trip failed\n");
+		fails++;
+	}
+	if (fails)
+		return 1;
+	printf("atlas ok\n");
+	return 0;
+}
+
+//
+// -tex-build OUT IN... : the PNM images IN with their mip chains into the
+// texture container OUT (tex.h).
+//
+int
+tex_build(const char *out, int num, char **paths)
+{
+	std::vector<tex_image_t> images(num);
+	uint64_t bytes = 0;
+	for (int i = 0; i < num; i++) {
+		atlas_image_t img;
+		if (!atlas_read_pnm(paths[i], img)) {
+			err("can not read %s\n", paths[i]);
+			return 1;
+		}
+		const char *name = strrchr(paths[i], '/');
+		tex_build_mips(images[i], name ? name + 1 : paths[i], img.width, img.height, img.rgba.data());
+		for (auto & m : images[i].mips)
+			bytes += m.size();
+	}
+	if (!tex_write(out, images)) {
+		err("can not write %s\n", out);
+		return 1;
+	}
+	printf("tex %s : %d textures, %.1f KB of mips\n", out, num, bytes / 1024.0);
+	return 0;
+}
+
+//
+// Texture container and streamer (tex.h). Textures of every format and
+// odd sizes are written, mapped and compared mip by mip, broken files
+// must not open. Then the streamer runs on a fake upload ring and a mock
+// GPU : a window of demand slides over the textures, the copies of each
+// frame go through record_stream_cmds(), the state tracker and the null
+// backend once the fence of the frame completed, so a ring that reused
+// the bytes of a frame in flight shows as a texture that differs from
+// the file. The resident bytes stay in the budget, textures get evicted
+// and the ones still wanted end up resident down to the mip they want.
+//
+int
+check_tex(int frame_max)
+{
+	const uint32_t key[2] = { 0x7e1, 0 };
+	const int tex_num = 48;
+	std::vector<tex_image_t> images(tex_num);
+	for (int i = 0; i < tex_num; i++) {
+		uint32_t r[4][8];
+		rng_philox_x8(i, 0, 0, 0, key, r);
+		auto & img = images[i];
+		char name[32];
+		snprintf(name, sizeof(name), "tex%d", i);
+		if (i % 8 == 6 || i % 8 == 7) {
+			img.name = name;
+			img.format = i % 8 == 6 ? TexBC1 : TexBC3;
+			img.width = 4 * (1 + r[0][0] % 64);
+			img.height = 4 * (1 + r[0][1] % 64);
+			img.mips.resize(tex_mip_count(img.width, img.height));
+			for (uint32_t m = 0; m < img.mips.size(); m++) {
+				auto l = tex_mip_layout(img.format, img.width, img.height, m);
+				img.mips[m].resize(size_t(l.row_bytes) * l.rows);
+				for (size_t k = 0; k < img.mips[m].size(); k++)
+					img.mips[m][k] = uint8_t((k * 131 + m * 17 + i) ^ (k >> 8));
+			}
+			continue;
+		}
+		uint32_t w = 1 + r[0][0] % 160, h = 1 + r[0][1] % 160;
+		if (i == 0)
+			w = h = 1;
+		if (i == 1) {
+			w = 1024;
+			h = 4;
+		}
+		std::vector<uint8_t> rgba(size_t(w) * h * 4);
+		for (size_t k = 0; k < rgba.size(); k++)
+			rgba[k] = uint8_t(k * 7 + i * 29 + (k / (w * 4)) * 3);
+		tex_build_mips(img, name, w, h, rgba.data());
+	}
+
+	int fails = 0;
+	//2x2 box of the chain, rounded.
+	tex_image_t box;
+	const uint8_t quad[16] = { 0, 10, 255, 1,  1, 10, 255, 2,  2, 10, 254, 3,  4, 10, 254, 4 };
+	tex_build_mips(box, "box", 2, 2, quad);
+	const uint8_t avg[4] = { 2, 10, 255, 3 };
+	if (box.mips.size() != 2 || memcmp(box.mips[1].data(), avg, 4)) {
+		err("mip of a 2x2 texture is wrong\n");
+		fails++;
+	}
+
+#ifdef _WIN32
+	char tmp[MAX_PATH];
+	GetTempPathA(MAX_PATH, tmp);
+	std::string path = std::string(tmp) + "tanbo_tex_check.tex";
+#else
+	std::string path = "/tmp/tanbo_tex_check.tex";
+#endif
+	double t = get_time_sec();
+	if (!tex_write(path.c_str(), images)) {
+		err("can not write %s\n", path.c_str());
+		return 1;
+	}
+	double t_write = get_time_sec() - t;
+	tex_file_t file;
+	t = get_time_sec();
+	bool opened = file.open(path);
+	double t_open = get_time_sec() - t;
+	if (!opened || file.count() != uint32_t(tex_num)) {
+		err("can not open %s\n", path.c_str());
+		remove(path.c_str());
+		return 1;
+	}
+	uint64_t total = 0;
+	for (int i = 0; i < tex_num && !fails; i++) {
+		auto & e = file.entries[i];
+		if (e.mips != images[i].mips.size() || e.format != images[i].format || file.find(images[i].name.c_str()) != i) {
+			err("entry %d does not match its image\n", i);
+			fails++;
+		}
+		for (uint32_t m = 0; m < e.mips && !fails; m++) {
+			auto & mip = e.mip[m];
+			const uint8_t *p = file.data(i, m);
+			if (uintptr_t(p) % TexPlaceAlign || mip.pitch % TexPitchAlign) {
+				err("mip %u of texture %d is not aligned for a placed footprint\n", m, i);
+				fails++;
+			}
+			for (uint32_t y = 0; y < mip.rows && !fails; y++)
+				if (memcmp(p + size_t(y) * mip.pitch, &images[i].mips[m][size_t(y) * mip.row_bytes], mip.row_bytes)) {
+					err("row %u of mip %u of texture %d differs\n", y, m, i);
+					fails++;
+				}
+		}
+		total += e.bytes;
+	}
+	printf("file : %d textures, %.1f KB, written in %.2f ms, opened in %.3f ms\n",
+		tex_num, file.header->size / 1024.0, t_write * 1e3, t_open * 1e3);
+
+	//broken copies : truncated, bad magic, a mip past the end.
+	std::vector<uint8_t> bytes(file.map.data, file.map.data + file.map.size);
+	std::string broken = path + ".broken";
+	for (int k = 0; k < 3; k++) {
+		std::vector<uint8_t> b = bytes;
+		if (k == 0)
+			b.resize(b.size() - 1);
+		if (k == 1)
+			b[0] ^= 1;
+		if (k == 2) {
+			tex_entry_t e;
+			size_t at = sizeof(tex_header_t) + sizeof(tex_entry_t) * 5;
+			memcpy(&e, &b[at], sizeof(e));
+			e.mip[0].offset = b.size() - TexPlaceAlign;
+			memcpy(&b[at], &e, sizeof(e));
+		}
+		FILE *fp = fopen(broken.c_str(), "wb");
+		bool ok = fp && fwrite(b.data(), 1, b.size(), fp) == b.size();
+		if (fp)
+			ok = fclose(fp) == 0 && ok;
+		tex_file_t bad;
+		if (!ok || bad.open(broken)) {
+			err("broken file %d opened\n", k);
+			fails++;
+		}
+	}
+	remove(broken.c_str());
+
+	//the streamer.
+	struct pending_t {
+		cmd_list_t list;
+		std::vector<uintptr_t> objects;
+		std::vector<std::vector<uint8_t>> states;  //of every id before the list
+		uint64_t fence;
+	};
+	ring_fixture_t fx("upload buffer");
+	//texture keys live above the buffer keys.
+	const uintptr_t TexKey = 1 << 20;
+	std::vector<uintptr_t> keys(tex_num);
+	for (int i = 0; i < tex_num; i++)
+		keys[i] = TexKey + i;
+	std::vector<std::vector<std::vector<uint8_t>>> gpu_tex(tex_num);
+	std::deque<pending_t> pending;
+	state_tracker_t tracker;
+	cmd_table_t table;
+	cmd_null_t gpu;
+	uint64_t errors = 0;
+	auto execute = [&](pending_t &p) {
+		gpu.init(uint32_t(p.objects.size()));
+		for (uint32_t id = 0; id < p.objects.size(); id++) {
+			uintptr_t k = p.objects[id];
+			if (k >= TexKey) {
+				gpu.set_texture(id, uint32_t(p.states[id].size()), CmdStateCommon);
+				gpu.states[id] = p.states[id];
+			} else {
+				auto & fake = fx.storage[k - 1];
+				gpu.set_buffer(id, fake.bytes.size());
+				gpu.buffers[id] = fake.bytes;
+				gpu.set_state(id, CmdStateGenericRead);
+			}
+		}
+		gpu.execute(p.list);
+		if (gpu.errors && !errors++)
+			err("mock gpu : %s\n", gpu.first_error);
+		for (uint32_t id = 0; id < p.objects.size(); id++) {
+			if (p.objects[id] < TexKey)
+				continue;
+			auto & dst = gpu_tex[p.objects[id] - TexKey];
+			auto & src = images[p.objects[id] - TexKey];
+			dst.resize(gpu.textures[id].size());
+			for (size_t m = 0; m < dst.size(); m++) {
+				if (gpu.textures[id][m].empty())
+					continue;
+				dst[m] = gpu.textures[id][m];
+				if (dst[m] != src.mips[m] && !errors++)
+					err("fence %llu : mip %zu of %s differs from the file\n",
+						(unsigned long long)p.fence, m, src.name.c_str());
+			}
+		}
+	};
+
+	tex_stream_t stream;
+	const uint32_t window = 10;
+	uint64_t budget = total / 2;
+	if (!stream.init(&file, 128 << 10, fx.upload_create(), fx.upload_release(), 96 << 10, budget, 8)) {
+		err("stream init failed\n");
+		remove(path.c_str());
+		return 1;
+	}
+	std::vector<tex_stream_job_t> jobs;
+	std::vector<uint32_t> evicted;
+	std::vector<float> area(tex_num), size(tex_num);
+	uint64_t peak_resident = 0;
+	uint32_t first = 0;
+	t = get_time_sec();
+	for (int f = 0; f < frame_max; f++) {
+		int slot = fx.begin();
+		uint64_t done = fx.done;
+		while (!pending.empty() && pending.front().fence <= done) {
+			execute(pending.front());
+			pending.pop_front();
+		}
+		stream.begin(done);
+
+		//the window stops for the last quarter, so what it wants can arrive.
+		if (f < frame_max * 3 / 4)
+			first = uint32_t(f / 6) % tex_num;
+		std::fill(area.begin(), area.end(), 0.0f);
+		std::fill(size.begin(), size.end(), 0.0f);
+		for (uint32_t k = 0; k < window; k++) {
+			uint32_t i = (first + k) % tex_num;
+			area[i] = 1000.0f * (window - k);
+			size[i] = float(512 >> (k % 6));
+		}
+		stream.demand(area.data(), size.data());
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+
+		stream.take(jobs, evicted);
+		for (auto e : evicted) {
+			tracker.forget(keys[e]);
+			gpu_tex[e].clear();
+		}
+		for (auto & j : jobs)
+			if (j.mip == file.entries[j.tex].mips - 1)
+				tracker.set(keys[j.tex], CmdStateCommon, file.entries[j.tex].mips);
+		if (stream.resident_bytes > budget) {
+			err("frame %d : %llu bytes resident over a budget of %llu\n", f,
+				(unsigned long long)stream.resident_bytes, (unsigned long long)budget);
+			fails++;
+		}
+		peak_resident = std::max(peak_resident, stream.resident_bytes);
+
+		pending.emplace_back();
+		auto & p = pending.back();
+		cmd_list_t cl;
+		table.reset();
+		record_stream_cmds(cl, table, file, jobs, keys);
+		p.objects = table.objects;
+		p.states.resize(p.objects.size());
+		for (uint32_t id = 0; id < p.objects.size(); id++) {
+			uintptr_t k = p.objects[id];
+			if (k >= TexKey)
+				for (uint32_t s = 0; s < file.entries[k - TexKey].mips; s++)
+					p.states[id].push_back(tracker.state(k, s));
+		}
+		tracker.resolve(cl, p.list, table.objects);
+		//GPU bound : the ring holds the copies of every frame in flight.
+		p.fence = fx.end(slot, 1500.0);
+		stream.end(p.fence);
+	}
+	fx.flush();
+	while (!pending.empty()) {
+		execute(pending.front());
+		pending.pop_front();
+	}
+	double t_stream = get_time_sec() - t;
+	fails += int(errors);
+
+	//what the window still wants is resident and equal to the file.
+	for (uint32_t k = 0; k < window && !fails; k++) {
+		uint32_t i = (first + k) % tex_num;
+		auto & s = stream.states[i];
+		if (s.resident > s.want) {
+			err("texture %u : mip %u resident, %u wanted\n", i, s.resident, s.want);
+			fails++;
+		}
+	}
+	for (int i = 0; i < tex_num && !fails; i++) {
+		auto & e = file.entries[i];
+		for (uint32_t m = stream.states[i].resident; m < e.mips; m++) {
+			if (gpu_tex[i].size() <= m || gpu_tex[i][m] != images[i].mips[m]) {
+				err("mip %u of texture %d on the mock gpu differs from the file\n", m, i);
+				fails++;
+				break;
+			}
+		}
+	}
+	if (stream.evictions == 0 || stream.ring.grows) {
+		err("stream : %u evictions, %u ring grows\n", stream.evictions, stream.ring.grows);
+		fails++;
+	}
+	printf("stream : %d frames, %u mips, %.1f KB, %u evictions, %u full frames, resident peak %.1f KB of %.1f KB, %.1f ms\n",
+		frame_max, stream.loads, stream.loaded_bytes / 1024.0, stream.evictions, stream.stalls,
+		peak_resident / 1024.0, budget / 1024.0, t_stream * 1e3);
+	stream.term();
+	size_t alive = fx.alive();
+	if (alive) {
+		err("%zu upload buffers left\n", alive);
+		fails++;
+	}
+	fails += fx.fails;
+	file.close();
+	remove(path.c_str());
+	if (fails)
+		return 1;
+	printf("tex ok\n");
+	return 0;
+}
+
+//per pipeline : wait for a builder thread and build time, thread 0 is a waiting caller.
+void
+pipeline_report(const pipeline_builder_t &pipelines)
+{
+	for (auto & e : pipelines.entries)
+		printf("pipeline %-14s : %-6s waited %7.2f ms, built %7.2f ms on thread %d\n", e->name.c_str(),
+			e->state == pipeline_builder_t::Ready ? "ready," : "failed,",
+			e->queue_sec * 1e3, e->build_sec * 1e3, e->thread);
+}
+
+//
+// Startup pipelines (pipeline.h) with fake builds of 2 .. 12 ms of work :
+// all of them serially against the builder on 1, 2, 4 .. N threads, with
+// a frame loop of 1 ms frames that only polls. Reports when the first
+// pipeline is there, how many frames ran before the last one and checks
+// the results, a caller building a pipeline no thread took yet included.
+//
+int
+bench_pipelines(int num, int thread_max)
+{
+	std::vector<int> values(num);
+	auto spin = [](double sec) {
+		volatile uint64_t h = 0;
+		double t = get_time_sec();
+		while (get_time_sec() - t < sec)
+			h = h + 1;
+	};
+	auto add_all = [&](pipeline_builder_t &b) {
+		for (int i = 0; i < num; i++) {
+			char name[32];
+			snprintf(name, sizeof(name), "variant%02d", i);
+			b.add(name, [&values, &spin, i]() -> void * {
+				spin((2 + (i * 7) % 11) * 1e-3);
+				return &values[i];
+			});
+		}
+	};
+	auto check = [&](pipeline_builder_t &b) {
+		for (int i = 0; i < num; i++)
+			if (b.get<int>(i) != &values[i] || !b.ready(i))
+				return false;
+		return true;
+	};
+
+	pipeline_builder_t serial;
+	add_all(serial);
+	double t_serial = get_time_sec();
+	serial.wait_all();
+	t_serial = get_time_sec() - t_serial;
+	if (!check(serial)) {
+		err("serial builds are wrong\n");
+		return 1;
+	}
+	printf("pipelines=%d serial : %.1f ms\n", num, t_serial * 1e3);
+
+	std::vector<int> thread_nums;
+	for (int threads = 1; threads < thread_max; threads *= 2)
+		thread_nums.push_back(threads);
+	thread_nums.push_back(std::max(1, thread_max));
+	for (int threads : thread_nums) {
+		pipeline_builder_t b;
+		add_all(b);
+		double t = get_time_sec();
+		b.start(threads);
+		if (b.get<int>(num - 1)) {
+			err("the last pipeline can not be ready yet\n");
+			return 1;
+		}
+		double t_first = 0.0;
+		int frames = 0;
+		while (!b.done()) {
+			if (t_first == 0.0 && b.ready(0))
+				t_first = get_time_sec() - t;
+			spin(1e-3);
+			frames++;
+		}
+		t = get_time_sec() - t;
+		b.term();
+		if (!check(b)) {
+			err("threads=%d builds are wrong\n", threads);
+			return 1;
+		}
+		printf("  threads=%-2d : first %5.1f ms, all %6.1f ms x%.2f, %d frames while building\n",
+			threads, t_first * 1e3, t * 1e3, t_serial / t, frames);
+	}
+
+	//one builder busy with the first, the caller takes the last itself.
+	pipeline_builder_t b;
+	add_all(b);
+	b.start(1);
+	if (b.wait<int>(num - 1) != &values[num - 1] || b.entries[num - 1]->thread != 0) {
+		err("wait did not build the pipeline on the caller\n");
+		return 1;
+	}
+	b.wait_all();
+	b.term();
+	if (!check(b)) {
+		err("builds after a wait are wrong\n");
+		return 1;
+	}
+	pipeline_report(b);
+	return 0;
+}
+
+//-profile : the events of the run as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+int
+prof_write(const char *path)
+{
+	auto & prof = prof_t::get();
+	FILE *fp = fopen(path, "w");
+	if (!fp) {
+		err("can not open %s\n", path);
+		return 1;
+	}
+	bool ok = prof.write_trace(fp);
+	fclose(fp);
+	if (!ok)
+		err("can not write %s\n", path);
+	return ok ? 0 : 1;
+}
+
+//
+// Profiler (prof.h) : cost of a disabled and an enabled scope, a producer
+// racing the drain of its ring (every event arrives once, in order, or is
+// counted as lost, and at most 1% is lost), a full ring the producer drains
+// itself, one that drops while the exporter holds the lock, GPU ticks to
+// CPU time and the trace export.
+//
+int
+check_prof(int loop)
+{
+	auto & prof = prof_t::get();
+	volatile uint32_t sink = 0;
+
+	double t_none = get_time_sec();
+	for (int i = 0; i < loop; i++)
+		sink = sink + i;
+	t_none = get_time_sec() - t_none;
+	double t_off = get_time_sec();
+	for (int i = 0; i < loop; i++) {
+		PROF_SCOPE("off");
+		sink = sink + i;
+	}
+	t_off = get_time_sec() - t_off;
+	prof.drain();
+	if (prof.events()) {
+		err("disabled scopes recorded %zu events\n", prof.events());
+		return 1;
+	}
+	prof.enable();
+	double t_on = get_time_sec();
+	for (int i = 0; i < prof_ring_t::Size / 2; i++) {
+		PROF_SCOPE("on");
+		sink = sink + i;
+	}
+	t_on = get_time_sec() - t_on;
+	prof.drain();
+	printf("prof scope : disabled %.2f ns, enabled %.2f ns\n", (t_off - t_none) / loop * 1e9,
+		t_on / (prof_ring_t::Size / 2) * 1e9);
+
+	//one producer against the drain.
+	uint32_t produced = uint32_t(loop / 64);
+	std::atomic<bool> done {false};
+	prof_ring_t *ring = nullptr;
+	std::thread producer([&]() {
+		ring = prof.ring();
+		for (uint32_t i = 0; i < produced; i++)
+			prof.record("race", i + 1, i + 2);
+		done = true;
+	});
+	while (!done) {
+		prof.drain();
+		std::this_thread::yield();
+	}
+	producer.join();
+	prof.drain();
+	uint64_t last = 0;
+	for (auto & e : ring->drained) {
+		if (e.begin <= last) {
+			err("event %llu after %llu\n", (unsigned long long)e.begin, (unsigned long long)last);
+			return 1;
+		}
+		last = e.begin;
+	}
+	if (ring->drained.size() + ring->lost != produced || ring->lost > produced / 100) {
+		err("%zu drained + %llu lost of %u events\n", ring->drained.size(),
+			(unsigned long long)ring->lost.load(), produced);
+		return 1;
+	}
+	printf("prof race  : %zu drained, %llu lost of %u\n", ring->drained.size(),
+		(unsigned long long)ring->lost.load(), produced);
+
+	//nobody drains : the producer does.
+	std::thread full([&]() {
+		ring = prof.ring();
+		for (int i = 0; i < prof_ring_t::Size + 100; i++)
+			prof.record("full", 1, 2);
+	});
+	full.join();
+	prof.drain();
+	if (ring->lost || ring->drained.size() != prof_ring_t::Size + 100) {
+		err("full ring drained %zu, lost %llu events\n", ring->drained.size(),
+			(unsigned long long)ring->lost.load());
+		return 1;
+	}
+
+	//the exporter holds the lock (the ring registers before it is taken).
+	std::atomic<int> step {0};
+	std::thread held([&]() {
+		ring = prof.ring();
+		step = 1;
+		while (step != 2)
+			std::this_thread::yield();
+		for (int i = 0; i < prof_ring_t::Size + 100; i++)
+			prof.record("held", 1, 2);
+		step = 3;
+	});
+	while (step != 1)
+		std::this_thread::yield();
+	{
+		std::lock_guard<std::mutex> lock(prof.mtx);
+		step = 2;
+		while (step != 3)
+			std::this_thread::yield();
+	}
+	held.join();
+	if (ring->lost != 100) {
+		err("full ring lost %llu events, not 100\n", (unsigned long long)ring->lost.load());
+		return 1;
+	}
+
+	//10 MHz GPU, tick 1000 is CPU 5 s.
+	prof_gpu_t gpu;
+	uint64_t ticks[4] = { 1000, 2000, 3000, 3000 };
+	gpu.init({ "pass", "empty" }, 1);
+	gpu.calibrate(10000000, 1000, 5000000000ull);
+	gpu.collect(ticks);
+	if (gpu.collected != 1 || prof.gpu.back().begin != 5000000000ull || prof.gpu.back().end != 5000100000ull) {
+		err("gpu pass %llu - %llu ns\n", (unsigned long long)prof.gpu.back().begin,
+			(unsigned long long)prof.gpu.back().end);
+		return 1;
+	}
+
+	FILE *fp = tmpfile();
+	bool ok = fp && prof.write_trace(fp);
+	size_t bytes = fp ? size_t(ftell(fp)) : 0;
+	if (fp)
+		fclose(fp);
+	if (!ok) {
+		err("trace export failed\n");
+		return 1;
+	}
+	printf("prof trace : %zu events, %zu bytes\n", prof.events(), bytes);
+	return int(sink & 0);
+}
+
+//
+// Command recording of a frame with fragmented dirty ranges, serial and
+// per layer on 1 .. N job threads. The merged lists must match the serial
+// one. The state tracker (state.h) resolves them and the null backend
+// (cmd.h) runs them : barriers, bindings and the uploaded objects are
+// checked, for both the expand and the pull path.
+//
+int
+bench_cmd(int layer_max, int object_max, int thread_max, int loop_count)
+{
+	cmd_table_t table;
+	frame_cmd_ids_t ids;
+	std::vector<std::vector<dirty_range_t>> ranges(layer_max);
+	static const float clear_color[4] = { 0, 0, 0, 1 };
+	uint32_t object_bytes = object_max * sizeof(ObjectFormat);
+
+	auto id = [&table]() { return table.add(uintptr_t(table.objects.size() + 1)); };
+	ids.root_gsig = id();
+	ids.root_csig = id();
+	ids.pso_update = id();
+	ids.pso_clear = id();
+	ids.pso_draw_rects = id();
+	ids.pso_draw_sprites = id();
+	ids.pso_present = id();
+	ids.pso_cull = id();
+	ids.srv_table = id();
+	ids.sampler_table = id();
+	ids.rect_vertex = id();
+	ids.draw_args = id();
+	ids.backbuffer = id();
+	ids.backbuffer_rtv = id();
+	ids.tile_mask = id();
+	uint32_t capture = id();
+	ids.capture_pitch = capture_t::pitch(1024);
+	uint32_t timestamps = id();
+	ids.timestamp_readback = id();
+	ids.timestamp_base = 0;
+	ids.sprites = true;
+	prof_gpu_t gpu_prof;
+	gpu_prof.init(prof_pair_names(layer_max), 1);
+	uint32_t upload = id();
+	uint32_t upload_bytes = 0;
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		layer_cmd_ids_t l;
+		l.image = id();
+		l.rtv = id();
+		l.update_buffer = id();
+		l.upload = upload;
+		l.upload_offset = upload_bytes;
+		l.vertex_buffer = id();
+		l.uav_src = id();
+		l.uav_dst = id();
+		l.visible = id();
+		l.cull_args = id();
+		l.capacity = object_max;
+		l.count = object_max;
+		l.visible_count = object_max / 8;
+		l.user_tex = CmdNoId;
+		l.idle = false;
+		ids.layers.push_back(l);
+		for (uint32_t i = 0; i < uint32_t(object_max); i += 16) {
+			ranges[lidx].push_back({ i, std::min(i + 1 + (i / 16 + lidx) % 8, uint32_t(object_max)) });
+			upload_bytes += (ranges[lidx].back().end - i) * sizeof(ObjectFormat);
+		}
+	}
+
+	static const struct {
+		const char *name;
+		bool pull;
+		uint8_t cull;
+		bool capture;
+		bool profile;
+	} variants[] = {
+		{ "expand", false, CullNone, false, false },
+		{ "pull", true, CullNone, false, false },
+		{ "expand cull-cpu", false, CullCpu, false, false },
+		{ "pull cull-cpu", true, CullCpu, false, false },
+		{ "pull cull-gpu", true, CullGpu, false, false },
+		{ "pull capture", true, CullNone, true, false },
+		{ "expand timestamps", false, CullNone, false, true },
+	};
+	for (auto & variant : variants) {
+		bool pull = variant.pull;
+		ids.capture = variant.capture ? capture : CmdNoId;
+		ids.timestamps = variant.profile ? timestamps : CmdNoId;
+		layer_cmd_params_t params = {
+			pull, variant.cull, 2.0f / 512, sizeof(ObjectFormat), sizeof(VertexFormat),
+			6 * sizeof(VertexFormat), sizeof(VertexFormat), 512, 512, 256,
+		};
+		cmd_list_t serial;
+		double t_serial = get_time_sec();
+		for (int i = 0; i < loop_count; i++) {
+			serial.reset();
+			for (int lidx = 0; lidx < layer_max; lidx++)
+				record_layer_cmds(serial, ids, lidx, ranges[lidx], params);
+			record_present_cmds(serial, ids, params, clear_color, 1024, 1024);
+		}
+		t_serial = get_time_sec() - t_serial;
+
+		cmd_null_t null;
+		state_tracker_t tracker;
+		cmd_list_t resolved;
+		auto key = [&table](uint32_t id) { return table.objects[id]; };
+		null.init(table.objects.size());
+		null.set_buffer(ids.rect_vertex, params.rect_vertex_bytes);
+		null.set_buffer(ids.draw_args, layer_max * sizeof(uint32_t) * 4);
+		null.set_state(ids.rect_vertex, CmdStateGenericRead);
+		null.set_buffer(ids.tile_mask, 1024);
+		null.set_state(ids.draw_args, CmdStateGenericRead);
+		null.set_state(ids.tile_mask, CmdStateGenericRead);
+		tracker.set(key(ids.rect_vertex), CmdStateGenericRead, 1, true);
+		tracker.set(key(ids.draw_args), CmdStateGenericRead, 1, true);
+		tracker.set(key(ids.tile_mask), CmdStateGenericRead, 1, true);
+		null.set_buffer(capture, ids.capture_pitch * 1024);
+		null.set_state(capture, CmdStateCopyDest);
+		tracker.set(key(capture), CmdStateCopyDest, 1, true);
+		null.set_queries(timestamps, gpu_prof.query_num());
+		null.set_buffer(ids.timestamp_readback, gpu_prof.query_num() * sizeof(uint64_t));
+		null.set_state(ids.timestamp_readback, CmdStateCopyDest);
+		tracker.set(key(ids.timestamp_readback), CmdStateCopyDest, 1, true);
+		null.set_buffer(upload, upload_bytes);
+		null.set_state(upload, CmdStateGenericRead);
+		tracker.set(key(upload), CmdStateGenericRead, 1, true);
+		for (uint32_t i = 0; i < upload_bytes; i++)
+			null.buffers[upload][i] = uint8_t(i * 7 + i / 251);
+		for (auto & l : ids.layers) {
+			null.set_buffer(l.update_buffer, object_bytes);
+			null.set_buffer(l.vertex_buffer, object_max * 6 * sizeof(VertexFormat));
+			null.set_buffer(l.visible, object_max * sizeof(uint32_t));
+			null.set_buffer(l.cull_args, sizeof(uint32_t) * 4);
+			//the kept list is an upload buffer for bin.h, written by cull.hlsl otherwise.
+			uint8_t visible_state = variant.cull == CullCpu ? CmdStateGenericRead : CmdStateCommon;
+			null.set_state(l.visible, visible_state);
+			tracker.set(key(l.visible), visible_state, 1, true);
+			tracker.set(key(l.cull_args), CmdStateCommon, 1, true);
+			tracker.set(key(l.update_buffer), CmdStateCommon, 1, true);
+			tracker.set(key(l.vertex_buffer), CmdStateCommon, 1, true);
+		}
+		for (int frame = 0; frame < 2; frame++) {
+			tracker.resolve(serial, resolved, table.objects);
+			null.execute(resolved);
+			tracker.end_list();
+		}
+		if (null.errors) {
+			err("null backend : %llu errors, %s\n", (unsigned long long)null.errors, null.first_error);
+			return 1;
+		}
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			auto & l = ids.layers[lidx];
+			size_t src = l.upload_offset;
+			for (auto & r : ranges[lidx]) {
+				size_t offset = r.begin * sizeof(ObjectFormat);
+				size_t bytes = (r.end - r.begin) * sizeof(ObjectFormat);
+				if (memcmp(&null.buffers[l.update_buffer][offset], &null.buffers[upload][src], bytes)) {
+					err("layer=%d objects [%u, %u) were not uploaded\n", lidx, r.begin, r.end);
+					return 1;
+				}
+				src += bytes;
+			}
+		}
+
+		size_t n = serial.cmds.size();
+		printf("cmd %s layers=%d objects=%d ranges/layer=%zu cmds/frame=%zu loop=%d\n",
+			variant.name, layer_max, object_max, ranges[0].size(), n, loop_count);
+		printf("  null backend : %llu copies (%llu bytes), %llu dispatches, %llu draws, %llu barriers in %llu batches per frame\n",
+			(unsigned long long)null.counts[CmdCopy] / 2, (unsigned long long)null.copy_bytes / 2,
+			(unsigned long long)null.counts[CmdDispatch] / 2,
+			(unsigned long long)(null.counts[CmdDraw] + null.counts[CmdDrawIndirect]) / 2,
+			(unsigned long long)null.barriers / 2, (unsigned long long)null.batches / 2);
+		printf("  tracker      : %llu transitions, %llu split, %llu uav, %llu promoted, %llu skipped per frame\n",
+			(unsigned long long)tracker.transitions / 2, (unsigned long long)tracker.splits / 2,
+			(unsigned long long)tracker.uavs / 2, (unsigned long long)tracker.promotions / 2,
+			(unsigned long long)tracker.skipped / 2);
+		//the mock clock only moves forward, so the queries have to ascend in pass order.
+		if (variant.profile) {
+			std::vector<uint64_t> ticks(gpu_prof.query_num());
+			memcpy(ticks.data(), null.buffers[ids.timestamp_readback].data(), ticks.size() * sizeof(uint64_t));
+			for (size_t q = 1; q < ticks.size(); q++) {
+				if (ticks[q] < ticks[q - 1] || !ticks[q]) {
+					err("query %zu : %llu after %llu\n", q, (unsigned long long)ticks[q],
+						(unsigned long long)ticks[q - 1]);
+					return 1;
+				}
+			}
+			printf("  timestamps   : %u pairs, layer0 copy %llu, update %llu, draw %llu, present %llu ticks\n",
+				gpu_prof.pairs(), (unsigned long long)(ticks[1] - ticks[0]),
+				(unsigned long long)(ticks[3] - ticks[2]), (unsigned long long)(ticks[5] - ticks[4]),
+				(unsigned long long)(ticks.back() - ticks[ticks.size() - 2]));
+		}
+		printf("  serial       : %8.2f Mcmds/sec\n", n * loop_count / t_serial * 1e-6);
+
+		std::vector<int> thread_nums;
+		for (int threads = 1; threads < thread_max; threads *= 2)
+			thread_nums.push_back(threads);
+		thread_nums.push_back(std::max(1, thread_max));
+		for (int threads : thread_nums) {
+			job_system_t jobs;
+			std::vector<cmd_list_t> layer_lists;
+			cmd_list_t merged;
+			jobs.init(threads);
+			double t = get_time_sec();
+			for (int i = 0; i < loop_count; i++)
+				record_frame_cmds(jobs, layer_lists, merged, ids, ranges.data(), params,
+					clear_color, 1024, 1024);
+			t = get_time_sec() - t;
+			jobs.term();
+			if (merged.cmds.size() != n || memcmp(merged.cmds.data(), serial.cmds.data(), n * sizeof(cmd_t))) {
+				err("threads=%d merged list does not match the serial one\n", threads);
+				return 1;
+			}
+			printf("  threads=%-2d   : %8.2f Mcmds/sec x%.2f\n", threads, n * loop_count / t * 1e-6, t_serial / t);
+		}
+	}
+	return 0;
+}
+
+int
+bench_update(int layer_max, int object_max, int chunk, int thread_max, int loop_count)
+{
+	std::vector<ObjectFormat> serial(layer_max * object_max);
+	std::vector<ObjectFormat> objects(serial.size());
+	std::vector<PackedObjectFormat> packed(serial.size());
+	std::vector<ObjectFormat *> obj_ptrs;
+	std::vector<PackedObjectFormat *> packed_ptrs;
+	std::unique_ptr<object_store_t[]> stores(new object_store_t[layer_max]);
+	std::vector<std::vector<dirty_range_t>> ranges(layer_max);
+	std::vector<uint32_t> counts(layer_max, object_max);
+
+	thread_max = std::max(1, thread_max);
+	for (int lidx = 0; lidx < layer_max; lidx++) {
+		stores[lidx].init(object_max);
+		stores[lidx].set_flags(0, object_max, 1);
+		ranges[lidx].push_back({ 0, uint32_t(object_max) });
+		obj_ptrs.push_back(&objects[lidx * object_max]);
+		packed_ptrs.push_back(&packed[lidx * object_max]);
+	}
+
+	double t_serial = get_time_sec();
+	for (int i = 0; i < loop_count; i++)
+		for (int lidx = 0; lidx < layer_max; lidx++)
+			update_objects(&serial[lidx * object_max], object_max, lidx, i);
+	t_serial = get_time_sec() - t_serial;
+
+	double n = double(serial.size()) * loop_count;
+	printf("update objects=%zu chunk=%d loop=%d\n", serial.size(), chunk, loop_count);
+	printf("  serial    : %8.2f Mobjects/sec\n", n / t_serial * 1e-6);
+	std::vector<int> thread_nums;
+	for (int threads = 1; threads < thread_max; threads *= 2)
+		thread_nums.push_back(threads);
+	thread_nums.push_back(thread_max);
+	for (int threads : thread_nums) {
+		job_system_t jobs;
+		jobs.init(threads);
+		double t = get_time_sec();
+		for (int i = 0; i < loop_count; i++) {
+			update_layers(jobs, stores.get(), counts.data(), layer_max, chunk, i);
+			flush_layers(jobs, stores.get(), ranges.data(), obj_ptrs.data(), nullptr, layer_max, chunk);
+		}
+		t = get_time_sec() - t;
+		double t_packed = get_time_sec();
+		for (int i = 0; i < loop_count; i++) {
+			update_layers(jobs, stores.get(), counts.data(), layer_max, chunk, i);
+			flush_layers(jobs, stores.get(), ranges.data(), obj_ptrs.data(), packed_ptrs.data(), layer_max, chunk);
+		}
+		t_packed = get_time_sec() - t_packed;
+		uint64_t steals = jobs.steal_count;
+		jobs.term();
+
+		if (memcmp(serial.data(), objects.data(), serial.size() * sizeof(ObjectFormat))) {
+			err("threads=%d does not match the serial update\n", threads);
+			return 1;
+		}
+		printf("  threads=%-2d: %8.2f Mobjects/sec x%.2f, +pack %8.2f Mobjects/sec, steals=%llu\n",
+			threads, n / t * 1e-6, t_serial / t, n / t_packed * 1e-6,
+			(unsigned long long)steals);
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	enum {
+		ScreenWidth = 1024,
+		ScreenHeight = 1024,
+		Width = 512,
+		Height = 512,
+
+		FrameCount = 2,
+		LayerMax = 8,
+		ObjectMax = 4096,
+		MaxDescNum = 32,
+		MaxDescSrvNum = 256,
+		MaxDescSampler = 32,
+		DescPageSize = 256,   //CPU only descriptors per heap
+		DescRingSize = 1024,  //shader visible, grows when a frame needs more
+		UploadRingSize = 4 << 20,  //bytes, grows when the frames in flight need more
+		TexRingSize = 8 << 20,     //-tex, fixed
+		TexFrameBytes = 4 << 20,   //-tex, streamed per frame at most
+		TexEvictFrames = 120,      //-tex, frames without demand before a texture may go
+		ComputeUpdateGroupSize = 256,
+		UpdateChunk = 512,
+		DirtyPageShift = 0,
+		DirtyMergeGap = 16,
+		CaptureSlack = 3,  //capture slots over the frames in flight, time for the writer
+	};
+
+	bool draw_pull = false;
+	bool packed = false;
+	bool do_bench_update = false;
+	bool do_bench_cmd = false;
+	bool do_bench_cull = false;
+	bool do_bench_soft = false;
+	int soft = 0;
+	const char *dump = nullptr;
+	const char *capture_path = nullptr;
+	uint8_t capture_format = CaptureRaw;
+	bool do_bench_capture = false;
+	const char *benchmark = nullptr;
+	const char *json_path = nullptr;
+	const char *profile_path = nullptr;
+	const char *shader_cache_dir = "shader_cache";
+	int pipeline_threads = std::thread::hardware_concurrency();
+	bool committed = false;
+	bool defrag = false;
+	std::vector<const char *> atlas_paths;
+	const char *tex_path = nullptr;
+	uint64_t tex_budget = 256 << 20;
+	int bench_count = 0;
+	int layers = LayerMax;
+	uint32_t bench_w = ScreenWidth;
+	uint32_t bench_h = ScreenHeight;
+	bool raster = false;
+	bool vsync = true;
+	uint32_t animate = ~0u;
+	uint32_t objects = ObjectMax;
+	size_t budget = ~size_t(0);
+	int churn = 0;
+	int cull = CullNone;
+	double world = 1.0;
+	int frame_count = FrameCount;
+	int latency = 0;
+	int thread_num = std::thread::hardware_concurrency();
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-bench-expand"))
+			return bench_expand(LayerMax, ObjectMax, 256);
+		if (!strcmp(argv[i], "-check-pull"))
+			return check_pull(LayerMax, ObjectMax);
+		if (!strcmp(argv[i], "-bench-pack"))
+			return bench_pack(LayerMax, ObjectMax, 256);
+		if (!strcmp(argv[i], "-bench-rng"))
+			return bench_rng(LayerMax, ObjectMax, 64);
+		if (!strcmp(argv[i], "-bench-store"))
+			return bench_store(LayerMax, ObjectMax, 64);
+		if (!strcmp(argv[i], "-bench-dirty"))
+			return bench_dirty(LayerMax, ObjectMax, FrameCount, 64, 256);
+		if (!strcmp(argv[i], "-bench-slots"))
+			return bench_slots(ObjectMax, 64, 4096);
+		if (!strcmp(argv[i], "-bench-grow")) {
+			bench_grow(FrameCount, 100000, 2048, ~size_t(0));
+			return bench_grow(FrameCount, 100000, 2048, 16 << 20);
+		}
+		if (!strcmp(argv[i], "-bench-frames"))
+			return bench_frames(2000, 3000, 240);
+		if (!strcmp(argv[i], "-bench-update"))
+			do_bench_update = true;
+		if (!strcmp(argv[i], "-bench-cmd"))
+			do_bench_cmd = true;
+		if (!strcmp(argv[i], "-bench-cull"))
+			do_bench_cull = true;
+		if (!strcmp(argv[i], "-bench-soft"))
+			do_bench_soft = true;
+		if (!strcmp(argv[i], "-soft") && i + 1 < argc)
+			soft = std::max(atoi(argv[++i]), 1);
+		if (!strcmp(argv[i], "-dump") && i + 1 < argc)
+			dump = argv[++i];
+		if (!strcmp(argv[i], "-capture") && i + 1 < argc)
+			capture_path = argv[++i];
+		if (!strcmp(argv[i], "-y4m"))
+			capture_format = CaptureY4m;
+		if (!strcmp(argv[i], "-bench-capture"))
+			do_bench_capture = true;
+		if (!strcmp(argv[i], "-benchmark") && i + 1 < argc)
+			benchmark = argv[++i];
+		if (!strcmp(argv[i], "-bench-count") && i + 1 < argc)
+			bench_count = std::max(atoi(argv[++i]), 1);
+		if (!strcmp(argv[i], "-layers") && i + 1 < argc)
+			layers = std::min(std::max(atoi(argv[++i]), 1), int(LayerMax));
+		if (!strcmp(argv[i], "-size") && i + 1 < argc) {
+			unsigned sw = 0, sh = 0;
+			if (sscanf(argv[++i], "%ux%u", &sw, &sh) == 2 && sw >= 2 && sh >= 2) {
+				bench_w = sw;
+				bench_h = sh;
+			}
+		}
+		if (!strcmp(argv[i], "-json") && i + 1 < argc)
+			json_path = argv[++i];
+		if (!strcmp(argv[i], "-raster"))
+			raster = true;
+		if (!strcmp(argv[i], "-no-vsync"))
+			vsync = false;
+		if (!strcmp(argv[i], "-profile") && i + 1 < argc)
+			profile_path = argv[++i];
+		if (!strcmp(argv[i], "-shader-cache") && i + 1 < argc)
+			shader_cache_dir = argv[++i];
+		if (!strcmp(argv[i], "-no-shader-cache"))
+			shader_cache_dir = "";
+		if (!strcmp(argv[i], "-pso-threads") && i + 1 < argc)
+			pipeline_threads = std::max(atoi(argv[++i]), 1);
+		if (!strcmp(argv[i], "-bench-pipelines"))
+			return bench_pipelines(24, std::thread::hardware_concurrency());
+		if (!strcmp(argv[i], "-committed"))
+			committed = true;
+		if (!strcmp(argv[i], "-defrag"))
+			defrag = true;
+		if (!strcmp(argv[i], "-atlas") && i + 1 < argc && atlas_paths.size() < LayerMax)
+			atlas_paths.push_back(argv[++i]);
+		if (!strcmp(argv[i], "-atlas-build") && i + 2 < argc)
+			return atlas_build(argv[i + 1], argc - i - 2, argv + i + 2);
+		if (!strcmp(argv[i], "-check-atlas"))
+			return check_atlas(400);
+		if (!strcmp(argv[i], "-tex") && i + 1 < argc)
+			tex_path = argv[++i];
+		if (!strcmp(argv[i], "-tex-budget") && i + 1 < argc)
+			tex_budget = uint64_t(std::max(atoi(argv[++i]), 1)) << 20;
+		if (!strcmp(argv[i], "-tex-build") && i + 2 < argc)
+			return tex_build(argv[i + 1], argc - i - 2, argv + i + 2);
+		if (!strcmp(argv[i], "-check-tex"))
+			return check_tex(400);
+		if (!strcmp(argv[i], "-check-mem"))
+			return check_mem(1 << 16);
+		if (!strcmp(argv[i], "-check-desc"))
+			return check_desc(400);
+		if (!strcmp(argv[i], "-check-upload"))
+			return check_upload(400);
+		if (!strcmp(argv[i], "-check-cache"))
+			return check_cache();
+		if (!strcmp(argv[i], "-check-prof"))
+			return check_prof(1 << 24);
+		if (!strcmp(argv[i], "-check-state"))
+			return check_state();
+		if (!strcmp(argv[i], "-check-compose"))
+			return check_compose(LayerMax, ObjectMax, Width, Height);
+		if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+			thread_num = atoi(argv[++i]);
+		if (!strcmp(argv[i], "-animate") && i + 1 < argc)
+			animate = std::max(atoi(argv[++i]), 0);
+		if (!strcmp(argv[i], "-objects") && i + 1 < argc)
+			objects = std::max(atoi(argv[++i]), 0);
+		if (!strcmp(argv[i], "-budget") && i + 1 < argc)
+			budget = size_t(std::max(atoi(argv[++i]), 0)) << 20;
+		if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+			frame_count = std::min(std::max(atoi(argv[++i]), 2), 4);
+		if (!strcmp(argv[i], "-latency") && i + 1 < argc)
+			latency = std::min(std::max(atoi(argv[++i]), 1), 16);
+		if (!strcmp(argv[i], "-churn") && i + 1 < argc)
+			churn = atoi(argv[++i]);
+		if (!strcmp(argv[i], "-draw-pull"))
+			draw_pull = true;
+		if (!strcmp(argv[i], "-packed"))
+			packed = true;
+		if (!strcmp(argv[i], "-cull"))
+			cull = CullCpu;
+		if (!strcmp(argv[i], "-cull-gpu"))
+			cull = CullGpu;
+		if (!strcmp(argv[i], "-world") && i + 1 < argc)
+			world = std::max(atof(argv[++i]), 1.0);
+	}
+	//cull.hlsl writes the instance count, only the pull path draws from it.
+	if (cull == CullGpu)
+		draw_pull = true;
+	if (latency <= 0)
+		latency = frame_count - 1;
+	if (profile_path)
+		prof_t::get().enable();
+	if (do_bench_update)
+		return bench_update(LayerMax, ObjectMax, UpdateChunk, thread_num, 64);
+	if (do_bench_cull)
+		return bench_cull(LayerMax, ObjectMax * 4, thread_num, 16, 2.0);
+	if (do_bench_cmd)
+		return bench_cmd(LayerMax, ObjectMax, thread_num, 256);
+	if (do_bench_soft)
+		return bench_soft(LayerMax, ObjectMax, Width, Height, ScreenWidth, ScreenHeight, thread_num, 16);
+	if (do_bench_capture)
+		return bench_capture(ScreenWidth, ScreenHeight, 240, 60, FrameCount + CaptureSlack);
+	if (benchmark) {
+		int ret = run_benchmark(benchmark, layers, objects, bench_w, bench_h, bench_count ? bench_count : 240,
+			frame_count, thread_num, raster, world, json_path);
+		return profile_path ? ret | prof_write(profile_path) : ret;
+	}
+	FILE *capture_fp = nullptr;
+	if (capture_path) {
+		capture_fp = capture_open(capture_path);
+		if (!capture_fp) {
+			err("can not open %s\n", capture_path);
+			return 1;
+		}
+	}
+	if (soft) {
+		capture_t cap;
+		std::vector<std::vector<uint8_t>> mem(capture_fp ? FrameCount + CaptureSlack : 0);
+		std::vector<const uint8_t *> ptrs;
+		for (auto & m : mem) {
+			m.resize(ScreenWidth * ScreenHeight * 4);
+			ptrs.push_back(m.data());
+		}
+		if (capture_fp)
+			cap.init(capture_t::file_sink(capture_fp), capture_format,
+				ScreenWidth, ScreenHeight, ScreenWidth * 4, 60, ptrs);
+		int ret = run_soft(LayerMax, objects, Width, Height, ScreenWidth, ScreenHeight, soft,
+			thread_num, world, dump, capture_fp ? &cap : nullptr);
+		if (capture_fp)
+			fclose(capture_fp);
+		return profile_path ? ret | prof_write(profile_path) : ret;
+	}
+#ifndef _WIN32
+	(void)draw_pull;
+	(void)packed;
+	(void)thread_num;
+	(void)animate;
+	(void)objects;
+	(void)budget;
+	(void)churn;
+	(void)cull;
+	(void)world;
+	(void)frame_count;
+	(void)latency;
+	(void)vsync;
+	(void)shader_cache_dir;
+	(void)pipeline_threads;
+	(void)committed;
+	(void)defrag;
+	(void)atlas_paths;
+	(void)tex_path;
+	(void)tex_budget;
+	err("D3D12 renderer is only available on Windows, try -soft N\n");
+	return 1;
+#else
+	double t_startup = get_time_sec();
+	auto hwnd = win_create("test", ScreenWidth, ScreenHeight);
+	auto dev = create_device();
+	d3d_mem_t gpu_mem;
+	gpu_mem.init(dev, committed);
+
+	auto queue = create_queue(dev);
+	auto swapchain = create_swap_chain(queue, hwnd, ScreenWidth, ScreenHeight, frame_count);
+	auto root_gsig = create_root_gsig(dev);
+	auto root_csig = create_root_csig(dev);
+
+	//views live in CPU only pools (desc.h), every frame copies its tables
+	//into the shader visible rings.
+	auto type_view = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+	auto type_rtv = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+	auto type_sampler = D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER;
+	auto inc_view = dev->GetDescriptorHandleIncrementSize(type_view);
+	auto inc_sampler = dev->GetDescriptorHandleIncrementSize(type_sampler);
+	desc_pool_t pool_rtv;
+	desc_pool_t pool_view;
+	desc_pool_t pool_sampler;
+	desc_ring_t ring_view;
+	desc_ring_t ring_sampler;
+	pool_rtv.init(dev->GetDescriptorHandleIncrementSize(type_rtv), DescPageSize,
+		d3d_desc_heaps(dev, type_rtv, false), d3d_desc_release);
+	pool_view.init(inc_view, DescPageSize, d3d_desc_heaps(dev, type_view, false), d3d_desc_release);
+	pool_sampler.init(inc_sampler, MaxDescSampler, d3d_desc_heaps(dev, type_sampler, false), d3d_desc_release);
+	ring_view.init(inc_view, DescRingSize, d3d_desc_heaps(dev, type_view, true), d3d_desc_release);
+	ring_sampler.init(inc_sampler, MaxDescSampler * 4, d3d_desc_heaps(dev, type_sampler, true), d3d_desc_release);
+	std::vector<D3D_SHADER_MACRO> defines_packed;
+	if (packed)
+		defines_packed.push_back({ "PACKED", "1" });
+	defines_packed.push_back({ nullptr, nullptr });
+	std::vector<D3D_SHADER_MACRO> defines_cull = defines_packed;
+	if (cull != CullNone)
+		defines_cull.insert(defines_cull.begin(), { "CULL", "1" });
+	auto defines = defines_cull.data();
+	//-atlas : the sprites sample the atlas of their layer.
+	std::vector<D3D_SHADER_MACRO> defines_draw = defines_cull;
+	std::vector<D3D_SHADER_MACRO> defines_rects(1, { nullptr, nullptr });
+	if (!atlas_paths.empty()) {
+		defines_draw.insert(defines_draw.begin(), { "ATLAS", "1" });
+		defines_rects.insert(defines_rects.begin(), { "ATLAS", "1" });
+	}
+	//-tex : they sample user_tex[matid] (tex_assign()).
+	if (tex_path) {
+		defines_draw.insert(defines_draw.begin(), { "USER_TEX", "1" });
+		defines_rects.insert(defines_rects.begin(), { "USER_TEX", "1" });
+	}
+	auto sprite_layout = packed ? InputLayoutPackedVertex : InputLayoutVertex;
+	//in the order the first frames need them : the clears, then the sprites.
+	shader_cache_t shader_cache;
+	pipeline_builder_t pipelines;
+	auto fmt_color = DXGI_FORMAT_R8G8B8A8_UNORM;
+	auto fmt_depth = DXGI_FORMAT_R32_FLOAT;
+	shader_cache.init(shader_cache_dir, std::to_string(D3D_COMPILER_VERSION), d3d_compile);
+	auto pso_present = pipelines.add("present", [&]() -> void * {
+		return create_gpstate_from_file(dev, &shader_cache, root_gsig, fmt_color, fmt_depth, "present");
+	});
+	auto pso_clear = pipelines.add("clear", [&]() -> void * {
+		return create_gpstate_from_file(dev, &shader_cache, root_gsig, fmt_color, fmt_depth, "clear");
+	});
+	auto add_draw_sprites = [&]() {
+		return pipelines.add("draw_sprites", [&]() -> void * {
+			return create_gpstate_from_file(dev, &shader_cache, root_gsig, fmt_color, fmt_depth,
+				"draw_sprites", InputLayoutNone, defines_draw.data());
+		});
+	};
+	auto add_draw_rects = [&]() {
+		return pipelines.add("draw_rects", [&]() -> void * {
+			return create_gpstate_from_file(dev, &shader_cache, root_gsig, fmt_color, fmt_depth,
+				"draw_rects", sprite_layout, defines_rects.data());
+		});
+	};
+	uint32_t pso_draw_sprites = ~0u;
+	uint32_t pso_draw_rects = ~0u;
+	uint32_t pso_cull = ~0u;
+	if (draw_pull) {
+		pso_draw_sprites = add_draw_sprites();
+		if (cull == CullGpu)
+			pso_cull = pipelines.add("cull", [&]() -> void * {
+				return create_cpstate_from_file(dev, &shader_cache, root_csig, "cull", defines_packed.data());
+			});
+	}
+	auto pso_update = pipelines.add("update", [&]() -> void * {
+		return create_cpstate_from_file(dev, &shader_cache, root_csig, "update", defines);
+	});
+	pso_draw_rects = add_draw_rects();
+	if (!draw_pull)
+		pso_draw_sprites = add_draw_sprites();
+	pipelines.start(pipeline_threads);
+	bool sprites_ready = false;
+	bool clear_ready = false;
+	bool pipelines_reported = false;
+	auto cmd_sig_draw = create_cmd_sig_draw(dev);
+
+	VertexFormat vertex_rect[6] = {
+		{ {-1, -1, 0, 1}, {0, 0} },
+		{ {-1,  1, 0, 1}, {0, 1} },
+		{ { 1, -1, 0, 1}, {1, 0} },
+
+		{ { 1,  1, 0, 1}, {1, 1} },
+		{ {-1,  1, 0, 1}, {0, 1} },
+		{ { 1, -1, 0, 1}, {1, 0} },
+	};
+	float clear_color[LayerMax][4] = {
+		{1, 0, 0, 1},
+		{0, 0, 1, 1},
+		{0, 1, 1, 1},
+		{1, 0, 1, 1},
+		{1, 1, 0, 1},
+		{0, 1, 1, 1},
+		{0, 0, 1, 1},
+		{1, 0, 0, 1},
+	};
+	std::vector<frame_info_t> framedata(frame_count);
+
+	desc_range_t samplers;
+	if (!pool_sampler.alloc(2, samplers)) {
+		err("out of descriptor heaps\n");
+		return 1;
+	}
+	create_sampler(dev, D3D12_FILTER_MIN_MAG_MIP_POINT, cpu_handle(samplers, 0));
+	create_sampler(dev, D3D12_FILTER_MIN_MAG_MIP_LINEAR, cpu_handle(samplers, 1));
+
+	auto object_size = packed ? sizeof(PackedObjectFormat) : sizeof(ObjectFormat);
+	auto vertex_size = packed ? sizeof(PackedVertexFormat) : sizeof(VertexFormat);
+	//default copy of every frame in flight, the expanded vertices and the store.
+	//uploads come from ring_upload and only hold what changed.
+	auto layer_bytes_per_object = frame_count * (object_size + (draw_pull ? 0 : vertex_size * 6)) +
+		sizeof(float) * object_store_t::ArrayNum;
+	state_tracker_t tracker;
+
+	//-atlas : sprite atlases (atlas.h), layer i samples atlas i % count.
+	std::vector<atlas_t> atlases(atlas_paths.size());
+	std::vector<ID3D12Resource *> res_atlas;
+	desc_range_t atlas_views;
+	for (size_t i = 0; i < atlases.size(); i++) {
+		auto & a = atlases[i];
+		if (!a.load(atlas_paths[i]) || a.rects.empty()) {
+			err("cannot load atlas %s\n", atlas_paths[i]);
+			return 1;
+		}
+		auto res = create_res_texture(&gpu_mem, a.width, a.height, DXGI_FORMAT_R8G8B8A8_UNORM);
+		if (!res || !upload_texture(dev, queue, &gpu_mem, res, a.pixels.data(), a.width, a.height)) {
+			err("cannot upload atlas %s\n", atlas_paths[i]);
+			return 1;
+		}
+		tracker.set(uintptr_t(res), CmdStatePixelResource);
+		res_atlas.push_back(res);
+		dbg("atlas %s : %ux%u, %zu sprites, %.1f%% used\n", atlas_paths[i], a.width, a.height,
+			a.rects.size(), a.occupancy() * 100.0);
+		//only the table is needed from now on.
+		a.pixels.clear();
+		a.pixels.shrink_to_fit();
+	}
+	if (!res_atlas.empty()) {
+		if (!pool_view.alloc(uint32_t(res_atlas.size()), atlas_views)) {
+			err("out of descriptor heaps\n");
+			return 1;
+		}
+		for (size_t i = 0; i < res_atlas.size(); i++)
+			create_srv(dev, res_atlas[i], cpu_handle(atlas_views, uint32_t(i)));
+	}
+
+	//upload buffers of the rings (upload.h), mapped for good.
+	upload_create_t create_upload = [&](uint64_t size, upload_buffer_t &b) {
+		size = (size + 255) & ~255;
+		auto res = create_res_buffer(&gpu_mem, UINT(size));
+		if (!res)
+			return false;
+		b.resource = res;
+		b.cpu = (uint8_t *)get_data_address(res);
+		b.gpu = res->GetGPUVirtualAddress();
+		b.size = size;
+		tracker.set(uintptr_t(res), CmdStateGenericRead, 1, true);
+		return true;
+	};
+	upload_release_t release_upload = [&](upload_buffer_t &b) {
+		tracker.forget(uintptr_t(b.resource));
+		gpu_mem.release((ID3D12Resource *)b.resource);
+	};
+
+	//-tex : textures streamed from the mapped container (tex.h), user_tex[1 + i] of every layer.
+	//Until a texture has a mip resident its view is a white texel.
+	tex_file_t tex_file;
+	tex_stream_t tex_stream;
+	uint32_t tex_num = 0;
+	std::vector<uintptr_t> res_tex;
+	std::vector<std::pair<ID3D12Resource *, uint64_t>> tex_retired;  //evicted, released once their fence completed
+	std::vector<tex_stream_job_t> tex_jobs;
+	std::vector<uint32_t> tex_evicted;
+	std::vector<float> tex_area[LayerMax];
+	std::vector<float> tex_size[LayerMax];
+	ID3D12Resource *res_white = nullptr;
+	desc_range_t tex_views;
+	if (tex_path) {
+		const uint8_t white[4] = { 255, 255, 255, 255 };
+		if (!tex_file.open(tex_path) || tex_file.count() == 0) {
+			err("cannot open textures %s\n", tex_path);
+			return 1;
+		}
+		tex_num = std::min(tex_file.count(), 255u);
+		res_white = create_res_texture(&gpu_mem, 1, 1, DXGI_FORMAT_R8G8B8A8_UNORM);
+		if (!res_white || !upload_texture(dev, queue, &gpu_mem, res_white, white, 1, 1)) {
+			err("cannot upload the white texture\n");
+			return 1;
+		}
+		tracker.set(uintptr_t(res_white), CmdStatePixelResource);
+		res_tex.assign(tex_file.count(), 0);
+		if (!pool_view.alloc(tex_num, tex_views)) {
+			err("out of descriptor heaps\n");
+			return 1;
+		}
+		for (uint32_t i = 0; i < tex_num; i++)
+			create_srv(dev, res_white, cpu_handle(tex_views, i));
+		for (auto & a : tex_area)
+			a.resize(tex_file.count());
+		for (auto & a : tex_size)
+			a.resize(tex_file.count());
+		if (!tex_stream.init(&tex_file, TexRingSize, create_upload, release_upload,
+			TexFrameBytes, tex_budget, TexEvictFrames)) {
+			err("cannot create the texture stream\n");
+			return 1;
+		}
+		dbg("textures %s : %u of %u used, %.1f MB mapped, budget %.0f MB\n", tex_path, tex_num,
+			tex_file.count(), tex_file.map.size / 1048576.0, tex_budget / 1048576.0);
+	}
+	tile_cover_t covers[LayerMax];
+	tile_mask_t compose_mask;
+	for (int lidx = 0; lidx < LayerMax; lidx++)
+		covers[lidx].init(Width, Height, ComposeLayerTile);
+	compose_mask.init(ScreenWidth, ScreenHeight, ComposeOutTile);
+	for (int i = 0 ; i < frame_count; i++) {
+		auto & ref = framedata[i];
+		ref.init(dev, swapchain, i);
+		ref.res_vertex_buffer_rect = create_res_buffer(&gpu_mem, sizeof(vertex_rect));
+		upload_data(ref.res_vertex_buffer_rect, vertex_rect, sizeof(vertex_rect));
+		ref.res_draw_args = create_res_buffer(&gpu_mem, sizeof(D3D12_DRAW_ARGUMENTS) * LayerMax);
+		ref.draw_args = (D3D12_DRAW_ARGUMENTS *)get_data_address(ref.res_draw_args);
+		ref.res_tile_mask = create_res_buffer(&gpu_mem, compose_mask.buffer_size());
+		ref.tile_mask = (uint32_t *)get_data_address(ref.res_tile_mask);
+		tracker.set(uintptr_t(ref.image), CmdStateCommon);
+		tracker.set(uintptr_t(ref.res_vertex_buffer_rect), CmdStateGenericRead, 1, true);
+		tracker.set(uintptr_t(ref.res_draw_args), CmdStateGenericRead, 1, true);
+		tracker.set(uintptr_t(ref.res_tile_mask), CmdStateGenericRead, 1, true);
+
+		auto desc_backbuffer = ref.image->GetDesc();
+		if (!pool_rtv.alloc(LayerMax + 1, ref.rtv) || !pool_view.alloc(LayerMax, ref.srv)) {
+			err("out of descriptor heaps\n");
+			return 1;
+		}
+		for (int i = 0 ; i < LayerMax; i++) {
+			frame_info_t::layer_t layer;
+			layer.image = create_res_render_target(&gpu_mem, Width, Height, desc_backbuffer.Format);
+			tracker.set(uintptr_t(layer.image), CmdStateCommon);
+			if (cull == CullGpu) {
+				layer.res_cull_args = create_res_uav_buffer(&gpu_mem, sizeof(D3D12_DRAW_ARGUMENTS));
+				tracker.set(uintptr_t(layer.res_cull_args), CmdStateCommon, 1, true);
+			}
+			layer.dirty.init(0, DirtyPageShift);
+			create_rtv(dev, layer.image, cpu_handle(ref.rtv, i));
+			create_srv(dev, layer.image, cpu_handle(ref.srv, i));
+			ref.layers.push_back(layer);
+		}
+
+		//object buffers are created by fit_layer_buffers() at the first frame.
+		for (auto & layer : ref.layers) {
+			if (!pool_view.alloc(2, layer.uav)) {
+				err("out of descriptor heaps\n");
+				return 1;
+			}
+		}
+		create_rtv(dev, ref.image, cpu_handle(ref.rtv, LayerMax));
+		ref.cmd_list->Close();
+	}
+
+	//
+	// (Re)create the object buffers and views of a layer of a frame at the
+	// capacity of its slot allocator. Only called once the fence of that
+	// frame has completed, so the old buffers are idle.
+	//
+	auto fit_layer_buffers = [&](frame_info_t::layer_t &layer, uint32_t capacity) {
+		if (layer.capacity == capacity)
+			return false;
+		auto release = [&tracker, &gpu_mem](ID3D12Resource *&res) {
+			if (res) {
+				tracker.forget(uintptr_t(res));
+				gpu_mem.release(res);
+			}
+			res = nullptr;
+		};
+		release(layer.res_object_update_buffer_uav);
+		release(layer.res_object_vertex);
+		release(layer.res_visible);
+
+		auto object_buffer_size = object_size * capacity;
+		auto object_buffer_vertex_size = vertex_size * 6 * capacity;
+		object_buffer_size = (object_buffer_size + 255) & ~255;
+		object_buffer_vertex_size = (object_buffer_vertex_size + 255) & ~255;
+		auto huav_src = cpu_handle(layer.uav, 0);
+		auto huav_dst = cpu_handle(layer.uav, 1);
+		layer.res_object_update_buffer_uav = create_res_uav_buffer(&gpu_mem, object_buffer_size);
+		create_uav(dev, layer.res_object_update_buffer_uav, capacity, object_size, huav_src);
+		if (!draw_pull) {
+			layer.res_object_vertex = create_res_uav_buffer(&gpu_mem, object_buffer_vertex_size);
+			create_uav(dev, layer.res_object_vertex, capacity * 6, vertex_size, huav_dst);
+			tracker.set(uintptr_t(layer.res_object_vertex), CmdStateCommon, 1, true);
+		}
+		tracker.set(uintptr_t(layer.res_object_update_buffer_uav), CmdStateCommon, 1, true);
+
+		//kept list : written by bin.h into an upload buffer, or by cull.hlsl.
+		auto visible_size = (sizeof(uint32_t) * capacity + 255) & ~255;
+		if (cull == CullCpu) {
+			layer.res_visible = create_res_buffer(&gpu_mem, visible_size);
+			layer.visible = (uint32_t *)get_data_address(layer.res_visible);
+			tracker.set(uintptr_t(layer.res_visible), CmdStateGenericRead, 1, true);
+		} else if (cull == CullGpu) {
+			layer.res_visible = create_res_uav_buffer(&gpu_mem, visible_size);
+			tracker.set(uintptr_t(layer.res_visible), CmdStateCommon, 1, true);
+		}
+		layer.capacity = capacity;
+		layer.dirty.init(capacity, DirtyPageShift);
+		layer.dirty.mark_all();
+		dbg("capacity=%u res_object_update_buffer_uav=%p\n", capacity, layer.res_object_update_buffer_uav);
+		return true;
+	};
+
+	//
+	// Moves the object buffers of a layer of an idle frame where defrag()
+	// planned them. Upload buffers keep their contents, the mapped pointers
+	// and views follow; default buffers lose theirs and are uploaded again.
+	// The upload ring is not moved, its buffers only live a few frames.
+	//
+	auto move_layer_buffers = [&](frame_info_t::layer_t &layer) {
+		auto move = [&](ID3D12Resource *&res, uint8_t state) {
+			auto p = res ? gpu_mem.move(res) : res;
+			if (p == res)
+				return false;
+			tracker.forget(uintptr_t(res));
+			tracker.set(uintptr_t(p), state, 1, true);
+			res = p;
+			return true;
+		};
+		if (move(layer.res_object_update_buffer_uav, CmdStateCommon)) {
+			create_uav(dev, layer.res_object_update_buffer_uav, layer.capacity, object_size, cpu_handle(layer.uav, 0));
+			layer.dirty.mark_all();
+		}
+		if (move(layer.res_object_vertex, CmdStateCommon)) {
+			create_uav(dev, layer.res_object_vertex, layer.capacity * 6, vertex_size, cpu_handle(layer.uav, 1));
+			layer.dirty.mark_all();
+		}
+		if (move(layer.res_visible, cull == CullCpu ? CmdStateGenericRead : CmdStateCommon) && cull == CullCpu)
+			layer.visible = (uint32_t *)get_data_address(layer.res_visible);
+	};
+
+	//
+	// Commands are recorded every frame into the IR (cmd.h), one list per
+	// layer on the job system, then the state tracker places the barriers
+	// and the result is translated into the command list.
+	// The object copies and the update dispatch only cover the dirty ranges.
+	//
+	job_system_t jobs;
+	jobs.init(thread_num);
+
+	//viewport culling (bin.h) of every layer, only the kept list, no tiles.
+	const float cull_margin = 2.0f / Width;
+	sprite_bins_t bins[LayerMax];
+	uint32_t live_end[LayerMax] = {};
+	for (auto & b : bins)
+		b.init({ cull_margin, 0, 0 });
+
+	//dirty ranges of every frame (upload.h), back in the ring once its fence completed.
+	upload_ring_t ring_upload;
+	ring_upload.init(UploadRingSize, create_upload, release_upload);
+	//-packed : the ranges are flushed here, then packed into the ring.
+	std::vector<ObjectFormat> pack_staging[LayerMax];
+
+	//capture ring (capture.h), readback buffers stay mapped.
+	capture_t cap;
+	std::vector<ID3D12Resource *> res_capture;
+	uint32_t capture_pitch = capture_t::pitch(ScreenWidth);
+	int capture_slot = -1;
+	if (capture_fp) {
+		std::vector<const uint8_t *> ptrs;
+		for (int i = 0; i < frame_count + CaptureSlack; i++) {
+			auto res = create_res_readback(&gpu_mem, capture_pitch * ScreenHeight);
+			res_capture.push_back(res);
+			ptrs.push_back((const uint8_t *)get_data_address(res));
+			tracker.set(uintptr_t(res), CmdStateCopyDest, 1, true);
+		}
+		cap.init(capture_t::file_sink(capture_fp), capture_format,
+			ScreenWidth, ScreenHeight, capture_pitch, 60, ptrs);
+	}
+
+	//timestamps of every pass (prof.h), resolved into a mapped readback buffer.
+	prof_gpu_t gpu_prof;
+	ID3D12QueryHeap *timestamp_heap = nullptr;
+	ID3D12Resource *res_timestamps = nullptr;
+	const uint64_t *timestamp_ticks = nullptr;
+	if (profile_path) {
+		D3D12_QUERY_HEAP_DESC desc = {};
+		UINT64 freq = 0, gpu_tick = 0, cpu_tick = 0;
+		LARGE_INTEGER qpf;
+		gpu_prof.init(prof_pair_names(LayerMax), frame_count);
+		desc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+		desc.Count = gpu_prof.query_num();
+		dev->CreateQueryHeap(&desc, IID_PPV_ARGS(&timestamp_heap));
+		res_timestamps = create_res_readback(&gpu_mem, desc.Count * sizeof(uint64_t));
+		timestamp_ticks = (const uint64_t *)get_data_address(res_timestamps);
+		tracker.set(uintptr_t(res_timestamps), CmdStateCopyDest, 1, true);
+		//steady_clock is QueryPerformanceCounter in ns.
+		queue->GetTimestampFrequency(&freq);
+		queue->GetClockCalibration(&gpu_tick, &cpu_tick);
+		QueryPerformanceFrequency(&qpf);
+		gpu_prof.calibrate(freq, gpu_tick, uint64_t(double(cpu_tick) * 1e9 / double(qpf.QuadPart)));
+	}
+
+	cmd_table_t cmd_table;
+	cmd_list_t cmd_frame;
+	cmd_list_t cmd_stream;
+	cmd_list_t cmd_resolved;
+	std::vector<cmd_list_t> cmd_layers;
+	//false when the rings cannot give the frame its descriptors, nothing is recorded then.
+	auto record_frame = [&](int findex) -> bool {
+		auto & ref = framedata[findex];
+		auto cmd_list = ref.cmd_list;
+		frame_cmd_ids_t ids;
+		layer_cmd_params_t params = {
+			draw_pull, uint8_t(cull), cull_margin, uint32_t(object_size), uint32_t(vertex_size),
+			sizeof(vertex_rect), sizeof(VertexFormat), Width, Height, ComputeUpdateGroupSize,
+		};
+		std::vector<dirty_range_t> ranges[LayerMax];
+
+		//tables of the frame : the layer SRVs, then update and vertex UAVs of every layer,
+		//then user_tex[] of every layer : its atlas (or white), the -tex textures.
+		desc_range_t views;
+		desc_range_t sampler_table;
+		uint32_t user_num = res_atlas.empty() && !tex_num ? 0 : 1 + tex_num;
+		uint32_t view_num = LayerMax * (3 + user_num);
+		if (!ring_view.alloc(view_num, views) || !ring_sampler.alloc(samplers.num, sampler_table))
+			return false;
+		dev->CopyDescriptorsSimple(LayerMax, cpu_handle(views), cpu_handle(ref.srv), type_view);
+		for (int i = 0 ; i < LayerMax; i++)
+			dev->CopyDescriptorsSimple(2, cpu_handle(views, LayerMax + i * 2), cpu_handle(ref.layers[i].uav), type_view);
+		for (int i = 0; user_num && i < LayerMax; i++) {
+			uint32_t at = LayerMax * 3 + i * user_num;
+			if (res_atlas.empty())
+				create_srv(dev, res_white, cpu_handle(views, at));
+			else
+				dev->CopyDescriptorsSimple(1, cpu_handle(views, at), cpu_handle(atlas_views, i % res_atlas.size()), type_view);
+			if (tex_num)
+				dev->CopyDescriptorsSimple(tex_num, cpu_handle(views, at + 1), cpu_handle(tex_views), type_view);
+		}
+		dev->CopyDescriptorsSimple(samplers.num, cpu_handle(sampler_table), cpu_handle(samplers), type_sampler);
+		std::vector<ID3D12DescriptorHeap *> heaplists = {
+			(ID3D12DescriptorHeap *)ring_view.buffer.heap,
+			(ID3D12DescriptorHeap *)ring_sampler.buffer.heap,
+		};
+
+		//ids change with the layer buffers, so the table is built every frame.
+		cmd_table.reset();
+		ids.root_gsig = cmd_table.add(root_gsig);
+		ids.root_csig = cmd_table.add(root_csig);
+		//pipelines still building are CmdNoId.
+		auto pso = [&](uint32_t h) {
+			auto p = h == ~0u ? nullptr : pipelines.get<ID3D12PipelineState>(h);
+			return p ? cmd_table.add(p) : CmdNoId;
+		};
+		ids.pso_update = pso(pso_update);
+		ids.pso_clear = clear_ready ? pso(pso_clear) : CmdNoId;
+		ids.pso_draw_rects = pso(pso_draw_rects);
+		ids.pso_draw_sprites = pso(pso_draw_sprites);
+		ids.pso_present = pso(pso_present);
+		ids.pso_cull = pso(pso_cull);
+		ids.sprites = sprites_ready;
+		ids.srv_table = cmd_table.add(uintptr_t(views.gpu_at(0)));
+		ids.sampler_table = cmd_table.add(uintptr_t(sampler_table.gpu_at(0)));
+		ids.rect_vertex = cmd_table.add(ref.res_vertex_buffer_rect);
+		ids.draw_args = cmd_table.add(ref.res_draw_args);
+		ids.backbuffer = cmd_table.add(ref.image);
+		ids.backbuffer_rtv = cmd_table.add(uintptr_t(ref.rtv.cpu_at(LayerMax)));
+		ids.tile_mask = cmd_table.add(ref.res_tile_mask);
+		ids.capture = capture_slot < 0 ? CmdNoId : cmd_table.add(res_capture[capture_slot]);
+		ids.capture_pitch = capture_pitch;
+		ids.timestamps = timestamp_heap ? cmd_table.add(timestamp_heap) : CmdNoId;
+		ids.timestamp_readback = timestamp_heap ? cmd_table.add(res_timestamps) : CmdNoId;
+		ids.timestamp_base = timestamp_heap ? gpu_prof.query(findex, 0) : 0;
 		for (int i = 0 ; i < LayerMax; i++) {
 			auto & layer = ref.layers[i];
-			auto barrier = get_barrier(layer.image, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COMMON);
-			cmd_list->ResourceBarrier(1, &barrier);
-		}
-		printf("End Layer Command\n");
-		auto barrier_present_begin = get_barrier(ref.image, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		auto barrier_present_end = get_barrier(ref.image, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COMMON);
-		cmd_list->ResourceBarrier(1, &barrier_present_begin);
-		cmd_list->OMSetRenderTargets(rtv_backbuffer_handles.size(), rtv_backbuffer_handles.data(), FALSE, nullptr);
-		cmd_list->ClearRenderTargetView(hbackbuffer.cpu, clear_color[i], 0, NULL);
-		D3D12_VIEWPORT viewport = {0, 0, ScreenWidth, ScreenHeight, 0.0f, 1.0f };
-		D3D12_RECT rect = { 0, 0, ScreenWidth, ScreenHeight };
-
-		cmd_list->RSSetViewports(1, &viewport);
-		cmd_list->RSSetScissorRects(1, &rect);
-		cmd_list->SetPipelineState(pstate_present);
-		cmd_list->IASetVertexBuffers(0, 1, &view);
-		cmd_list->DrawInstanced(6, 1, 0, 0);
-		cmd_list->ResourceBarrier(1, &barrier_present_end);
+			layer_cmd_ids_t l;
+			l.image = cmd_table.add(layer.image);
+			l.rtv = cmd_table.add(uintptr_t(ref.rtv.cpu_at(i)));
+			l.update_buffer = cmd_table.add(layer.res_object_update_buffer_uav);
+			l.upload = cmd_table.add(layer.upload.resource);
+			l.upload_offset = uint32_t(layer.upload.offset);
+			l.vertex_buffer = cmd_table.add(layer.res_object_vertex);
+			l.uav_src = cmd_table.add(uintptr_t(views.gpu_at(LayerMax + i * 2)));
+			l.uav_dst = cmd_table.add(uintptr_t(views.gpu_at(LayerMax + i * 2 + 1)));
+			l.visible = cmd_table.add(layer.res_visible);
+			l.cull_args = cmd_table.add(layer.res_cull_args);
+			l.capacity = layer.capacity;
+			l.count = live_end[i];
+			l.visible_count = layer.visible_count;
+			l.user_tex = user_num ? cmd_table.add(uintptr_t(views.gpu_at(LayerMax * 3 + i * user_num))) : CmdNoId;
+			l.idle = layer.idle;
+			ids.layers.push_back(l);
+			ranges[i] = layer.ranges;
+		}
+		record_frame_cmds(jobs, cmd_layers, cmd_frame, ids, ranges, params,
+			clear_color[findex], ScreenWidth, ScreenHeight);
+		//-tex : the streamed mips go first.
+		if (!tex_jobs.empty()) {
+			cmd_stream.reset();
+			record_stream_cmds(cmd_stream, cmd_table, tex_file, tex_jobs, res_tex);
+			cmd_stream.append(cmd_frame);
+			std::swap(cmd_stream, cmd_frame);
+		}
+
+		ref.cmd_alloc->Reset();
+		cmd_list->Reset(ref.cmd_alloc, 0);
+		cmd_list->SetDescriptorHeaps(heaplists.size(), heaplists.data());
+		tracker.resolve(cmd_frame, cmd_resolved, cmd_table.objects);
+		d3d_translate(cmd_list, cmd_resolved, cmd_table, cmd_sig_draw);
 		cmd_list->Close();
-	}
-	dbg("heap_rtv=%p\n", heap_rtv);
-	dbg("heap_dsv=%p\n", heap_dsv);
-	dbg("heap_srv=%p\n", heap_srv);
-	dbg("heap_sampler=%p\n", heap_sampler);
+		return true;
+	};
+	dbg("ring_view=%p\n", ring_view.buffer.heap);
+	dbg("ring_sampler=%p\n", ring_sampler.buffer.heap);
 	dbg("dev=%p\n", dev);
 	dbg("swapchain=%p\n", swapchain);
 	dbg("root_gsig=%p\n", root_gsig);
 	dbg("root_csig=%p\n", root_csig);
-	dbg("pstate_clear=%p\n", pstate_clear);
 
+	object_store_t stores[LayerMax];
+	slot_allocator_t slots[LayerMax];
+	std::vector<slot_handle_t> handles[LayerMax];
+	for (int lidx = 0; lidx < LayerMax; lidx++) {
+		stores[lidx].init(LayerCapacityMin);
+		slots[lidx].init(LayerCapacityMin);
+	}
+	dbg("threads=%d\n", jobs.num_threads());
+
+	d3d_timeline_t timeline;
+	frame_scheduler_t sched;
+	timeline.init(dev, queue, swapchain, latency);
+	sched.init(&timeline, frame_count);
+	dbg("frames=%d latency=%d\n", frame_count, latency);
+
+	upload_stats_t stats;
+	double compose_samples = 0.0;
+	double cull_kept = 0.0;
+	double cull_live = 0.0;
 	double a_time = 0.0;
+	bench_scene_result_t bench;
+	double bench_t = get_time_sec();
+	bench.name = "window";
+	bench.objects = objects;
+	bench.churn = churn;
+	//a frame that cannot be recorded ends the loop, the shutdown below still runs.
+	bool failed = false;
 	while (win_update()) {
+		if (bench_count && int(bench.frame.values.size()) == bench_count)
+			break;
+		prof_t::get().frame();
+		double t0 = get_time_sec();
 		a_time += 1.0 / 16.0f;
 		auto index = swapchain->GetCurrentBackBufferIndex();
 		auto & ref = framedata[index];
+		{
+			PROF_SCOPE("frame wait");
+			sched.begin(index);
+		}
+		ring_view.retire(timeline.completed());
+		ring_sampler.retire(timeline.completed());
+		ring_upload.retire(timeline.completed());
+		if (tex_num) {
+			tex_stream.begin(timeline.completed());
+			for (size_t i = 0; i < tex_retired.size(); ) {
+				auto & r = tex_retired[i];
+				if (r.second && r.second <= timeline.completed()) {
+					tracker.forget(uintptr_t(r.first));
+					gpu_mem.release(r.first);
+					tex_retired.erase(tex_retired.begin() + i);
+				} else {
+					i++;
+				}
+			}
+		}
+		//the last frame of this slot completed.
+		if (timestamp_heap)
+			gpu_prof.collect(timestamp_ticks + gpu_prof.query(index, 0));
+
+		//every frame in flight has its own copy, so mark all of them.
+		uint32_t frame_no = uint32_t(a_time * 16.0);
+		uint32_t target = churn ? uint32_t(objects * (0.625 + 0.375 * cos(a_time * 0.5))) : objects;
+		size_t object_bytes = 0;
+		for (int lidx = 0; lidx < LayerMax; lidx++)
+			object_bytes += size_t(slots[lidx].capacity) * layer_bytes_per_object;
+		bool pressure = object_bytes > budget;
+		for (int lidx = 0; lidx < LayerMax; lidx++) {
+			auto mark = [&framedata, lidx](uint32_t slot) {
+				for (auto & frame : framedata)
+					frame.layers[lidx].dirty.mark(slot, slot + 1);
+			};
+			if (fit_layer_capacity(slots[lidx], stores[lidx], target, pressure, mark)) {
+				for (auto & frame : framedata)
+					frame.layers[lidx].dirty.resize(slots[lidx].capacity);
+			}
+			churn_layer(slots[lidx], handles[lidx], stores[lidx], lidx, frame_no, churn, target, a_time, mark, world);
+			if (slots[lidx].need_compact())
+				compact_layer(slots[lidx], stores[lidx], mark);
+		}
+		uint32_t counts[LayerMax];
+		for (int lidx = 0; lidx < LayerMax; lidx++)
+			counts[lidx] = std::min(animate, slots[lidx].end());
+		update_layers(jobs, stores, counts, LayerMax, UpdateChunk, a_time, world);
+		if (!atlases.empty()) {
+			jobs.parallel_for(LayerMax, 1, [&](int begin, int end) {
+				PROF_SCOPE("atlas");
+				for (int lidx = begin; lidx < end; lidx++)
+					atlas_assign(stores[lidx], 0, slots[lidx].end(), atlases[lidx % atlases.size()]);
+			});
+		}
+		if (tex_num) {
+			jobs.parallel_for(LayerMax, 1, [&](int begin, int end) {
+				PROF_SCOPE("tex demand");
+				for (int lidx = begin; lidx < end; lidx++) {
+					std::fill(tex_area[lidx].begin(), tex_area[lidx].end(), 0.0f);
+					std::fill(tex_size[lidx].begin(), tex_size[lidx].end(), 0.0f);
+					tex_assign(stores[lidx], 0, slots[lidx].end(), tex_num, !atlases.empty());
+					tex_demand(stores[lidx], slots[lidx].end(), Width, Height, tex_num,
+						tex_area[lidx].data(), tex_size[lidx].data());
+				}
+			});
+			for (int lidx = 1; lidx < LayerMax; lidx++) {
+				for (uint32_t i = 0; i < tex_num; i++) {
+					tex_area[0][i] += tex_area[lidx][i];
+					tex_size[0][i] = std::max(tex_size[0][i], tex_size[lidx][i]);
+				}
+			}
+			tex_stream.demand(tex_area[0].data(), tex_size[0].data());
+		}
+		for (int lidx = 0; lidx < LayerMax; lidx++) {
+			PROF_SCOPE("cull");
+			live_end[lidx] = slots[lidx].end();
+			if (cull == CullCpu)
+				bins[lidx].build(&jobs, stores[lidx], live_end[lidx], UpdateChunk);
+		}
+		for (auto & frame : framedata)
+			for (int lidx = 0; lidx < LayerMax; lidx++)
+				frame.layers[lidx].dirty.mark(0, counts[lidx]);
+		double t1 = get_time_sec();
+
+		//tiles of every layer, then the layers of every output tile.
+		jobs.parallel_for(LayerMax, 1, [&](int begin, int end) {
+			PROF_SCOPE("compose classify");
+			for (int lidx = begin; lidx < end; lidx++)
+				compose_classify_layer(stores[lidx], slots[lidx].end(), covers[lidx]);
+		});
+		compose_mask.build(covers, LayerMax);
+		compose_mask.write(ref.tile_mask);
+		compose_samples += compose_mask.samples;
+
+		//what this frame draws with : until the sprite pipelines are ready
+		//the dirty ranges wait in the trackers.
+		clear_ready = pipelines.ready(pso_clear);
+		if (draw_pull)
+			sprites_ready = pipelines.ready(pso_draw_sprites) && (cull != CullGpu || pipelines.ready(pso_cull));
+		else
+			sprites_ready = pipelines.ready(pso_update) && pipelines.ready(pso_draw_rects);
+		if (!pipelines_reported && pipelines.done()) {
+			pipeline_report(pipelines);
+			pipelines_reported = true;
+			for (auto & e : pipelines.entries) {
+				if (e->state == pipeline_builder_t::Failed) {
+					err("pipeline %s failed\n", e->name.c_str());
+					failed = true;
+				}
+			}
+			if (failed)
+				break;
+		}
+
+		//-defrag : now and then the buffers of this idle frame move out of the emptiest heaps.
+		bool defragging = false;
+		if (defrag && stats.frames == 128) {
+			defragging = gpu_mem.defrag([&ref](ID3D12Resource *res) {
+				for (auto & l : ref.layers)
+					if (res == l.res_object_update_buffer_uav ||
+						res == l.res_object_vertex || res == l.res_visible)
+						return true;
+				return false;
+			}, MemHeapSize) > 0;
+		}
+
+		ObjectFormat *obj_ptrs[LayerMax];
+		PackedObjectFormat *packed_ptrs[LayerMax];
+		std::vector<dirty_range_t> ranges[LayerMax];
 		for(int lidx = 0; lidx < LayerMax ; lidx++) {
 			auto & layer = ref.layers[lidx];
-			srand(0);
-			for (int i = 0 ; i < ObjectMax; i++) {
-				auto frand = []() {
-					return (float(rand()) / 32767.0f) * 2.0f - 1.0f;
-				};
-				layer.object_buffer[i].pos[0] = cos(frand() * (lidx + i + 1.0 + a_time * 0.03));
-				layer.object_buffer[i].pos[1] = sin(frand() * (lidx + i + 1.0 + a_time * 0.04));
-				layer.object_buffer[i].scale[0] = 0.01f  + frand() * 0.01;
-				layer.object_buffer[i].scale[1] = 0.01f  + frand() * 0.01;
-
-				layer.object_buffer[i].rotate[0] = frand();
-
-				layer.object_buffer[i].color[0] = frand() * 0.5 + 0.5;
-				layer.object_buffer[i].color[1] = frand() * 0.5 + 0.5;
-				layer.object_buffer[i].color[2] = frand() * 0.5 + 0.5;
-				layer.object_buffer[i].color[3] = frand() * 0.5 + 0.5;
-
-				layer.object_buffer[i].metadata[0] = 1;
-				layer.object_buffer[i].metadata[1] = i;
-			}
-		}
-		queue->Signal(ref.fence, ref.fence_value);
-		if (ref.fence->GetCompletedValue() < ref.fence_value) {
-			auto hevent = CreateEvent(NULL, FALSE, FALSE, NULL);
-			ref.fence->SetEventOnCompletion(ref.fence_value, hevent);
-			WaitForSingleObject(hevent, INFINITE);
-			CloseHandle(hevent);
+			fit_layer_buffers(layer, slots[lidx].capacity);
+			if (defragging)
+				move_layer_buffers(layer);
+			layer.ranges.clear();
+			if (sprites_ready) {
+				layer.dirty.get_ranges(layer.ranges, DirtyMergeGap);
+				layer.dirty.clear();
+				dirty_clip(layer.ranges, slots[lidx].end());
+			}
+
+			//the ranges back to back in the ring, a full ring that cannot grow retries next frame.
+			uint32_t dirty_num = 0;
+			for (auto & r : layer.ranges)
+				dirty_num += r.end - r.begin;
+			layer.upload = upload_alloc_t();
+			if (dirty_num && !ring_upload.alloc(uint64_t(dirty_num) * object_size, 16, layer.upload)) {
+				err("upload ring : no room for %u objects\n", dirty_num);
+				layer.dirty.mark_all();
+				layer.ranges.clear();
+			}
+			if (packed) {
+				if (pack_staging[lidx].size() < dirty_num)
+					pack_staging[lidx].resize(dirty_num);
+				obj_ptrs[lidx] = pack_staging[lidx].data();
+				packed_ptrs[lidx] = (PackedObjectFormat *)layer.upload.cpu;
+			} else {
+				obj_ptrs[lidx] = (ObjectFormat *)layer.upload.cpu;
+				packed_ptrs[lidx] = nullptr;
+			}
+
+			//dispatch and draw sizes follow the live slots.
+			//an empty layer clears its image once, then its pass is skipped.
+			uint32_t end = slots[lidx].end();
+			layer.idle = end == 0 && layer.clear;
+			layer.clear = end == 0 && clear_ready;
+			if (cull == CullCpu) {
+				auto & visible = bins[lidx].visible;
+				memcpy(layer.visible, visible.data(), visible.size() * sizeof(uint32_t));
+				layer.visible_count = end = uint32_t(visible.size());
+				cull_kept += end;
+				cull_live += live_end[lidx];
+			}
+			if (draw_pull)
+				ref.draw_args[lidx] = { 6, end, 0, 0 };
+			else
+				ref.draw_args[lidx] = { end * 6, 1, 0, 0 };
+			ranges[lidx] = layer.ranges;
+			stats.add(layer.ranges, object_size);
+		}
+		if (defragging) {
+			gpu_mem.cancel();
+			gpu_mem.report();
+		}
+		flush_layers(jobs, stores, ranges, obj_ptrs, packed ? packed_ptrs : nullptr,
+			LayerMax, UpdateChunk, true);
+		if (bench_count) {
+			bench.update.add(t1 - t0);
+			bench.upload.add(get_time_sec() - t1);
+			for (int lidx = 0; lidx < LayerMax; lidx++) {
+				bench.sprites += slots[lidx].live;
+				for (auto & r : ranges[lidx])
+					bench.upload_bytes += double(r.end - r.begin) * object_size;
+				bench.copies += ranges[lidx].size();
+			}
+		}
+		//-tex : what the stream copied since begin(), into textures created on their first mip.
+		if (tex_num) {
+			PROF_SCOPE("tex stream");
+			tex_stream.take(tex_jobs, tex_evicted);
+			for (auto t : tex_evicted) {
+				create_srv(dev, res_white, cpu_handle(tex_views, t));
+				tex_retired.push_back({ (ID3D12Resource *)res_tex[t], 0 });
+				res_tex[t] = 0;
+			}
+			for (auto & j : tex_jobs) {
+				auto & e = tex_file.entries[j.tex];
+				if (!res_tex[j.tex]) {
+					auto res = create_res_texture(&gpu_mem, e.width, e.height, tex_dxgi_format(e.format), e.mips);
+					if (!res) {
+						err("cannot create texture %s\n", e.name);
+						failed = true;
+						break;
+					}
+					tracker.set(uintptr_t(res), CmdStateCommon, e.mips);
+					res_tex[j.tex] = uintptr_t(res);
+				}
+				create_srv(dev, (ID3D12Resource *)res_tex[j.tex], cpu_handle(tex_views, j.tex), j.mip, e.mips - j.mip);
+			}
+			if (failed)
+				break;
 		}
-		ref.fence_value++;
+		capture_slot = capture_fp ? cap.begin() : -1;
+		if (!record_frame(index)) {
+			err("out of descriptor heaps\n");
+			failed = true;
+			break;
+		}
+		stats.frame();
+		if (stats.frames == 256) {
+			dbg("upload %.0f bytes/frame, %.1f copies/frame, %.1f layers skipped/frame\n",
+				stats.bytes_per_frame(), stats.copies_per_frame(), stats.skipped_per_frame());
+			dbg("frame wait %.2f ms/frame, %llu stalls\n",
+				sched.stall_sec / 256 * 1e3, (unsigned long long)sched.stalls);
+			sched.stall_sec = 0.0;
+			dbg("barriers %.1f transitions/frame, %.1f split, %.1f uav, %.1f batches/frame, %.1f skipped\n",
+				tracker.transitions / 256.0, tracker.splits / 256.0, tracker.uavs / 256.0,
+				tracker.batches / 256.0, tracker.skipped / 256.0);
+			dbg("compose %.1f%% of the layer samples\n",
+				compose_samples / 256 * 100.0 / (double(ScreenWidth) * ScreenHeight * LayerMax));
+			compose_samples = 0.0;
+			if (cull == CullCpu)
+				dbg("cull kept %.1f%% of the objects\n", cull_kept * 100.0 / std::max(cull_live, 1.0));
+			cull_kept = cull_live = 0.0;
+			if (capture_fp)
+				dbg("capture %llu written, %llu dropped, %.2f ms/frame\n",
+					(unsigned long long)cap.written.load(), (unsigned long long)cap.dropped,
+					cap.write_sec / std::max<uint64_t>(cap.written, 1) * 1e3);
+			dbg("descriptors %u views, %u rtvs, ring %u of %u used, %u grows\n", pool_view.live, pool_rtv.live,
+				ring_view.used(), ring_view.buffer.size, ring_view.grows);
+			dbg("upload ring %.1f of %.1f MB, peak %.1f MB/frame, %u grows\n",
+				ring_upload.peak_used / 1048576.0, ring_upload.buffer.size / 1048576.0,
+				ring_upload.peak_frame / 1048576.0, ring_upload.grows);
+			if (tex_num)
+				dbg("tex stream %u mips, %.1f MB, %u evictions, %.1f of %.0f MB resident, %u frames with a full ring\n",
+					tex_stream.loads, tex_stream.loaded_bytes / 1048576.0, tex_stream.evictions,
+					tex_stream.resident_bytes / 1048576.0, tex_budget / 1048576.0, tex_stream.stalls);
+			gpu_mem.report();
+			tracker.reset_stats();
+			sched.stalls = 0;
+			stats = upload_stats_t();
+		}
+
 		ID3D12CommandList *pplists[] = {
 			ref.cmd_list,
 		};
-		queue->ExecuteCommandLists(1, pplists);
-		swapchain->Present(1, 0);
+		{
+			PROF_SCOPE("submit");
+			queue->ExecuteCommandLists(1, pplists);
+		}
+		tracker.end_list();
+		uint64_t value = sched.end(index);
+		ring_view.close(value);
+		ring_sampler.close(value);
+		ring_upload.close(value);
+		if (tex_num) {
+			tex_stream.end(value);
+			for (auto & r : tex_retired)
+				if (!r.second)
+					r.second = value;
+		}
+		if (capture_slot >= 0)
+			cap.end(capture_slot, value);
+		if (capture_fp)
+			cap.collect(timeline.completed());
+		{
+			PROF_SCOPE("present");
+			swapchain->Present(vsync ? 1 : 0, 0);
+		}
+		if (frame_no == 1) {
+			int ready = 0;
+			for (uint32_t h = 0; h < pipelines.entries.size(); h++)
+				ready += pipelines.ready(h);
+			dbg("first frame %.1f ms after startup, %d of %zu pipelines ready\n",
+				(get_time_sec() - t_startup) * 1e3, ready, pipelines.entries.size());
+		}
+		if (bench_count) {
+			double t = get_time_sec();
+			bench.frame.add(t - bench_t);
+			bench_t = t;
+		}
+	}
+	sched.flush();
+	if (capture_fp) {
+		cap.collect(~0ull);
+		cap.term();
+		fclose(capture_fp);
+	}
+	timeline.term();
+	jobs.term();
+	if (profile_path) {
+		prof_write(profile_path);
+		dbg("profile %zu events, %llu gpu passes, %llu lost\n", prof_t::get().events(),
+			(unsigned long long)gpu_prof.collected, (unsigned long long)prof_t::get().lost());
+	}
+	if (failed)
+		return 1;
+	if (bench_count) {
+		bench.animate = double(std::min(animate, objects)) / std::max(objects, 1u);
+		return bench_write_json(json_path, "d3d12", thread_num, LayerMax,
+			ScreenWidth, ScreenHeight, { bench });
 	}
+#endif //_WIN32
 }
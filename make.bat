@@ -1,2 +1,2 @@
-cl main.cpp /EHsc /Ox /GS- /nologo && main
+cl main.cpp /EHsc /Ox /GS- /arch:AVX2 /nologo && main
 
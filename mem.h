@@ -0,0 +1,493 @@
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//
+// Two level segregated fit over the offsets of one heap. Free blocks sit
+// in lists by size class, the first level is the power of two, the second
+// splits it into SlNum steps; two bitmaps find a fitting list in O(1).
+// Blocks are kept in address order, a free merges with its neighbours.
+// Sizes and offsets are in bytes, multiples of Granule.
+//
+struct mem_tlsf_t {
+	enum : uint32_t {
+		Invalid = 0xFFFFFFFF,
+	};
+	enum {
+		SlBits = 4,
+		SlNum = 1 << SlBits,
+		FlNum = 48,
+		Granule = 256,
+	};
+	struct block_t {
+		uint64_t offset;
+		uint64_t size;
+		uint32_t prev_phys;
+		uint32_t next_phys;
+		uint32_t prev_free;
+		uint32_t next_free;
+		bool free;
+	};
+
+	std::vector<block_t> blocks;
+	std::vector<uint32_t> unused;  //block entries to reuse
+	uint64_t fl_bitmap = 0;
+	uint32_t sl_bitmap[FlNum] = {};
+	uint32_t heads[FlNum][SlNum];
+	uint64_t size = 0;
+	uint64_t used = 0;
+	uint32_t live = 0;
+
+	//v != 0.
+	static int msb(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanReverse64(&i, v);
+		return int(i);
+#else
+		return 63 - __builtin_clzll(v);
+#endif
+	}
+
+	static int lsb(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward64(&i, v);
+		return int(i);
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+
+	static void mapping(uint64_t n, int &fl, int &sl)
+	{
+		uint64_t units = std::max<uint64_t>(n / Granule, 1);
+		fl = msb(units);
+		if (fl < SlBits) {
+			sl = int(units);
+			fl = 0;
+		} else {
+			sl = int((units >> (fl - SlBits)) ^ SlNum);
+			fl -= SlBits - 1;
+		}
+	}
+
+	void init(uint64_t bytes)
+	{
+		blocks.clear();
+		unused.clear();
+		fl_bitmap = 0;
+		for (int i = 0; i < FlNum; i++) {
+			sl_bitmap[i] = 0;
+			for (int j = 0; j < SlNum; j++)
+				heads[i][j] = Invalid;
+		}
+		size = bytes / Granule * Granule;
+		used = 0;
+		live = 0;
+		insert(new_block(0, size, Invalid, Invalid));
+	}
+
+	uint32_t new_block(uint64_t offset, uint64_t bytes, uint32_t prev, uint32_t next)
+	{
+		block_t b = { offset, bytes, prev, next, Invalid, Invalid, false };
+		if (!unused.empty()) {
+			uint32_t ret = unused.back();
+			unused.pop_back();
+			blocks[ret] = b;
+			return (ret);
+		}
+		blocks.push_back(b);
+		return uint32_t(blocks.size() - 1);
+	}
+
+	void insert(uint32_t i)
+	{
+		int fl, sl;
+		auto & b = blocks[i];
+		mapping(b.size, fl, sl);
+		b.free = true;
+		b.prev_free = Invalid;
+		b.next_free = heads[fl][sl];
+		if (b.next_free != Invalid)
+			blocks[b.next_free].prev_free = i;
+		heads[fl][sl] = i;
+		fl_bitmap |= 1ull << fl;
+		sl_bitmap[fl] |= 1u << sl;
+	}
+
+	void remove(uint32_t i)
+	{
+		int fl, sl;
+		auto & b = blocks[i];
+		mapping(b.size, fl, sl);
+		if (b.prev_free != Invalid)
+			blocks[b.prev_free].next_free = b.next_free;
+		else
+			heads[fl][sl] = b.next_free;
+		if (b.next_free != Invalid)
+			blocks[b.next_free].prev_free = b.prev_free;
+		if (heads[fl][sl] == Invalid) {
+			sl_bitmap[fl] &= ~(1u << sl);
+			if (!sl_bitmap[fl])
+				fl_bitmap &= ~(1ull << fl);
+		}
+		b.free = false;
+	}
+
+	//a free block of at least n : the next class up, where any block fits,
+	//else a walk of the class of n itself.
+	uint32_t find(uint64_t n)
+	{
+		int fl, sl;
+		uint64_t units = std::max<uint64_t>(n / Granule, 1);
+		uint64_t up = n;
+		if (msb(units) >= SlBits)
+			up += (uint64_t(1) << (msb(units) - SlBits)) * Granule - 1;
+		mapping(up, fl, sl);
+		if (fl < FlNum) {
+			uint32_t sl_map = sl < SlNum ? sl_bitmap[fl] & (~0u << sl) : 0;
+			uint64_t fl_map = fl + 1 < FlNum ? fl_bitmap & (~0ull << (fl + 1)) : 0;
+			if (!sl_map && fl_map) {
+				fl = lsb(fl_map);
+				sl_map = sl_bitmap[fl];
+			}
+			if (sl_map)
+				return heads[fl][lsb(sl_map)];
+		}
+		mapping(n, fl, sl);
+		if (fl >= FlNum)
+			return Invalid;
+		for (uint32_t i = heads[fl][sl]; i != Invalid; i = blocks[i].next_free)
+			if (blocks[i].size >= n)
+				return (i);
+		return Invalid;
+	}
+
+	//splits the tail of i off as a free block.
+	void split(uint32_t i, uint64_t bytes)
+	{
+		auto & b = blocks[i];
+		if (b.size - bytes < Granule)
+			return;
+		uint32_t t = new_block(b.offset + bytes, b.size - bytes, i, blocks[i].next_phys);
+		auto & a = blocks[i];
+		if (a.next_phys != Invalid)
+			blocks[a.next_phys].prev_phys = t;
+		a.next_phys = t;
+		a.size = bytes;
+		insert(t);
+	}
+
+	//block of bytes at a multiple of align (a power of two), Invalid when full.
+	uint32_t alloc(uint64_t bytes, uint64_t align = Granule)
+	{
+		bytes = std::max<uint64_t>((bytes + Granule - 1) / Granule * Granule, Granule);
+		align = std::max<uint64_t>(align, Granule);
+		uint32_t i = find(bytes + align - Granule);
+		if (i == Invalid)
+			return Invalid;
+		remove(i);
+		uint64_t pad = ((blocks[i].offset + align - 1) & ~(align - 1)) - blocks[i].offset;
+		if (pad) {
+			//the front stays free, the rest is the block.
+			split(i, pad);
+			uint32_t next = blocks[i].next_phys;
+			remove(next);
+			insert(i);
+			i = next;
+		}
+		split(i, bytes);
+		used += blocks[i].size;
+		live++;
+		return (i);
+	}
+
+	void free(uint32_t i)
+	{
+		used -= blocks[i].size;
+		live--;
+		uint32_t prev = blocks[i].prev_phys;
+		uint32_t next = blocks[i].next_phys;
+		if (next != Invalid && blocks[next].free) {
+			remove(next);
+			blocks[i].size += blocks[next].size;
+			blocks[i].next_phys = blocks[next].next_phys;
+			if (blocks[i].next_phys != Invalid)
+				blocks[blocks[i].next_phys].prev_phys = i;
+			unused.push_back(next);
+		}
+		if (prev != Invalid && blocks[prev].free) {
+			remove(prev);
+			blocks[prev].size += blocks[i].size;
+			blocks[prev].next_phys = blocks[i].next_phys;
+			if (blocks[prev].next_phys != Invalid)
+				blocks[blocks[prev].next_phys].prev_phys = prev;
+			unused.push_back(i);
+			i = prev;
+		}
+		insert(i);
+	}
+
+	uint64_t offset(uint32_t i) const
+	{
+		return blocks[i].offset;
+	}
+
+	uint64_t largest_free() const
+	{
+		if (!fl_bitmap)
+			return 0;
+		int fl = msb(fl_bitmap);
+		int sl = msb(sl_bitmap[fl]);
+		uint64_t ret = 0;
+		for (uint32_t i = heads[fl][sl]; i != Invalid; i = blocks[i].next_free)
+			ret = std::max(ret, blocks[i].size);
+		return (ret);
+	}
+};
+
+//
+// Resources placed in large heaps of one kind, each a mem_tlsf_t. A new
+// heap is made when none fits, empty ones past the first are released.
+// Allocations are ids that stay valid across defragmentation : defrag()
+// plans moves out of the emptiest heap into the free space of the others
+// and reserves the targets, the caller copies the data and calls finish()
+// for every move, which frees the source.
+//
+struct mem_alloc_t {
+	uint32_t heap;
+	uint32_t block;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t align;
+};
+
+struct mem_move_t {
+	uint32_t id;
+	mem_alloc_t from;
+	mem_alloc_t to;
+};
+
+struct mem_heaps_t {
+	enum : uint32_t {
+		Invalid = 0xFFFFFFFF,
+	};
+	//heap of size bytes, false on failure.
+	typedef std::function<bool(uint64_t, void *&)> create_t;
+	typedef std::function<void(void *)> release_t;
+	struct heap_t {
+		void *heap;
+		mem_tlsf_t tlsf;
+	};
+
+	create_t create;
+	release_t release;
+	uint64_t heap_size = 0;
+	std::vector<heap_t *> heaps;  //nullptr : released
+	std::vector<mem_alloc_t> allocs;
+	std::vector<uint32_t> free_ids;
+	uint64_t created = 0;
+	uint64_t moved = 0;
+
+	void init(uint64_t bytes, create_t c, release_t r)
+	{
+		term();
+		heap_size = bytes;
+		create = std::move(c);
+		release = std::move(r);
+	}
+
+	void term()
+	{
+		for (auto h : heaps) {
+			if (h && release)
+				release(h->heap);
+			delete h;
+		}
+		heaps.clear();
+		allocs.clear();
+		free_ids.clear();
+	}
+
+	~mem_heaps_t()
+	{
+		term();
+	}
+
+	void *heap(uint32_t id) const
+	{
+		return heaps[allocs[id].heap]->heap;
+	}
+
+	const mem_alloc_t &get(uint32_t id) const
+	{
+		return allocs[id];
+	}
+
+	bool place_in(uint32_t h, uint64_t bytes, uint64_t align, mem_alloc_t &out)
+	{
+		uint32_t b = heaps[h]->tlsf.alloc(bytes, align);
+		if (b == mem_tlsf_t::Invalid)
+			return false;
+		out = { h, b, heaps[h]->tlsf.offset(b), heaps[h]->tlsf.blocks[b].size, align };
+		return true;
+	}
+
+	bool place(uint64_t bytes, uint64_t align, mem_alloc_t &out)
+	{
+		for (uint32_t h = 0; h < heaps.size(); h++)
+			if (heaps[h] && place_in(h, bytes, align, out))
+				return true;
+		void *p = nullptr;
+		uint64_t n = std::max(heap_size, (bytes + align + 0xFFFF) & ~uint64_t(0xFFFF));
+		if (!create(n, p))
+			return false;
+		auto heap = new heap_t;
+		heap->heap = p;
+		heap->tlsf.init(n);
+		created++;
+		//the slot of a released heap first.
+		uint32_t h = uint32_t(std::find(heaps.begin(), heaps.end(), nullptr) - heaps.begin());
+		if (h == heaps.size())
+			heaps.push_back(heap);
+		else
+			heaps[h] = heap;
+		return place_in(h, bytes, align, out);
+	}
+
+	//align : a power of two.
+	uint32_t alloc(uint64_t bytes, uint64_t align)
+	{
+		mem_alloc_t a;
+		if (!place(bytes, align, a))
+			return Invalid;
+		if (free_ids.empty()) {
+			allocs.push_back(a);
+			return uint32_t(allocs.size() - 1);
+		}
+		uint32_t ret = free_ids.back();
+		free_ids.pop_back();
+		allocs[ret] = a;
+		return (ret);
+	}
+
+	void unplace(const mem_alloc_t &a)
+	{
+		auto & h = heaps[a.heap];
+		h->tlsf.free(a.block);
+		size_t live = 0;
+		for (auto p : heaps)
+			live += p != nullptr;
+		if (h->tlsf.live == 0 && live > 1) {
+			release(h->heap);
+			delete h;
+			h = nullptr;
+		}
+	}
+
+	void free(uint32_t id)
+	{
+		unplace(allocs[id]);
+		allocs[id].size = 0;
+		free_ids.push_back(id);
+	}
+
+	//moves of up to max_bytes of the movable allocations of the emptiest heap
+	//into the others, fullest first. Once all of them finished the heap is released.
+	size_t defrag(std::function<bool(uint32_t)> movable, uint64_t max_bytes, std::vector<mem_move_t> &moves)
+	{
+		moves.clear();
+		std::vector<uint32_t> order;
+		for (uint32_t h = 0; h < heaps.size(); h++)
+			if (heaps[h])
+				order.push_back(h);
+		if (order.size() < 2)
+			return 0;
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+			return heaps[a]->tlsf.used > heaps[b]->tlsf.used;
+		});
+		uint32_t src = order.back();
+		order.pop_back();
+		uint64_t bytes = 0;
+		for (uint32_t id = 0; id < allocs.size() && bytes < max_bytes; id++) {
+			auto & a = allocs[id];
+			if (a.size == 0 || a.heap != src || !movable(id))
+				continue;
+			mem_alloc_t to;
+			for (auto h : order) {
+				if (place_in(h, a.size, a.align, to)) {
+					moves.push_back({ id, a, to });
+					bytes += a.size;
+					break;
+				}
+			}
+		}
+		return moves.size();
+	}
+
+	void finish(const mem_move_t &m)
+	{
+		unplace(m.from);
+		allocs[m.id] = m.to;
+		moved += m.to.size;
+	}
+
+	//a move that will not happen, frees its target.
+	void cancel(const mem_move_t &m)
+	{
+		unplace(m.to);
+	}
+
+	uint64_t used() const
+	{
+		uint64_t ret = 0;
+		for (auto h : heaps)
+			ret += h ? h->tlsf.used : 0;
+		return (ret);
+	}
+
+	uint64_t reserved() const
+	{
+		uint64_t ret = 0;
+		for (auto h : heaps)
+			ret += h ? h->tlsf.size : 0;
+		return (ret);
+	}
+
+	//1 - the largest free blocks of the heaps / their free bytes.
+	double fragmentation() const
+	{
+		uint64_t free = 0, largest = 0;
+		for (auto h : heaps) {
+			if (!h)
+				continue;
+			free += h->tlsf.size - h->tlsf.used;
+			largest += h->tlsf.largest_free();
+		}
+		return free ? 1.0 - double(largest) / double(free) : 0.0;
+	}
+
+	void report(FILE *fp, const char *name) const
+	{
+		size_t num = 0;
+		for (auto h : heaps)
+			num += h != nullptr;
+		fprintf(fp, "%s : %zu heaps, %.1f of %.1f MB used, %zu allocations, fragmentation %.1f%%\n",
+			name, num, used() / 1048576.0, reserved() / 1048576.0, allocs.size() - free_ids.size(),
+			fragmentation() * 100.0);
+	}
+};
+
+#endif //_MEM_H_
@@ -0,0 +1,154 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Pipelines built in the background at startup. add() queues a build and
+// returns a handle, workers of their own (not the job system, a compile
+// would stall the frame that waits on it) take the builds in add order,
+// so the ones the first frame needs go first. get() never blocks : the
+// frame loop draws with whatever is ready. wait() builds the pipeline on
+// the calling thread when no worker took it yet.
+//
+struct pipeline_builder_t {
+	enum : uint8_t {
+		Queued,
+		Building,
+		Ready,
+		Failed,
+	};
+	struct entry_t {
+		std::string name;
+		std::function<void *()> create;
+		std::atomic<void *> result {nullptr};
+		std::atomic<uint8_t> state {Queued};
+		double queue_sec = 0.0;  //from start() until a thread took it
+		double build_sec = 0.0;
+		int thread = 0;          //0 : the waiting thread
+	};
+
+	std::vector<std::unique_ptr<entry_t>> entries;
+	std::vector<std::thread> threads;
+	std::mutex mtx;
+	std::condition_variable cv;
+	size_t next = 0;
+	std::atomic<int> remaining {0};
+	std::chrono::steady_clock::time_point t_start;
+
+	~pipeline_builder_t()
+	{
+		term();
+	}
+
+	//before start().
+	uint32_t add(const std::string &name, std::function<void *()> create)
+	{
+		entries.emplace_back(new entry_t);
+		entries.back()->name = name;
+		entries.back()->create = create;
+		remaining++;
+		return uint32_t(entries.size() - 1);
+	}
+
+	void start(int num_threads)
+	{
+		t_start = std::chrono::steady_clock::now();
+		num_threads = std::max(1, std::min(num_threads, int(entries.size())));
+		for (int i = 0; i < num_threads; i++)
+			threads.emplace_back([this, i]() { worker_main(i + 1); });
+	}
+
+	//joins once everything is built.
+	void term()
+	{
+		for (auto & t : threads)
+			t.join();
+		threads.clear();
+	}
+
+	//next queued build, nullptr when none is left.
+	entry_t *take()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		while (next < entries.size()) {
+			auto e = entries[next++].get();
+			uint8_t expect = Queued;
+			if (e->state.compare_exchange_strong(expect, Building))
+				return e;
+		}
+		return nullptr;
+	}
+
+	void build(entry_t *e, int thread)
+	{
+		using namespace std::chrono;
+		auto t = steady_clock::now();
+		e->queue_sec = duration<double>(t - t_start).count();
+		e->thread = thread;
+		void *p = e->create();
+		e->build_sec = duration<double>(steady_clock::now() - t).count();
+		e->result.store(p, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			e->state.store(p ? Ready : Failed, std::memory_order_release);
+			remaining--;
+		}
+		cv.notify_all();
+	}
+
+	void worker_main(int index)
+	{
+		while (auto e = take())
+			build(e, index);
+	}
+
+	//the pipeline of h or nullptr, never blocks.
+	template <typename T>
+	T *get(uint32_t h) const
+	{
+		return (T *)entries[h]->result.load(std::memory_order_acquire);
+	}
+
+	bool ready(uint32_t h) const
+	{
+		return entries[h]->state.load(std::memory_order_acquire) == Ready;
+	}
+
+	bool done() const
+	{
+		return remaining.load() == 0;
+	}
+
+	template <typename T>
+	T *wait(uint32_t h)
+	{
+		auto e = entries[h].get();
+		uint8_t expect = Queued;
+		if (e->state.compare_exchange_strong(expect, Building)) {
+			build(e, 0);
+		} else {
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [e]() { return e->state.load() >= Ready; });
+		}
+		return get<T>(h);
+	}
+
+	void wait_all()
+	{
+		for (uint32_t h = 0; h < entries.size(); h++)
+			wait<void>(h);
+	}
+};
+
+#endif //_PIPELINE_H_
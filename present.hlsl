@@ -21,18 +21,10 @@
  *
  */
 
-struct ObjectFormat {
-	float4 pos;
-	float4 scale;
-	float4 rotate;
-	float4 color;
-	
-	float4 uvinfo;
-	uint metadata[4];
-};
+#include "format.h"
 
-Texture2D<float4> layer_tex[] : register(t0);
-Texture2D<float4> user_tex[] : register(t1);
+Texture2D<float4> layer_tex[256] : register(t0);
+Texture2D<float4> user_tex[256] : register(t256);  //[0] : atlas of the layer (atlas.h), then -tex (tex.h)
 ConstantBuffer<ObjectFormat> objects[] : register(b0);
 SamplerState samplers[]   : register(s0);
 
@@ -56,15 +48,20 @@ PSInput VSMain(VSInput vsin)
 	return result;
 }
 
+//
+// tile_mask[0] : output tile size, tile_mask[1] : tiles per row, then the
+// layers with something in the footprint of each tile (compose.h).
+//
+StructuredBuffer<uint> tile_mask : register(t1, space1);
+
 void PSMain(PSInput input, out float4 mrt0 : SV_TARGET)
 {
+	uint2 tile = uint2(input.pos.xy) / tile_mask[0];
+	uint mask = tile_mask[2 + tile.y * tile_mask[1] + tile.x];
+
 	mrt0 = float4(0, 0, 0, 0);
-	mrt0 += layer_tex[0].SampleLevel(samplers[1], input.uv, 0);
-	mrt0 += layer_tex[1].SampleLevel(samplers[1], input.uv, 0);
-	mrt0 += layer_tex[2].SampleLevel(samplers[1], input.uv, 0);
-	mrt0 += layer_tex[3].SampleLevel(samplers[1], input.uv, 0);
-	mrt0 += layer_tex[4].SampleLevel(samplers[1], input.uv, 0);
-	mrt0 += layer_tex[5].SampleLevel(samplers[1], input.uv, 0);
-	mrt0 += layer_tex[6].SampleLevel(samplers[1], input.uv, 0);
-	mrt0 += layer_tex[7].SampleLevel(samplers[1], input.uv, 0);
+	[unroll]
+	for (uint i = 0; i < 8; i++)
+		if (mask & (1u << i))
+			mrt0 += layer_tex[i].SampleLevel(samplers[1], input.uv, 0);
 }
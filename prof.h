@@ -0,0 +1,280 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//
+// Profiler (-profile). PROF_SCOPE(name) times a block into a ring of the
+// calling thread : one producer and one consumer at a time, so the rings
+// take no lock. The exporter drains them under the profiler lock; a full
+// ring is drained by its producer under the same lock and only drops (and
+// counts) the event when the exporter holds it at that moment. Disabled,
+// a scope is a relaxed load and a branch; PROF_NONE compiles it out.
+// GPU times come from pairs of timestamp queries (prof_gpu_t) and go into
+// the "gpu" track once their frame completed. write_trace() exports the
+// Chrome trace event format, which Perfetto also reads.
+// Names are string literals or outlive the profiler.
+//
+struct prof_event_t {
+	const char *name;
+	uint64_t begin;  //ns
+	uint64_t end;    //ns, begin == end is an instant (frame marker)
+};
+
+struct prof_ring_t {
+	enum { Size = 1 << 14 };
+	prof_event_t events[Size];
+	std::atomic<uint32_t> head {0};
+	std::atomic<uint32_t> tail {0};
+	std::atomic<uint64_t> lost {0};
+	uint32_t tid = 0;
+	std::vector<prof_event_t> drained;
+
+	//false when full.
+	bool push(const prof_event_t &e)
+	{
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == Size)
+			return false;
+		events[h % Size] = e;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer side, under prof_t::mtx.
+	void drain()
+	{
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		uint32_t h = head.load(std::memory_order_acquire);
+		for ( ; t != h; t++)
+			drained.push_back(events[t % Size]);
+		tail.store(t, std::memory_order_release);
+	}
+};
+
+static inline uint64_t
+prof_now()
+{
+	using namespace std::chrono;
+	return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+struct prof_t {
+	std::atomic<bool> enabled {false};
+	std::mutex mtx;
+	std::vector<std::unique_ptr<prof_ring_t>> rings;
+	std::vector<prof_event_t> gpu;
+	uint64_t origin = prof_now();
+
+	static prof_t &get()
+	{
+		static prof_t ret;
+		return (ret);
+	}
+
+	//ring of the calling thread, registered on first use.
+	prof_ring_t *ring()
+	{
+		thread_local prof_ring_t *ret = nullptr;
+		if (!ret) {
+			std::lock_guard<std::mutex> lock(mtx);
+			rings.emplace_back(new prof_ring_t);
+			ret = rings.back().get();
+			ret->tid = uint32_t(rings.size());
+		}
+		return (ret);
+	}
+
+	//the calling thread becomes the first track.
+	void enable()
+	{
+		ring();
+		enabled = true;
+	}
+
+	void record(const char *name, uint64_t begin, uint64_t end)
+	{
+		auto r = ring();
+		if (!r->push({ name, begin, end }))
+			spill(r, { name, begin, end });
+	}
+
+	//full ring : the producer drains it itself unless the exporter is at it.
+	void spill(prof_ring_t *r, const prof_event_t &e)
+	{
+		std::unique_lock<std::mutex> lock(mtx, std::try_to_lock);
+		if (lock.owns_lock())
+			r->drain();
+		if (!r->push(e))
+			r->lost.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	//frame marker, also drains the rings so they do not fill up.
+	void frame(const char *name = "frame")
+	{
+		if (enabled.load(std::memory_order_relaxed)) {
+			uint64_t t = prof_now();
+			record(name, t, t);
+			drain();
+		}
+	}
+
+	//moves the events out of every ring, once per frame or at the end.
+	void drain()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (auto & r : rings)
+			r->drain();
+	}
+
+	uint64_t lost()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		uint64_t ret = 0;
+		for (auto & r : rings)
+			ret += r->lost;
+		return (ret);
+	}
+
+	size_t events()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		size_t ret = gpu.size();
+		for (auto & r : rings)
+			ret += r->drained.size();
+		return (ret);
+	}
+
+	static void write_event(FILE *fp, const prof_event_t &e, uint32_t tid, uint64_t origin, bool &first)
+	{
+		double ts = double(int64_t(e.begin - origin)) * 1e-3;
+		if (e.begin == e.end)
+			fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+				first ? "" : ",", e.name, tid, ts);
+		else
+			fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				first ? "" : ",", e.name, tid, ts, double(e.end - e.begin) * 1e-3);
+		first = false;
+	}
+
+	//drained events as Chrome trace JSON, the GPU track is tid 0.
+	bool write_trace(FILE *fp)
+	{
+		drain();
+		std::lock_guard<std::mutex> lock(mtx);
+		bool first = false;  //after the track names
+		fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		fprintf(fp, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"gpu\"}}");
+		for (auto & r : rings)
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s%u\"}}",
+				r->tid, r->tid == 1 ? "main" : "thread", r->tid);
+		for (auto & e : gpu)
+			write_event(fp, e, 0, origin, first);
+		for (auto & r : rings)
+			for (auto & e : r->drained)
+				write_event(fp, e, r->tid, origin, first);
+		fprintf(fp, "\n]}\n");
+		return !ferror(fp);
+	}
+};
+
+struct prof_scope_t {
+	const char *name;
+	uint64_t begin;
+
+	prof_scope_t(const char *n) : name(n), begin(0)
+	{
+		if (prof_t::get().enabled.load(std::memory_order_relaxed))
+			begin = prof_now();
+	}
+
+	~prof_scope_t()
+	{
+		if (begin)
+			prof_t::get().record(name, begin, prof_now());
+	}
+};
+
+#define PROF_CAT2(a, b) a##b
+#define PROF_CAT(a, b) PROF_CAT2(a, b)
+#ifdef PROF_NONE
+#define PROF_SCOPE(name)
+#else
+#define PROF_SCOPE(name) prof_scope_t PROF_CAT(prof_scope_, __LINE__)(name)
+#endif
+
+//
+// Named pairs of timestamp queries, a range of them per frame in flight :
+// pair p of slot s is queries query(s, p) and query(s, p) + 1. A backend
+// writes them around the passes, resolves the range of the slot into a
+// readback buffer and collect() reads it once the fence of the slot
+// completed. calibrate() maps GPU ticks to the CPU clock of prof_now().
+//
+struct prof_gpu_t {
+	std::vector<std::string> names;
+	int frames = 0;
+	uint64_t frequency = 1000000000;  //ticks/sec
+	uint64_t gpu_base = 0;
+	uint64_t cpu_base = 0;
+	uint64_t collected = 0;
+
+	void init(const std::vector<std::string> &pair_names, int frame_count)
+	{
+		names = pair_names;
+		frames = frame_count;
+	}
+
+	uint32_t pairs() const
+	{
+		return uint32_t(names.size());
+	}
+
+	uint32_t query_num() const
+	{
+		return pairs() * 2 * frames;
+	}
+
+	uint32_t query(int slot, uint32_t pair) const
+	{
+		return (slot * pairs() + pair) * 2;
+	}
+
+	void calibrate(uint64_t freq, uint64_t gpu_tick, uint64_t cpu_ns)
+	{
+		frequency = freq;
+		gpu_base = gpu_tick;
+		cpu_base = cpu_ns;
+	}
+
+	uint64_t to_cpu(uint64_t tick) const
+	{
+		int64_t d = int64_t(tick - gpu_base);
+		return cpu_base + int64_t(double(d) * 1e9 / double(frequency));
+	}
+
+	//ticks : the resolved queries of the slot, pair order. Empty pairs are skipped.
+	void collect(const uint64_t *ticks)
+	{
+		auto & prof = prof_t::get();
+		if (!prof.enabled.load(std::memory_order_relaxed))
+			return;
+		std::lock_guard<std::mutex> lock(prof.mtx);
+		for (uint32_t p = 0; p < pairs(); p++) {
+			uint64_t b = ticks[p * 2];
+			uint64_t e = ticks[p * 2 + 1];
+			if (e <= b)
+				continue;
+			prof.gpu.push_back({ names[p].c_str(), to_cpu(b), to_cpu(e) });
+			collected++;
+		}
+	}
+};
+
+#endif //_PROF_H_
@@ -0,0 +1,129 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <vector>
+
+//
+// Fenced ring of the upload ring (upload.h) and the descriptor ring
+// (desc.h). B is the storage, an upload buffer or a descriptor heap with
+// its size in units of N (bytes, descriptors). Positions only grow,
+// position % size is the offset. close() ends the frame with its fence
+// value, its units come back in retire() once that fence completed. A full
+// ring grows into storage twice as big, the old one is released after the
+// last frame using it. Not thread safe.
+//
+template <typename B, typename N>
+struct fence_ring_t {
+	struct span_t {
+		uint64_t fence;
+		uint64_t end;  //the frame ends here
+	};
+	struct old_t {
+		B buffer;
+		uint64_t fence;  //0 : the open frame still uses it
+	};
+
+	std::function<bool(N, B &)> create;
+	std::function<void(B &)> release;
+	B buffer;
+	uint64_t head = 0;
+	uint64_t tail = 0;
+	uint64_t closed = 0;
+	std::deque<span_t> spans;
+	std::vector<old_t> old;
+	bool fixed = false;  //place() fails when full instead of growing
+	uint32_t grows = 0;
+
+	bool start(N size, std::function<bool(N, B &)> c, std::function<void(B &)> r)
+	{
+		term();
+		create = c;
+		release = r;
+		grows = 0;
+		return create(size, buffer);
+	}
+
+	void term()
+	{
+		if (release) {
+			for (auto & o : old)
+				release(o.buffer);
+			if (buffer.size)
+				release(buffer);
+		}
+		old.clear();
+		spans.clear();
+		buffer = B();
+		head = tail = closed = 0;
+	}
+
+	~fence_ring_t()
+	{
+		term();
+	}
+
+	//what was placed since the last close() is the frame of fence.
+	void close(uint64_t fence)
+	{
+		for (auto & o : old)
+			if (o.fence == 0)
+				o.fence = fence;
+		if (head != closed)
+			spans.push_back({ fence, head });
+		closed = head;
+	}
+
+	void retire(uint64_t completed)
+	{
+		while (!spans.empty() && spans.front().fence <= completed) {
+			tail = spans.front().end;
+			spans.pop_front();
+		}
+		for (size_t i = 0; i < old.size(); ) {
+			if (old[i].fence && old[i].fence <= completed) {
+				release(old[i].buffer);
+				old.erase(old.begin() + i);
+			} else {
+				i++;
+			}
+		}
+	}
+
+	//the frames in flight keep the old storage, new frames use storage twice as big.
+	bool grow(N num)
+	{
+		B b;
+		if (!create(std::max(N(buffer.size * 2), num), b))
+			return false;
+		if (!spans.empty() || head != closed)
+			old.push_back({ buffer, head != closed ? 0 : spans.back().fence });
+		else if (buffer.size)
+			release(buffer);
+		buffer = b;
+		head = tail = closed = 0;
+		spans.clear();
+		grows++;
+		return true;
+	}
+
+	//position of num units at pos or later, never across the end of the storage.
+	//The caller moves head past them.
+	bool place(uint64_t pos, N num, uint64_t &out)
+	{
+		if (buffer.size && pos % buffer.size + num > buffer.size)
+			pos += buffer.size - pos % buffer.size;
+		if (pos + num - tail > buffer.size) {
+			if (fixed || !grow(num))
+				return false;
+			pos = 0;
+		}
+		out = pos;
+		return true;
+	}
+};
+
+#endif //_RING_H_
@@ -0,0 +1,173 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include <stdint.h>
+
+//same gate as sprite.h, sse4.1 is not implied by msvc x64.
+#if defined(SPRITE_NO_SIMD)
+#elif defined(__AVX2__)
+#define RNG_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE4_1__) || defined(__AVX__) || defined(SPRITE_SSE4)
+#define RNG_SIMD_SSE4
+#include <smmintrin.h>
+#endif
+
+//
+// Counter based random numbers (Philox4x32-10, Salmon et al. 2011).
+// A number is a pure function of (key, counter), there is no state to share,
+// so any thread and any chunk size gives the same stream.
+// The x8 version runs 8 counters at once : ctr[0] = first + lane.
+//
+static const uint32_t RngPhiloxM0 = 0xD2511F53;
+static const uint32_t RngPhiloxM1 = 0xCD9E8D57;
+static const uint32_t RngPhiloxW0 = 0x9E3779B9;
+static const uint32_t RngPhiloxW1 = 0xBB67AE85;
+static const int RngPhiloxRounds = 10;
+
+static inline const char *
+rng_simd_name()
+{
+#if defined(RNG_SIMD_AVX2)
+	return "avx2";
+#elif defined(RNG_SIMD_SSE4)
+	return "sse4";
+#else
+	return "scalar";
+#endif
+}
+
+static inline void
+rng_philox(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+{
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (int r = 0; r < RngPhiloxRounds; r++) {
+		uint64_t p0 = uint64_t(RngPhiloxM0) * c0;
+		uint64_t p1 = uint64_t(RngPhiloxM1) * c2;
+		c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+		c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+		c1 = uint32_t(p1);
+		c3 = uint32_t(p0);
+		k0 += RngPhiloxW0;
+		k1 += RngPhiloxW1;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+static inline void
+rng_philox_x8_ref(uint32_t first, uint32_t c1, uint32_t c2, uint32_t c3,
+	const uint32_t key[2], uint32_t out[4][8])
+{
+	for (int lane = 0; lane < 8; lane++) {
+		uint32_t ctr[4] = { first + lane, c1, c2, c3 };
+		uint32_t r[4];
+		rng_philox(ctr, key, r);
+		for (int w = 0; w < 4; w++)
+			out[w][lane] = r[w];
+	}
+}
+
+#if defined(RNG_SIMD_AVX2)
+//hi and lo 32 bits of 8 32x32 multiplies.
+static inline void
+rng_mulhilo8(__m256i a, __m256i m, __m256i &hi, __m256i &lo)
+{
+	__m256i even = _mm256_mul_epu32(a, m);
+	__m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+	hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+	lo = _mm256_mullo_epi32(a, m);
+}
+
+static inline void
+rng_philox_x8(uint32_t first, uint32_t c1, uint32_t c2, uint32_t c3,
+	const uint32_t key[2], uint32_t out[4][8])
+{
+	__m256i x0 = _mm256_add_epi32(_mm256_set1_epi32(first),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i x1 = _mm256_set1_epi32(c1);
+	__m256i x2 = _mm256_set1_epi32(c2);
+	__m256i x3 = _mm256_set1_epi32(c3);
+	__m256i m0 = _mm256_set1_epi32(RngPhiloxM0);
+	__m256i m1 = _mm256_set1_epi32(RngPhiloxM1);
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (int r = 0; r < RngPhiloxRounds; r++) {
+		__m256i hi0, lo0, hi1, lo1;
+		rng_mulhilo8(x0, m0, hi0, lo0);
+		rng_mulhilo8(x2, m1, hi1, lo1);
+		x0 = _mm256_xor_si256(_mm256_xor_si256(hi1, x1), _mm256_set1_epi32(k0));
+		x2 = _mm256_xor_si256(_mm256_xor_si256(hi0, x3), _mm256_set1_epi32(k1));
+		x1 = lo1;
+		x3 = lo0;
+		k0 += RngPhiloxW0;
+		k1 += RngPhiloxW1;
+	}
+	_mm256_storeu_si256((__m256i *)out[0], x0);
+	_mm256_storeu_si256((__m256i *)out[1], x1);
+	_mm256_storeu_si256((__m256i *)out[2], x2);
+	_mm256_storeu_si256((__m256i *)out[3], x3);
+}
+#elif defined(RNG_SIMD_SSE4)
+static inline void
+rng_mulhilo4(__m128i a, __m128i m, __m128i &hi, __m128i &lo)
+{
+	__m128i even = _mm_mul_epu32(a, m);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+	hi = _mm_blend_epi16(_mm_srli_epi64(even, 32), odd, 0xCC);
+	lo = _mm_mullo_epi32(a, m);
+}
+
+static inline void
+rng_philox_x8(uint32_t first, uint32_t c1, uint32_t c2, uint32_t c3,
+	const uint32_t key[2], uint32_t out[4][8])
+{
+	__m128i m0 = _mm_set1_epi32(RngPhiloxM0);
+	__m128i m1 = _mm_set1_epi32(RngPhiloxM1);
+
+	for (int h = 0; h < 2; h++) {
+		__m128i x0 = _mm_add_epi32(_mm_set1_epi32(first + h * 4),
+			_mm_setr_epi32(0, 1, 2, 3));
+		__m128i x1 = _mm_set1_epi32(c1);
+		__m128i x2 = _mm_set1_epi32(c2);
+		__m128i x3 = _mm_set1_epi32(c3);
+		uint32_t k0 = key[0], k1 = key[1];
+
+		for (int r = 0; r < RngPhiloxRounds; r++) {
+			__m128i hi0, lo0, hi1, lo1;
+			rng_mulhilo4(x0, m0, hi0, lo0);
+			rng_mulhilo4(x2, m1, hi1, lo1);
+			x0 = _mm_xor_si128(_mm_xor_si128(hi1, x1), _mm_set1_epi32(k0));
+			x2 = _mm_xor_si128(_mm_xor_si128(hi0, x3), _mm_set1_epi32(k1));
+			x1 = lo1;
+			x3 = lo0;
+			k0 += RngPhiloxW0;
+			k1 += RngPhiloxW1;
+		}
+		_mm_storeu_si128((__m128i *)&out[0][h * 4], x0);
+		_mm_storeu_si128((__m128i *)&out[1][h * 4], x1);
+		_mm_storeu_si128((__m128i *)&out[2][h * 4], x2);
+		_mm_storeu_si128((__m128i *)&out[3][h * 4], x3);
+	}
+}
+#else
+static inline void
+rng_philox_x8(uint32_t first, uint32_t c1, uint32_t c2, uint32_t c3,
+	const uint32_t key[2], uint32_t out[4][8])
+{
+	rng_philox_x8_ref(first, c1, c2, c3, key, out);
+}
+#endif
+
+//top 24 bits to [-1, 1), exact in float.
+static inline float
+rng_snorm(uint32_t u)
+{
+	return float(u >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+#endif //_RNG_H_
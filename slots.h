@@ -0,0 +1,171 @@
+#ifndef _SLOTS_H_
+#define _SLOTS_H_
+
+#include <stdint.h>
+#include <vector>
+
+//
+// Stable handle to an object slot. index points into the handle table,
+// generation changes every time the handle is freed, so a stale handle
+// never reaches a reused slot.
+//
+struct slot_handle_t {
+	uint32_t index;
+	uint32_t generation;
+};
+
+struct slot_move_t {
+	uint32_t from;
+	uint32_t to;
+};
+
+//
+// Object slot allocator of a layer.
+// alloc/free are O(1) with free lists for slots and handles. Freed slots
+// leave holes below end(), compact() moves the tail objects into the holes
+// so [0, live) is dense again; handles stay valid across compaction.
+// Dispatch and draw sizes follow end().
+//
+struct slot_allocator_t {
+	enum : uint32_t {
+		Invalid = 0xFFFFFFFF,
+	};
+	struct entry_t {
+		uint32_t slot;
+		uint32_t generation;
+	};
+
+	uint32_t capacity = 0;
+	uint32_t live = 0;
+	uint32_t high = 0;
+	std::vector<entry_t> entries;
+	std::vector<uint32_t> free_entries;
+	std::vector<uint32_t> free_slots;
+	std::vector<uint32_t> owner;  //slot -> entry
+
+	void init(uint32_t num)
+	{
+		capacity = num;
+		live = 0;
+		high = 0;
+		entries.clear();
+		free_entries.clear();
+		free_slots.clear();
+		owner.assign(num, Invalid);
+	}
+
+	//grow, or shrink down to end() (compact first to shrink to live).
+	//free slots are always below end(), so they stay valid.
+	bool resize(uint32_t num)
+	{
+		if (num < high)
+			return false;
+		capacity = num;
+		owner.resize(num, Invalid);
+		return true;
+	}
+
+	uint32_t end() const
+	{
+		return high;
+	}
+
+	uint32_t holes() const
+	{
+		return high - live;
+	}
+
+	bool alloc(slot_handle_t &h, uint32_t &slot)
+	{
+		if (!free_slots.empty()) {
+			slot = free_slots.back();
+			free_slots.pop_back();
+		} else if (high < capacity) {
+			slot = high++;
+		} else {
+			return false;
+		}
+
+		uint32_t e;
+		if (!free_entries.empty()) {
+			e = free_entries.back();
+			free_entries.pop_back();
+		} else {
+			e = uint32_t(entries.size());
+			entries.push_back({ Invalid, 0 });
+		}
+		entries[e].slot = slot;
+		owner[slot] = e;
+		live++;
+		h = { e, entries[e].generation };
+		return true;
+	}
+
+	bool valid(slot_handle_t h) const
+	{
+		return h.index < entries.size() &&
+			entries[h.index].generation == h.generation &&
+			entries[h.index].slot != Invalid;
+	}
+
+	//slot of h or Invalid.
+	uint32_t get(slot_handle_t h) const
+	{
+		return valid(h) ? entries[h.index].slot : Invalid;
+	}
+
+	//returns the freed slot or Invalid for a stale handle.
+	uint32_t free(slot_handle_t h)
+	{
+		if (!valid(h))
+			return Invalid;
+		auto & e = entries[h.index];
+		uint32_t slot = e.slot;
+		owner[slot] = Invalid;
+		e.slot = Invalid;
+		e.generation++;
+		free_entries.push_back(h.index);
+		live--;
+		if (live == 0) {
+			high = 0;
+			free_slots.clear();
+		} else if (slot + 1 == high) {
+			high--;
+		} else {
+			free_slots.push_back(slot);
+		}
+		return slot;
+	}
+
+	//compaction pays off when at least 1 / ratio of [0, end) are holes.
+	bool need_compact(uint32_t ratio = 4) const
+	{
+		return holes() && holes() * ratio >= high;
+	}
+
+	//move the objects above live into the holes below it.
+	void compact(std::vector<slot_move_t> &moves)
+	{
+		moves.clear();
+		uint32_t to = 0;
+		uint32_t from = high;
+		while (true) {
+			while (to < live && owner[to] != Invalid)
+				to++;
+			while (from > live && owner[from - 1] == Invalid)
+				from--;
+			if (to >= live || from <= live)
+				break;
+			from--;
+			uint32_t e = owner[from];
+			owner[to] = e;
+			owner[from] = Invalid;
+			entries[e].slot = to;
+			moves.push_back({ from, to });
+		}
+		high = live;
+		free_slots.clear();
+	}
+};
+
+#endif //_SLOTS_H_
@@ -0,0 +1,327 @@
+#ifndef _SOFT_H_
+#define _SOFT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "format.h"
+#include "fp.h"
+#include "sprite.h"
+#include "store.h"
+#include "job.h"
+#include "bin.h"
+#include "compose.h"
+#include "prof.h"
+
+//no fma, the edge functions have to match compose_raster_ref.
+FP_NO_FMA_BEGIN
+
+//
+// Software backend of the frame : clear.hlsl, draw_rects.hlsl and
+// present.hlsl on the CPU (-soft), without a GPU and as an oracle of
+// the D3D12 passes.
+// The layer pass draws the tile lists of bin.h. One job clears and
+// rasterizes a tile, 8 pixels per step, with the edge functions and
+// the pixel center rule of compose_raster_ref. The lists are in object
+// order, so the last object still wins and no two jobs share a pixel.
+// The present pass is compose_rows with the tile mask on row bands.
+// Images are R8G8B8A8_UNORM like the render targets, r in the low byte.
+//
+enum {
+	SoftTile = 32,  //layer pixels per tile, about
+	SoftRows = 16,  //output rows per present job
+};
+
+static inline uint32_t
+soft_unorm(float c)
+{
+	c = c > 0.0f ? (c < 1.0f ? c : 1.0f) : 0.0f;
+	return uint32_t(c * 255.0f + 0.5f);
+}
+
+static inline uint32_t
+soft_pack(const float c[4])
+{
+	return soft_unorm(c[0]) | (soft_unorm(c[1]) << 8) |
+		(soft_unorm(c[2]) << 16) | (soft_unorm(c[3]) << 24);
+}
+
+static inline void
+soft_unpack(uint32_t p, float c[4])
+{
+	for (int k = 0; k < 4; k++)
+		c[k] = float((p >> (k * 8)) & 0xFF) / 255.0f;
+}
+
+struct soft_image_t {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint32_t> pixels;
+
+	void init(uint32_t w, uint32_t h)
+	{
+		width = w;
+		height = h;
+		pixels.assign(w * h, 0);
+	}
+
+	//FNV-1a of the pixels, for golden images.
+	uint64_t hash() const
+	{
+		uint64_t h = 0xcbf29ce484222325ULL;
+		auto p = (const uint8_t *)pixels.data();
+		for (size_t i = 0; i < pixels.size() * 4; i++)
+			h = (h ^ p[i]) * 0x100000001b3ULL;
+		return h;
+	}
+
+	//binary PPM, alpha is dropped.
+	bool write_ppm(const char *path) const
+	{
+		FILE *fp = fopen(path, "wb");
+		if (!fp)
+			return false;
+		std::vector<uint8_t> row(width * 3);
+		fprintf(fp, "P6\n%u %u\n255\n", width, height);
+		bool ok = true;
+		for (uint32_t y = 0; y < height && ok; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				uint32_t p = pixels[y * width + x];
+				row[x * 3 + 0] = uint8_t(p);
+				row[x * 3 + 1] = uint8_t(p >> 8);
+				row[x * 3 + 2] = uint8_t(p >> 16);
+			}
+			ok = fwrite(row.data(), 1, row.size(), fp) == row.size();
+		}
+		return fclose(fp) == 0 && ok;
+	}
+};
+
+//
+// Tile grid of an image, as bin.h maps NDC to tiles. A pixel is in the
+// tile of its center, so tiles can differ by a pixel. The margin of the
+// view (one pixel) covers the rounding between the object bounds and
+// the expanded vertices.
+//
+struct soft_tiles_t {
+	bin_view_t view = {};
+	std::vector<uint32_t> cols;  //first pixel of every tile column, then width
+	std::vector<uint32_t> rows;  //first pixel of every tile row, then height
+
+	static void starts(uint32_t n, uint32_t grid, std::vector<uint32_t> &out)
+	{
+		out.assign(grid + 1, n);
+		for (uint32_t p = n; p-- > 0; )
+			out[bin_tile(floorf((p + 0.5f) / n * grid), grid)] = p;
+		for (uint32_t t = grid; t-- > 0; )
+			out[t] = std::min(out[t], out[t + 1]);
+	}
+
+	void init(uint32_t w, uint32_t h)
+	{
+		view.margin = 2.0f / std::min(w, h);
+		view.grid_x = std::max(1u, (w + SoftTile / 2) / SoftTile);
+		view.grid_y = std::max(1u, (h + SoftTile / 2) / SoftTile);
+		starts(w, view.grid_x, cols);
+		starts(h, view.grid_y, rows);
+	}
+};
+
+//
+// Triangle v[0..2] in color, only the pixels of [x0, x1) x [y0, y1).
+// Same setup and edge functions as compose_raster_ref, 8 pixels a step.
+//
+static inline void
+soft_raster_tri(const VertexFormat *v, uint32_t color, soft_image_t &img,
+	int x0, int y0, int x1, int y1)
+{
+	static const float lanes[8] = { 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f };
+	uint32_t w = img.width;
+	uint32_t h = img.height;
+	float x[3], y[3];
+	for (int k = 0; k < 3; k++) {
+		x[k] = (v[k].pos[0] + 1.0f) * 0.5f * w;
+		y[k] = (1.0f - v[k].pos[1]) * 0.5f * h;
+	}
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (area == 0.0f)
+		return;
+	float sign = area < 0.0f ? -1.0f : 1.0f;
+	int bx0 = std::max(int(floorf(std::min({ x[0], x[1], x[2] }))), std::max(x0, 0));
+	int by0 = std::max(int(floorf(std::min({ y[0], y[1], y[2] }))), std::max(y0, 0));
+	int bx1 = std::min(int(ceilf(std::max({ x[0], x[1], x[2] }))), std::min(x1, int(w)) - 1);
+	int by1 = std::min(int(ceilf(std::max({ y[0], y[1], y[2] }))), std::min(y1, int(h)) - 1);
+	if (bx0 > bx1 || by0 > by1)
+		return;
+
+	const f32x8 zero = f8_set1(0.0f);
+	const f32x8 vsign = f8_set1(sign);
+	const f32x8 half = f8_load(lanes);
+	f32x8 dy[3], xk[3];
+	float dx[3];
+	for (int k = 0; k < 3; k++) {
+		int n = (k + 1) % 3;
+		dx[k] = x[n] - x[k];
+		dy[k] = f8_set1(y[n] - y[k]);
+		xk[k] = f8_set1(x[k]);
+	}
+	for (int py = by0; py <= by1; py++) {
+		float cy = py + 0.5f;
+		f32x8 a[3];
+		for (int k = 0; k < 3; k++)
+			a[k] = f8_set1(dx[k] * (cy - y[k]));
+		uint32_t *row = &img.pixels[py * w];
+		for (int px = bx0; px <= bx1; px += 8) {
+			f32x8 cx = f8_add(f8_set1(float(px)), half);
+			f32x8 in = f8_ge(f8_mul(f8_sub(a[0], f8_mul(dy[0], f8_sub(cx, xk[0]))), vsign), zero);
+			for (int k = 1; k < 3; k++)
+				in = f8_and(in, f8_ge(f8_mul(f8_sub(a[k], f8_mul(dy[k], f8_sub(cx, xk[k]))), vsign), zero));
+			uint32_t bits = f8_bits(in);
+			if (bx1 - px < 7)
+				bits &= (1u << (bx1 - px + 1)) - 1;
+			for (int l = 0; bits; l++, bits >>= 1)
+				if (bits & 1)
+					row[px + l] = color;
+		}
+	}
+}
+
+//
+// Layer pass : tile t of img is cleared (clear.hlsl), then the objects of
+// its list are drawn (draw_rects.hlsl). vtx holds 6 vertices per object.
+// jobs == nullptr runs on the calling thread.
+//
+static inline void
+soft_draw_layer(job_system_t *jobs, soft_image_t &img, const soft_tiles_t &tiles,
+	const sprite_bins_t &bins, const VertexFormat *vtx)
+{
+	uint32_t gx = tiles.view.grid_x;
+	auto fn = [&](int begin, int end) {
+		for (int t = begin; t < end; t++) {
+			int x0 = tiles.cols[t % gx];
+			int x1 = tiles.cols[t % gx + 1];
+			int y0 = tiles.rows[t / gx];
+			int y1 = tiles.rows[t / gx + 1];
+			for (int y = y0; y < y1; y++)
+				std::fill(&img.pixels[y * img.width + x0], &img.pixels[y * img.width + x1], 0u);
+			for (uint32_t j = bins.offsets[t]; j < bins.offsets[t + 1]; j++) {
+				auto v = vtx + bins.objects[j] * 6;
+				uint32_t color = soft_pack(v[0].color);
+				soft_raster_tri(v, color, img, x0, y0, x1, y1);
+				soft_raster_tri(v + 3, color, img, x0, y0, x1, y1);
+			}
+		}
+	};
+	if (jobs)
+		jobs->parallel_for(bins.tiles(), 1, fn);
+	else
+		fn(0, bins.tiles());
+}
+
+//
+// The whole frame : every layer from its store, then the composition into
+// frame. draw() does update.hlsl (sprite_expand), the binning and the layer
+// pass, present() samples the layers as unorm textures.
+//
+struct soft_renderer_t {
+	struct layer_t {
+		sprite_bins_t bins;
+		std::vector<ObjectFormat> obj;
+		std::vector<VertexFormat> vtx;
+		soft_image_t image;
+		std::vector<float> texels;
+	};
+	soft_tiles_t tiles;
+	std::vector<layer_t> layers;
+	std::vector<tile_cover_t> covers;
+	std::vector<const float *> texel_ptrs;
+	tile_mask_t mask;
+	std::vector<float> out;
+	soft_image_t frame;
+	uint64_t sprites = 0;  //kept objects drawn
+
+	static void run(job_system_t *jobs, uint32_t n, const std::function<void(int, int)> &fn)
+	{
+		if (jobs)
+			jobs->parallel_for(n, 1, fn);
+		else
+			fn(0, n);
+	}
+
+	void init(int layer_max, uint32_t lw, uint32_t lh, uint32_t w, uint32_t h)
+	{
+		tiles.init(lw, lh);
+		layers.resize(layer_max);
+		covers.resize(layer_max);
+		texel_ptrs.resize(layer_max);
+		for (int lidx = 0; lidx < layer_max; lidx++) {
+			auto & l = layers[lidx];
+			l.bins.init(tiles.view);
+			l.image.init(lw, lh);
+			l.texels.assign(lw * lh * 4, 0.0f);
+			covers[lidx].init(lw, lh, ComposeLayerTile);
+			texel_ptrs[lidx] = l.texels.data();
+		}
+		mask.init(w, h, ComposeOutTile);
+		out.assign(w * h * 4, 0.0f);
+		frame.init(w, h);
+		sprites = 0;
+	}
+
+	//objects [0, end) of st into layer lidx.
+	void draw(job_system_t *jobs, int lidx, const object_store_t &st, uint32_t end, uint32_t chunk)
+	{
+		PROF_SCOPE("soft draw");
+		auto & l = layers[lidx];
+		l.obj.resize(end);
+		l.vtx.resize(end * 6);
+		run(jobs, (end + chunk - 1) / chunk, [&](int job_begin, int job_end) {
+			for (int k = job_begin; k < job_end; k++) {
+				uint32_t begin = k * chunk;
+				uint32_t last = std::min(begin + chunk, end);
+				st.flush(l.obj.data(), begin, last);
+				sprite_expand(&l.obj[begin], &l.vtx[begin * 6], last - begin);
+			}
+		});
+		l.bins.build(jobs, st, end, chunk);
+		soft_draw_layer(jobs, l.image, tiles, l.bins, l.vtx.data());
+		compose_classify_layer(st, end, covers[lidx]);
+		sprites += l.bins.visible.size();
+	}
+
+	void present(job_system_t *jobs)
+	{
+		PROF_SCOPE("soft present");
+		uint32_t w = frame.width;
+		uint32_t h = frame.height;
+		mask.build(covers.data(), int(layers.size()));
+		for (size_t lidx = 0; lidx < layers.size(); lidx++) {
+			auto & l = layers[lidx];
+			if (!(mask.active & (1u << lidx)))
+				continue;
+			uint32_t rows = l.image.height;
+			run(jobs, (rows + SoftRows - 1) / SoftRows, [&](int job_begin, int job_end) {
+				size_t begin = size_t(job_begin) * SoftRows * l.image.width;
+				size_t end = std::min(size_t(job_end) * SoftRows, size_t(rows)) * l.image.width;
+				for (size_t i = begin; i < end; i++)
+					soft_unpack(l.image.pixels[i], &l.texels[i * 4]);
+			});
+		}
+		run(jobs, (h + SoftRows - 1) / SoftRows, [&](int job_begin, int job_end) {
+			uint32_t y0 = job_begin * SoftRows;
+			uint32_t y1 = std::min(uint32_t(job_end) * SoftRows, h);
+			compose_rows(texel_ptrs.data(), int(layers.size()), tiles.cols.back(), tiles.rows.back(),
+				&mask, out.data(), w, h, y0, y1);
+			for (size_t i = size_t(y0) * w; i < size_t(y1) * w; i++)
+				frame.pixels[i] = soft_pack(&out[i * 4]);
+		});
+	}
+};
+
+FP_NO_FMA_END
+
+#endif //_SOFT_H_
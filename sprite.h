@@ -0,0 +1,1048 @@
+#ifndef _SPRITE_H_
+#define _SPRITE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "format.h"
+#include "fp.h"
+
+//msvc never defines __SSE4_1__, x64 only promises sse2 : sse4.1 comes
+//with /arch:AVX or an explicit SPRITE_SSE4, else the scalar path.
+#if defined(SPRITE_NO_SIMD)
+#elif defined(__AVX2__)
+#define SPRITE_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE4_1__) || defined(__AVX__) || defined(SPRITE_SSE4)
+#define SPRITE_SIMD_SSE4
+#include <smmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SPRITE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(SPRITE_NO_SIMD)
+#elif defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define SPRITE_SIMD_F16C
+#include <immintrin.h>
+#endif
+
+//
+// 8 wide float vector. Every backend must give the same result per lane
+// as the scalar one, so only IEEE exact operations are used here.
+//
+struct f32x8 {
+#if defined(SPRITE_SIMD_AVX2)
+	__m256 v;
+#elif defined(SPRITE_SIMD_SSE4)
+	__m128 v[2];
+#elif defined(SPRITE_SIMD_NEON)
+	float32x4_t v[2];
+#else
+	float v[8];
+#endif
+};
+
+#if defined(SPRITE_SIMD_AVX2)
+static inline f32x8 f8_set1(float a) { return { _mm256_set1_ps(a) }; }
+static inline f32x8 f8_load(const float *p) { return { _mm256_loadu_ps(p) }; }
+static inline void f8_store(float *p, f32x8 a) { _mm256_storeu_ps(p, a.v); }
+static inline f32x8 f8_add(f32x8 a, f32x8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+static inline f32x8 f8_sub(f32x8 a, f32x8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+static inline f32x8 f8_mul(f32x8 a, f32x8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+static inline f32x8 f8_div(f32x8 a, f32x8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+static inline f32x8 f8_floor(f32x8 a) { return { _mm256_floor_ps(a.v) }; }
+static inline f32x8 f8_min(f32x8 a, f32x8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+static inline f32x8 f8_max(f32x8 a, f32x8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+static inline f32x8 f8_eq(f32x8 a, f32x8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) }; }
+static inline f32x8 f8_ge(f32x8 a, f32x8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+static inline f32x8 f8_or(f32x8 a, f32x8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+static inline f32x8 f8_and(f32x8 a, f32x8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+static inline uint32_t f8_bits(f32x8 m) { return _mm256_movemask_ps(m.v); }
+static inline f32x8 f8_select(f32x8 m, f32x8 a, f32x8 b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+static inline f32x8 f8_gather(const float *p, size_t n)
+{
+	return { _mm256_setr_ps(p[0], p[n], p[n * 2], p[n * 3],
+		p[n * 4], p[n * 5], p[n * 6], p[n * 7]) };
+}
+#elif defined(SPRITE_SIMD_SSE4)
+#define F8_OP2(name, op) \
+	static inline f32x8 name(f32x8 a, f32x8 b) \
+	{ return {{ op(a.v[0], b.v[0]), op(a.v[1], b.v[1]) }}; }
+static inline f32x8 f8_set1(float a) { return {{ _mm_set1_ps(a), _mm_set1_ps(a) }}; }
+static inline f32x8 f8_load(const float *p) { return {{ _mm_loadu_ps(p), _mm_loadu_ps(p + 4) }}; }
+static inline void f8_store(float *p, f32x8 a) { _mm_storeu_ps(p, a.v[0]); _mm_storeu_ps(p + 4, a.v[1]); }
+F8_OP2(f8_add, _mm_add_ps)
+F8_OP2(f8_sub, _mm_sub_ps)
+F8_OP2(f8_mul, _mm_mul_ps)
+F8_OP2(f8_div, _mm_div_ps)
+F8_OP2(f8_eq, _mm_cmpeq_ps)
+F8_OP2(f8_ge, _mm_cmpge_ps)
+F8_OP2(f8_or, _mm_or_ps)
+F8_OP2(f8_and, _mm_and_ps)
+F8_OP2(f8_min, _mm_min_ps)
+F8_OP2(f8_max, _mm_max_ps)
+static inline f32x8 f8_floor(f32x8 a) { return {{ _mm_floor_ps(a.v[0]), _mm_floor_ps(a.v[1]) }}; }
+static inline uint32_t f8_bits(f32x8 m) { return _mm_movemask_ps(m.v[0]) | (_mm_movemask_ps(m.v[1]) << 4); }
+static inline f32x8 f8_select(f32x8 m, f32x8 a, f32x8 b)
+{
+	return {{ _mm_blendv_ps(b.v[0], a.v[0], m.v[0]),
+		_mm_blendv_ps(b.v[1], a.v[1], m.v[1]) }};
+}
+static inline f32x8 f8_gather(const float *p, size_t n)
+{
+	return {{ _mm_setr_ps(p[0], p[n], p[n * 2], p[n * 3]),
+		_mm_setr_ps(p[n * 4], p[n * 5], p[n * 6], p[n * 7]) }};
+}
+#undef F8_OP2
+#elif defined(SPRITE_SIMD_NEON)
+#define F8_OP2(name, op) \
+	static inline f32x8 name(f32x8 a, f32x8 b) \
+	{ return {{ op(a.v[0], b.v[0]), op(a.v[1], b.v[1]) }}; }
+#define F8_CMP(name, op) \
+	static inline f32x8 name(f32x8 a, f32x8 b) \
+	{ return {{ vreinterpretq_f32_u32(op(a.v[0], b.v[0])), \
+		vreinterpretq_f32_u32(op(a.v[1], b.v[1])) }}; }
+static inline f32x8 f8_set1(float a) { return {{ vdupq_n_f32(a), vdupq_n_f32(a) }}; }
+static inline f32x8 f8_load(const float *p) { return {{ vld1q_f32(p), vld1q_f32(p + 4) }}; }
+static inline void f8_store(float *p, f32x8 a) { vst1q_f32(p, a.v[0]); vst1q_f32(p + 4, a.v[1]); }
+F8_OP2(f8_add, vaddq_f32)
+F8_OP2(f8_sub, vsubq_f32)
+F8_OP2(f8_mul, vmulq_f32)
+F8_OP2(f8_div, vdivq_f32)
+F8_OP2(f8_min, vminq_f32)
+F8_OP2(f8_max, vmaxq_f32)
+F8_CMP(f8_eq, vceqq_f32)
+F8_CMP(f8_ge, vcgeq_f32)
+static inline f32x8 f8_floor(f32x8 a) { return {{ vrndmq_f32(a.v[0]), vrndmq_f32(a.v[1]) }}; }
+static inline f32x8 f8_or(f32x8 a, f32x8 b)
+{
+	return {{ vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a.v[0]), vreinterpretq_u32_f32(b.v[0]))),
+		vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a.v[1]), vreinterpretq_u32_f32(b.v[1]))) }};
+}
+static inline f32x8 f8_and(f32x8 a, f32x8 b)
+{
+	return {{ vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v[0]), vreinterpretq_u32_f32(b.v[0]))),
+		vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v[1]), vreinterpretq_u32_f32(b.v[1]))) }};
+}
+static inline uint32_t f8_bits(f32x8 m)
+{
+	static const uint32_t lane[4] = { 1, 2, 4, 8 };
+	uint32x4_t w = vld1q_u32(lane);
+	uint32x4_t lo = vshrq_n_u32(vreinterpretq_u32_f32(m.v[0]), 31);
+	uint32x4_t hi = vshrq_n_u32(vreinterpretq_u32_f32(m.v[1]), 31);
+	return vaddvq_u32(vmulq_u32(lo, w)) | (vaddvq_u32(vmulq_u32(hi, w)) << 4);
+}
+static inline f32x8 f8_select(f32x8 m, f32x8 a, f32x8 b)
+{
+	return {{ vbslq_f32(vreinterpretq_u32_f32(m.v[0]), a.v[0], b.v[0]),
+		vbslq_f32(vreinterpretq_u32_f32(m.v[1]), a.v[1], b.v[1]) }};
+}
+static inline f32x8 f8_gather(const float *p, size_t n)
+{
+	float t[8] = { p[0], p[n], p[n * 2], p[n * 3],
+		p[n * 4], p[n * 5], p[n * 6], p[n * 7] };
+	return f8_load(t);
+}
+static inline void f8_store_xy01(float (*dst)[4], f32x8 x, f32x8 y)
+{
+	float32x2_t c = vset_lane_f32(1.0f, vdup_n_f32(0.0f), 1);
+	for (int h = 0; h < 2; h++) {
+		float32x4_t lo = vzip1q_f32(x.v[h], y.v[h]);
+		float32x4_t hi = vzip2q_f32(x.v[h], y.v[h]);
+		vst1q_f32(dst[h * 4 + 0], vcombine_f32(vget_low_f32(lo), c));
+		vst1q_f32(dst[h * 4 + 1], vcombine_f32(vget_high_f32(lo), c));
+		vst1q_f32(dst[h * 4 + 2], vcombine_f32(vget_low_f32(hi), c));
+		vst1q_f32(dst[h * 4 + 3], vcombine_f32(vget_high_f32(hi), c));
+	}
+}
+#undef F8_OP2
+#undef F8_CMP
+#else
+#define F8_OP2(name, expr) \
+	static inline f32x8 name(f32x8 a, f32x8 b) \
+	{ f32x8 r; for (int i = 0; i < 8; i++) { float x = a.v[i], y = b.v[i]; r.v[i] = (expr); } return r; }
+static inline float f8_mask(bool c)
+{
+	uint32_t u = c ? 0xFFFFFFFF : 0;
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+static inline bool f8_test(float m)
+{
+	uint32_t u;
+	memcpy(&u, &m, sizeof(u));
+	return u != 0;
+}
+static inline f32x8 f8_set1(float a) { f32x8 r; for (auto & x : r.v) x = a; return r; }
+static inline f32x8 f8_load(const float *p) { f32x8 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+static inline void f8_store(float *p, f32x8 a) { memcpy(p, a.v, sizeof(a.v)); }
+F8_OP2(f8_add, x + y)
+F8_OP2(f8_sub, x - y)
+F8_OP2(f8_mul, x * y)
+F8_OP2(f8_div, x / y)
+F8_OP2(f8_min, x < y ? x : y)
+F8_OP2(f8_max, x > y ? x : y)
+F8_OP2(f8_eq, f8_mask(x == y))
+F8_OP2(f8_ge, f8_mask(x >= y))
+F8_OP2(f8_or, f8_mask(f8_test(x) || f8_test(y)))
+F8_OP2(f8_and, f8_mask(f8_test(x) && f8_test(y)))
+static inline uint32_t f8_bits(f32x8 m)
+{
+	uint32_t r = 0;
+	for (int i = 0; i < 8; i++)
+		r |= uint32_t(f8_test(m.v[i])) << i;
+	return r;
+}
+static inline f32x8 f8_floor(f32x8 a) { f32x8 r; for (int i = 0; i < 8; i++) r.v[i] = floorf(a.v[i]); return r; }
+static inline f32x8 f8_select(f32x8 m, f32x8 a, f32x8 b)
+{
+	f32x8 r;
+	for (int i = 0; i < 8; i++)
+		r.v[i] = f8_test(m.v[i]) ? a.v[i] : b.v[i];
+	return r;
+}
+static inline f32x8 f8_gather(const float *p, size_t n)
+{
+	f32x8 r;
+	for (int i = 0; i < 8; i++)
+		r.v[i] = p[n * i];
+	return r;
+}
+static inline void f8_store_xy01(float (*dst)[4], f32x8 x, f32x8 y)
+{
+	for (int i = 0; i < 8; i++) {
+		dst[i][0] = x.v[i];
+		dst[i][1] = y.v[i];
+		dst[i][2] = 0.0f;
+		dst[i][3] = 1.0f;
+	}
+}
+#undef F8_OP2
+#endif
+
+static inline const char *
+sprite_simd_name()
+{
+#if defined(SPRITE_SIMD_AVX2)
+	return "avx2";
+#elif defined(SPRITE_SIMD_SSE4)
+	return "sse4";
+#elif defined(SPRITE_SIMD_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+//no fma, the scalar reference and the vector kernel have to round the same.
+FP_NO_FMA_BEGIN
+
+//
+// sincos shared by the scalar reference and the vector kernel.
+// Cody-Waite reduction by pi/2 and the cephes sinf/cosf polynomials.
+// Both versions do the same operations in the same order so they are
+// bit exact against each other.
+//
+static inline void
+sprite_sincos(float x, float &s, float &c)
+{
+	float q = floorf(x * 0.63661977236758134f + 0.5f);
+	float r = x - q * 1.5703125f;
+	r = r - q * 4.837512969970703125e-4f;
+	r = r - q * 7.54978995489188216e-8f;
+	float z = r * r;
+	float ps = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z + -1.6666654611e-1f) * z;
+	ps = ps * r + r;
+	float pc = ((2.443315711809948e-5f * z + -1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z;
+	pc = (pc * z - 0.5f * z) + 1.0f;
+
+	float q4 = q - floorf(q * 0.25f) * 4.0f;
+	bool m1 = q4 == 1.0f;
+	bool m2 = q4 == 2.0f;
+	bool swap = m1 || q4 == 3.0f;
+	float st = swap ? pc : ps;
+	float ct = swap ? ps : pc;
+	s = q4 >= 2.0f ? 0.0f - st : st;
+	c = (m1 || m2) ? 0.0f - ct : ct;
+}
+
+static inline void
+f8_sincos(f32x8 x, f32x8 &s, f32x8 &c)
+{
+	f32x8 q = f8_floor(f8_add(f8_mul(x, f8_set1(0.63661977236758134f)), f8_set1(0.5f)));
+	f32x8 r = f8_sub(x, f8_mul(q, f8_set1(1.5703125f)));
+	r = f8_sub(r, f8_mul(q, f8_set1(4.837512969970703125e-4f)));
+	r = f8_sub(r, f8_mul(q, f8_set1(7.54978995489188216e-8f)));
+	f32x8 z = f8_mul(r, r);
+	f32x8 ps = f8_add(f8_mul(f8_set1(-1.9515295891e-4f), z), f8_set1(8.3321608736e-3f));
+	ps = f8_mul(f8_add(f8_mul(ps, z), f8_set1(-1.6666654611e-1f)), z);
+	ps = f8_add(f8_mul(ps, r), r);
+	f32x8 pc = f8_add(f8_mul(f8_set1(2.443315711809948e-5f), z), f8_set1(-1.388731625493765e-3f));
+	pc = f8_mul(f8_add(f8_mul(pc, z), f8_set1(4.166664568298827e-2f)), z);
+	pc = f8_add(f8_sub(f8_mul(pc, z), f8_mul(f8_set1(0.5f), z)), f8_set1(1.0f));
+
+	f32x8 q4 = f8_sub(q, f8_mul(f8_floor(f8_mul(q, f8_set1(0.25f))), f8_set1(4.0f)));
+	f32x8 m1 = f8_eq(q4, f8_set1(1.0f));
+	f32x8 m2 = f8_eq(q4, f8_set1(2.0f));
+	f32x8 swap = f8_or(m1, f8_eq(q4, f8_set1(3.0f)));
+	f32x8 st = f8_select(swap, pc, ps);
+	f32x8 ct = f8_select(swap, ps, pc);
+	s = f8_select(f8_ge(q4, f8_set1(2.0f)), f8_sub(f8_set1(0.0f), st), st);
+	c = f8_select(f8_or(m1, m2), f8_sub(f8_set1(0.0f), ct), ct);
+}
+
+//
+// CPU version of update.hlsl CSMain.
+// Each valid object becomes 6 vertices at vtx[i * 6]. Dead slots
+// (metadata[0] == 0) get 6 zero, degenerate vertices like update.hlsl
+// writes, and a group of dead slots is zeroed at once.
+//
+static const float sprite_corner[4][2] = {
+	{0, 0}, {0, 1}, {1, 0}, {1, 1},
+};
+
+static const int sprite_index[6] = {
+	0, 1, 2, 1, 3, 2,
+};
+
+static inline void
+sprite_store4(void *dst, float x, float y, float z, float w)
+{
+#if defined(SPRITE_SIMD_AVX2) || defined(SPRITE_SIMD_SSE4)
+	_mm_storeu_ps((float *)dst, _mm_setr_ps(x, y, z, w));
+#elif defined(SPRITE_SIMD_NEON)
+	float32x4_t v = vdupq_n_f32(x);
+	v = vsetq_lane_f32(y, v, 1);
+	v = vsetq_lane_f32(z, v, 2);
+	v = vsetq_lane_f32(w, v, 3);
+	vst1q_f32((float *)dst, v);
+#else
+	float v[4] = { x, y, z, w };
+	memcpy(dst, v, sizeof(v));
+#endif
+}
+
+static inline void
+sprite_copy4(void *dst, const void *src)
+{
+#if defined(SPRITE_SIMD_AVX2) || defined(SPRITE_SIMD_SSE4)
+	_mm_storeu_ps((float *)dst, _mm_loadu_ps((const float *)src));
+#elif defined(SPRITE_SIMD_NEON)
+	vst1q_f32((float *)dst, vld1q_f32((const float *)src));
+#else
+	memcpy(dst, src, sizeof(float) * 4);
+#endif
+}
+
+static inline void
+sprite_write_vertices(VertexFormat *v, const float bx[4], const float by[4],
+	const float ux[4], const float uy[4], const float color[4], uint32_t matid)
+{
+	float id;
+	memcpy(&id, &matid, sizeof(id));
+	for (int k = 0; k < 6; k++) {
+		auto i = sprite_index[k];
+		sprite_store4(v[k].pos, bx[i], by[i], 0.0f, 1.0f);
+		sprite_store4(v[k].uv, ux[i], uy[i], 0.0f, 1.0f);
+		sprite_copy4(v[k].color, color);
+		sprite_store4(&v[k].matid, id, 0.0f, 0.0f, 0.0f);
+	}
+}
+
+//
+// uvinfo is the rect of the sprite in its texture : offset .xy, size .zw
+// (atlas.h). A uniform grid of divx x divy cells is a special case.
+//
+static inline void
+sprite_uv_grid(float x, float y, float divx, float divy, float *uvinfo)
+{
+	uvinfo[0] = x / divx;
+	uvinfo[1] = y / divy;
+	uvinfo[2] = 1.0f / divx;
+	uvinfo[3] = 1.0f / divy;
+}
+
+//dead slots (metadata[0] == 0) get zero, degenerate vertices like update.hlsl.
+static inline void
+sprite_expand_ref(const ObjectFormat *obj, VertexFormat *vtx, size_t count)
+{
+	for (size_t tid = 0; tid < count; tid++) {
+		auto & o = obj[tid];
+		if (o.metadata[0] == 0) {
+			memset(vtx + tid * 6, 0, sizeof(VertexFormat) * 6);
+			continue;
+		}
+
+		float s, c;
+		sprite_sincos(o.rotate[0], s, c);
+
+		float bx[4], by[4], ux[4], uy[4];
+		for (int i = 0; i < 4; i++) {
+			float cx = sprite_corner[i][0];
+			float cy = sprite_corner[i][1];
+			ux[i] = o.uvinfo[0] + cx * o.uvinfo[2];
+			uy[i] = o.uvinfo[1] + cy * o.uvinfo[3];
+
+			//scale
+			float px = (cx * 2.0f - 1.0f) * o.scale[0];
+			float py = (cy * 2.0f - 1.0f) * o.scale[1];
+
+			//rotate, trans
+			bx[i] = (px * c - py * s) + o.pos[0];
+			by[i] = (px * s + py * c) + o.pos[1];
+		}
+		sprite_write_vertices(vtx + tid * 6, bx, by, ux, uy,
+			o.color, o.metadata[1]);
+	}
+}
+
+#if defined(SPRITE_SIMD_AVX2)
+//
+// 4 floats at p of 8 objects stride floats apart as lanes .x to .w,
+// loaded whole and transposed (objects l and l + 4 share a row).
+//
+static inline void
+sprite_load8(const float *p, size_t stride, __m256 &x, __m256 &y, __m256 &z, __m256 &w)
+{
+	__m256 a0 = _mm256_loadu2_m128(p + stride * 4, p);
+	__m256 a1 = _mm256_loadu2_m128(p + stride * 5, p + stride);
+	__m256 a2 = _mm256_loadu2_m128(p + stride * 6, p + stride * 2);
+	__m256 a3 = _mm256_loadu2_m128(p + stride * 7, p + stride * 3);
+	__m256 t0 = _mm256_unpacklo_ps(a0, a1);
+	__m256 t1 = _mm256_unpacklo_ps(a2, a3);
+	__m256 t2 = _mm256_unpackhi_ps(a0, a1);
+	__m256 t3 = _mm256_unpackhi_ps(a2, a3);
+	x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+	y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+	z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	w = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+//pos | uv of corner i into the vertices using it (sprite_index).
+static inline void
+sprite_write_corner(float *v, int i, __m256 pu)
+{
+	static const int first[4] = { 0, 1, 2, 4 };
+	static const int second[4] = { -1, 3, 5, -1 };
+	_mm256_storeu_ps(v + first[i] * 16, pu);
+	if (second[i] >= 0)
+		_mm256_storeu_ps(v + second[i] * 16, pu);
+}
+
+//color | matid of the 6 vertices of o.
+static inline void
+sprite_write_color(float *v, const ObjectFormat &o)
+{
+	__m256 cm = _mm256_insertf128_ps(
+		_mm256_castps128_ps256(_mm_loadu_ps(o.color)),
+		_mm_castsi128_ps(_mm_cvtsi32_si128(int(o.metadata[1]))), 1);
+	for (int k = 0; k < 6; k++)
+		_mm256_storeu_ps(v + k * 16 + 8, cm);
+}
+#elif defined(SPRITE_SIMD_SSE4)
+//4 floats at p of 8 objects stride floats apart as lanes .x to .w.
+static inline void
+sprite_load8(const float *p, size_t stride, f32x8 &x, f32x8 &y, f32x8 &z, f32x8 &w)
+{
+	for (int h = 0; h < 2; h++) {
+		const float *q = p + stride * 4 * h;
+		__m128 r0 = _mm_loadu_ps(q);
+		__m128 r1 = _mm_loadu_ps(q + stride);
+		__m128 r2 = _mm_loadu_ps(q + stride * 2);
+		__m128 r3 = _mm_loadu_ps(q + stride * 3);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		x.v[h] = r0;
+		y.v[h] = r1;
+		z.v[h] = r2;
+		w.v[h] = r3;
+	}
+}
+
+//pos and uv of corner i into the vertices using it (sprite_index).
+static inline void
+sprite_write_corner(float *v, int i, __m128 pos, __m128 uv)
+{
+	static const int first[4] = { 0, 1, 2, 4 };
+	static const int second[4] = { -1, 3, 5, -1 };
+	_mm_storeu_ps(v + first[i] * 16, pos);
+	_mm_storeu_ps(v + first[i] * 16 + 4, uv);
+	if (second[i] >= 0) {
+		_mm_storeu_ps(v + second[i] * 16, pos);
+		_mm_storeu_ps(v + second[i] * 16 + 4, uv);
+	}
+}
+
+//color, matid of the 6 vertices of o.
+static inline void
+sprite_write_color(float *v, const ObjectFormat &o)
+{
+	__m128 color = _mm_loadu_ps(o.color);
+	__m128 id = _mm_castsi128_ps(_mm_cvtsi32_si128(int(o.metadata[1])));
+	for (int k = 0; k < 6; k++) {
+		_mm_storeu_ps(v + k * 16 + 8, color);
+		_mm_storeu_ps(v + k * 16 + 12, id);
+	}
+}
+#endif
+
+static inline void
+sprite_expand(const ObjectFormat *obj, VertexFormat *vtx, size_t count)
+{
+	enum { W = 8 };
+	size_t tid = 0;
+
+#if defined(SPRITE_SIMD_AVX2)
+	//8 objects in registers, every vertex is written as two 32 byte halves.
+	for ( ; tid + W <= count; tid += W) {
+		auto o = obj + tid;
+		uint32_t valid = 0;
+		for (int l = 0; l < W; l++)
+			valid |= (o[l].metadata[0] != 0) << l;
+		if (!valid) {
+			memset(vtx + tid * 6, 0, sizeof(VertexFormat) * 6 * W);
+			continue;
+		}
+
+		//the lines of the next (up to) 8 objects, written while these compute.
+		size_t next = tid + W < count ? count - tid - W : 0;
+		if (next > W)
+			next = W;
+		for (size_t k = 0; k < next * 6; k++)
+			_mm_prefetch((const char *)(vtx + (tid + W) * 6 + k), _MM_HINT_T0);
+
+		const size_t stride = sizeof(ObjectFormat) / sizeof(float);
+		__m256 posx, posy, scalex, scaley, rot, uv_offx, uv_offy, uv_sizex, uv_sizey, unused;
+		sprite_load8(o->pos, stride, posx, posy, unused, unused);
+		sprite_load8(o->scale, stride, scalex, scaley, unused, unused);
+		sprite_load8(o->rotate, stride, rot, unused, unused, unused);
+		sprite_load8(o->uvinfo, stride, uv_offx, uv_offy, uv_sizex, uv_sizey);
+
+		f32x8 s, c;
+		f8_sincos({ rot }, s, c);
+
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 two = _mm256_set1_ps(2.0f);
+		const __m256 c01 = _mm256_setr_ps(0, 1, 0, 1, 0, 1, 0, 1);
+		float *v = (float *)(vtx + tid * 6);
+		for (int i = 0; i < 4; i++) {
+			__m256 cx = _mm256_set1_ps(sprite_corner[i][0]);
+			__m256 cy = _mm256_set1_ps(sprite_corner[i][1]);
+			__m256 ux = _mm256_add_ps(_mm256_mul_ps(cx, uv_sizex), uv_offx);
+			__m256 uy = _mm256_add_ps(_mm256_mul_ps(cy, uv_sizey), uv_offy);
+
+			//scale, rotate, trans
+			__m256 px = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(cx, two), one), scalex);
+			__m256 py = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(cy, two), one), scaley);
+			__m256 bx = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(px, c.v), _mm256_mul_ps(py, s.v)), posx);
+			__m256 by = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, s.v), _mm256_mul_ps(py, c.v)), posy);
+
+			//pos.xy01 | uv.xy01 of the corner, objects l and l + 4 share a pair.
+			__m256 plo = _mm256_unpacklo_ps(bx, by);
+			__m256 phi = _mm256_unpackhi_ps(bx, by);
+			__m256 ulo = _mm256_unpacklo_ps(ux, uy);
+			__m256 uhi = _mm256_unpackhi_ps(ux, uy);
+			__m256 p[4] = {
+				_mm256_shuffle_ps(plo, c01, _MM_SHUFFLE(1, 0, 1, 0)),
+				_mm256_shuffle_ps(plo, c01, _MM_SHUFFLE(1, 0, 3, 2)),
+				_mm256_shuffle_ps(phi, c01, _MM_SHUFFLE(1, 0, 1, 0)),
+				_mm256_shuffle_ps(phi, c01, _MM_SHUFFLE(1, 0, 3, 2)),
+			};
+			__m256 u[4] = {
+				_mm256_shuffle_ps(ulo, c01, _MM_SHUFFLE(1, 0, 1, 0)),
+				_mm256_shuffle_ps(ulo, c01, _MM_SHUFFLE(1, 0, 3, 2)),
+				_mm256_shuffle_ps(uhi, c01, _MM_SHUFFLE(1, 0, 1, 0)),
+				_mm256_shuffle_ps(uhi, c01, _MM_SHUFFLE(1, 0, 3, 2)),
+			};
+			for (int l = 0; l < 4; l++) {
+				sprite_write_corner(v + l * 96, i, _mm256_permute2f128_ps(p[l], u[l], 0x20));
+				sprite_write_corner(v + (l + 4) * 96, i, _mm256_permute2f128_ps(p[l], u[l], 0x31));
+			}
+		}
+		for (int l = 0; l < W; l++) {
+			if (valid & (1 << l))
+				sprite_write_color(v + l * 96, o[l]);
+			else
+				memset(v + l * 96, 0, sizeof(VertexFormat) * 6);
+		}
+	}
+#elif defined(SPRITE_SIMD_SSE4)
+	//same as avx2 on two halves, every vertex is written as four 16 byte quarters.
+	for ( ; tid + W <= count; tid += W) {
+		auto o = obj + tid;
+		uint32_t valid = 0;
+		for (int l = 0; l < W; l++)
+			valid |= (o[l].metadata[0] != 0) << l;
+		if (!valid) {
+			memset(vtx + tid * 6, 0, sizeof(VertexFormat) * 6 * W);
+			continue;
+		}
+
+		size_t next = tid + W < count ? count - tid - W : 0;
+		if (next > W)
+			next = W;
+		for (size_t k = 0; k < next * 6; k++)
+			_mm_prefetch((const char *)(vtx + (tid + W) * 6 + k), _MM_HINT_T0);
+
+		const size_t stride = sizeof(ObjectFormat) / sizeof(float);
+		f32x8 posx, posy, scalex, scaley, rot, uv_offx, uv_offy, uv_sizex, uv_sizey, unused;
+		sprite_load8(o->pos, stride, posx, posy, unused, unused);
+		sprite_load8(o->scale, stride, scalex, scaley, unused, unused);
+		sprite_load8(o->rotate, stride, rot, unused, unused, unused);
+		sprite_load8(o->uvinfo, stride, uv_offx, uv_offy, uv_sizex, uv_sizey);
+
+		f32x8 s, c;
+		f8_sincos(rot, s, c);
+
+		f32x8 one = f8_set1(1.0f);
+		f32x8 two = f8_set1(2.0f);
+		const __m128 c01 = _mm_setr_ps(0, 1, 0, 1);
+		float *v = (float *)(vtx + tid * 6);
+		for (int i = 0; i < 4; i++) {
+			f32x8 cx = f8_set1(sprite_corner[i][0]);
+			f32x8 cy = f8_set1(sprite_corner[i][1]);
+			f32x8 ux = f8_add(f8_mul(cx, uv_sizex), uv_offx);
+			f32x8 uy = f8_add(f8_mul(cy, uv_sizey), uv_offy);
+
+			//scale, rotate, trans
+			f32x8 px = f8_mul(f8_sub(f8_mul(cx, two), one), scalex);
+			f32x8 py = f8_mul(f8_sub(f8_mul(cy, two), one), scaley);
+			f32x8 bx = f8_add(f8_sub(f8_mul(px, c), f8_mul(py, s)), posx);
+			f32x8 by = f8_add(f8_add(f8_mul(px, s), f8_mul(py, c)), posy);
+			for (int h = 0; h < 2; h++) {
+				__m128 plo = _mm_unpacklo_ps(bx.v[h], by.v[h]);
+				__m128 phi = _mm_unpackhi_ps(bx.v[h], by.v[h]);
+				__m128 ulo = _mm_unpacklo_ps(ux.v[h], uy.v[h]);
+				__m128 uhi = _mm_unpackhi_ps(ux.v[h], uy.v[h]);
+				float *w = v + h * 4 * 96;
+				sprite_write_corner(w, i, _mm_movelh_ps(plo, c01), _mm_movelh_ps(ulo, c01));
+				sprite_write_corner(w + 96, i, _mm_movehl_ps(c01, plo), _mm_movehl_ps(c01, ulo));
+				sprite_write_corner(w + 192, i, _mm_movelh_ps(phi, c01), _mm_movelh_ps(uhi, c01));
+				sprite_write_corner(w + 288, i, _mm_movehl_ps(c01, phi), _mm_movehl_ps(c01, uhi));
+			}
+		}
+		for (int l = 0; l < W; l++) {
+			if (valid & (1 << l))
+				sprite_write_color(v + l * 96, o[l]);
+			else
+				memset(v + l * 96, 0, sizeof(VertexFormat) * 6);
+		}
+	}
+#else
+	const size_t stride = sizeof(ObjectFormat) / sizeof(float);
+	for ( ; tid + W <= count; tid += W) {
+		auto o = obj + tid;
+		uint32_t valid = 0;
+		for (int l = 0; l < W; l++)
+			valid |= (o[l].metadata[0] != 0) << l;
+		if (!valid) {
+			memset(vtx + tid * 6, 0, sizeof(VertexFormat) * 6 * W);
+			continue;
+		}
+
+		f32x8 s, c;
+		f8_sincos(f8_gather(o->rotate, stride), s, c);
+
+		f32x8 one = f8_set1(1.0f);
+		f32x8 two = f8_set1(2.0f);
+		f32x8 uv_offx = f8_gather(&o->uvinfo[0], stride);
+		f32x8 uv_offy = f8_gather(&o->uvinfo[1], stride);
+		f32x8 uv_sizex = f8_gather(&o->uvinfo[2], stride);
+		f32x8 uv_sizey = f8_gather(&o->uvinfo[3], stride);
+		f32x8 posx = f8_gather(&o->pos[0], stride);
+		f32x8 posy = f8_gather(&o->pos[1], stride);
+		f32x8 scalex = f8_gather(&o->scale[0], stride);
+		f32x8 scaley = f8_gather(&o->scale[1], stride);
+
+		alignas(32) float pos[4][W][4];
+		alignas(32) float uv[4][W][4];
+		for (int i = 0; i < 4; i++) {
+			f32x8 cx = f8_set1(sprite_corner[i][0]);
+			f32x8 cy = f8_set1(sprite_corner[i][1]);
+			f8_store_xy01(uv[i],
+				f8_add(f8_mul(cx, uv_sizex), uv_offx),
+				f8_add(f8_mul(cy, uv_sizey), uv_offy));
+
+			//scale, rotate, trans
+			f32x8 px = f8_mul(f8_sub(f8_mul(cx, two), one), scalex);
+			f32x8 py = f8_mul(f8_sub(f8_mul(cy, two), one), scaley);
+			f8_store_xy01(pos[i],
+				f8_add(f8_sub(f8_mul(px, c), f8_mul(py, s)), posx),
+				f8_add(f8_add(f8_mul(px, s), f8_mul(py, c)), posy));
+		}
+
+		for (int l = 0; l < W; l++) {
+			auto v = vtx + (tid + l) * 6;
+			if (!(valid & (1 << l))) {
+				memset(v, 0, sizeof(VertexFormat) * 6);
+				continue;
+			}
+			float id;
+			memcpy(&id, &o[l].metadata[1], sizeof(id));
+			for (int k = 0; k < 6; k++) {
+				auto i = sprite_index[k];
+				sprite_copy4(v[k].pos, pos[i][l]);
+				sprite_copy4(v[k].uv, uv[i][l]);
+				sprite_copy4(v[k].color, o[l].color);
+				sprite_store4(&v[k].matid, id, 0.0f, 0.0f, 0.0f);
+			}
+		}
+	}
+#endif
+	sprite_expand_ref(obj + tid, vtx + tid * 6, count - tid);
+}
+
+//
+// CPU version of draw_sprites.hlsl VSMain (vertex pulling).
+// One instance per object, 6 vertices per instance, nothing is expanded
+// into memory. Returns false for dead slots, the shader emits a
+// degenerate vertex for those.
+//
+static inline bool
+sprite_pull_vertex(const ObjectFormat *obj, uint32_t instance_id,
+	uint32_t vertex_id, VertexFormat &v)
+{
+	auto & o = obj[instance_id];
+	if (o.metadata[0] == 0)
+		return false;
+
+	float s, c;
+	sprite_sincos(o.rotate[0], s, c);
+
+	auto i = sprite_index[vertex_id % 6];
+	float cx = sprite_corner[i][0];
+	float cy = sprite_corner[i][1];
+	float px = (cx * 2.0f - 1.0f) * o.scale[0];
+	float py = (cy * 2.0f - 1.0f) * o.scale[1];
+	float id;
+
+	memcpy(&id, &o.metadata[1], sizeof(id));
+	sprite_store4(v.pos,
+		(px * c - py * s) + o.pos[0],
+		(px * s + py * c) + o.pos[1], 0.0f, 1.0f);
+	sprite_store4(v.uv,
+		o.uvinfo[0] + cx * o.uvinfo[2],
+		o.uvinfo[1] + cy * o.uvinfo[3], 0.0f, 1.0f);
+	sprite_copy4(v.color, o.color);
+	sprite_store4(&v.matid, id, 0.0f, 0.0f, 0.0f);
+	return true;
+}
+
+//
+// PackedObjectFormat / PackedVertexFormat conversion.
+// float -> half rounds to nearest even like F16C and f32tof16,
+// float -> unorm8 is floor(saturate(c) * 255 + 0.5) like pack_unorm4().
+//
+static inline uint32_t
+sprite_half(float f)
+{
+	uint32_t u, sign, ret;
+
+	memcpy(&u, &f, sizeof(u));
+	sign = (u >> 16) & 0x8000;
+	u &= 0x7FFFFFFF;
+	if (u >= 0x47800000) {
+		ret = u > 0x7F800000 ? 0x7E00 : 0x7C00;
+	} else if (u < 0x38800000) {
+		float magic = 0.5f;
+		memcpy(&f, &u, sizeof(f));
+		f += magic;
+		memcpy(&ret, &f, sizeof(ret));
+		ret -= 0x3F000000;
+	} else {
+		u += 0xC8000FFF + ((u >> 13) & 1);
+		ret = u >> 13;
+	}
+	return (ret | sign);
+}
+
+static inline float
+sprite_half_to_float(uint32_t h)
+{
+	uint32_t sign = (h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1F;
+	uint32_t mant = h & 0x3FF;
+	uint32_t u;
+	float f;
+
+	if (exp == 0x1F) {
+		u = sign | 0x7F800000 | (mant << 13);
+	} else if (exp) {
+		u = sign | ((exp + 112) << 23) | (mant << 13);
+	} else {
+		f = float(mant) * (1.0f / 16777216.0f);
+		memcpy(&u, &f, sizeof(u));
+		u |= sign;
+	}
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+static inline uint32_t
+sprite_unorm8(float c)
+{
+	c = c > 0.0f ? (c < 1.0f ? c : 1.0f) : 0.0f;
+	return (uint32_t)floorf(c * 255.0f + 0.5f);
+}
+
+static inline uint32_t
+sprite_pack_half2(float x, float y)
+{
+	return sprite_half(x) | (sprite_half(y) << 16);
+}
+
+static inline uint32_t
+sprite_pack_unorm4(const float c[4])
+{
+	return sprite_unorm8(c[0]) | (sprite_unorm8(c[1]) << 8) |
+		(sprite_unorm8(c[2]) << 16) | (sprite_unorm8(c[3]) << 24);
+}
+
+static inline void
+f8_store_half(uint16_t *dst, f32x8 a)
+{
+#if defined(SPRITE_SIMD_F16C) && defined(SPRITE_SIMD_AVX2)
+	_mm_storeu_si128((__m128i *)dst, _mm256_cvtps_ph(a.v, _MM_FROUND_TO_NEAREST_INT));
+#elif defined(SPRITE_SIMD_F16C) && defined(SPRITE_SIMD_SSE4)
+	_mm_storel_epi64((__m128i *)dst, _mm_cvtps_ph(a.v[0], _MM_FROUND_TO_NEAREST_INT));
+	_mm_storel_epi64((__m128i *)(dst + 4), _mm_cvtps_ph(a.v[1], _MM_FROUND_TO_NEAREST_INT));
+#elif defined(SPRITE_SIMD_NEON)
+	vst1_u16(dst, vreinterpret_u16_f16(vcvt_f16_f32(a.v[0])));
+	vst1_u16(dst + 4, vreinterpret_u16_f16(vcvt_f16_f32(a.v[1])));
+#else
+	alignas(32) float t[8];
+	f8_store(t, a);
+	for (int i = 0; i < 8; i++)
+		dst[i] = sprite_half(t[i]);
+#endif
+}
+
+static inline f32x8
+f8_load_half(const uint16_t *src)
+{
+#if defined(SPRITE_SIMD_F16C) && defined(SPRITE_SIMD_AVX2)
+	return { _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)src)) };
+#elif defined(SPRITE_SIMD_F16C) && defined(SPRITE_SIMD_SSE4)
+	return {{ _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)src)),
+		_mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(src + 4))) }};
+#elif defined(SPRITE_SIMD_NEON)
+	return {{ vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src))),
+		vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + 4))) }};
+#else
+	alignas(32) float t[8];
+	for (int i = 0; i < 8; i++)
+		t[i] = sprite_half_to_float(src[i]);
+	return f8_load(t);
+#endif
+}
+
+static inline void
+f8_store_unorm8(uint8_t *dst, f32x8 a)
+{
+	alignas(32) float t[8];
+	a = f8_min(f8_max(a, f8_set1(0.0f)), f8_set1(1.0f));
+	f8_store(t, f8_floor(f8_add(f8_mul(a, f8_set1(255.0f)), f8_set1(0.5f))));
+	for (int i = 0; i < 8; i++)
+		dst[i] = (uint8_t)t[i];
+}
+
+static inline void
+sprite_pack_object_ref(const ObjectFormat &o, PackedObjectFormat &p)
+{
+	p.pos = sprite_pack_half2(o.pos[0], o.pos[1]);
+	p.scale = sprite_pack_half2(o.scale[0], o.scale[1]);
+	p.rotate_matid = sprite_half(o.rotate[0]) | (o.metadata[1] << 16);
+	p.color = sprite_pack_unorm4(o.color);
+	p.uvinfo[0] = sprite_pack_half2(o.uvinfo[0], o.uvinfo[1]);
+	p.uvinfo[1] = sprite_pack_half2(o.uvinfo[2], o.uvinfo[3]);
+	p.flags = o.metadata[0];
+	p.reserved = 0;
+}
+
+static inline void
+sprite_unpack_object_ref(const PackedObjectFormat &p, ObjectFormat &o)
+{
+	memset(&o, 0, sizeof(o));
+	o.pos[0] = sprite_half_to_float(p.pos & 0xFFFF);
+	o.pos[1] = sprite_half_to_float(p.pos >> 16);
+	o.scale[0] = sprite_half_to_float(p.scale & 0xFFFF);
+	o.scale[1] = sprite_half_to_float(p.scale >> 16);
+	o.rotate[0] = sprite_half_to_float(p.rotate_matid & 0xFFFF);
+	for (int i = 0; i < 4; i++)
+		o.color[i] = float((p.color >> (i * 8)) & 0xFF) / 255.0f;
+	o.uvinfo[0] = sprite_half_to_float(p.uvinfo[0] & 0xFFFF);
+	o.uvinfo[1] = sprite_half_to_float(p.uvinfo[0] >> 16);
+	o.uvinfo[2] = sprite_half_to_float(p.uvinfo[1] & 0xFFFF);
+	o.uvinfo[3] = sprite_half_to_float(p.uvinfo[1] >> 16);
+	o.metadata[0] = p.flags;
+	o.metadata[1] = p.rotate_matid >> 16;
+}
+
+static inline void
+sprite_pack_objects_ref(const ObjectFormat *src, PackedObjectFormat *dst,
+	size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		sprite_pack_object_ref(src[i], dst[i]);
+}
+
+static inline void
+sprite_unpack_objects_ref(const PackedObjectFormat *src, ObjectFormat *dst,
+	size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		sprite_unpack_object_ref(src[i], dst[i]);
+}
+
+static inline void
+sprite_pack_objects(const ObjectFormat *src, PackedObjectFormat *dst,
+	size_t count)
+{
+	enum { W = 8 };
+	const size_t stride = sizeof(ObjectFormat) / sizeof(float);
+	size_t i = 0;
+
+	for ( ; i + W <= count; i += W) {
+		auto o = src + i;
+		alignas(16) uint16_t h[9][W];
+		alignas(16) uint8_t c[4][W];
+
+		f8_store_half(h[0], f8_gather(&o->pos[0], stride));
+		f8_store_half(h[1], f8_gather(&o->pos[1], stride));
+		f8_store_half(h[2], f8_gather(&o->scale[0], stride));
+		f8_store_half(h[3], f8_gather(&o->scale[1], stride));
+		f8_store_half(h[4], f8_gather(&o->rotate[0], stride));
+		for (int k = 0; k < 4; k++) {
+			f8_store_half(h[5 + k], f8_gather(&o->uvinfo[k], stride));
+			f8_store_unorm8(c[k], f8_gather(&o->color[k], stride));
+		}
+		for (int l = 0; l < W; l++) {
+			auto & p = dst[i + l];
+			p.pos = h[0][l] | (uint32_t(h[1][l]) << 16);
+			p.scale = h[2][l] | (uint32_t(h[3][l]) << 16);
+			p.rotate_matid = h[4][l] | (o[l].metadata[1] << 16);
+			p.color = c[0][l] | (uint32_t(c[1][l]) << 8) | (uint32_t(c[2][l]) << 16) | (uint32_t(c[3][l]) << 24);
+			p.uvinfo[0] = h[5][l] | (uint32_t(h[6][l]) << 16);
+			p.uvinfo[1] = h[7][l] | (uint32_t(h[8][l]) << 16);
+			p.flags = o[l].metadata[0];
+			p.reserved = 0;
+		}
+	}
+	sprite_pack_objects_ref(src + i, dst + i, count - i);
+}
+
+static inline void
+sprite_unpack_objects(const PackedObjectFormat *src, ObjectFormat *dst,
+	size_t count)
+{
+	enum { W = 8 };
+	size_t i = 0;
+
+	for ( ; i + W <= count; i += W) {
+		auto p = src + i;
+		alignas(16) uint16_t h[9][W];
+		alignas(32) float f[9][W];
+		alignas(32) float c[4][W];
+
+		for (int l = 0; l < W; l++) {
+			h[0][l] = p[l].pos & 0xFFFF;
+			h[1][l] = p[l].pos >> 16;
+			h[2][l] = p[l].scale & 0xFFFF;
+			h[3][l] = p[l].scale >> 16;
+			h[4][l] = p[l].rotate_matid & 0xFFFF;
+			h[5][l] = p[l].uvinfo[0] & 0xFFFF;
+			h[6][l] = p[l].uvinfo[0] >> 16;
+			h[7][l] = p[l].uvinfo[1] & 0xFFFF;
+			h[8][l] = p[l].uvinfo[1] >> 16;
+			for (int k = 0; k < 4; k++)
+				c[k][l] = float((p[l].color >> (k * 8)) & 0xFF);
+		}
+		for (int k = 0; k < 9; k++)
+			f8_store(f[k], f8_load_half(h[k]));
+		for (int k = 0; k < 4; k++)
+			f8_store(c[k], f8_div(f8_load(c[k]), f8_set1(255.0f)));
+		for (int l = 0; l < W; l++) {
+			auto & o = dst[i + l];
+			memset(&o, 0, sizeof(o));
+			o.pos[0] = f[0][l];
+			o.pos[1] = f[1][l];
+			o.scale[0] = f[2][l];
+			o.scale[1] = f[3][l];
+			o.rotate[0] = f[4][l];
+			for (int k = 0; k < 4; k++) {
+				o.uvinfo[k] = f[5 + k][l];
+				o.color[k] = c[k][l];
+			}
+			o.metadata[0] = p[l].flags;
+			o.metadata[1] = p[l].rotate_matid >> 16;
+		}
+	}
+	sprite_unpack_objects_ref(src + i, dst + i, count - i);
+}
+
+static inline void
+sprite_pack_vertices_ref(const VertexFormat *src, PackedVertexFormat *dst,
+	size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		dst[i].pos = sprite_pack_half2(src[i].pos[0], src[i].pos[1]);
+		dst[i].uv = sprite_pack_half2(src[i].uv[0], src[i].uv[1]);
+		dst[i].color = sprite_pack_unorm4(src[i].color);
+		dst[i].matid = src[i].matid & 0xFFFF;
+	}
+}
+
+static inline void
+sprite_pack_vertices(const VertexFormat *src, PackedVertexFormat *dst,
+	size_t count)
+{
+	enum { W = 8 };
+	const size_t stride = sizeof(VertexFormat) / sizeof(float);
+	size_t i = 0;
+
+	for ( ; i + W <= count; i += W) {
+		auto v = src + i;
+		alignas(16) uint16_t h[4][W];
+		alignas(16) uint8_t c[4][W];
+
+		f8_store_half(h[0], f8_gather(&v->pos[0], stride));
+		f8_store_half(h[1], f8_gather(&v->pos[1], stride));
+		f8_store_half(h[2], f8_gather(&v->uv[0], stride));
+		f8_store_half(h[3], f8_gather(&v->uv[1], stride));
+		for (int k = 0; k < 4; k++)
+			f8_store_unorm8(c[k], f8_gather(&v->color[k], stride));
+		for (int l = 0; l < W; l++) {
+			dst[i + l].pos = h[0][l] | (uint32_t(h[1][l]) << 16);
+			dst[i + l].uv = h[2][l] | (uint32_t(h[3][l]) << 16);
+			dst[i + l].color = c[0][l] | (uint32_t(c[1][l]) << 8) | (uint32_t(c[2][l]) << 16) | (uint32_t(c[3][l]) << 24);
+			dst[i + l].matid = v[l].matid & 0xFFFF;
+		}
+	}
+	sprite_pack_vertices_ref(src + i, dst + i, count - i);
+}
+
+//
+// CPU version of update.hlsl with PACKED defined.
+//
+static inline void
+sprite_expand_packed(const PackedObjectFormat *obj, PackedVertexFormat *vtx,
+	size_t count)
+{
+	enum { N = 64 };
+	ObjectFormat o[N];
+	VertexFormat v[N * 6];
+
+	for (size_t i = 0; i < count; i += N) {
+		size_t n = count - i < N ? count - i : size_t(N);
+		sprite_unpack_objects(obj + i, o, n);
+		sprite_expand(o, v, n);
+		sprite_pack_vertices(v, vtx + i * 6, n * 6);
+	}
+}
+
+FP_NO_FMA_END
+
+#endif //_SPRITE_H_
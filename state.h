@@ -0,0 +1,206 @@
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "cmd.h"
+
+//
+// Resource state tracker. Keeps the state of every subresource across
+// lists, keyed by the backend object (cmd_table_t::objects), and resolves
+// the use() / done() of a list (cmd.h) into barriers :
+//  - no barrier when the state already matches,
+//  - a UAV barrier between two UAV uses,
+//  - buffers promote from common without a barrier,
+//  - done() followed by a later use in another state begins a split
+//    barrier right away and ends it at the use,
+//  - barriers in front of the same command go out as one batch.
+//
+struct state_tracker_t {
+	struct res_t {
+		bool buffer = false;
+		uint8_t split = CmdStateMax;
+		std::vector<uint8_t> subs = std::vector<uint8_t>(1, CmdStateCommon);
+	};
+	std::unordered_map<uintptr_t, res_t> res;
+	std::vector<cmd_t> batch;
+	std::vector<int> next_use;
+	uint64_t transitions = 0;
+	uint64_t uavs = 0;
+	uint64_t splits = 0;
+	uint64_t promotions = 0;
+	uint64_t skipped = 0;
+	uint64_t batches = 0;
+
+	//a new resource (or a reused address) starts in state.
+	void set(uintptr_t key, uint8_t state, uint32_t num_subs = 1, bool buffer = false)
+	{
+		auto & r = res[key];
+		r.buffer = buffer;
+		r.split = CmdStateMax;
+		r.subs.assign(num_subs ? num_subs : 1, state);
+	}
+
+	void forget(uintptr_t key)
+	{
+		res.erase(key);
+	}
+
+	uint8_t state(uintptr_t key, uint32_t sub = 0) const
+	{
+		auto it = res.find(key);
+		if (it == res.end())
+			return CmdStateCommon;
+		return it->second.subs[sub < it->second.subs.size() ? sub : 0];
+	}
+
+	void reset_stats()
+	{
+		transitions = uavs = splits = promotions = skipped = batches = 0;
+	}
+
+	void transition(uint32_t id, uint32_t sub, uint8_t before, uint8_t after, uint8_t flags = 0)
+	{
+		cmd_t c = {};
+		c.type = CmdBarrier;
+		c.slot = flags;
+		c.id[0] = id;
+		c.id[1] = sub;
+		c.arg.u[0] = before;
+		c.arg.u[1] = after;
+		batch.push_back(c);
+	}
+
+	void flush(cmd_list_t &out)
+	{
+		if (batch.empty())
+			return;
+		out.cmds.insert(out.cmds.end(), batch.begin(), batch.end());
+		batch.clear();
+		batches++;
+	}
+
+	void use(uint32_t id, res_t &r, uint32_t sub, uint8_t state)
+	{
+		auto & subs = r.subs;
+		if (r.split != CmdStateMax) {
+			transition(id, CmdAllSubresources, subs[0], r.split, CmdBarrierEnd);
+			subs.assign(subs.size(), r.split);
+			r.split = CmdStateMax;
+			if (subs[0] == state)
+				return;
+		}
+		if (sub != CmdAllSubresources && sub >= subs.size())
+			sub = CmdAllSubresources;
+		uint32_t begin = sub == CmdAllSubresources ? 0 : sub;
+		uint32_t end = sub == CmdAllSubresources ? uint32_t(subs.size()) : sub + 1;
+
+		bool same = true;
+		for (uint32_t s = begin; s < end; s++)
+			same &= subs[s] == subs[begin];
+		if (same && subs[begin] == state) {
+			if (state == CmdStateUnorderedAccess) {
+				cmd_t c = {};
+				c.type = CmdBarrier;
+				c.slot = CmdBarrierUav;
+				c.id[0] = id;
+				c.id[1] = CmdAllSubresources;
+				c.arg.u[0] = c.arg.u[1] = state;
+				batch.push_back(c);
+				uavs++;
+			} else {
+				skipped++;
+			}
+			return;
+		}
+		if (same && r.buffer && subs[begin] == CmdStateCommon) {
+			promotions++;
+		} else if (same && (end - begin == subs.size())) {
+			transition(id, CmdAllSubresources, subs[begin], state);
+			transitions++;
+		} else {
+			for (uint32_t s = begin; s < end; s++) {
+				if (subs[s] == state)
+					continue;
+				transition(id, s, subs[s], state);
+				transitions++;
+			}
+		}
+		for (uint32_t s = begin; s < end; s++)
+			subs[s] = state;
+	}
+
+	//
+	// in -> out with use() / done() replaced by barriers. keys[id] is the
+	// backend object of id. The states are those after out has run.
+	//
+	void resolve(const cmd_list_t &in, cmd_list_t &out, const std::vector<uintptr_t> &keys)
+	{
+		std::unordered_map<uintptr_t, int> last;
+		size_t n = in.cmds.size();
+
+		//index of the next use of the resource of every done().
+		next_use.assign(n, -1);
+		for (size_t i = n; i-- > 0; ) {
+			auto & c = in.cmds[i];
+			if (c.type == CmdUse) {
+				last[keys[c.id[0]]] = int(i);
+			} else if (c.type == CmdDone) {
+				auto it = last.find(keys[c.id[0]]);
+				if (it != last.end())
+					next_use[i] = it->second;
+			}
+		}
+
+		out.reset();
+		batch.clear();
+		for (size_t i = 0; i < n; i++) {
+			auto & c = in.cmds[i];
+			if (c.type == CmdUse) {
+				use(c.id[0], res[keys[c.id[0]]], c.id[1], uint8_t(c.arg.u[0]));
+				continue;
+			}
+			if (c.type == CmdDone) {
+				auto & r = res[keys[c.id[0]]];
+				int u = next_use[i];
+				if (u < 0 || r.split != CmdStateMax)
+					continue;
+				auto & next = in.cmds[u];
+				uint8_t after = uint8_t(next.arg.u[0]);
+				bool same = true;
+				for (auto st : r.subs)
+					same &= st == r.subs[0];
+				bool gap = false;
+				for (int k = int(i) + 1; k < u && !gap; k++)
+					gap = in.cmds[k].type != CmdUse && in.cmds[k].type != CmdDone;
+				if (!same || !gap || next.id[1] != CmdAllSubresources || r.subs[0] == after ||
+					(r.buffer && r.subs[0] == CmdStateCommon))
+					continue;
+				transition(c.id[0], CmdAllSubresources, r.subs[0], after, CmdBarrierBegin);
+				r.split = after;
+				splits++;
+				continue;
+			}
+			flush(out);
+			out.cmds.push_back(c);
+		}
+		flush(out);
+	}
+
+	//after the list has run : buffers decay to common.
+	void end_list()
+	{
+		for (auto & it : res) {
+			auto & r = it.second;
+			if (!r.buffer || r.split != CmdStateMax)
+				continue;
+			for (auto & st : r.subs)
+				if (st != CmdStateGenericRead)
+					st = CmdStateCommon;
+		}
+	}
+};
+
+#endif //_STATE_H_
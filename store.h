@@ -0,0 +1,250 @@
+#ifndef _STORE_H_
+#define _STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+#include "format.h"
+#include "sprite.h"
+
+static_assert(offsetof(ObjectFormat, scale) == 16, "ObjectFormat.scale");
+static_assert(offsetof(ObjectFormat, rotate) == 32, "ObjectFormat.rotate");
+static_assert(offsetof(ObjectFormat, color) == 48, "ObjectFormat.color");
+static_assert(offsetof(ObjectFormat, uvinfo) == 64, "ObjectFormat.uvinfo");
+static_assert(offsetof(ObjectFormat, metadata) == 80, "ObjectFormat.metadata");
+
+static inline void *
+store_aligned_alloc(size_t bytes, size_t align)
+{
+#ifdef _MSC_VER
+	return _aligned_malloc(bytes, align);
+#else
+	void *p = nullptr;
+	if (posix_memalign(&p, align, bytes))
+		return nullptr;
+	return p;
+#endif
+}
+
+static inline void
+store_aligned_free(void *p)
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+//
+// Structure of arrays object container in cached memory.
+// Game code reads and writes here, flush() writes the ObjectFormat layout
+// to the (write combined) upload buffer in one streaming pass.
+// Fields that are not stored (pos.zw, scale.zw, rotate.yzw, metadata[2..3])
+// are written as 0.
+//
+struct object_store_t {
+	enum {
+		Align = 64,
+		ArrayNum = 15,
+	};
+	size_t count = 0;
+	size_t capacity = 0;
+	void *block = nullptr;
+
+	float *pos_x = nullptr;
+	float *pos_y = nullptr;
+	float *scale_x = nullptr;
+	float *scale_y = nullptr;
+	float *rotate = nullptr;
+	float *color[4] = {};
+	float *uvinfo[4] = {};
+	uint32_t *flags = nullptr;
+	uint32_t *matid = nullptr;
+
+	object_store_t() = default;
+	object_store_t(const object_store_t &) = delete;
+	object_store_t & operator=(const object_store_t &) = delete;
+	~object_store_t()
+	{
+		term();
+	}
+
+	bool init(size_t num)
+	{
+		term();
+		capacity = (num + 15) & ~size_t(15);
+		block = store_aligned_alloc(capacity * sizeof(float) * ArrayNum, Align);
+		if (!block)
+			return false;
+		memset(block, 0, capacity * sizeof(float) * ArrayNum);
+		bind();
+		count = num;
+		return true;
+	}
+
+	//point the field arrays into block.
+	void bind()
+	{
+		float *p = (float *)block;
+		auto next = [&p, this]() { float *ret = p; p += capacity; return ret; };
+		pos_x = next();
+		pos_y = next();
+		scale_x = next();
+		scale_y = next();
+		rotate = next();
+		for (auto & c : color)
+			c = next();
+		for (auto & u : uvinfo)
+			u = next();
+		flags = (uint32_t *)next();
+		matid = (uint32_t *)next();
+	}
+
+	//keep [0, min(count, num)), the rest is zero.
+	bool resize(size_t num)
+	{
+		object_store_t old;
+		std::swap(block, old.block);
+		old.count = count;
+		old.capacity = capacity;
+		if (!init(num)) {
+			std::swap(block, old.block);
+			count = old.count;
+			capacity = old.capacity;
+			bind();
+			return false;
+		}
+		size_t n = old.count < num ? old.count : num;
+		for (size_t i = 0; i < ArrayNum; i++)
+			memcpy((float *)block + i * capacity, (float *)old.block + i * old.capacity, n * sizeof(float));
+		return true;
+	}
+
+	void term()
+	{
+		store_aligned_free(block);
+		block = nullptr;
+		count = capacity = 0;
+	}
+
+	void get(size_t i, ObjectFormat &o) const
+	{
+		memset(&o, 0, sizeof(o));
+		o.pos[0] = pos_x[i];
+		o.pos[1] = pos_y[i];
+		o.scale[0] = scale_x[i];
+		o.scale[1] = scale_y[i];
+		o.rotate[0] = rotate[i];
+		for (int k = 0; k < 4; k++) {
+			o.color[k] = color[k][i];
+			o.uvinfo[k] = uvinfo[k][i];
+		}
+		o.metadata[0] = flags[i];
+		o.metadata[1] = matid[i];
+	}
+
+	void copy(size_t from, size_t to)
+	{
+		pos_x[to] = pos_x[from];
+		pos_y[to] = pos_y[from];
+		scale_x[to] = scale_x[from];
+		scale_y[to] = scale_y[from];
+		rotate[to] = rotate[from];
+		for (int k = 0; k < 4; k++) {
+			color[k][to] = color[k][from];
+			uvinfo[k][to] = uvinfo[k][from];
+		}
+		flags[to] = flags[from];
+		matid[to] = matid[from];
+	}
+
+	void set_flags(size_t begin, size_t end, uint32_t value)
+	{
+		for (size_t i = begin; i < end; i++)
+			flags[i] = value;
+	}
+
+	void flush_ref(ObjectFormat *dst, size_t begin, size_t end) const
+	{
+		flush_ref_to(dst + begin, begin, end);
+	}
+
+	void flush_ref_to(ObjectFormat *out, size_t begin, size_t end) const
+	{
+		for (size_t i = begin; i < end; i++) {
+			ObjectFormat o;
+			get(i, o);
+			memcpy(&out[i - begin], &o, sizeof(o));
+		}
+	}
+
+	//write [begin, end) to dst[begin, end).
+	void flush(ObjectFormat *dst, size_t begin, size_t end) const
+	{
+		flush_to(dst + begin, begin, end);
+	}
+
+	//write [begin, end) to out[0, end - begin), e.g. straight into upload memory.
+	void flush_to(ObjectFormat *out, size_t begin, size_t end) const
+	{
+#if defined(SPRITE_SIMD_AVX2) || defined(SPRITE_SIMD_SSE4)
+		size_t i = begin;
+		if ((uintptr_t(out) & 15) == 0) {
+			const __m128 z = _mm_setzero_ps();
+			for ( ; i + 4 <= end; i += 4) {
+				__m128 px = _mm_loadu_ps(pos_x + i);
+				__m128 py = _mm_loadu_ps(pos_y + i);
+				__m128 sx = _mm_loadu_ps(scale_x + i);
+				__m128 sy = _mm_loadu_ps(scale_y + i);
+				__m128 r = _mm_loadu_ps(rotate + i);
+				__m128 c0 = _mm_loadu_ps(color[0] + i);
+				__m128 c1 = _mm_loadu_ps(color[1] + i);
+				__m128 c2 = _mm_loadu_ps(color[2] + i);
+				__m128 c3 = _mm_loadu_ps(color[3] + i);
+				__m128 u0 = _mm_loadu_ps(uvinfo[0] + i);
+				__m128 u1 = _mm_loadu_ps(uvinfo[1] + i);
+				__m128 u2 = _mm_loadu_ps(uvinfo[2] + i);
+				__m128 u3 = _mm_loadu_ps(uvinfo[3] + i);
+				__m128 f = _mm_loadu_ps((const float *)flags + i);
+				__m128 m = _mm_loadu_ps((const float *)matid + i);
+				_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+				_MM_TRANSPOSE4_PS(u0, u1, u2, u3);
+
+				__m128 p01 = _mm_unpacklo_ps(px, py);
+				__m128 p23 = _mm_unpackhi_ps(px, py);
+				__m128 s01 = _mm_unpacklo_ps(sx, sy);
+				__m128 s23 = _mm_unpackhi_ps(sx, sy);
+				__m128 r01 = _mm_unpacklo_ps(r, z);
+				__m128 r23 = _mm_unpackhi_ps(r, z);
+				__m128 m01 = _mm_unpacklo_ps(f, m);
+				__m128 m23 = _mm_unpackhi_ps(f, m);
+				__m128 rows[4][6] = {
+					{ _mm_movelh_ps(p01, z), _mm_movelh_ps(s01, z), _mm_movelh_ps(r01, z),
+						c0, u0, _mm_movelh_ps(m01, z) },
+					{ _mm_movehl_ps(z, p01), _mm_movehl_ps(z, s01), _mm_movehl_ps(z, r01),
+						c1, u1, _mm_movehl_ps(z, m01) },
+					{ _mm_movelh_ps(p23, z), _mm_movelh_ps(s23, z), _mm_movelh_ps(r23, z),
+						c2, u2, _mm_movelh_ps(m23, z) },
+					{ _mm_movehl_ps(z, p23), _mm_movehl_ps(z, s23), _mm_movehl_ps(z, r23),
+						c3, u3, _mm_movehl_ps(z, m23) },
+				};
+				for (int l = 0; l < 4; l++) {
+					float *o = (float *)&out[i - begin + l];
+					for (int k = 0; k < 6; k++)
+						_mm_stream_ps(o + k * 4, rows[l][k]);
+				}
+			}
+			_mm_sfence();
+		}
+		flush_ref_to(out + (i - begin), i, end);
+#else
+		flush_ref_to(out, begin, end);
+#endif
+	}
+};
+
+#endif //_STORE_H_
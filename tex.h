@@ -0,0 +1,530 @@
+#ifndef _TEX_H_
+#define _TEX_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache.h"
+#include "upload.h"
+
+//
+// Texture container (-tex). A header, a table of fixed size entries and
+// the payload : every mip of every texture at a TexPlaceAlign offset, rows
+// of blocks TexPitchAlign apart, which is the placed footprint a D3D12
+// copy reads, so a mip goes from the mapped file to the upload ring with
+// one memcpy and from there to the texture with one copy, nothing is
+// decoded. Block compressed textures are multiples of 4 texels, as D3D12
+// wants them. tex_write() writes the file, tex_file_t maps it and checks
+// the table against the file size once, so later reads need no checks.
+//
+enum {
+	TexMagic = 0x31584554,  //"TEX1"
+	TexVersion = 1,
+	TexPitchAlign = 256,    //D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+	TexPlaceAlign = 512,    //D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+	TexMipMax = 15,         //16384 texels
+	TexNameMax = 48,
+};
+
+enum tex_format_t : uint32_t {
+	TexRGBA8,  //DXGI_FORMAT_R8G8B8A8_UNORM
+	TexBC1,    //DXGI_FORMAT_BC1_UNORM, 8 bytes per 4x4 block
+	TexBC3,    //DXGI_FORMAT_BC3_UNORM, 16 bytes per 4x4 block
+	TexFormatNum,
+};
+
+struct tex_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t data;  //first payload byte
+	uint64_t size;  //of the whole file
+};
+
+struct tex_mip_t {
+	uint64_t offset;     //in the file, TexPlaceAlign
+	uint32_t width;
+	uint32_t height;
+	uint32_t row_bytes;  //of a row of blocks
+	uint32_t rows;       //of blocks
+	uint32_t pitch;      //TexPitchAlign
+	uint32_t reserved;
+};
+
+struct tex_entry_t {
+	char name[TexNameMax];
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mips;
+	uint64_t bytes;  //payload of every mip, what the texture takes on the GPU
+	uint64_t reserved;
+	tex_mip_t mip[TexMipMax];
+};
+
+//texels per block side and bytes per block.
+static inline uint32_t
+tex_block_dim(uint32_t format)
+{
+	return format == TexRGBA8 ? 1 : 4;
+}
+
+static inline uint32_t
+tex_block_bytes(uint32_t format)
+{
+	return format == TexRGBA8 ? 4 : format == TexBC1 ? 8 : 16;
+}
+
+static inline uint32_t
+tex_mip_count(uint32_t w, uint32_t h)
+{
+	uint32_t ret = 1;
+	while ((w | h) >> ret)
+		ret++;
+	return (ret);
+}
+
+//layout of mip m of a w x h texture, offset left to the caller.
+static inline tex_mip_t
+tex_mip_layout(uint32_t format, uint32_t w, uint32_t h, uint32_t m)
+{
+	tex_mip_t ret = {};
+	uint32_t dim = tex_block_dim(format);
+	ret.width = std::max(w >> m, 1u);
+	ret.height = std::max(h >> m, 1u);
+	ret.row_bytes = (ret.width + dim - 1) / dim * tex_block_bytes(format);
+	ret.rows = (ret.height + dim - 1) / dim;
+	ret.pitch = (ret.row_bytes + TexPitchAlign - 1) & ~uint32_t(TexPitchAlign - 1);
+	return (ret);
+}
+
+//a texture before it is written : mips of tight rows of blocks.
+struct tex_image_t {
+	std::string name;
+	uint32_t format = TexRGBA8;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<std::vector<uint8_t>> mips;
+};
+
+//RGBA8 image with its whole chain, 2x2 box filter, odd sides repeat the last texel.
+static inline void
+tex_build_mips(tex_image_t &out, const std::string &name, uint32_t w, uint32_t h, const uint8_t *rgba)
+{
+	uint32_t num = tex_mip_count(w, h);
+	out.name = name;
+	out.format = TexRGBA8;
+	out.width = w;
+	out.height = h;
+	out.mips.assign(num, std::vector<uint8_t>());
+	out.mips[0].assign(rgba, rgba + size_t(w) * h * 4);
+	for (uint32_t m = 1; m < num; m++) {
+		auto & src = out.mips[m - 1];
+		uint32_t sw = std::max(w >> (m - 1), 1u), sh = std::max(h >> (m - 1), 1u);
+		uint32_t dw = std::max(w >> m, 1u), dh = std::max(h >> m, 1u);
+		auto & dst = out.mips[m];
+		dst.resize(size_t(dw) * dh * 4);
+		for (uint32_t y = 0; y < dh; y++) {
+			uint32_t y0 = std::min(y * 2, sh - 1), y1 = std::min(y * 2 + 1, sh - 1);
+			for (uint32_t x = 0; x < dw; x++) {
+				uint32_t x0 = std::min(x * 2, sw - 1), x1 = std::min(x * 2 + 1, sw - 1);
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t sum = src[(size_t(y0) * sw + x0) * 4 + c] + src[(size_t(y0) * sw + x1) * 4 + c] +
+						src[(size_t(y1) * sw + x0) * 4 + c] + src[(size_t(y1) * sw + x1) * 4 + c];
+					dst[(size_t(y) * dw + x) * 4 + c] = uint8_t((sum + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+//write to a temporary file, then rename it over path.
+static inline bool
+tex_write(const char *path, const std::vector<tex_image_t> &images)
+{
+	std::vector<tex_entry_t> entries(images.size());
+	uint64_t pos = sizeof(tex_header_t) + sizeof(tex_entry_t) * entries.size();
+	pos = (pos + TexPlaceAlign - 1) & ~uint64_t(TexPlaceAlign - 1);
+	tex_header_t h = { TexMagic, TexVersion, uint32_t(images.size()), 0, pos, 0 };
+	for (size_t i = 0; i < images.size(); i++) {
+		auto & img = images[i];
+		auto & e = entries[i];
+		memset(&e, 0, sizeof(e));
+		if (img.format >= TexFormatNum || img.mips.empty() || img.mips.size() > TexMipMax ||
+			img.mips.size() > tex_mip_count(img.width, img.height) || img.width > 16384 || img.height > 16384 ||
+			(img.width | img.height) % tex_block_dim(img.format))
+			return false;
+		strncpy(e.name, img.name.c_str(), TexNameMax - 1);
+		e.format = img.format;
+		e.width = img.width;
+		e.height = img.height;
+		e.mips = uint32_t(img.mips.size());
+		for (uint32_t m = 0; m < e.mips; m++) {
+			auto & mip = e.mip[m];
+			mip = tex_mip_layout(img.format, img.width, img.height, m);
+			if (img.mips[m].size() != size_t(mip.row_bytes) * mip.rows)
+				return false;
+			pos = (pos + TexPlaceAlign - 1) & ~uint64_t(TexPlaceAlign - 1);
+			mip.offset = pos;
+			pos += uint64_t(mip.pitch) * mip.rows;
+			e.bytes += uint64_t(mip.pitch) * mip.rows;
+		}
+	}
+	h.size = pos;
+
+	std::string tmp = std::string(path) + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	bool ok = fp && fwrite(&h, sizeof(h), 1, fp) == 1 &&
+		fwrite(entries.data(), sizeof(tex_entry_t), entries.size(), fp) == entries.size();
+	std::vector<uint8_t> zero(TexPlaceAlign + TexPitchAlign);
+	uint64_t at = sizeof(h) + sizeof(tex_entry_t) * entries.size();
+	for (size_t i = 0; ok && i < images.size(); i++) {
+		for (uint32_t m = 0; ok && m < entries[i].mips; m++) {
+			auto & mip = entries[i].mip[m];
+			const uint8_t *src = images[i].mips[m].data();
+			ok = fwrite(zero.data(), 1, size_t(mip.offset - at), fp) == mip.offset - at;
+			for (uint32_t y = 0; ok && y < mip.rows; y++)
+				ok = fwrite(src + size_t(y) * mip.row_bytes, 1, mip.row_bytes, fp) == mip.row_bytes &&
+					fwrite(zero.data(), 1, mip.pitch - mip.row_bytes, fp) == mip.pitch - mip.row_bytes;
+			at = mip.offset + uint64_t(mip.pitch) * mip.rows;
+		}
+	}
+	if (fp)
+		ok = fclose(fp) == 0 && ok;
+#ifdef _WIN32
+	ok = ok && MoveFileExA(tmp.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && rename(tmp.c_str(), path) == 0;
+#endif
+	if (!ok)
+		remove(tmp.c_str());
+	return ok;
+}
+
+//mapped container, read only.
+struct tex_file_t {
+	cache_map_t map;
+	const tex_header_t *header = nullptr;
+	const tex_entry_t *entries = nullptr;
+
+	bool open(const std::string &path)
+	{
+		close();
+		if (!map.open(path) || map.size < sizeof(tex_header_t))
+			return fail();
+		header = (const tex_header_t *)map.data;
+		entries = (const tex_entry_t *)(map.data + sizeof(tex_header_t));
+		auto & h = *header;
+		if (h.magic != TexMagic || h.version != TexVersion || h.size != map.size || h.count > 65536 ||
+			h.data % TexPlaceAlign || h.data > h.size ||
+			sizeof(tex_header_t) + uint64_t(sizeof(tex_entry_t)) * h.count > h.data)
+			return fail();
+		for (uint32_t i = 0; i < h.count; i++) {
+			auto & e = entries[i];
+			if (e.format >= TexFormatNum || e.mips == 0 || e.mips > TexMipMax || e.width > 16384 ||
+				e.height > 16384 || e.mips > tex_mip_count(e.width, e.height) || (e.width | e.height) % tex_block_dim(e.format) ||
+				memchr(e.name, 0, TexNameMax) == nullptr)
+				return fail();
+			for (uint32_t m = 0; m < e.mips; m++) {
+				auto & mip = e.mip[m];
+				auto expect = tex_mip_layout(e.format, e.width, e.height, m);
+				if (mip.width != expect.width || mip.height != expect.height || mip.row_bytes != expect.row_bytes ||
+					mip.rows != expect.rows || mip.pitch != expect.pitch || mip.offset % TexPlaceAlign ||
+					mip.offset < h.data || mip.offset > h.size || uint64_t(mip.pitch) * mip.rows > h.size - mip.offset)
+					return fail();
+			}
+		}
+		return true;
+	}
+
+	bool fail()
+	{
+		close();
+		return false;
+	}
+
+	void close()
+	{
+		map.close();
+		header = nullptr;
+		entries = nullptr;
+	}
+
+	uint32_t count() const
+	{
+		return header ? header->count : 0;
+	}
+
+	//mip of texture i as stored : rows of blocks pitch bytes apart.
+	const uint8_t *data(uint32_t i, uint32_t mip) const
+	{
+		return map.data + entries[i].mip[mip].offset;
+	}
+
+	uint64_t mip_size(uint32_t i, uint32_t mip) const
+	{
+		return uint64_t(entries[i].mip[mip].pitch) * entries[i].mip[mip].rows;
+	}
+
+	int find(const char *name) const
+	{
+		for (uint32_t i = 0; i < count(); i++)
+			if (!strcmp(entries[i].name, name))
+				return int(i);
+		return -1;
+	}
+};
+
+//
+// Streams the textures of a tex_file_t in a thread of its own. The frame
+// sets the demand of every texture (demand()) : its on-screen area is the
+// priority, its largest on-screen side gives the finest mip it needs.
+// Between begin() and take() the thread copies mips, coarsest first, from
+// the mapped file into a fixed upload ring, at most frame_budget bytes a
+// frame, textures with nothing resident before the others. take() stops
+// it and hands over the copies, which the frame records and end() closes
+// with its fence, so a copy never outlives the frame that records it.
+// When a wanted texture does not fit in resident_budget, the ones without
+// demand for evict_after frames are evicted, longest idle first.
+//
+struct tex_stream_job_t {
+	uint32_t tex;
+	uint32_t mip;
+	upload_alloc_t src;  //the mip as stored in the file
+};
+
+struct tex_stream_t {
+	struct state_t {
+		float priority = 0.0f;  //on-screen pixels
+		uint32_t idle = 0;      //frames without demand
+		uint8_t want = 0;       //finest mip the screen needs
+		uint8_t queued = 0;     //finest mip copied into the ring, mips : none
+		uint8_t resident = 0;   //finest mip handed to the frame, mips : none
+	};
+
+	const tex_file_t *file = nullptr;
+	upload_ring_t ring;
+	std::vector<state_t> states;
+	std::vector<tex_stream_job_t> ready;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::thread thread;
+	bool quit = false;
+	bool open = false;  //begin() .. take()
+	bool busy = false;  //a copy runs outside the lock
+	bool full = false;  //the ring is full until the next frame
+	uint64_t frame_budget = 0;
+	uint64_t frame_used = 0;
+	uint64_t resident_budget = 0;
+	uint64_t resident_bytes = 0;
+	uint32_t evict_after = 0;
+	uint64_t loaded_bytes = 0;
+	uint32_t loads = 0;
+	uint32_t evictions = 0;
+	uint32_t stalls = 0;  //frames the ring was full
+
+	~tex_stream_t()
+	{
+		term();
+	}
+
+	bool init(const tex_file_t *f, uint64_t ring_size, upload_create_t c, upload_release_t r,
+		uint64_t per_frame, uint64_t budget, uint32_t idle_frames)
+	{
+		term();
+		file = f;
+		states.assign(f->count(), state_t());
+		uint64_t largest = 0;
+		for (uint32_t i = 0; i < f->count(); i++) {
+			auto & s = states[i];
+			s.want = uint8_t(f->entries[i].mips - 1);
+			s.queued = s.resident = uint8_t(f->entries[i].mips);
+			largest = std::max(largest, f->mip_size(i, 0));
+		}
+		frame_budget = per_frame;
+		resident_budget = budget;
+		evict_after = idle_frames;
+		resident_bytes = frame_used = loaded_bytes = 0;
+		loads = evictions = stalls = 0;
+		ready.clear();
+		quit = open = busy = full = false;
+		ring.fixed = true;
+		if (!ring.init(std::max(ring_size, largest + TexPlaceAlign), c, r))
+			return false;
+		thread = std::thread([this]() { main(); });
+		return true;
+	}
+
+	void term()
+	{
+		if (thread.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				quit = true;
+			}
+			cv.notify_all();
+			thread.join();
+		}
+		ring.term();
+	}
+
+	uint32_t mips(uint32_t i) const
+	{
+		return file->entries[i].mips;
+	}
+
+	//next texture to copy a mip of, -1 when none. Under the lock.
+	int pick() const
+	{
+		int ret = -1;
+		bool ret_empty = false;
+		for (uint32_t i = 0; i < states.size(); i++) {
+			auto & s = states[i];
+			bool empty = s.queued == mips(i);
+			if (s.priority <= 0.0f || s.queued <= s.want)
+				continue;
+			if (empty && resident_bytes + file->entries[i].bytes > resident_budget)
+				continue;
+			if (ret < 0 || (empty && !ret_empty) ||
+				(empty == ret_empty && s.priority > states[ret].priority)) {
+				ret = int(i);
+				ret_empty = empty;
+			}
+		}
+		return (ret);
+	}
+
+	void main()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		for (;;) {
+			int t = -1;
+			cv.wait(lock, [&]() {
+				return quit || (open && !full && frame_used < frame_budget && (t = pick()) >= 0);
+			});
+			if (quit)
+				break;
+			auto & s = states[t];
+			tex_stream_job_t job = { uint32_t(t), uint32_t(s.queued - 1), upload_alloc_t() };
+			uint64_t size = file->mip_size(t, job.mip);
+			if (!ring.alloc(size, TexPlaceAlign, job.src)) {
+				full = true;
+				stalls++;
+				continue;
+			}
+			if (s.queued == mips(t))
+				resident_bytes += file->entries[t].bytes;
+			s.queued = uint8_t(job.mip);
+			frame_used += size;
+			busy = true;
+			lock.unlock();
+			memcpy(job.src.cpu, file->data(t, job.mip), size_t(size));
+			lock.lock();
+			busy = false;
+			ready.push_back(job);
+			loads++;
+			loaded_bytes += size;
+			cv.notify_all();
+		}
+	}
+
+	//start of a frame, after the fence of the frame that used its ring space.
+	void begin(uint64_t completed)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			ring.retire(completed);
+			frame_used = 0;
+			full = false;
+			open = true;
+		}
+		cv.notify_all();
+	}
+
+	//on-screen area and largest on-screen side in pixels of every texture.
+	void demand(const float *area, const float *size)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			for (uint32_t i = 0; i < states.size(); i++) {
+				auto & s = states[i];
+				auto & e = file->entries[i];
+				s.priority = area[i];
+				if (area[i] <= 0.0f) {
+					s.idle++;
+					continue;
+				}
+				uint32_t want = 0;
+				while (want + 1 < e.mips && float(std::max(e.width, e.height) >> (want + 1)) >= size[i])
+					want++;
+				s.idle = 0;
+				s.want = uint8_t(want);
+			}
+		}
+		cv.notify_all();
+	}
+
+	//the copies since begin() and the textures evicted, stops the thread until the next begin().
+	void take(std::vector<tex_stream_job_t> &jobs, std::vector<uint32_t> &evicted)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		open = false;
+		cv.wait(lock, [this]() { return !busy; });
+		jobs.clear();
+		jobs.swap(ready);
+		for (auto & j : jobs)
+			states[j.tex].resident = uint8_t(j.mip);
+		evicted.clear();
+		int t = -1;
+		float best = 0.0f;
+		for (uint32_t i = 0; i < states.size(); i++) {
+			auto & s = states[i];
+			if (s.queued == mips(i) && s.priority > best) {
+				t = int(i);
+				best = s.priority;
+			}
+		}
+		while (t >= 0 && resident_bytes + file->entries[t].bytes > resident_budget) {
+			int victim = -1;
+			for (uint32_t i = 0; i < states.size(); i++) {
+				auto & s = states[i];
+				//not one the jobs of this frame copy into.
+				if (s.resident < mips(i) && s.idle >= evict_after &&
+					(victim < 0 || s.idle > states[victim].idle) &&
+					std::none_of(jobs.begin(), jobs.end(),
+						[i](const tex_stream_job_t &j) { return j.tex == i; }))
+					victim = int(i);
+			}
+			if (victim < 0)
+				break;
+			auto & s = states[victim];
+			s.queued = s.resident = uint8_t(mips(victim));
+			resident_bytes -= file->entries[victim].bytes;
+			evictions++;
+			evicted.push_back(uint32_t(victim));
+		}
+	}
+
+	//copies taken by the frame of fence.
+	void end(uint64_t fence)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		ring.close(fence);
+	}
+
+	uint32_t resident(uint32_t i)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return states[i].resident;
+	}
+};
+
+#endif //_TEX_H_
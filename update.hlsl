@@ -20,25 +20,50 @@
  *
  */
 
-struct ObjectFormat {
-	float4 pos;
-	float4 scale;
-	float4 rotate;
-	float4 color;
-	float4 uvinfo;
-	uint metadata[4];
-};
-
-struct VertexFormat {
-	float4 pos;
-	float4 uv;
-	float4 color;
-	uint matid;
-	uint reserved[3];
-};
+#include "format.h"
 
+#ifdef PACKED
+RWStructuredBuffer<PackedObjectFormat> obj : register(u0);
+RWStructuredBuffer<PackedVertexFormat> vtx : register(u1);
+#else
 RWStructuredBuffer<ObjectFormat> obj : register(u0);
 RWStructuredBuffer<VertexFormat> vtx : register(u1);
+#endif
+
+#ifdef CULL
+//kept objects of the layer (bin.h), the vertices follow the list.
+StructuredBuffer<uint> visible : register(t0, space1);
+#define object_index(i) visible[i]
+#else
+#define object_index(i) (i)
+#endif
+
+cbuffer UpdateRange : register(b0)
+{
+	uint range_begin;
+	uint range_end;
+};
+
+ObjectFormat load_object(uint i)
+{
+#ifdef PACKED
+	return unpack_object(obj[i]);
+#else
+	return obj[i];
+#endif
+}
+
+void store_vertex(uint i, float2 pos, float2 uv, float4 color, uint matid)
+{
+#ifdef PACKED
+	vtx[i] = pack_vertex(pos, uv, color, matid);
+#else
+	vtx[i].pos = float4(pos, 0, 1);
+	vtx[i].uv = float4(uv, 0, 1);
+	vtx[i].color = color;
+	vtx[i].matid = matid;
+#endif
+}
 
 float2 rotate(float2 p, float a) {
 	float c = cos(a);
@@ -51,29 +76,33 @@ float2 rotate(float2 p, float a) {
 [numthreads(256, 1, 1)]
 void CSMain(uint3 gl_GlobalInvocationID : SV_DispatchThreadID)
 {
-	uint tid = gl_GlobalInvocationID.x;
-	uint valid = obj[tid].metadata[0];
-	if(valid == 0)
+	uint tid = range_begin + gl_GlobalInvocationID.x;
+	if(tid >= range_end)
+		return;
+	ObjectFormat o = load_object(object_index(tid));
+	uint valid = o.metadata[0];
+	if(valid == 0) {
+		//dead slot, degenerate vertices instead of the stale ones.
+		for (uint k = 0; k < 6; k++)
+			store_vertex(tid * 6 + k, float2(0, 0), float2(0, 0), float4(0, 0, 0, 0), 0);
 		return;
+	}
 
-	float4 pos = obj[tid].pos;
-	float4 scale = obj[tid].scale;
-	float4 color = obj[tid].color;
-	float4 uvinfo = obj[tid].uvinfo;
-	float rotvalue = obj[tid].rotate.x;
-	uint matid = obj[tid].metadata[1];
+	float4 pos = o.pos;
+	float4 scale = o.scale;
+	float4 color = o.color;
+	float4 uvinfo = o.uvinfo;
+	float rotvalue = o.rotate.x;
+	uint matid = o.metadata[1];
 
 	float2 basepos[4];
 	float2 baseuv[4];
 
-	float2 uv_div = uvinfo.zw;
-	float2 uv_unit = 1.0 / uv_div;
-	float2 uv_offset = uv_unit * uvinfo.xy;
-
-	baseuv[0] = (float2( 0,  0) / uv_div) + uv_offset;
-	baseuv[1] = (float2( 0,  1) / uv_div) + uv_offset;
-	baseuv[2] = (float2( 1,  0) / uv_div) + uv_offset;
-	baseuv[3] = (float2( 1,  1) / uv_div) + uv_offset;
+	//rect in the texture : offset .xy, size .zw
+	baseuv[0] = uvinfo.xy + float2( 0,  0) * uvinfo.zw;
+	baseuv[1] = uvinfo.xy + float2( 0,  1) * uvinfo.zw;
+	baseuv[2] = uvinfo.xy + float2( 1,  0) * uvinfo.zw;
+	baseuv[3] = uvinfo.xy + float2( 1,  1) * uvinfo.zw;
 
 	//scale
 	basepos[0] = float2(-1, -1) * scale.xy;
@@ -95,34 +124,10 @@ void CSMain(uint3 gl_GlobalInvocationID : SV_DispatchThreadID)
 
 	//result
 	float2 aspect = float2(1.0, 1.0);
-	vtx[tid * 6 + 0].pos = float4(basepos[0] * aspect, 0, 1);
-	vtx[tid * 6 + 1].pos = float4(basepos[1] * aspect, 0, 1);
-	vtx[tid * 6 + 2].pos = float4(basepos[2] * aspect, 0, 1);
-	vtx[tid * 6 + 3].pos = float4(basepos[1] * aspect, 0, 1);
-	vtx[tid * 6 + 4].pos = float4(basepos[3] * aspect, 0, 1);
-	vtx[tid * 6 + 5].pos = float4(basepos[2] * aspect, 0, 1);
-
-	//uv
-	vtx[tid * 6 + 0].uv = float4(baseuv[0], 0, 1);
-	vtx[tid * 6 + 1].uv = float4(baseuv[1], 0, 1);
-	vtx[tid * 6 + 2].uv = float4(baseuv[2], 0, 1);
-	vtx[tid * 6 + 3].uv = float4(baseuv[1], 0, 1);
-	vtx[tid * 6 + 4].uv = float4(baseuv[3], 0, 1);
-	vtx[tid * 6 + 5].uv = float4(baseuv[2], 0, 1);
-	
-	//color
-	vtx[tid * 6 + 0].color = color;
-	vtx[tid * 6 + 1].color = color;
-	vtx[tid * 6 + 2].color = color;
-	vtx[tid * 6 + 3].color = color;
-	vtx[tid * 6 + 4].color = color;
-	vtx[tid * 6 + 5].color = color;
-	
-	//matid
-	vtx[tid * 6 + 0].matid = matid;
-	vtx[tid * 6 + 1].matid = matid;
-	vtx[tid * 6 + 2].matid = matid;
-	vtx[tid * 6 + 3].matid = matid;
-	vtx[tid * 6 + 4].matid = matid;
-	vtx[tid * 6 + 5].matid = matid;
+	store_vertex(tid * 6 + 0, basepos[0] * aspect, baseuv[0], color, matid);
+	store_vertex(tid * 6 + 1, basepos[1] * aspect, baseuv[1], color, matid);
+	store_vertex(tid * 6 + 2, basepos[2] * aspect, baseuv[2], color, matid);
+	store_vertex(tid * 6 + 3, basepos[1] * aspect, baseuv[1], color, matid);
+	store_vertex(tid * 6 + 4, basepos[3] * aspect, baseuv[3], color, matid);
+	store_vertex(tid * 6 + 5, basepos[2] * aspect, baseuv[2], color, matid);
 }
@@ -0,0 +1,83 @@
+#ifndef _UPLOAD_H_
+#define _UPLOAD_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+
+#include "ring.h"
+
+//
+// Upload ring of a queue. alloc() reserves bytes of the open frame in one
+// mapped upload buffer and gives back where to write them (cpu) and where
+// the GPU reads them (resource + offset, gpu address). close() ends the
+// frame with its fence value; its bytes come back in retire() once that
+// fence completed, so nothing a frame in flight reads is overwritten. The
+// ring only holds what the frames in flight wrote and grows when full
+// (ring.h). Buffers come from a create function, a fake one runs the ring
+// on any platform. Not thread safe.
+//
+struct upload_buffer_t {
+	void *resource = nullptr;  //ID3D12Resource
+	uint8_t *cpu = nullptr;    //mapped
+	uint64_t gpu = 0;          //virtual address
+	uint64_t size = 0;
+};
+
+//buffer of at least size bytes, false on failure.
+typedef std::function<bool(uint64_t, upload_buffer_t &)> upload_create_t;
+typedef std::function<void(upload_buffer_t &)> upload_release_t;
+
+struct upload_alloc_t {
+	void *resource = nullptr;
+	uint8_t *cpu = nullptr;
+	uint64_t gpu = 0;
+	uint64_t offset = 0;  //in resource
+	uint64_t size = 0;
+};
+
+struct upload_ring_t : fence_ring_t<upload_buffer_t, uint64_t> {
+	uint64_t frame_bytes = 0;  //written by the open frame, padding included
+	uint64_t peak_frame = 0;
+	uint64_t peak_used = 0;
+
+	bool init(uint64_t size, upload_create_t c, upload_release_t r)
+	{
+		frame_bytes = peak_frame = peak_used = 0;
+		return start(size, c, r);
+	}
+
+	//allocations since the last close() are the frame of fence.
+	void close(uint64_t fence)
+	{
+		fence_ring_t::close(fence);
+		peak_frame = std::max(peak_frame, frame_bytes);
+		frame_bytes = 0;
+	}
+
+	uint64_t used() const
+	{
+		return head - tail;
+	}
+
+	//bytes at an offset aligned to align (a power of two), never across the end of the buffer.
+	bool alloc(uint64_t bytes, uint64_t align, upload_alloc_t &out)
+	{
+		uint64_t pos = head;
+		uint64_t offset = buffer.size ? pos % buffer.size : 0;
+		pos += ((offset + align - 1) & ~(align - 1)) - offset;
+		if (!place(pos, bytes, pos))
+			return false;
+		out.resource = buffer.resource;
+		out.offset = pos % buffer.size;
+		out.cpu = buffer.cpu + out.offset;
+		out.gpu = buffer.gpu + out.offset;
+		out.size = bytes;
+		frame_bytes += pos + bytes - head;
+		head = pos + bytes;
+		peak_used = std::max(peak_used, used());
+		return true;
+	}
+};
+
+#endif //_UPLOAD_H_